@@ -0,0 +1,275 @@
+// bench_aot.cpp  (C++20, Linux; needs a host C++ compiler at run time)
+// g++ -std=c++20 -O2 -pthread bench_aot.cpp ../lesson1/lesson1/stack_vm.cpp -o bench_aot
+// Usage: ./bench_aot [instructions=200000] [reps=7] [common=../common] [cxx=c++]
+//
+// Ahead-of-time compiled images (common/aot.h) against the interpreters.
+// Each workload is written as an out.bin image, read back through
+// MappedImage, translated to C++ and built into a shared object with
+// `cxx -O2 -shared -fPIC -I<common>`, then dlopened:
+//
+//   lesson1      runUnchecked (verified fast path) vs the AOT blocks
+//   MiniTCGVM    hot TB cache, closures and copy-and-patch, vs AOT blocks
+//
+// Timings are the median of `reps` hot runs (Minsn/s); the build column is
+// translation plus the host compiler, per image. Before timing, random
+// programs (all lesson1 primitives, division traps included) run on lesson1
+// with and without their module, and interrupt programs with an
+// instruction timer run on MiniTCGVM with and without theirs (block size =
+// max_tb_insns, so interrupts land on the same boundaries); console output
+// and errors must match byte for byte.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "../common/aot.h"
+#include "../lesson1/lesson1/stack_vm.h"
+#include "../mini_TCG/mini_TCG/mini_tcg.h"
+#include "workloads.h"
+
+using Clock = std::chrono::steady_clock;
+
+namespace op {
+constexpr std::int32_t FLUSH = 0x40000006;
+constexpr std::int32_t VEC = 0x40000009;
+constexpr std::int32_t IRET = 0x4000000A;
+constexpr std::int32_t IMM_MAX = 0x3FFFFFFF;
+} // namespace op
+
+static std::int32_t imm(std::int32_t v) { return v >= 0 ? v : static_cast<std::int32_t>(0x80000000u | std::uint32_t(-v)); }
+
+static double seconds(Clock::time_point t0) { return std::chrono::duration<double>(Clock::now() - t0).count(); }
+
+struct Toolchain {
+    std::string dir;    // scratch directory
+    std::string common; // -I for aot_abi.h
+    std::string cxx;
+    int built = 0;
+};
+
+// out.bin -> module.cpp -> module.so, as the tools do; returns the .so path
+static std::string build_module(Toolchain& tc, const std::vector<std::int32_t>& prog, std::size_t max_block,
+                                double* secs = nullptr) {
+    const std::string base = tc.dir + "/m" + std::to_string(tc.built++);
+    const auto t0 = Clock::now();
+    BytecodeImage::write((base + ".bin").c_str(), prog);
+    MappedImage image((base + ".bin").c_str());
+    AotCompiler::Options opt;
+    opt.max_block = max_block;
+    opt.source_name = base + ".bin";
+    {
+        std::ofstream out(base + ".cpp", std::ios::binary);
+        out << AotCompiler::translate(image.code(), opt);
+        if (!out) throw std::runtime_error("cannot write " + base + ".cpp");
+    }
+    const std::string cmd =
+        tc.cxx + " -std=c++20 -O2 -shared -fPIC -I" + tc.common + " " + base + ".cpp -o " + base + ".so";
+    if (std::system(cmd.c_str()) != 0) throw std::runtime_error("host compiler failed: " + cmd);
+    if (secs) *secs = seconds(t0);
+    return base + ".so";
+}
+
+// Console text plus the error, if any, of one run.
+template <class Run>
+static std::string capture(Run&& run) {
+    std::FILE* f = std::tmpfile();
+    if (!f) throw std::runtime_error("tmpfile failed");
+    std::string err;
+    VirtualConsole::Options con;
+    con.fd = ::fileno(f);
+    try {
+        run(con);
+    }
+    catch (const std::exception& ex) {
+        err = std::string("error: ") + ex.what() + "\n";
+    }
+    std::string text;
+    std::rewind(f);
+    char buf[4096];
+    for (std::size_t n; (n = std::fread(buf, 1, sizeof(buf), f)) > 0;) text.append(buf, n);
+    std::fclose(f);
+    return text + err;
+}
+
+static std::vector<std::int32_t> random_program(std::mt19937& rng) {
+    std::uniform_int_distribution<int> len(1, 120), pick(0, 11);
+    std::uniform_int_distribution<std::int32_t> small(-9, 9), big(-op::IMM_MAX, op::IMM_MAX);
+    std::vector<std::int32_t> p;
+    const int n = len(rng);
+    int depth = 0;
+    for (int i = 0; i < n; ++i) {
+        const int k = pick(rng);
+        if (k < 4 || depth < 2) {
+            p.push_back(imm(k == 0 ? big(rng) : small(rng)));
+            ++depth;
+        }
+        else if (k < 9) {
+            p.push_back(k == 4 ? ops::ADD : k == 5 ? ops::SUB : k == 6 ? ops::MUL : k == 7 ? ops::DIV : ops::PRINT);
+            depth -= k < 8;
+        }
+        else {
+            p.push_back(k == 9 ? ops::PRINT : op::FLUSH);
+        }
+    }
+    p.push_back(ops::PRINT);
+    p.push_back(ops::HALT);
+    return p;
+}
+
+static std::size_t check_lesson1(Toolchain& tc) {
+    std::mt19937 rng(45);
+    std::vector<std::vector<std::int32_t>> progs;
+    for (int i = 0; i < 24; ++i) progs.push_back(random_program(rng));
+    progs.push_back({ 5, 0, ops::DIV, ops::PRINT, ops::HALT });                                   // div by zero
+    progs.push_back({ imm(-op::IMM_MAX), 1, ops::SUB, 2, ops::MUL, imm(-1), ops::DIV, ops::HALT }); // INT_MIN / -1
+    std::size_t checked = 0;
+    for (std::size_t i = 0; i < progs.size(); ++i) {
+        AotLibrary lib(build_module(tc, progs[i], 1 + i % 40).c_str());
+        auto run = [&](bool aot) {
+            return capture([&](const VirtualConsole::Options& con) {
+                StackVM vm(1024, con);
+                vm.loadProgram(progs[i]);
+                if (aot) vm.attachAot(&lib);
+                vm.run(false);
+            });
+        };
+        const std::string a = run(false), b = run(true);
+        if (a != b) throw std::runtime_error("lesson1 differs from its AOT module:\n" + a + "--\n" + b);
+        ++checked;
+    }
+    return checked;
+}
+
+static std::size_t check_minitcg(Toolchain& tc) {
+    // push H; vec; (push 1; add; print?)*; halt; H: print; flush; iret
+    std::mt19937 rng(46);
+    std::size_t checked = 0;
+    for (std::size_t tb : { 3, 8, 64 }) {
+        std::vector<std::int32_t> p{ 0, op::VEC, 0 };
+        for (int i = 0; i < 300; ++i) {
+            p.insert(p.end(), { imm(static_cast<std::int32_t>(rng() % 19) - 9), ops::ADD });
+            if (rng() % 7 == 0) p.push_back(ops::PRINT);
+        }
+        p.insert(p.end(), { ops::PRINT, ops::HALT });
+        p[0] = static_cast<std::int32_t>(p.size());
+        p.insert(p.end(), { ops::PRINT, op::FLUSH, op::IRET });
+        AotLibrary lib(build_module(tc, p, tb).c_str());
+        for (std::uint64_t period : { 5, 17, 50 }) {
+            auto run = [&](bool aot) {
+                return capture([&](const VirtualConsole::Options& con) {
+                    MiniTCGVM vm(tb, con);
+                    InterruptController irq;
+                    VirtualTimer timer(irq, 3, VirtualTimer::Mode::Instructions, period);
+                    vm.attachInterrupts(&irq, &timer);
+                    vm.loadProgram(p);
+                    if (aot) vm.attachAot(&lib);
+                    vm.run(false);
+                    vm.run(false);
+                });
+            };
+            const std::string a = run(false), b = run(true);
+            if (a != b) throw std::runtime_error("MiniTCGVM differs with its AOT module (tb " + std::to_string(tb) + ")");
+            ++checked;
+        }
+    }
+    return checked;
+}
+
+static double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+static double lesson1_mips(const std::vector<std::int32_t>& prog, const AotLibrary* lib, int reps) {
+    StackVM vm;
+    std::vector<double> t;
+    for (int r = 0; r < reps; ++r) {
+        vm.loadProgram(prog);
+        vm.attachAot(lib);
+        const auto t0 = Clock::now();
+        vm.runUnchecked();
+        t.push_back(seconds(t0));
+    }
+    return double(prog.size()) / median(t) / 1e6;
+}
+
+static double minitcg_mips(const std::vector<std::int32_t>& prog, MiniTCGVM::Backend backend, const AotLibrary* lib,
+                           int reps) {
+    MiniTCGVM vm(64);
+    vm.setBackend(backend);
+    vm.loadProgram(prog);
+    vm.attachAot(lib);
+    vm.run(false); // fill the TB cache
+    std::vector<double> t;
+    for (int r = 0; r < reps; ++r) {
+        const auto t0 = Clock::now();
+        vm.run(false);
+        t.push_back(seconds(t0));
+    }
+    return double(prog.size()) / median(t) / 1e6;
+}
+
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::stoull(argv[1]) : 200'000ull;
+    const int reps = argc > 2 ? std::stoi(argv[2]) : 7;
+    Toolchain tc;
+    tc.common = argc > 3 ? argv[3] : "../common";
+    tc.cxx = argc > 4 ? argv[4] : "c++";
+    char dir[] = "/tmp/bench_aot.XXXXXX";
+    if (!::mkdtemp(dir)) {
+        std::perror("mkdtemp");
+        return 1;
+    }
+    tc.dir = dir;
+
+    try {
+        std::cerr << "differential check: " << check_lesson1(tc) << " lesson1 programs, " << check_minitcg(tc)
+                  << " MiniTCGVM interrupt runs, interpreter == AOT\n\n";
+
+        const int fd = ::open("/dev/null", O_WRONLY);
+        if (fd < 0 || ::dup2(fd, 1) < 0) throw std::runtime_error("cannot redirect stdout");
+        ::close(fd);
+
+        std::cerr << "workload        build s   .so KiB   lesson1 Minsn/s: interp      aot   speedup\n";
+        std::cerr << std::fixed;
+        for (const Workload& w : { arith_chain(n), mul_div(n), straight_line(n), print_heavy(n / 4) }) {
+            double secs = 0;
+            const std::string so = build_module(tc, w.prog, 512, &secs);
+            AotLibrary lib(so.c_str());
+            std::ifstream f(so, std::ios::binary | std::ios::ate);
+            const double kib = double(f.tellg()) / 1024.0;
+            const double a = lesson1_mips(w.prog, nullptr, reps), b = lesson1_mips(w.prog, &lib, reps);
+            std::cerr << std::left << std::setw(14) << w.name << std::right << std::setprecision(2) << std::setw(9)
+                      << secs << std::setprecision(0) << std::setw(10) << kib << std::setprecision(1)
+                      << std::setw(24) << a << std::setw(9) << b << std::setw(9) << b / a << "x\n";
+        }
+
+        std::cerr << "\nworkload        MiniTCGVM tb 64 Minsn/s: closures  copy-patch      aot   vs closures  vs jit\n";
+        for (const Workload& w : { add_chain(n), deep_stack(n), print_heavy(n / 4) }) {
+            AotLibrary lib(build_module(tc, w.prog, 512).c_str());
+            const double a = minitcg_mips(w.prog, MiniTCGVM::Backend::Closures, nullptr, reps);
+            const double b = minitcg_mips(w.prog, MiniTCGVM::Backend::CopyPatch, nullptr, reps);
+            const double c = minitcg_mips(w.prog, MiniTCGVM::Backend::Closures, &lib, reps);
+            std::cerr << std::left << std::setw(14) << w.name << std::right << std::setprecision(1)
+                      << std::setw(36) << a << std::setw(12) << b << std::setw(9) << c << std::setw(13) << c / a
+                      << "x" << std::setw(7) << c / b << "x\n";
+        }
+    }
+    catch (const std::exception& ex) {
+        std::cerr << "error: " << ex.what() << "\n";
+        std::system(("rm -rf " + tc.dir).c_str());
+        return 1;
+    }
+    std::system(("rm -rf " + tc.dir).c_str());
+    return 0;
+}
@@ -0,0 +1,432 @@
+// bench_coroutines.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 -pthread bench_coroutines.cpp -o bench_coroutines
+// Usage: ./bench_coroutines [guests=100000] [threads=4] [signals=100000] [rate=50000]
+//
+// lesson3 guests that wait on host I/O, run as coroutines on an IoLoop
+// (io_loop.h) instead of a thread each. Two parts:
+//
+//   checks  a guest echoes console input that a host thread writes into a
+//           pipe in small, delayed chunks (ConsoleDevice IN): the output
+//           must be the same from run() blocking in poll(2), from
+//           runAsync() on the fast loop and on the checked loop (paging).
+//           A guest counting EventDevice events must see every signal,
+//           sync and async, and a guest trap must reach the task's
+//           completion callback as TrapError
+//   scale   `guests` guests, each `push COUNT; load; push STAMP; store`
+//           16 times: wait for an event, report back. All are spawned and
+//           left waiting; the host then signals random idle ones, first
+//           one at a time (unloaded), then paced at `rate` per second.
+//           Reports memory per waiting guest (process RSS and address
+//           space growth over the guests, with the coroutine frame and VM
+//           parts) and resume latency: signal() on the host to the guest's
+//           store, after the loop thread woke and resumed it. The same for
+//           a thread per guest blocked in run(), for up to 1000 guests
+//
+// Guests share eventfds when RLIMIT_NOFILE is below the guest count
+// (EventDevice shared mode): a signal then also wakes the others on that
+// fd, which find nothing and wait again; the report gives the sharing.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../lesson3/lesson3/stack_vm.h"
+
+#include "../common/io_loop.h"
+#include "../common/mmio_devices.h"
+
+using Clock = std::chrono::steady_clock;
+
+static std::int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+static void expect(bool ok, const std::string& what) {
+    if (!ok) throw std::runtime_error(what);
+}
+
+// ---- devices and programs ----
+
+constexpr u32 EVENT = StackVM::MMIO_BASE;                      // EventDevice
+constexpr u32 STAMP = StackVM::MMIO_BASE + EventDevice::WORDS; // StampDevice
+constexpr u32 CONSOLE = StackVM::MMIO_BASE + 0x100;            // ConsoleDevice
+constexpr int ROUNDS = 16;
+
+// Resume latencies, appended from the loop threads.
+struct Latencies {
+    std::vector<std::uint32_t> ns;
+    std::atomic<std::size_t> n{ 0 };
+    explicit Latencies(std::size_t cap) : ns(cap) {}
+    void add(std::int64_t v) {
+        const std::size_t i = n.fetch_add(1, std::memory_order_relaxed);
+        if (i < ns.size()) ns[i] = static_cast<std::uint32_t>(std::min<std::int64_t>(v, UINT32_MAX));
+    }
+    void clear() { n.store(0); }
+};
+
+// Where a guest reports back: a write counts the round, adds the value, and
+// records the latency of the timed signal it answers, if there is one.
+class StampDevice final : public MmioDevice {
+public:
+    std::atomic<std::int64_t> signalled{ 0 }; // host: when the timed signal was sent, 0 if none
+    std::atomic<std::uint32_t> rounds{ 0 };
+    std::atomic<std::uint64_t> sum{ 0 };
+    Latencies* sink = nullptr;
+
+    const char* name() const override { return "stamp"; }
+    std::uint32_t read(std::uint32_t) override { return 0; }
+    void write(std::uint32_t, std::uint32_t value) override {
+        if (const std::int64_t t = signalled.exchange(0, std::memory_order_acq_rel); t != 0 && sink) sink->add(now_ns() - t);
+        sum.fetch_add(value, std::memory_order_relaxed);
+        rounds.fetch_add(1, std::memory_order_release);
+    }
+};
+
+struct Asm {
+    std::vector<u32> code;
+    void load(u32 addr) { code.insert(code.end(), { Instr::push(static_cast<i32>(addr)), Instr::prim(Prim::Load) }); }
+    void store(u32 addr) { code.insert(code.end(), { Instr::push(static_cast<i32>(addr)), Instr::prim(Prim::Store) }); }
+    std::vector<u32> halt() {
+        code.push_back(Instr::prim(Prim::Halt));
+        return code;
+    }
+};
+
+// (wait for events; report the count) * rounds
+static std::vector<u32> event_program(int rounds) {
+    Asm a;
+    for (int i = 0; i < rounds; ++i) {
+        a.load(EVENT + EventDevice::COUNT);
+        a.store(STAMP);
+    }
+    return a.halt();
+}
+
+// A guest with an event source and a stamp, on a one-page VM.
+struct Guest {
+    StackVM vm{ 1024, 100 };
+    MmioBus bus;
+    EventDevice event;
+    StampDevice stamp;
+
+    Guest(int fd, bool shared, const std::vector<u32>& prog, Latencies* sink) : event(fd, shared) {
+        bus.map(EVENT, EventDevice::WORDS, event);
+        bus.map(STAMP, 1, stamp);
+        stamp.sink = sink;
+        vm.attachBus(&bus);
+        vm.loadProgram(prog);
+    }
+};
+
+// ---- checks ----
+
+struct Capture {
+    int fd = ::memfd_create("guest-output", MFD_CLOEXEC);
+    ~Capture() { ::close(fd); }
+    std::string text() const {
+        std::string s(static_cast<std::size_t>(::lseek(fd, 0, SEEK_END)), '\0');
+        if (::pread(fd, s.data(), s.size(), 0) != static_cast<ssize_t>(s.size())) throw std::runtime_error("pread");
+        return s;
+    }
+};
+
+enum class Mode { Sync, AsyncFast, AsyncChecked };
+
+static std::string console_echo(const std::string& input, Mode mode, std::mt19937& rng) {
+    int p[2];
+    if (::pipe2(p, O_CLOEXEC) != 0) throw std::runtime_error("pipe2");
+    Capture out;
+    VirtualConsole::Options o;
+    o.fd = out.fd;
+    {
+        VirtualConsole con(o);
+        ConsoleDevice dev(con, p[0]);
+        MmioBus bus;
+        bus.map(CONSOLE, ConsoleDevice::WORDS, dev);
+        StackVM vm(1 << 16, 100);
+        if (mode == Mode::AsyncChecked) vm.enablePaging();
+        vm.attachBus(&bus);
+        Asm a;
+        for (std::size_t i = 0; i <= input.size(); ++i) { // and the end of input
+            a.load(CONSOLE + ConsoleDevice::IN);
+            a.store(CONSOLE + ConsoleDevice::INT);
+        }
+        vm.loadProgram(a.halt());
+
+        const unsigned seed = static_cast<unsigned>(rng());
+        std::thread writer([&, seed] {
+            std::mt19937 r(seed);
+            for (std::size_t i = 0; i < input.size();) {
+                const std::size_t n = std::min<std::size_t>(1 + r() % 7, input.size() - i);
+                if (::write(p[1], input.data() + i, n) != static_cast<ssize_t>(n)) break;
+                i += n;
+                std::this_thread::sleep_for(std::chrono::microseconds(r() % 300));
+            }
+            ::close(p[1]);
+        });
+        if (mode == Mode::Sync) {
+            vm.run(false);
+        }
+        else {
+            IoLoop loop(2);
+            std::exception_ptr error;
+            loop.spawn(vm.runAsync(loop, 1000), [&](std::exception_ptr e) { error = e; });
+            loop.wait();
+            if (error) std::rethrow_exception(error);
+        }
+        writer.join();
+        con.flush();
+    }
+    ::close(p[0]);
+    return out.text();
+}
+
+static void check_console(std::mt19937& rng) {
+    std::string input;
+    for (int i = 0; i < 300; ++i) input += static_cast<char>('a' + rng() % 26);
+    std::string expected;
+    for (char c : input) expected += std::to_string(static_cast<unsigned char>(c)) + "\n";
+    expected += "-1\n"; // END_OF_INPUT through INT
+    for (Mode m : { Mode::Sync, Mode::AsyncFast, Mode::AsyncChecked }) {
+        const std::string got = console_echo(input, m, rng);
+        expect(got == expected, std::string("console echo differs (") +
+                                    (m == Mode::Sync ? "sync" : m == Mode::AsyncFast ? "async fast" : "async checked") + ")");
+    }
+}
+
+static void check_events() {
+    const std::vector<u32> prog = event_program(64);
+    for (bool async : { false, true }) {
+        const int fd = EventDevice::makeEventFd();
+        Guest g(fd, false, prog, nullptr);
+        std::exception_ptr error;
+        std::unique_ptr<IoLoop> loop;
+        std::thread runner;
+        if (async) {
+            loop = std::make_unique<IoLoop>(1);
+            loop->spawn(g.vm.runAsync(*loop), [&](std::exception_ptr e) { error = e; });
+        }
+        else {
+            runner = std::thread([&] { g.vm.run(false); });
+        }
+        for (int i = 0; i < 40; ++i) {
+            g.event.signal();
+            if (i % 3 == 0) std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        g.event.close(); // rounds left over run through
+        if (async) loop->wait();
+        else runner.join();
+        if (error) std::rethrow_exception(error);
+        expect(g.stamp.sum.load() == 40, std::string(async ? "async" : "sync") + " guest lost events");
+        expect(g.stamp.rounds.load() == 64, "guest did not run to its end");
+        ::close(fd);
+    }
+
+    // a trap ends the task with TrapError
+    StackVM vm(1024, 100); // no bus: loads outside RAM trap
+    Asm a;
+    a.load(CONSOLE);
+    vm.loadProgram(a.halt());
+    IoLoop loop(1);
+    std::exception_ptr error;
+    loop.spawn(vm.runAsync(loop), [&](std::exception_ptr e) { error = e; });
+    loop.wait();
+    bool trapped = false;
+    try {
+        if (error) std::rethrow_exception(error);
+    }
+    catch (const TrapError& e) {
+        trapped = e.trap.code == TrapCode::BadAddress;
+    }
+    expect(trapped, "a guest trap did not reach the completion callback");
+}
+
+// ---- scale ----
+
+struct Memory {
+    std::size_t vsz = 0, rss = 0;
+    static Memory now() {
+        Memory m;
+        FILE* f = std::fopen("/proc/self/statm", "r");
+        if (!f) return m;
+        unsigned long v = 0, r = 0;
+        if (std::fscanf(f, "%lu %lu", &v, &r) == 2) {
+            const std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+            m.vsz = v * page;
+            m.rss = r * page;
+        }
+        std::fclose(f);
+        return m;
+    }
+};
+
+static std::string pct(std::vector<std::uint32_t> v, std::size_t n) {
+    v.resize(std::min(n, v.size()));
+    if (v.empty()) return "-";
+    std::sort(v.begin(), v.end());
+    auto at = [&](double q) { return double(v[static_cast<std::size_t>(q * double(v.size() - 1))]) / 1000.0; };
+    std::ostringstream s;
+    s << std::fixed << std::setprecision(1) << at(0.5) << " / " << at(0.99) << " / " << double(v.back()) / 1000.0;
+    return s.str();
+}
+
+// Signal `samples` random idle guests one at a time, each after the last
+// one answered.
+static void unloaded(std::vector<std::unique_ptr<Guest>>& gs, std::size_t samples, std::mt19937& rng) {
+    std::uniform_int_distribution<std::size_t> pick(0, gs.size() - 1);
+    for (std::size_t i = 0; i < samples; ++i) {
+        Guest& g = *gs[pick(rng)];
+        const std::uint32_t r0 = g.stamp.rounds.load();
+        if (r0 >= ROUNDS - 2) continue;
+        g.stamp.signalled.store(now_ns());
+        g.event.signal();
+        while (g.stamp.rounds.load(std::memory_order_acquire) == r0) std::this_thread::yield();
+    }
+}
+
+// `signals` signals to random idle guests at `rate` per second.
+static void loaded(std::vector<std::unique_ptr<Guest>>& gs, std::size_t signals, double rate, std::mt19937& rng) {
+    std::uniform_int_distribution<std::size_t> pick(0, gs.size() - 1);
+    const auto t0 = Clock::now();
+    for (std::size_t i = 0; i < signals; ++i) {
+        const auto due = t0 + std::chrono::nanoseconds(static_cast<std::int64_t>(double(i) * 1e9 / rate));
+        while (Clock::now() < due) std::this_thread::yield();
+        for (;;) {
+            Guest& g = *gs[pick(rng)];
+            if (g.stamp.signalled.load() != 0 || g.stamp.rounds.load() >= ROUNDS - 2) continue;
+            g.stamp.signalled.store(now_ns());
+            g.event.signal();
+            break;
+        }
+    }
+}
+
+static void wait_answered(std::vector<std::unique_ptr<Guest>>& gs) {
+    for (auto& g : gs) {
+        while (g->stamp.signalled.load() != 0) std::this_thread::yield();
+    }
+}
+
+static void row(const char* what, std::size_t guests, const Memory& before, const Memory& after, const std::string& idle,
+                const std::string& busy) {
+    std::cerr << std::left << std::setw(22) << what << std::right << std::setw(8) << guests << std::fixed
+              << std::setprecision(2) << std::setw(10) << double(after.rss - before.rss) / double(guests) / 1024.0
+              << std::setw(11) << double(after.vsz - before.vsz) / double(guests) / 1024.0 << "   " << std::left
+              << std::setw(22) << idle << busy << "\n";
+}
+
+int main(int argc, char** argv) {
+    const std::size_t guests = argc > 1 ? std::stoull(argv[1]) : 100'000;
+    const unsigned threads = argc > 2 ? static_cast<unsigned>(std::stoul(argv[2])) : 4;
+    const std::size_t signals = argc > 3 ? std::stoull(argv[3]) : 100'000;
+    const double rate = argc > 4 ? std::stod(argv[4]) : 50'000;
+    try {
+        std::mt19937 rng(12345);
+        check_console(rng);
+        check_events();
+        std::cerr << "checks: console echo matches (sync, async fast, async checked), events counted, traps reported\n\n";
+
+        // as many eventfds as the fd limit allows, shared beyond that
+        rlimit lim{};
+        ::getrlimit(RLIMIT_NOFILE, &lim);
+        lim.rlim_cur = lim.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &lim);
+        const std::size_t fds = std::min<std::size_t>(guests, lim.rlim_cur > 2200 ? lim.rlim_cur - 2200 : 1);
+        const bool shared = fds < guests;
+
+        const std::vector<u32> prog = event_program(ROUNDS);
+        Latencies lat(signals + 10'000);
+
+        std::cerr << "guests wait for an event and report back; latency signal -> guest store, us p50 / p99 / max\n"
+                  << "mode                    guests  KB RSS/g  KB addr/g   unloaded              at " << rate << "/s\n";
+
+        // coroutines on the loop
+        {
+            std::vector<int> efds;
+            for (std::size_t i = 0; i < fds; ++i) efds.push_back(EventDevice::makeEventFd());
+            const Memory m0 = Memory::now();
+            std::vector<std::unique_ptr<Guest>> gs;
+            gs.reserve(guests);
+            IoLoop loop(threads);
+            std::atomic<std::size_t> failed{ 0 };
+            for (std::size_t i = 0; i < guests; ++i) {
+                gs.push_back(std::make_unique<Guest>(efds[i % fds], shared, prog, &lat));
+                loop.spawn(gs.back()->vm.runAsync(loop), [&](std::exception_ptr e) {
+                    if (e) failed.fetch_add(1);
+                });
+            }
+            while (loop.stats().waits < guests) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            const Memory m1 = Memory::now();
+            std::size_t resident = 0;
+            for (auto& g : gs) resident += g->vm.residentBytes();
+
+            unloaded(gs, 2000, rng);
+            const std::size_t n_idle = lat.n.load();
+            const std::vector<std::uint32_t> idle(lat.ns.begin(), lat.ns.begin() + static_cast<std::ptrdiff_t>(std::min(n_idle, lat.ns.size())));
+            lat.clear();
+            const IoLoop::Stats s0 = loop.stats();
+            loaded(gs, signals, rate, rng);
+            wait_answered(gs);
+            const IoLoop::Stats s1 = loop.stats();
+            const std::size_t n_busy = lat.n.load();
+            row("coroutines on IoLoop", guests, m0, m1, pct(idle, n_idle), pct(lat.ns, n_busy));
+            std::cerr << "  per guest: frame " << VmTask::liveFrameBytes() / guests << " B, Guest object "
+                      << sizeof(Guest) << " B (StackVM " << sizeof(StackVM) << " B), guest memory "
+                      << resident / guests << " B resident; " << threads << " loop threads, " << fds
+                      << " eventfds (" << std::setprecision(1) << double(guests) / double(fds)
+                      << " guests per fd), " << std::setprecision(2)
+                      << double(s1.resumes - s0.resumes) / double(n_busy ? n_busy : 1) << " resumes per signal\n";
+
+            for (auto& g : gs) g->event.close(); // run the remaining rounds through
+            loop.wait();
+            expect(failed.load() == 0, "a guest task failed");
+            for (int fd : efds) ::close(fd);
+        }
+        lat.clear();
+
+        // a thread per guest, blocked in run()
+        {
+            const std::size_t n = std::min<std::size_t>(guests, 1000);
+            std::vector<int> efds;
+            for (std::size_t i = 0; i < n; ++i) efds.push_back(EventDevice::makeEventFd());
+            const Memory m0 = Memory::now();
+            std::vector<std::unique_ptr<Guest>> gs;
+            std::vector<std::thread> ts;
+            for (std::size_t i = 0; i < n; ++i) {
+                gs.push_back(std::make_unique<Guest>(efds[i], false, prog, &lat));
+                ts.emplace_back([g = gs.back().get()] { g->vm.run(false); });
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(300)); // all in poll(2)
+            const Memory m1 = Memory::now();
+            unloaded(gs, 2000, rng);
+            const std::size_t n_idle = lat.n.load();
+            const std::vector<std::uint32_t> idle(lat.ns.begin(), lat.ns.begin() + static_cast<std::ptrdiff_t>(std::min(n_idle, lat.ns.size())));
+            lat.clear();
+            loaded(gs, std::min<std::size_t>(signals, n * 4), std::min(rate, double(n) * 10), rng);
+            wait_answered(gs);
+            row("thread per guest", n, m0, m1, pct(idle, n_idle), pct(lat.ns, lat.n.load()));
+            for (auto& g : gs) g->event.close();
+            for (auto& t : ts) t.join();
+            for (int fd : efds) ::close(fd);
+        }
+    }
+    catch (const std::exception& ex) {
+        std::cerr << "error: " << ex.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+// bench_counters.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 -pthread bench_counters.cpp engine_lesson1.cpp engine_lesson3.cpp engine_lesson6.cpp engine_minitcg.cpp ../lesson1/lesson1/stack_vm.cpp -o bench_counters
+// Usage: ./bench_counters [instructions=2000000] [reps=5]
+//
+// Hardware counters (perf_counters.h) around Engine::run for every engine,
+// workload of the corpus and mode (checked / verified), hot: one untimed
+// warmup run, then `reps` counted runs after Engine::rewind(). Reports per
+// guest instruction, summed over the counted runs:
+//
+//   cyc      CPU cycles            ipc   host instructions per cycle
+//   ins      host instructions     br    branch misses (dispatch)
+//   L1i      L1 i-cache misses     L1d   L1 d-cache misses (stack, memory)
+//   dTLB     data TLB misses       pf    page faults per run
+//
+// "-" marks an event the kernel did not give us (the reason is printed
+// once); the run still reports Minsn/s from wall-clock time. stdout goes to
+// /dev/null, as in bench_suite.
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "../common/perf_counters.h"
+#include "engine.h"
+#include "workloads.h"
+
+struct EngineKind {
+    const char* name;
+    std::unique_ptr<Engine> (*make)();
+};
+
+// Sum of `reps` counted runs; throws what the engine throws.
+static PerfCounters::Sample count_runs(PerfCounters& pc, const EngineKind& kind, const Workload& w, Engine::Mode mode,
+                                       int reps) {
+    auto e = kind.make();
+    e->load(w.prog);
+    if (mode == Engine::Mode::Verified && !e->verified()) throw std::runtime_error("failed verification");
+    e->run(mode);
+    e->rewind();
+    PerfCounters::Sample total;
+    for (int r = 0; r < reps; ++r) {
+        const PerfCounters::Sample s = pc.measure([&] { e->run(mode); });
+        e->rewind();
+        for (int i = 0; i < PerfCounters::EVENT_COUNT; ++i) {
+            total.value[i] += s.value[i];
+            total.valid[i] = s.valid[i] && (r == 0 || total.valid[i]);
+        }
+        total.wall_ns += s.wall_ns;
+    }
+    return total;
+}
+
+static void cell(const PerfCounters::Sample& s, PerfCounters::Event e, double n, int width, int precision) {
+    if (s.valid[e]) std::cerr << std::setw(width) << std::setprecision(precision) << s.per(e, n);
+    else std::cerr << std::setw(width) << "-";
+}
+
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::stoull(argv[1]) : 2'000'000ull;
+    const int reps = argc > 2 ? std::stoi(argv[2]) : 5;
+
+    const int fd = ::open("/dev/null", O_WRONLY);
+    if (fd < 0 || ::dup2(fd, 1) < 0) {
+        std::perror("redirect stdout");
+        return 1;
+    }
+    ::close(fd);
+
+    PerfCounters pc;
+    for (int e = 0; e < PerfCounters::EVENT_COUNT; ++e) {
+        const auto ev = static_cast<PerfCounters::Event>(e);
+        if (!pc.available(ev)) std::cerr << PerfCounters::name(ev) << ": unavailable (" << pc.error(ev) << ")\n";
+    }
+    if (!pc.anyHardware()) {
+        std::cerr << "no hardware counters (no PMU exposed, or perf_event_paranoid > 2); "
+                     "reporting software events and wall time only\n";
+    }
+
+    const EngineKind engines[] = {
+        { "lesson1", make_lesson1_engine },
+        { "lesson3", make_lesson3_engine },
+        { "lesson6", make_lesson6_engine },
+        { "minitcg", make_minitcg_engine },
+    };
+
+    std::cerr << "\n" << n << " insns per workload, " << reps << " counted runs; per guest instruction\n";
+    std::cerr << "engine   workload       mode      Minsn/s    cyc    ins   ipc      br     L1i     L1d    dTLB"
+                 "     pf\n";
+    std::cerr << std::fixed;
+    for (const Workload& w : corpus(n)) {
+        for (const EngineKind& k : engines) {
+            for (Engine::Mode mode : { Engine::Mode::Checked, Engine::Mode::Verified }) {
+                if (mode == Engine::Mode::Verified && !k.make()->hasVerifiedMode()) continue;
+                std::cerr << std::left << std::setw(9) << k.name << std::setw(15) << w.name << std::setw(9)
+                          << (mode == Engine::Mode::Verified ? "verified" : "checked") << std::right;
+                try {
+                    const PerfCounters::Sample s = count_runs(pc, k, w, mode, reps);
+                    const double insns = double(w.prog.size()) * reps;
+                    std::cerr << std::setw(8) << std::setprecision(1) << insns / s.wall_ns * 1e3;
+                    cell(s, PerfCounters::Cycles, insns, 7, 2);
+                    cell(s, PerfCounters::Instructions, insns, 7, 2);
+                    if (s.valid[PerfCounters::Cycles] && s.valid[PerfCounters::Instructions]) {
+                        std::cerr << std::setw(6) << std::setprecision(2) << s.ipc();
+                    }
+                    else {
+                        std::cerr << std::setw(6) << "-";
+                    }
+                    cell(s, PerfCounters::BranchMisses, insns, 8, 4);
+                    cell(s, PerfCounters::L1iMisses, insns, 8, 4);
+                    cell(s, PerfCounters::L1dMisses, insns, 8, 4);
+                    cell(s, PerfCounters::DtlbMisses, insns, 8, 4);
+                    cell(s, PerfCounters::PageFaults, reps, 7, 0);
+                    std::cerr << "\n";
+                }
+                catch (const std::exception& ex) {
+                    std::cerr << "  skipped: " << ex.what() << "\n";
+                }
+            }
+        }
+    }
+    return 0;
+}
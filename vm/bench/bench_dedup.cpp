@@ -0,0 +1,123 @@
+// bench_dedup.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 -pthread bench_dedup.cpp -o bench_dedup
+// Usage: ./bench_dedup [guests=1000] [program_words=65536]
+//
+// N identical lesson6 guests, each with its own copy of the same program in
+// guest memory (loadProgram(vector) copies it to PROGRAM_BASE). Reports the
+// process's anonymous RSS, shmem RSS and PSS from /proc/self/smaps_rollup
+// without dedup and after PageDedup scans (two passes: a page must hash the
+// same twice before it is merged). PSS charges each shared page once, so it
+// is the total the host really pays. Then 10 guests reload their program,
+// which breaks sharing page by page (copy-on-write), and every guest's
+// program is checked against the original.
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../lesson6/lesson6/stack-vm.h"
+#include "workloads.h" // ops::
+
+struct Rss {
+    double anon_mib = 0;
+    double shmem_mib = 0;
+    double pss_mib = 0;
+};
+
+static Rss rss() {
+    Rss r;
+    std::FILE* f = std::fopen("/proc/self/smaps_rollup", "r");
+    if (!f) return r;
+    char line[256];
+    auto field = [&](const char* name, double& out) {
+        const std::size_t n = std::strlen(name);
+        if (std::strncmp(line, name, n) == 0) out = double(std::strtoull(line + n, nullptr, 10)) / 1024.0;
+    };
+    while (std::fgets(line, sizeof(line), f)) {
+        field("Pss:", r.pss_mib);
+        field("Anonymous:", r.anon_mib);
+        field("Pss_Shmem:", r.shmem_mib);
+    }
+    std::fclose(f);
+    return r;
+}
+
+static void print(const char* what, const Rss& r) {
+    std::cout << std::left << std::setw(26) << what << std::right << std::setw(10) << r.anon_mib
+              << std::setw(12) << r.shmem_mib << std::setw(10) << r.pss_mib << "\n";
+}
+
+static bool same_program(StackVM& vm, const std::vector<i32>& prog) {
+    const i32* code = vm.guestMemory().as<i32>() + 100; // PROGRAM_BASE
+    return std::memcmp(code, prog.data(), prog.size() * sizeof(i32)) == 0;
+}
+
+static void run(std::size_t guests, const std::vector<i32>& prog, bool dedup) {
+    GuestMemory::Options opt;
+    opt.mergeable = dedup;
+    const Rss before = rss();
+
+    std::vector<std::unique_ptr<StackVM>> vms;
+    for (std::size_t g = 0; g < guests; ++g) {
+        vms.push_back(std::make_unique<StackVM>(opt));
+        vms.back()->loadProgram(prog);
+        vms.back()->run(false);
+    }
+    Rss loaded = rss();
+    loaded.anon_mib -= before.anon_mib;
+    loaded.pss_mib -= before.pss_mib;
+    std::cout << "\n" << guests << " guests, dedup " << (dedup ? "on" : "off") << "\n";
+    std::cout << "                          anon MiB  shmem MiB   PSS MiB\n";
+    print("loaded + ran", loaded);
+    if (!dedup) return;
+
+    PageDedup& d = PageDedup::instance();
+    const auto t0 = std::chrono::steady_clock::now();
+    d.scanOnce();
+    d.scanOnce();
+    const auto t1 = std::chrono::steady_clock::now();
+    Rss merged = rss();
+    merged.anon_mib -= before.anon_mib;
+    merged.pss_mib -= before.pss_mib;
+    print("after 2 scans", merged);
+    const double scan_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+    // copy-on-write: 10 guests rewrite their program area
+    for (std::size_t g = 0; g < 10 && g < guests; ++g) {
+        vms[g]->loadProgram(prog);
+        vms[g]->run(false);
+    }
+    Rss cow = rss();
+    cow.anon_mib -= before.anon_mib;
+    cow.pss_mib -= before.pss_mib;
+    print("10 guests reloaded", cow);
+
+    std::size_t bad = 0;
+    for (auto& vm : vms) bad += same_program(*vm, prog) ? 0 : 1;
+
+    const PageDedup::Stats s = d.stats();
+    std::cout << "scan time " << scan_ms << " ms (2 passes)\n"
+              << "pages scanned " << s.pages_scanned << ", shared " << s.pages_shared << ", sharing "
+              << s.pages_sharing << ", unshared (COW) " << s.pages_unshared << ", merges " << s.merges << "\n"
+              << "guests with a corrupted program: " << bad << "\n";
+}
+
+int main(int argc, char** argv) {
+    const std::size_t guests = argc > 1 ? std::stoull(argv[1]) : 1000;
+    const std::size_t words = argc > 2 ? std::stoull(argv[2]) : 65536;
+    // push k; add for varying k, so no two program pages are alike
+    std::vector<i32> prog{ 0 };
+    for (i32 k = 1; prog.size() + 3 <= words; ++k) prog.insert(prog.end(), { k & 0xFFFF, ops::ADD });
+    prog.push_back(ops::HALT);
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "program " << prog.size() << " words (" << prog.size() * 4 / 1024 << " KiB) per guest\n";
+    run(guests, prog, false);
+    run(guests, prog, true);
+    return 0;
+}
@@ -0,0 +1,124 @@
+// bench_density.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 bench_density.cpp -o bench_density
+// Usage: ./bench_density [counts=1,100,10000]
+//
+// VM density: create N lesson3 / lesson6 VMs, run a small guest on each and
+// report creation time, process RSS growth and the guest memory resident
+// per VM (GuestMemory::residentBytes). "eager" is the pre-GuestMemory
+// layout -- a zero-filled std::vector of 1M words per VM -- and is skipped
+// where it would not fit in RAM.
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#define StackVM Lesson3StackVM
+#include "../lesson3/lesson3/stack_vm.h"
+#undef StackVM
+
+#define StackVM Lesson6StackVM
+#include "../lesson6/lesson6/stack-vm.h"
+#undef StackVM
+
+#include "../common/sasm.h"
+
+static constexpr auto PROG = sasm_program<"3 4 + 5 - 3 * 2 / halt">;
+static constexpr std::size_t MEM_WORDS = 1'000'000;
+
+static std::size_t rss_bytes() {
+    std::FILE* f = std::fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long size = 0, resident = 0;
+    const int n = std::fscanf(f, "%lu %lu", &size, &resident);
+    std::fclose(f);
+    return n == 2 ? resident * static_cast<std::size_t>(::sysconf(_SC_PAGESIZE)) : 0;
+}
+
+struct Row {
+    double create_us = 0;   // per VM
+    double rss_kib = 0;     // process RSS growth per VM
+    double guest_kib = 0;   // resident guest memory per VM
+};
+
+// make(i) creates VM i; run(vm) loads and runs the guest and returns its
+// resident guest bytes.
+template <class VM, class Make, class Run>
+static Row measure(std::size_t n, Make&& make, Run&& run) {
+    std::vector<std::unique_ptr<VM>> vms;
+    vms.reserve(n);
+    const std::size_t rss0 = rss_bytes();
+
+    const auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < n; ++i) vms.push_back(make());
+    const auto t1 = std::chrono::steady_clock::now();
+
+    std::size_t guest = 0;
+    for (auto& vm : vms) guest += run(*vm);
+    const std::size_t rss1 = rss_bytes();
+
+    Row r;
+    r.create_us = std::chrono::duration<double, std::micro>(t1 - t0).count() / double(n);
+    r.rss_kib = double(rss1 > rss0 ? rss1 - rss0 : 0) / 1024.0 / double(n);
+    r.guest_kib = double(guest) / 1024.0 / double(n);
+    return r;
+}
+
+static void print_row(const char* name, std::size_t n, const Row& r) {
+    std::cout << std::left << std::setw(9) << name << std::right << std::setw(7) << n
+              << std::setw(14) << r.create_us << std::setw(14) << r.rss_kib << std::setw(14) << r.guest_kib << "\n";
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::size_t> counts{ 1, 100, 10000 };
+    if (argc > 1) {
+        counts.clear();
+        std::stringstream ss(argv[1]);
+        std::string tok;
+        while (std::getline(ss, tok, ',')) counts.push_back(std::stoull(tok));
+    }
+    const std::vector<i32> prog6(PROG.begin(), PROG.end());
+
+    // keep the eager baseline under ~2 GiB
+    const std::size_t eager_limit = (std::size_t(2) << 30) / (MEM_WORDS * sizeof(u32));
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "engine         N  create us/VM   RSS KiB/VM  guest KiB/VM\n";
+    for (std::size_t n : counts) {
+        if (n <= eager_limit) {
+            Row r = measure<std::vector<u32>>(n,
+                [] { return std::make_unique<std::vector<u32>>(MEM_WORDS, 0u); },
+                [](std::vector<u32>& m) {
+                    for (std::size_t i = 0; i < PROG.size(); ++i) m[100 + i] = PROG[i];
+                    return m.size() * sizeof(u32);
+                });
+            print_row("eager", n, r);
+        }
+        else {
+            std::cout << std::left << std::setw(9) << "eager" << std::right << std::setw(7) << n
+                      << "  skipped (" << n * MEM_WORDS * sizeof(u32) / (1u << 20) << " MiB)\n";
+        }
+
+        print_row("lesson3", n, measure<Lesson3StackVM>(n,
+            [] { return std::make_unique<Lesson3StackVM>(MEM_WORDS, 100); },
+            [](Lesson3StackVM& vm) {
+                vm.loadProgram(PROG);
+                vm.run(false);
+                return vm.residentBytes();
+            }));
+
+        print_row("lesson6", n, measure<Lesson6StackVM>(n,
+            [] { return std::make_unique<Lesson6StackVM>(); },
+            [&](Lesson6StackVM& vm) {
+                vm.loadProgram(prog6);
+                vm.run(false);
+                return vm.residentBytes();
+            }));
+    }
+    return 0;
+}
@@ -0,0 +1,354 @@
+// bench_guard_stack.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 -pthread bench_guard_stack.cpp -o bench_guard_stack
+// Usage: ./bench_guard_stack [insns=100000] [reps=7]
+//
+// Guest operand stack between guard pages (common/guard_stack.h), in three
+// parts:
+//
+//   checks    lesson6's checked loop, which now pushes and pops without
+//             bounds checks: underflow and overflow must come back from
+//             tryRun as StackUnderflow / StackOverflow at the right pc, a
+//             trap handler must be entered (and a fault inside it be a
+//             double fault), the VM must run normally afterwards, faults
+//             must stay per-thread, and a SIGSEGV that is not a guarded
+//             stack access must still reach the handler installed before
+//   loops     ns per guest instruction of one checked dispatch loop over
+//             two stacks: "checked" compares sp against the capacity on
+//             every push and against the operand count on every pop (what
+//             lesson6 did before), "guarded" has neither; plus lesson6's
+//             own runChecked
+//   faults    ns per run of a 3-instruction program that underflows, by
+//             explicit check and by guard page fault
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csetjmp>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/mman.h>
+
+#include "../lesson6/lesson6/stack-vm.h"
+#include "workloads.h"
+
+using Clock = std::chrono::steady_clock;
+
+// ---- reference loops: lesson6's checked loop over either stack ----
+
+template <bool GUARDED>
+class RefVM {
+public:
+    static constexpr std::size_t WORDS = 1u << 16;
+
+    explicit RefVM(std::span<const i32> code) : code_(code), guarded_(WORDS), checked_(WORDS) {
+        base_ = GUARDED ? guarded_.base() : checked_.data();
+    }
+
+    TrapCode run() {
+        pc_ = 0;
+        sp_ = -1;
+        trap_ = TrapCode::None;
+        running_ = true;
+        if constexpr (GUARDED) {
+            const GuardStack::Hit hit = guarded_.guard([&] { loop(); });
+            if (hit != GuardStack::Hit::None) {
+                fault(hit == GuardStack::Hit::Overflow ? TrapCode::StackOverflow : TrapCode::StackUnderflow);
+            }
+        }
+        else {
+            loop();
+        }
+        return trap_;
+    }
+
+    i32 tos() const { return base_[sp_]; }
+    std::size_t pc() const { return pc_; }
+
+private:
+    [[gnu::cold]] [[gnu::noinline]] void fault(TrapCode code) {
+        trap_ = code;
+        running_ = false;
+    }
+
+    void push(i32 v) {
+        if constexpr (!GUARDED) {
+            if (static_cast<std::size_t>(sp_ + 1) >= WORDS) [[unlikely]] return fault(TrapCode::StackOverflow);
+        }
+        base_[sp_ + 1] = v;
+        ++sp_;
+    }
+
+    bool need(i32 n) {
+        if constexpr (!GUARDED) {
+            if (sp_ + 1 < n) [[unlikely]] {
+                fault(TrapCode::StackUnderflow);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <class Op>
+    void binary(Op op) {
+        if (!need(2)) return;
+        i32* const top = base_ + sp_;
+        const i32 a = top[-1];
+        top[-1] = op(a, top[0]);
+        --sp_;
+    }
+
+    void loop() {
+        while (running_) {
+            if (pc_ >= code_.size()) [[unlikely]] return fault(TrapCode::PcOutOfRange);
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            const i32 ins = code_[pc_++];
+            const i32 typ = (ins >> 30) & 0x3;
+            const i32 dat = ins & 0x3fffffff;
+            if (typ == 0) push(dat);
+            else if (typ == 2) push(-dat);
+            else if (typ == 1) {
+                switch (dat) {
+                case 0: running_ = false; break;
+                case 1: binary([](i32 a, i32 b) { return a + b; }); break;
+                case 2: binary([](i32 a, i32 b) { return a - b; }); break;
+                case 3: binary([](i32 a, i32 b) { return a * b; }); break;
+                case 4: {
+                    if (!need(2)) break;
+                    const i32 b = base_[sp_];
+                    const i32 a = base_[sp_ - 1];
+                    if (b == 0) return fault(TrapCode::DivZero);
+                    if (a == std::numeric_limits<i32>::min() && b == -1) return fault(TrapCode::DivOverflow);
+                    base_[sp_ - 1] = a / b;
+                    --sp_;
+                    break;
+                }
+                default: return fault(TrapCode::BadPrimitive);
+                }
+            }
+            else return fault(TrapCode::BadInstruction);
+        }
+    }
+
+    std::span<const i32> code_;
+    GuardStack guarded_;
+    std::vector<i32> checked_;
+    i32* base_ = nullptr;
+    std::size_t pc_ = 0;
+    i32 sp_ = -1;
+    TrapCode trap_ = TrapCode::None;
+    bool running_ = true;
+};
+
+// ---- checks ----
+
+static void expect(bool ok, const std::string& what) {
+    if (!ok) throw std::runtime_error(what);
+}
+
+static void expect_trap(StackVM& vm, TrapCode code, std::size_t pc, const std::string& what) {
+    expect(vm.tryRun(false) == RunResult::Trapped, what + ": no trap");
+    expect(vm.trap().code == code, what + ": trap " + trapMessage(vm.trap().code));
+    expect(vm.trap().pc == pc, what + ": trap at pc " + std::to_string(vm.trap().pc) + ", expected " + std::to_string(pc));
+}
+
+// A handler of our own, installed before any GuardStack exists, so
+// GuardStack has to chain to it. It recovers from a fault at the one
+// address a check expects and crashes on anything else.
+static volatile std::int32_t* foreign_target = nullptr;
+static sigjmp_buf foreign_env;
+
+static void on_foreign_fault(int, siginfo_t* si, void*) {
+    if (si->si_addr == const_cast<std::int32_t*>(foreign_target)) siglongjmp(foreign_env, 1);
+    ::signal(SIGSEGV, SIG_DFL);
+}
+
+static void install_foreign_handler() {
+    struct sigaction sa {};
+    sa.sa_sigaction = &on_foreign_fault;
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    if (::sigaction(SIGSEGV, &sa, nullptr) != 0) throw std::runtime_error("sigaction failed");
+}
+
+// Write to `p`; true if the fault reached the foreign handler.
+static bool foreign_fault_at(volatile std::int32_t* p) {
+    foreign_target = p;
+    const bool faulted = sigsetjmp(foreign_env, 0) != 0;
+    if (!faulted) *p = 1;
+    foreign_target = nullptr;
+    return faulted;
+}
+
+static std::size_t check_lesson6() {
+    std::size_t n = 0;
+    StackVM vm;
+    const std::vector<i32> ok{ 2, 3, ops::ADD, ops::HALT };
+    struct Case {
+        std::vector<i32> prog;
+        std::size_t pc;
+    };
+    const std::vector<Case> underflows{
+        { { ops::ADD, ops::HALT }, 0 },
+        { { 1, ops::SUB, ops::HALT }, 1 },
+        { { 1, 2, ops::MUL, ops::MUL, ops::HALT }, 3 },
+        { { 4, ops::DIV, ops::HALT }, 1 },
+        { { ops::DIV, ops::HALT }, 0 },
+        { { 1, 2, 3, ops::ADD, ops::ADD, ops::ADD, ops::HALT }, 5 },
+    };
+    for (int round = 0; round < 2; ++round) {
+        for (const auto& c : underflows) {
+            vm.setTrapHandler(TrapVector::NONE);
+            vm.loadProgram(c.prog);
+            expect_trap(vm, TrapCode::StackUnderflow, c.pc, "underflow");
+
+            // the trap handler sees (pc, code) on a fresh stack and halts
+            std::vector<i32> handled = c.prog;
+            handled.insert(handled.end(), { ops::ADD, ops::HALT });
+            vm.setTrapHandler(c.prog.size());
+            vm.loadProgram(handled);
+            expect(vm.tryRun(false) == RunResult::Halted, "handler did not halt");
+
+            // a handler that underflows itself is a double fault
+            std::vector<i32> twice = c.prog;
+            twice.insert(twice.end(), { ops::ADD, ops::ADD, ops::HALT });
+            vm.loadProgram(twice);
+            expect_trap(vm, TrapCode::StackUnderflow, c.prog.size() + 1, "double fault");
+
+            vm.setTrapHandler(TrapVector::NONE);
+            vm.loadProgram(ok);
+            expect(vm.tryRun(false) == RunResult::Halted, "run after a guard fault");
+            vm.loadProgram(ok);
+            vm.runChecked(false);
+            expect(vm.trap().code == TrapCode::None, "checked run after a guard fault");
+            n += 4;
+        }
+    }
+
+    // overflow: one push more than the stack holds; executed in place
+    // (the program is larger than guest memory)
+    const std::size_t cap = GuardStack(1'000'000).capacity();
+    std::vector<i32> deep(cap + 1, 7);
+    deep.push_back(ops::HALT);
+    vm.loadProgram(std::span<const i32>(deep));
+    expect(!vm.verified(), "overflowing program verified");
+    expect_trap(vm, TrapCode::StackOverflow, cap, "overflow");
+    deep[cap] = ops::ADD; // exactly full, then an add: no trap
+    vm.loadProgram(std::span<const i32>(deep));
+    expect(vm.tryRun(false) == RunResult::Halted, "full stack");
+    n += 2;
+    return n;
+}
+
+// Each thread faults on its own VM; a fault must never land in another
+// thread's run.
+static std::size_t check_threads() {
+    constexpr int THREADS = 8, RUNS = 2000;
+    std::atomic<int> bad{ 0 };
+    std::vector<std::thread> ts;
+    for (int t = 0; t < THREADS; ++t) {
+        ts.emplace_back([&, t] {
+            StackVM vm;
+            for (int i = 0; i < RUNS; ++i) {
+                // k pushes, then more adds than they feed: add number k traps
+                const std::size_t k = static_cast<std::size_t>((t + i) % 5);
+                std::vector<i32> prog(k, 1);
+                prog.insert(prog.end(), { ops::ADD, ops::ADD, ops::ADD, ops::ADD, ops::ADD, ops::HALT });
+                vm.loadProgram(prog);
+                const std::size_t pc = k == 0 ? 0 : 2 * k - 1;
+                if (vm.tryRun(false) != RunResult::Trapped || vm.trap().code != TrapCode::StackUnderflow ||
+                    vm.trap().pc != pc) {
+                    bad.fetch_add(1);
+                }
+            }
+        });
+    }
+    for (auto& th : ts) th.join();
+    expect(bad.load() == 0, std::to_string(bad.load()) + " wrong traps across threads");
+    return std::size_t(THREADS) * RUNS;
+}
+
+static std::size_t check_chaining() {
+    void* p = ::mmap(nullptr, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) throw std::runtime_error("mmap failed");
+    GuardStack s(16);
+    expect(foreign_fault_at(static_cast<std::int32_t*>(p)), "fault outside any stack not chained");
+    // a guard page touched outside guard(), or another stack's guard page
+    // inside it, is a host bug rather than a guest trap
+    expect(foreign_fault_at(s.base() - 1), "guard fault outside guard() not chained");
+    GuardStack other(16);
+    bool chained = false;
+    const GuardStack::Hit hit = s.guard([&] { chained = foreign_fault_at(other.limit()); });
+    expect(chained && hit == GuardStack::Hit::None, "other stack's guard fault not chained");
+    ::munmap(p, 4096);
+    return 3;
+}
+
+// ---- timing ----
+
+template <class Run>
+static double median_ns(int reps, std::size_t per, Run&& run) {
+    std::vector<double> t;
+    for (int r = 0; r < reps; ++r) {
+        const auto t0 = Clock::now();
+        run();
+        t.push_back(std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / double(per));
+    }
+    std::sort(t.begin(), t.end());
+    return t[t.size() / 2];
+}
+
+int main(int argc, char** argv) {
+    const std::size_t insns = argc > 1 ? std::stoull(argv[1]) : 100'000ull;
+    const int reps = argc > 2 ? std::stoi(argv[2]) : 7;
+    try {
+        install_foreign_handler();
+        std::size_t n = check_lesson6();
+        n += check_threads();
+        n += check_chaining();
+        std::cerr << "checks: " << n << " runs, guard faults trapped at the right pc, other faults chained\n\n";
+
+        std::cerr << "ns/insn           checked  guarded  lesson6   guarded vs checked\n" << std::fixed
+                  << std::setprecision(3);
+        for (const Workload& w : { arith_chain(insns), deep_stack(insns), straight_line(insns) }) {
+            RefVM<false> c(w.prog);
+            RefVM<true> g(w.prog);
+            expect(c.run() == TrapCode::None && g.run() == TrapCode::None && c.tos() == g.tos(), "loops disagree");
+            StackVM vm;
+            vm.loadProgram(w.prog);
+            const std::size_t runs = std::max<std::size_t>(1, 2'000'000 / w.prog.size());
+            const double tc = median_ns(reps, runs * w.prog.size(), [&] { for (std::size_t i = 0; i < runs; ++i) c.run(); });
+            const double tg = median_ns(reps, runs * w.prog.size(), [&] { for (std::size_t i = 0; i < runs; ++i) g.run(); });
+            const double tl = median_ns(reps, runs * w.prog.size(), [&] {
+                for (std::size_t i = 0; i < runs; ++i) {
+                    vm.loadProgram(w.prog);
+                    vm.runChecked(false);
+                }
+            });
+            std::cerr << std::left << std::setw(16) << w.name << std::right << std::setw(9) << tc << std::setw(9) << tg
+                      << std::setw(9) << tl << std::setw(17) << std::setprecision(1) << (tg / tc - 1) * 100 << " %\n"
+                      << std::setprecision(3);
+        }
+
+        const std::vector<i32> under{ 1, ops::ADD, ops::HALT };
+        RefVM<false> c(under);
+        RefVM<true> g(under);
+        constexpr std::size_t RUNS = 100'000;
+        const double fc = median_ns(reps, RUNS, [&] { for (std::size_t i = 0; i < RUNS; ++i) c.run(); });
+        const double fg = median_ns(reps, RUNS, [&] { for (std::size_t i = 0; i < RUNS; ++i) g.run(); });
+        expect(c.run() == TrapCode::StackUnderflow && g.run() == TrapCode::StackUnderflow && c.pc() == g.pc(),
+               "underflow traps disagree");
+        std::cerr << "\nns/run, underflow trap: explicit check " << std::setprecision(1) << fc << ", guard page fault " << fg
+                  << "\n";
+    }
+    catch (const std::exception& ex) {
+        std::cerr << "error: " << ex.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
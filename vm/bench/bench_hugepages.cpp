@@ -0,0 +1,80 @@
+// bench_hugepages.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 bench_hugepages.cpp -o bench_hugepages
+// Usage: ./bench_hugepages [MiB=512] [steps=20000000] [numa_node=-1]
+//
+// Random-access memory walk over guest memory with 4 KiB pages, THP and
+// hugetlb backing (GuestMemory::Options). The guest words hold one random
+// cycle (Sattolo), so every step is a dependent load to an unpredictable
+// page: the cost is dominated by host TLB misses, which is what 2 MiB pages
+// remove. The instruction set has no load primitive, so the walk runs on
+// the host over the VM's guest memory, the way a memory-walking guest
+// would through its loads.
+//
+// hugetlb needs reserved pages (vm.nr_hugepages); without them the row
+// shows the Transparent fallback.
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "../common/guest_memory.h"
+
+using u32 = std::uint32_t;
+
+// AnonHugePages from /proc/self/smaps_rollup, in KiB (0 if unavailable).
+static std::size_t anon_huge_kib() {
+    std::FILE* f = std::fopen("/proc/self/smaps_rollup", "r");
+    if (!f) return 0;
+    char line[256];
+    std::size_t kib = 0;
+    while (std::fgets(line, sizeof(line), f)) {
+        if (std::strncmp(line, "AnonHugePages:", 14) == 0) kib = std::strtoull(line + 14, nullptr, 10);
+    }
+    std::fclose(f);
+    return kib;
+}
+
+static void walk(const char* name, std::size_t bytes, std::size_t steps, GuestMemory::Options opt) {
+    GuestMemory mem(bytes, opt);
+    mem.prefault(); // first touch from this thread
+    u32* const w = mem.as<u32>();
+    const std::size_t n = bytes / sizeof(u32);
+
+    // Sattolo's algorithm: one cycle through all n words
+    for (std::size_t i = 0; i < n; ++i) w[i] = static_cast<u32>(i);
+    std::mt19937_64 rng(12345);
+    for (std::size_t i = n - 1; i > 0; --i) {
+        const std::size_t j = std::uniform_int_distribution<std::size_t>(0, i - 1)(rng);
+        std::swap(w[i], w[j]);
+    }
+
+    u32 p = 0;
+    const auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t s = 0; s < steps; ++s) p = w[p];
+    const auto t1 = std::chrono::steady_clock::now();
+    const double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / double(steps);
+
+    const GuestMemory::Backing& b = mem.backing();
+    std::cout << std::left << std::setw(13) << name << std::right << std::setw(10) << ns
+              << std::setw(12) << 1e3 / ns << "   hugetlb=" << b.hugetlb << " thp=" << b.transparent
+              << " numa=" << b.numa_bound << " AnonHugePages=" << anon_huge_kib() / 1024 << " MiB"
+              << (p == 0xFFFFFFFFu ? " " : "") << "\n";
+}
+
+int main(int argc, char** argv) {
+    const std::size_t mib = argc > 1 ? std::stoull(argv[1]) : 512;
+    const std::size_t steps = argc > 2 ? std::stoull(argv[2]) : 20'000'000ull;
+    const int node = argc > 3 ? std::stoi(argv[3]) : -1;
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "random walk over " << mib << " MiB, " << steps << " dependent loads\n";
+    std::cout << "backing        ns/load  Mloads/s\n";
+    walk("4K", mib << 20, steps, { GuestMemory::Pages::Base, node });
+    walk("THP (2M)", mib << 20, steps, { GuestMemory::Pages::Transparent, node });
+    walk("hugetlb (2M)", mib << 20, steps, { GuestMemory::Pages::HugeTlb, node });
+    return 0;
+}
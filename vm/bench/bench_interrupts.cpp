@@ -0,0 +1,175 @@
+// bench_interrupts.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 -pthread bench_interrupts.cpp ../lesson1/lesson1/stack_vm.cpp -o bench_interrupts
+// Usage: ./bench_interrupts [instructions=20000000] [reps=5]
+//
+// 1. Cost of the exit check: add-chain on lesson1 and lesson3 (fast and
+//    checked loops) and MiniTCGVM (block boundaries), in Minsn/s, with
+//      none     no controller (the check reads a word that is always 0)
+//      idle     controller attached, nothing pending
+//      icount   instruction timer armed every 1M insns (countdown live)
+//    Compare "none" with the same loops before the check existed
+//    (bench_trace "off" column) for the absolute cost.
+//
+// 2. Delivery latency, raise -> handler entry, with a one-instruction
+//    handler (iret):
+//      icount     timer every 10k guest instructions
+//      host 100us timer thread every 100 microseconds
+//      raise      another thread raising a line every 100 microseconds
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../lesson1/lesson1/stack_vm.h"
+
+#define StackVM Lesson3StackVM
+#define Instr Lesson3Instr
+#define Prim Lesson3Prim
+#include "../lesson3/lesson3/stack_vm.h"
+#undef Prim
+#undef Instr
+#undef StackVM
+
+#include "../mini_TCG/mini_TCG/mini_tcg.h"
+#include "workloads.h"
+
+using Clock = std::chrono::steady_clock;
+
+namespace op {
+constexpr std::int32_t VEC = 0x40000009;
+constexpr std::int32_t IRET = 0x4000000A;
+} // namespace op
+
+// push H; vec; add-chain; halt; H: iret
+static std::vector<std::int32_t> with_handler(const Workload& w) {
+    std::vector<std::int32_t> p{ 0, op::VEC };
+    p.insert(p.end(), w.prog.begin(), w.prog.end());
+    p[0] = static_cast<std::int32_t>(p.size());
+    p.push_back(op::IRET);
+    return p;
+}
+
+struct Setup {
+    InterruptController* irq;
+    VirtualTimer* timer;
+};
+
+// Engine kinds: lesson1 fast/checked, lesson3 fast/checked, minitcg
+// Runs `prog` once on engine `kind`; returns Minsn/s. Only the run is
+// timed; lines left pending by the previous run are dropped first.
+static double run_once(int kind, const std::vector<std::int32_t>& prog, const Setup& s) {
+    auto timed = [&](auto&& run) {
+        if (s.irq) {
+            s.irq->clear(~0u);
+            s.irq->resetStats();
+        }
+        const auto t0 = Clock::now();
+        run();
+        return double(prog.size()) / std::chrono::duration<double>(Clock::now() - t0).count() / 1e6;
+    };
+    switch (kind) {
+    case 0:
+    case 1: {
+        StackVM vm;
+        vm.attachInterrupts(s.irq, s.timer);
+        vm.loadProgram(prog);
+        return timed([&] {
+            if (kind == 0) vm.runUnchecked();
+            else vm.runChecked(false);
+        });
+    }
+    case 2:
+    case 3: {
+        const std::vector<std::uint32_t> words(prog.begin(), prog.end());
+        Lesson3StackVM vm(words.size() + 200);
+        vm.attachInterrupts(s.irq, s.timer);
+        vm.loadProgram(words);
+        return timed([&] {
+            if (kind == 2) vm.runUnchecked();
+            else vm.runChecked(false);
+        });
+    }
+    default: {
+        MiniTCGVM vm(8);
+        vm.attachInterrupts(s.irq, s.timer);
+        vm.loadProgram(prog);
+        return timed([&] { vm.run(false); });
+    }
+    }
+}
+
+static double median_mips(int kind, const std::vector<std::int32_t>& prog, const Setup& s, int reps) {
+    std::vector<double> m;
+    for (int r = 0; r < reps; ++r) m.push_back(run_once(kind, prog, s));
+    std::sort(m.begin(), m.end());
+    return m[m.size() / 2];
+}
+
+static const char* const ENGINES[] = { "lesson1 fast", "lesson1 checked", "lesson3 fast", "lesson3 checked", "minitcg" };
+
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::stoull(argv[1]) : 20'000'000ull;
+    const int reps = argc > 2 ? std::stoi(argv[2]) : 5;
+
+    const int devnull = ::open("/dev/null", O_WRONLY);
+    if (devnull < 0 || ::dup2(devnull, 1) < 0) {
+        std::cerr << "cannot redirect stdout\n";
+        return 1;
+    }
+
+    const Workload w = add_chain(n);
+    const std::vector<std::int32_t> handled = with_handler(w);
+    std::cerr << std::fixed << std::setprecision(1);
+
+    std::cerr << "exit-check cost, add-chain " << n << " insns, Minsn/s (median of " << reps << ")\n";
+    std::cerr << "engine                none      idle    icount\n";
+    for (int kind = 0; kind < 5; ++kind) {
+        InterruptController idle;
+        InterruptController ticking;
+        VirtualTimer timer(ticking, 0, VirtualTimer::Mode::Instructions, 1'000'000);
+        // the add-chain has no vec, so timer ticks stay pending: countdown cost only
+        const double none = median_mips(kind, w.prog, { nullptr, nullptr }, reps);
+        const double quiet = median_mips(kind, w.prog, { &idle, nullptr }, reps);
+        const double icount = median_mips(kind, w.prog, { &ticking, &timer }, reps);
+        std::cerr << std::left << std::setw(18) << ENGINES[kind] << std::right << std::setw(9) << none
+                  << std::setw(10) << quiet << std::setw(10) << icount << "\n";
+    }
+
+    std::cerr << "\ndelivery latency raise -> handler entry (handler: iret)\n";
+    std::cerr << "engine            source      delivered    avg ns      max ns   Minsn/s\n";
+    for (int kind = 0; kind < 5; ++kind) {
+        for (int src = 0; src < 3; ++src) {
+            InterruptController irq;
+            irq.enable(1);
+            std::unique_ptr<VirtualTimer> timer;
+            if (src == 0) timer = std::make_unique<VirtualTimer>(irq, 0, VirtualTimer::Mode::Instructions, 10'000);
+            if (src == 1) timer = std::make_unique<VirtualTimer>(irq, 0, VirtualTimer::Mode::HostTime, 100);
+            std::atomic<bool> done{ false };
+            std::thread raiser;
+            if (src == 2) {
+                raiser = std::thread([&] {
+                    auto next = Clock::now();
+                    while (!done.load(std::memory_order_relaxed)) {
+                        next += std::chrono::microseconds(100);
+                        std::this_thread::sleep_until(next);
+                        irq.raise(1);
+                    }
+                });
+            }
+            const double mips = run_once(kind, handled, { &irq, timer.get() });
+            const InterruptController::Stats st = irq.stats();
+            done = true;
+            if (raiser.joinable()) raiser.join();
+            static const char* const SRC[] = { "icount 10k", "host 100us", "raise 100us" };
+            std::cerr << std::left << std::setw(18) << ENGINES[kind] << std::setw(12) << SRC[src] << std::right
+                      << std::setw(9) << st.delivered << std::setw(10) << st.latencyAvgNs() << std::setw(12)
+                      << st.latency_ns_max << std::setw(10) << mips << "\n";
+        }
+    }
+    return 0;
+}
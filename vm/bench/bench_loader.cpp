@@ -0,0 +1,99 @@
+// bench_loader.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 bench_loader.cpp -o bench_loader
+// Usage: ./bench_loader [instructions=100000000] [dir=.]
+//
+// Compares the original out.bin path (one out.write per word, then reading
+// 4 bytes at a time into a growing vector) against the versioned image
+// (single buffered write, mmap + header/CRC check, zero-copy loadProgram).
+// Numbers are for a warm page cache: the files were just written.
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../common/bytecode_image.h"
+#include "../lesson6/lesson6/stack-vm.h"
+
+template <class F>
+static double time_ms(F&& f) {
+    using namespace std::chrono;
+    auto t0 = steady_clock::now();
+    f();
+    auto t1 = steady_clock::now();
+    return duration<double, std::milli>(t1 - t0).count();
+}
+
+// push 0; (push 1; add) * k; halt
+static std::vector<i32> make_program(std::size_t n) {
+    std::vector<i32> prog;
+    prog.reserve(n);
+    prog.push_back(0);
+    while (prog.size() + 3 <= n) {
+        prog.push_back(1);
+        prog.push_back(0x40000001); // add
+    }
+    prog.push_back(0x40000000); // halt
+    return prog;
+}
+
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::stoull(argv[1]) : 100'000'000ull;
+    const std::string dir = argc > 2 ? argv[2] : ".";
+    const std::string raw_path = dir + "/bench_raw.bin";
+    const std::string img_path = dir + "/bench_img.bin";
+
+    const std::vector<i32> prog = make_program(n);
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Image: " << prog.size() << " instructions ("
+              << (prog.size() * sizeof(i32)) / (1024.0 * 1024.0) << " MiB)\n\n";
+
+    // ---- writers ----
+    double w_old = time_ms([&] {
+        std::ofstream out(raw_path, std::ios::binary);
+        for (i32 ins : prog) out.write(reinterpret_cast<const char*>(&ins), sizeof(ins));
+    });
+    double w_new = time_ms([&] { BytecodeImage::write(img_path.c_str(), prog); });
+
+    // ---- old loader: 4-byte reads into a growing vector ----
+    std::size_t old_words = 0;
+    double r_old = time_ms([&] {
+        std::ifstream r(raw_path, std::ios::binary);
+        std::vector<i32> loaded;
+        i32 word = 0;
+        while (r.read(reinterpret_cast<char*>(&word), sizeof(word))) loaded.push_back(word);
+        old_words = loaded.size();
+    });
+
+    // ---- new loader: mmap + validate + zero-copy loadProgram ----
+    StackVM vm;
+    std::size_t new_words = 0;
+    double r_new_crc = time_ms([&] {
+        MappedImage image(img_path.c_str(), /*verify_crc=*/true);
+        vm.loadProgram(image.code());
+        new_words = image.code().size();
+    });
+    double r_new_nocrc = time_ms([&] {
+        MappedImage image(img_path.c_str(), /*verify_crc=*/false);
+        vm.loadProgram(image.code());
+    });
+
+    if (old_words != prog.size() || new_words != prog.size()) {
+        std::cerr << "loader mismatch: old=" << old_words << " new=" << new_words << "\n";
+        return 1;
+    }
+
+    std::cout << "write  old (per-word out.write): " << std::setw(9) << w_old << " ms\n";
+    std::cout << "write  new (single write)      : " << std::setw(9) << w_new << " ms\n";
+    std::cout << "load   old (4-byte r.read)     : " << std::setw(9) << r_old << " ms\n";
+    std::cout << "load   new (mmap + CRC)        : " << std::setw(9) << r_new_crc << " ms\n";
+    std::cout << "load   new (mmap, no CRC)      : " << std::setw(9) << r_new_nocrc << " ms\n";
+    std::cout << "speedup (old / mmap+CRC)       : " << std::setw(9) << r_old / r_new_crc << "x\n";
+
+    std::remove(raw_path.c_str());
+    std::remove(img_path.c_str());
+    return 0;
+}
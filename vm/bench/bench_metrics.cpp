@@ -0,0 +1,206 @@
+// bench_metrics.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 -pthread bench_metrics.cpp ../lesson1/lesson1/stack_vm.cpp -o bench_metrics
+// Usage: ./bench_metrics [instructions=20000000] [reps=9] [socket=/tmp/bench_metrics.sock]
+//
+// Hot-path cost of the runtime metrics (metrics.h), median Minsn/s over
+// `reps` alternating runs with and without a VcpuMetrics block attached:
+// lesson1 and lesson3 (verified fast path and checked loop) on mul-div,
+// MiniTCGVM on add-chain. A reader thread takes snapshots in a tight loop
+// during the "on" runs, so the cost includes a concurrent reader on the
+// counter lines.
+//
+// Before timing, each engine's counts are checked against the program
+// (instructions, primitives by opcode, traps on a division by zero). After
+// timing the registry is dumped to a file and served once over the Unix
+// socket, and the first lines of the Prometheus text are printed.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../lesson1/lesson1/stack_vm.h"
+
+#define StackVM Lesson3StackVM
+#define Instr Lesson3Instr
+#define Prim Lesson3Prim
+#include "../lesson3/lesson3/stack_vm.h"
+#undef Prim
+#undef Instr
+#undef StackVM
+
+#include "../common/metrics.h"
+#include "../mini_TCG/mini_TCG/mini_tcg.h"
+#include "workloads.h"
+
+using Clock = std::chrono::steady_clock;
+
+enum class Kind { Lesson1Fast, Lesson1Checked, Lesson3Fast, Lesson3Checked, MiniTcg };
+static const char* const NAMES[] = { "lesson1 fast", "lesson1 checked", "lesson3 fast", "lesson3 checked",
+                                     "minitcg" };
+
+// One run of `prog` on `kind` with `m` attached (may be null); Minsn/s.
+static double run_once(Kind kind, const std::vector<std::int32_t>& prog, VcpuMetrics* m) {
+    auto timed = [&](auto&& run) {
+        const auto t0 = Clock::now();
+        run();
+        return double(prog.size()) / std::chrono::duration<double>(Clock::now() - t0).count() / 1e6;
+    };
+    switch (kind) {
+    case Kind::Lesson1Fast:
+    case Kind::Lesson1Checked: {
+        StackVM vm;
+        vm.attachMetrics(m);
+        vm.loadProgram(prog);
+        if (kind == Kind::Lesson1Fast) return timed([&] { vm.runUnchecked(); });
+        return timed([&] { vm.runChecked(false); });
+    }
+    case Kind::Lesson3Fast:
+    case Kind::Lesson3Checked: {
+        const std::vector<std::uint32_t> words(prog.begin(), prog.end());
+        Lesson3StackVM vm(words.size() + 200);
+        vm.attachMetrics(m);
+        vm.loadProgram(words);
+        if (kind == Kind::Lesson3Fast) return timed([&] { vm.runUnchecked(); });
+        return timed([&] { vm.runChecked(false); });
+    }
+    default: {
+        MiniTCGVM vm(8);
+        vm.attachMetrics(m);
+        vm.loadProgram(prog);
+        return timed([&] { vm.run(false); });
+    }
+    }
+}
+
+static void expect(bool ok, const std::string& what) {
+    if (!ok) throw std::runtime_error("metrics check failed: " + what);
+}
+
+// Counts from one run match the program; a division by zero counts a trap.
+static void check_counts(MetricsRegistry& reg) {
+    const std::vector<std::int32_t> md = mul_div(1001).prog;
+    const std::vector<std::int32_t> adds = add_chain(1001).prog;
+    for (int k = 0; k <= static_cast<int>(Kind::MiniTcg); ++k) {
+        const Kind kind = static_cast<Kind>(k);
+        const std::vector<std::int32_t>& prog = kind == Kind::MiniTcg ? adds : md;
+        VcpuMetrics* m = reg.vcpu(std::string("check ") + NAMES[k]);
+        run_once(kind, prog, m);
+        const VcpuMetrics::Values v = m->read();
+        std::uint64_t prims[VcpuMetrics::PRIMS] = {};
+        for (std::int32_t w : prog) {
+            if ((static_cast<std::uint32_t>(w) >> 30) == 1) ++prims[w & 0xF];
+        }
+        expect(v.instructions == prog.size(), std::string(NAMES[k]) + " instructions");
+        expect(std::equal(prims, prims + VcpuMetrics::PRIMS, v.prims), std::string(NAMES[k]) + " primitives");
+        expect(v.traps == 0 && v.stack_hwm >= 2, std::string(NAMES[k]) + " traps/stack");
+        if (kind == Kind::MiniTcg) expect(v.tb_misses == v.tb_translations && v.tb_misses > 0, "minitcg tb counts");
+    }
+    const std::vector<std::int32_t> div0{ 1, 0, ops::DIV, ops::HALT };
+    for (Kind kind : { Kind::Lesson1Fast, Kind::Lesson1Checked, Kind::Lesson3Fast, Kind::Lesson3Checked }) {
+        VcpuMetrics* m = reg.vcpu(std::string("trap ") + NAMES[static_cast<int>(kind)]);
+        try {
+            run_once(kind, div0, m);
+        }
+        catch (const std::runtime_error&) {
+        }
+        expect(m->read().traps == 1 && m->read().instructions == 3, std::string(NAMES[static_cast<int>(kind)]) + " trap");
+    }
+}
+
+static std::string fetch_socket(const std::string& path) {
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::copy(path.begin(), path.end(), addr.sun_path);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        throw std::runtime_error("cannot connect to " + path);
+    }
+    const std::string req = "GET /metrics HTTP/1.0\r\n\r\n";
+    ::send(fd, req.data(), req.size(), 0);
+    std::string out;
+    char buf[4096];
+    for (ssize_t n; (n = ::recv(fd, buf, sizeof(buf), 0)) > 0;) out.append(buf, static_cast<std::size_t>(n));
+    ::close(fd);
+    return out;
+}
+
+static double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::stoull(argv[1]) : 20'000'000ull;
+    const int reps = argc > 2 ? std::stoi(argv[2]) : 9;
+    const std::string sock = argc > 3 ? argv[3] : "/tmp/bench_metrics.sock";
+
+    MetricsRegistry reg;
+    check_counts(reg);
+    std::cerr << "count check: instructions, primitives and traps match on every engine\n\n";
+
+    const std::vector<std::int32_t> md = mul_div(n).prog;
+    const std::vector<std::int32_t> adds = add_chain(n / 10).prog; // MiniTCGVM is ~20x slower
+
+    std::atomic<bool> stop{ false };
+    std::atomic<std::uint64_t> snapshots{ 0 };
+    std::thread reader([&] {
+        while (!stop.load(std::memory_order_relaxed)) {
+            volatile std::uint64_t sink = reg.snapshot().total.instructions;
+            (void)sink;
+            snapshots.fetch_add(1, std::memory_order_relaxed);
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+
+    std::cerr << "engine             off Minsn/s   on Minsn/s  overhead\n";
+    for (int k = 0; k <= static_cast<int>(Kind::MiniTcg); ++k) {
+        const Kind kind = static_cast<Kind>(k);
+        const std::vector<std::int32_t>& prog = kind == Kind::MiniTcg ? adds : md;
+        VcpuMetrics* m = reg.vcpu(NAMES[k]);
+        std::vector<double> off, on;
+        for (int r = 0; r < reps; ++r) {
+            if (r % 2) {
+                off.push_back(run_once(kind, prog, nullptr));
+                on.push_back(run_once(kind, prog, m));
+            }
+            else {
+                on.push_back(run_once(kind, prog, m));
+                off.push_back(run_once(kind, prog, nullptr));
+            }
+        }
+        const double o = median(off), w = median(on);
+        std::cerr << std::left << std::setw(17) << NAMES[k] << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(13) << o << std::setw(13) << w << std::setw(9) << 100.0 * (o - w) / o << "%\n";
+    }
+    stop = true;
+    reader.join();
+
+    const std::string file = sock + ".prom";
+    reg.dumpToFile(file);
+    std::string served;
+    std::uint64_t conns = 0;
+    {
+        MetricsEndpoint ep(reg, sock);
+        served = fetch_socket(sock);
+        conns = ep.served();
+    }
+    std::ifstream f(file);
+    std::stringstream text;
+    text << f.rdbuf();
+    std::cerr << "\n" << snapshots.load() << " concurrent snapshots; " << file << ": " << text.str().size()
+              << " bytes; socket: " << served.size() << " bytes in " << conns << " connection(s)\n\n";
+    std::istringstream lines(text.str());
+    std::string line;
+    for (int i = 0; i < 12 && std::getline(lines, line); ++i) std::cerr << line << "\n";
+    return 0;
+}
@@ -0,0 +1,107 @@
+// bench_mmio.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 -pthread bench_mmio.cpp -o bench_mmio
+// Usage: ./bench_mmio [round_trips=1000000] [reps=5]
+//
+// Cost of a load + store round trip on lesson3, fast (verified) and checked
+// loops, in ns per round trip. Each round trip is "A load A store": read a
+// word and write it back, stack balanced.
+//
+//   ram, no bus      A in RAM, no MmioBus attached
+//   ram, bus         A in RAM, bus with 64 devices attached (must match)
+//   mmio, cached     A is a scratch-device register; per-vCPU cache hits
+//   mmio, alternate  load from one device, store to another: every access
+//                    misses the last-hit cache and binary-searches 64 ranges
+//   timer NOW_LO     load of the timer's clock register (steady_clock read)
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../lesson3/lesson3/stack_vm.h"
+#include "../common/mmio_devices.h"
+
+// A bank of plain registers.
+class ScratchDevice final : public MmioDevice {
+public:
+    const char* name() const override { return "scratch"; }
+    std::uint32_t read(std::uint32_t offset) override { return regs_[offset & 3]; }
+    void write(std::uint32_t offset, std::uint32_t value) override { regs_[offset & 3] = value; }
+
+private:
+    std::uint32_t regs_[4]{};
+};
+
+static constexpr u32 RAM_ADDR = 50; // below program_base, above the stack in use
+
+// 7 A store; (B load C store) * n; halt
+static std::vector<u32> round_trips(std::size_t n, u32 load_addr, u32 store_addr) {
+    std::vector<u32> p{ Instr::push(7), Instr::push(static_cast<i32>(store_addr)), Instr::prim(Prim::Store) };
+    for (std::size_t i = 0; i < n; ++i) {
+        p.insert(p.end(), { Instr::push(static_cast<i32>(load_addr)), Instr::prim(Prim::Load),
+                            Instr::push(static_cast<i32>(store_addr)), Instr::prim(Prim::Store) });
+    }
+    p.push_back(Instr::prim(Prim::Halt));
+    return p;
+}
+
+static double ns_per_trip(const std::vector<u32>& prog, std::size_t n, MmioBus* bus, bool fast, int reps) {
+    std::vector<double> ns;
+    for (int r = 0; r < reps; ++r) {
+        StackVM vm(prog.size() + 200, 100);
+        vm.attachBus(bus);
+        vm.loadProgram(prog);
+        if (!vm.verified()) throw std::runtime_error("benchmark program failed verification");
+        auto t0 = std::chrono::steady_clock::now();
+        if (fast) vm.runUnchecked();
+        else vm.runChecked(false);
+        auto t1 = std::chrono::steady_clock::now();
+        ns.push_back(std::chrono::duration<double, std::nano>(t1 - t0).count() / double(n));
+    }
+    std::sort(ns.begin(), ns.end());
+    return ns[ns.size() / 2];
+}
+
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::stoull(argv[1]) : 1'000'000ull;
+    const int reps = argc > 2 ? std::stoi(argv[2]) : 5;
+
+    // 64 scratch devices, 4 words each, then the timer
+    std::vector<std::unique_ptr<ScratchDevice>> scratch;
+    MmioBus bus;
+    for (u32 i = 0; i < 64; ++i) {
+        scratch.push_back(std::make_unique<ScratchDevice>());
+        bus.map(StackVM::MMIO_BASE + 16 * i, 4, *scratch.back());
+    }
+    TimerDevice timer;
+    const u32 timer_base = StackVM::MMIO_BASE + 16 * 64;
+    bus.map(timer_base, TimerDevice::WORDS, timer);
+
+    const u32 dev_a = StackVM::MMIO_BASE + 16 * 5;
+    const u32 dev_b = StackVM::MMIO_BASE + 16 * 40;
+
+    struct Case {
+        const char* name;
+        std::vector<u32> prog;
+        MmioBus* bus;
+    };
+    const Case cases[] = {
+        { "ram, no bus", round_trips(n, RAM_ADDR, RAM_ADDR), nullptr },
+        { "ram, bus", round_trips(n, RAM_ADDR, RAM_ADDR), &bus },
+        { "mmio, cached", round_trips(n, dev_a, dev_a), &bus },
+        { "mmio, alternate", round_trips(n, dev_a, dev_b), &bus },
+        { "timer NOW_LO", round_trips(n, timer_base + TimerDevice::NOW_LO, RAM_ADDR), &bus },
+    };
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << n << " load+store round trips, median of " << reps << ", ns per round trip\n";
+    std::cout << "case                 fast   checked\n";
+    for (const Case& c : cases) {
+        std::cout << std::left << std::setw(17) << c.name << std::right
+                  << std::setw(8) << ns_per_trip(c.prog, n, c.bus, true, reps)
+                  << std::setw(10) << ns_per_trip(c.prog, n, c.bus, false, reps) << "\n";
+    }
+    return 0;
+}
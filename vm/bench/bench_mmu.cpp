@@ -0,0 +1,62 @@
+// bench_mmu.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 bench_mmu.cpp -o bench_mmu
+// Usage: ./bench_mmu [instructions=2000000] [reps=5]
+//
+// Cost of the soft-MMU on lesson3: the checked loop with raw indexing into
+// guest memory versus the same loop with every fetch, push and pop going
+// through SoftMmu (TLB hit = tag compare + pointer add). Also reports the
+// TLB hit rate of the paged run. The fast path is not involved: it only
+// supports raw indexing.
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../lesson3/lesson3/stack_vm.h"
+#include "workloads.h"
+
+struct Result {
+    double mips = 0;
+    double hit_rate = 0;
+};
+
+static Result run(const std::vector<u32>& prog, bool paging, int reps) {
+    std::vector<double> mips;
+    double hit_rate = 0;
+    // room for the stack page, the program and its page tables
+    const std::size_t words = prog.size() + 8 * SoftMmu::PAGE_WORDS;
+    for (int r = 0; r < reps; ++r) {
+        StackVM vm(words, 100);
+        if (paging) vm.enablePaging();
+        vm.loadProgram(prog);
+        auto t0 = std::chrono::steady_clock::now();
+        vm.runChecked(false);
+        auto t1 = std::chrono::steady_clock::now();
+        mips.push_back(double(prog.size()) / std::chrono::duration<double>(t1 - t0).count() / 1e6);
+        if (paging) hit_rate = vm.mmu().stats().hitRate();
+    }
+    std::sort(mips.begin(), mips.end());
+    return { mips[mips.size() / 2], hit_rate };
+}
+
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::stoull(argv[1]) : 2'000'000ull;
+    const int reps = argc > 2 ? std::stoi(argv[2]) : 5;
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "lesson3 checked loop, " << n << " insns, median of " << reps << ", Minsn/s\n";
+    std::cout << "workload         raw     paged  overhead  TLB hit rate\n";
+    for (const Workload& w : { arith_chain(n), mul_div(n), deep_stack(n) }) {
+        const std::vector<u32> prog(w.prog.begin(), w.prog.end());
+        const Result raw = run(prog, false, reps);
+        const Result paged = run(prog, true, reps);
+        std::cout << std::left << std::setw(12) << w.name << std::right
+                  << std::setw(9) << raw.mips << std::setw(10) << paged.mips
+                  << std::setw(9) << (raw.mips / paged.mips - 1.0) * 100.0 << "%"
+                  << std::setw(13) << std::setprecision(4) << paged.hit_rate * 100.0 << "%\n"
+                  << std::setprecision(1);
+    }
+    return 0;
+}
@@ -0,0 +1,149 @@
+// bench_pool.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 -pthread bench_pool.cpp -o bench_pool
+// Usage: ./bench_pool [requests=20000]
+//
+// Per-request latency of a short guest on lesson3 and lesson6 (1M-word guest
+// memory each), two ways:
+//
+//   fresh   construct VM, loadProgram, run, destroy
+//   pool    VmPool::acquire, loadProgram, run, release (VM::reset)
+//
+// Reports median / p99 microseconds per request, pool hits/misses and the
+// average reset time. Before timing, each pooled VM type runs a guest that
+// stores all over memory and is checked to come back all-zero from reset().
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define StackVM Lesson3StackVM
+#include "../lesson3/lesson3/stack_vm.h"
+#undef StackVM
+
+#define StackVM Lesson6StackVM
+#include "../lesson6/lesson6/stack-vm.h"
+#undef StackVM
+
+#include "../common/vm_pool.h"
+#include "workloads.h"
+
+using Clock = std::chrono::steady_clock;
+
+static double us_since(Clock::time_point t0) {
+    return std::chrono::duration<double, std::micro>(Clock::now() - t0).count();
+}
+
+static double percentile(std::vector<double> v, double p) {
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, static_cast<std::size_t>(p * double(v.size())))];
+}
+
+template <class VM>
+static bool all_zero(VM& vm) {
+    const GuestMemory& m = vm.guestMemory();
+    const std::uint32_t* w = m.template as<std::uint32_t>();
+    return std::all_of(w, w + m.size() / sizeof(std::uint32_t), [](std::uint32_t x) { return x == 0; });
+}
+
+// lesson3 guest that writes the stack, the program and pages all over RAM.
+static void check_lesson3_reset() {
+    VmPool<Lesson3StackVM> pool([] { return std::make_unique<Lesson3StackVM>(); }, 1);
+    std::vector<u32> prog;
+    for (u32 addr : { 400u, 2048u, 77777u, 500000u, 999999u }) {
+        prog.insert(prog.end(), { Instr::push(static_cast<i32>(addr + 1)), Instr::push(static_cast<i32>(addr)),
+                                  Instr::prim(Prim::Store) });
+    }
+    for (int i = 0; i < 90; ++i) prog.push_back(Instr::push(i + 1));
+    for (int i = 0; i < 89; ++i) prog.push_back(Instr::prim(Prim::Add));
+    prog.push_back(Instr::prim(Prim::Halt));
+    for (bool fast : { true, false }) {
+        {
+            auto vm = pool.acquire();
+            vm->loadProgram(prog);
+            if (fast) vm->runUnchecked();
+            else vm->runChecked(false);
+        }
+        auto vm = pool.acquire();
+        if (!all_zero(*vm)) throw std::runtime_error("lesson3 reset left guest data behind");
+    }
+}
+
+static void check_lesson6_reset() {
+    VmPool<Lesson6StackVM> pool([] { return std::make_unique<Lesson6StackVM>(); }, 1);
+    const std::vector<i32> prog = deep_stack(2000).prog;
+    for (bool fast : { true, false }) {
+        {
+            auto vm = pool.acquire();
+            vm->loadProgram(prog);
+            if (fast) vm->runUnchecked();
+            else vm->runChecked(false);
+        }
+        auto vm = pool.acquire();
+        if (!all_zero(*vm)) throw std::runtime_error("lesson6 reset left guest data behind");
+    }
+}
+
+struct Row {
+    double p50 = 0;
+    double p99 = 0;
+};
+
+template <class F>
+static Row time_requests(std::size_t n, F&& request) {
+    std::vector<double> us;
+    us.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        const auto t0 = Clock::now();
+        request();
+        us.push_back(us_since(t0));
+    }
+    return { percentile(us, 0.50), percentile(us, 0.99) };
+}
+
+template <class VM, class Prog>
+static void compare(const char* engine, const char* workload, const Prog& prog, std::size_t n) {
+    const Row fresh = time_requests(n, [&] {
+        VM vm;
+        vm.loadProgram(prog);
+        vm.run(false);
+    });
+
+    VmPool<VM> pool([] { return std::make_unique<VM>(); }, 4, 1);
+    const Row pooled = time_requests(n, [&] {
+        auto vm = pool.acquire();
+        vm->loadProgram(prog);
+        vm->run(false);
+    });
+    const auto st = pool.stats();
+
+    std::cerr << std::left << std::setw(9) << engine << std::setw(16) << workload << std::right << std::fixed
+              << std::setprecision(2) << std::setw(9) << fresh.p50 << std::setw(9) << fresh.p99 << std::setw(9)
+              << pooled.p50 << std::setw(9) << pooled.p99 << std::setw(8) << st.hits << std::setw(7) << st.misses
+              << std::setw(10) << std::setprecision(0) << st.resetAvgNs() << "\n";
+}
+
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::stoull(argv[1]) : 20'000ull;
+
+    check_lesson3_reset();
+    check_lesson6_reset();
+    std::cerr << "reset check: guest memory all zero after release (lesson3 stores, lesson6 program copy)\n\n";
+
+    const Workload tiny{ "tiny (9)", { 3, 4, ops::ADD, 5, ops::SUB, 3, ops::MUL, 2, ops::DIV, ops::HALT } };
+    const Workload arith = arith_chain(1000);
+    const Workload deep = deep_stack(10'000);
+
+    std::cerr << n << " requests, us per request (acquire/construct .. release/destroy)\n";
+    std::cerr << "engine   workload         fresh p50      p99 pool p50      p99    hits misses  reset ns\n";
+    for (const Workload* w : { &tiny, &arith, &deep }) {
+        const std::vector<u32> words(w->prog.begin(), w->prog.end());
+        const std::string name = w == &tiny ? w->name : std::string(w->name) + " " + std::to_string(w->prog.size());
+        compare<Lesson3StackVM>("lesson3", name.c_str(), words, n);
+        compare<Lesson6StackVM>("lesson6", name.c_str(), w->prog, n);
+    }
+    return 0;
+}
@@ -0,0 +1,96 @@
+// bench_print.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 -pthread bench_print.cpp ../lesson1/lesson1/stack_vm.cpp -o bench_print
+// Usage: ./bench_print [prints=1000000] [out=/tmp/bench_print.out]
+//
+// Print-heavy guest: push 0; (print; push 1; add) * N; halt.
+// stdout is redirected to `out` for the whole run (the report goes to
+// stderr), so every variant pays for real writes to the same file.
+//
+//   cout/line     : the pre-console path, std::cout << prefix << v << "\n"
+//                   per Print, replayed on the host without a VM
+//   lesson1 sync  : StackVM, console flushing on the VM thread
+//   lesson1 iothr : StackVM, console drained by an I/O thread
+//   minitcg ...   : the same for MiniTCGVM
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "../lesson1/lesson1/stack_vm.h"
+#include "../mini_TCG/mini_TCG/mini_tcg.h"
+
+using i32 = std::int32_t;
+
+template <class F>
+static double time_s(F&& f) {
+    auto t0 = std::chrono::steady_clock::now();
+    f();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(t1 - t0).count();
+}
+
+static std::vector<i32> make_program(std::size_t prints) {
+    std::vector<i32> p{ 0 };
+    for (std::size_t i = 0; i < prints; ++i) {
+        p.push_back(0x40000005); // print
+        p.push_back(1);
+        p.push_back(0x40000001); // add
+    }
+    p.push_back(0x40000000); // halt
+    return p;
+}
+
+static void report(const char* name, std::size_t prints, double s, const VirtualConsole::Stats* st) {
+    std::cerr << std::left << std::setw(15) << name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(9) << prints / s / 1e6 << " M prints/s";
+    if (st) std::cerr << std::setw(10) << st->writes << " writes";
+    std::cerr << "\n";
+}
+
+int main(int argc, char** argv) {
+    const std::size_t prints = argc > 1 ? std::stoull(argv[1]) : 1'000'000ull;
+    const std::string out = argc > 2 ? argv[2] : "/tmp/bench_print.out";
+
+    const int fd = ::open(out.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ::dup2(fd, 1) < 0) {
+        std::cerr << "cannot redirect stdout to " << out << "\n";
+        return 1;
+    }
+    ::close(fd);
+
+    const std::vector<i32> prog = make_program(prints);
+
+    double s = time_s([&] {
+        for (std::size_t i = 0; i < prints; ++i) std::cout << "[prim] print: " << static_cast<i32>(i) << "\n";
+        std::cout.flush();
+    });
+    report("cout/line", prints, s, nullptr);
+
+    for (auto mode : { VirtualConsole::Mode::Sync, VirtualConsole::Mode::IoThread }) {
+        VirtualConsole::Options opt;
+        opt.mode = mode;
+        const bool sync = mode == VirtualConsole::Mode::Sync;
+
+        {
+            StackVM vm(1024, opt);
+            vm.loadProgram(prog);
+            s = time_s([&] { vm.run(false); });
+            const auto st = vm.console().stats();
+            report(sync ? "lesson1 sync" : "lesson1 iothr", prints, s, &st);
+        }
+        {
+            MiniTCGVM vm(8, opt);
+            vm.loadProgram(prog);
+            s = time_s([&] { vm.run(false); });
+            const auto st = vm.console().stats();
+            report(sync ? "minitcg sync" : "minitcg iothr", prints, s, &st);
+        }
+    }
+    std::remove(out.c_str());
+    return 0;
+}
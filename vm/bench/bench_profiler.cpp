@@ -0,0 +1,147 @@
+// bench_profiler.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 -pthread bench_profiler.cpp ../lesson1/lesson1/stack_vm.cpp -o bench_profiler
+// Usage: ./bench_profiler [instructions=50000000] [reps=7] [folded_prefix=/tmp/bench_profiler]
+//
+// Overhead of the sampling profiler (profiler.h) at 1 kHz on the fast
+// loops of lesson1, lesson3 and MiniTCGVM, median Minsn/s over `reps`
+// alternating runs:
+//
+//   off      no profiler attached
+//   icount   a sample every ~N guest instructions (jittered), N = the
+//            engine's "off" speed / 1000, i.e. ~1 kHz
+//   host     a 1 ms host timer requesting samples through the interrupt
+//            controller
+//
+// The guest is half arith-chain, half mul-div (MiniTCGVM: add-chain, the
+// only primitives it has). Afterwards the hottest pcs and the opcode
+// breakdown of one icount run per engine are printed. Folded stacks go to
+// <folded_prefix>.<engine>.folded, ready for flamegraph.pl.
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../lesson1/lesson1/stack_vm.h"
+
+#define StackVM Lesson3StackVM
+#define Instr Lesson3Instr
+#define Prim Lesson3Prim
+#include "../lesson3/lesson3/stack_vm.h"
+#undef Prim
+#undef Instr
+#undef StackVM
+
+#include "../common/profiler.h"
+#include "../mini_TCG/mini_TCG/mini_tcg.h"
+#include "workloads.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Runs `prog` once on engine `kind` (0 lesson1, 1 lesson3, 2 minitcg) with
+// `prof` attached (may be null); returns Minsn/s.
+static double run_once(int kind, const std::vector<std::int32_t>& prog, SampleProfiler* prof,
+                       InterruptController* irq) {
+    auto timed = [&](auto& vm, auto&& run) {
+        vm.attachInterrupts(irq);
+        vm.attachSampler(prof);
+        vm.loadProgram(prog);
+        const auto t0 = Clock::now();
+        run();
+        return double(prog.size()) / std::chrono::duration<double>(Clock::now() - t0).count() / 1e6;
+    };
+    switch (kind) {
+    case 0: {
+        StackVM vm;
+        return timed(vm, [&] { vm.runUnchecked(); });
+    }
+    case 1: {
+        const std::vector<std::uint32_t> words(prog.begin(), prog.end());
+        Lesson3StackVM vm(words.size() + 200);
+        vm.attachInterrupts(irq);
+        vm.attachSampler(prof);
+        vm.loadProgram(words);
+        const auto t0 = Clock::now();
+        vm.runUnchecked();
+        return double(prog.size()) / std::chrono::duration<double>(Clock::now() - t0).count() / 1e6;
+    }
+    default: {
+        MiniTCGVM vm(8);
+        return timed(vm, [&] { vm.run(false); });
+    }
+    }
+}
+
+static double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::stoull(argv[1]) : 50'000'000ull;
+    const int reps = argc > 2 ? std::stoi(argv[2]) : 7;
+    const std::string prefix = argc > 3 ? argv[3] : "/tmp/bench_profiler";
+
+    std::vector<std::int32_t> mixed = arith_chain(n / 2).prog;
+    mixed.pop_back(); // halt
+    const std::vector<std::int32_t> tail = mul_div(n / 2).prog;
+    mixed.insert(mixed.end(), tail.begin() + 1, tail.end()); // keep one operand on the stack
+    const std::vector<std::int32_t> adds = add_chain(n).prog;
+
+    static const char* const NAMES[] = { "lesson1", "lesson3", "minitcg" };
+    std::cerr << n << " insns, median of " << reps << ", Minsn/s; sampling at ~1 kHz\n";
+    std::cerr << "engine        off   icount  overhead     host  overhead  samples(icount/host)\n";
+
+    std::uint64_t periods[3];
+    for (int kind = 0; kind < 3; ++kind) {
+        const std::vector<std::int32_t>& prog = kind == 2 ? adds : mixed;
+        // calibrate the icount period to ~1 kHz for this engine
+        std::vector<double> warm;
+        for (int r = 0; r < 3; ++r) warm.push_back(run_once(kind, prog, nullptr, nullptr));
+        const std::uint64_t period = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(median(warm) * 1e3));
+        periods[kind] = period;
+
+        std::vector<double> off, icount, host;
+        std::uint64_t icount_samples = 0, host_samples = 0;
+        for (int r = 0; r < reps; ++r) {
+            for (int k = 0; k < 3; ++k) { // rotate the order to spread drift evenly
+                switch ((r + k) % 3) {
+                case 0: off.push_back(run_once(kind, prog, nullptr, nullptr)); break;
+                case 1: {
+                    SampleProfiler prof(SampleProfiler::Mode::Instructions, period);
+                    icount.push_back(run_once(kind, prog, &prof, nullptr));
+                    icount_samples += prof.samples();
+                    break;
+                }
+                default: {
+                    InterruptController irq;
+                    SampleProfiler prof(SampleProfiler::Mode::HostTime, 1000, &irq);
+                    host.push_back(run_once(kind, prog, &prof, &irq));
+                    host_samples += prof.samples();
+                    break;
+                }
+                }
+            }
+        }
+        const double o = median(off), i = median(icount), h = median(host);
+        std::cerr << std::left << std::setw(10) << NAMES[kind] << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(7) << o << std::setw(9) << i << std::setw(9) << 100.0 * (o - i) / o << "%"
+                  << std::setw(9) << h << std::setw(9) << 100.0 * (o - h) / o << "%" << std::setw(11)
+                  << icount_samples / reps << "/" << host_samples / reps << "\n";
+    }
+
+    for (int kind = 0; kind < 3; ++kind) {
+        const std::vector<std::int32_t>& prog = kind == 2 ? adds : mixed;
+        SampleProfiler prof(SampleProfiler::Mode::Instructions, periods[kind]);
+        run_once(kind, prog, &prof, nullptr);
+        std::cerr << "\n" << NAMES[kind] << ": " << prof.samples() << " samples\n";
+        prof.writeTop(std::cerr, prog, 5);
+        prof.writeOpcodes(std::cerr, prog);
+        std::ofstream folded(prefix + "." + NAMES[kind] + ".folded");
+        prof.writeFolded(folded, prog, NAMES[kind]);
+    }
+    return 0;
+}
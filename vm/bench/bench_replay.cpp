@@ -0,0 +1,376 @@
+// bench_replay.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 -pthread bench_replay.cpp ../lesson1/lesson1/stack_vm.cpp -o bench_replay
+// Usage: ./bench_replay [instructions=1000000] [reps=7]
+//
+// Record/replay of guest runs (common/replay.h), in two parts:
+//
+//   checks    guests whose output depends on when a host-time timer fires
+//             (the handler prints), on device reads of host time (lesson3)
+//             and on patches applied between time slices (MiniTCGVM) are
+//             recorded in slices of random length, then replayed in one
+//             run on a fresh VM with no controller, timer or patches (and
+//             on lesson1/lesson3 in the other loop, fast or checked). The
+//             guest output must match byte for byte and the whole log be
+//             consumed; a changed program must report divergence at its
+//             first device read (lesson3) or leave the log unfinished
+//   overhead  ns per instruction on the benchmark corpus with an
+//             instruction timer every 10k insns and a one-instruction
+//             handler, without a log and recording, and the log size per
+//             million instructions; lesson3 adds a workload that reads a
+//             device every 16 instructions
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../lesson1/lesson1/stack_vm.h"
+
+#define StackVM Lesson3StackVM
+#define Instr Lesson3Instr
+#define Prim Lesson3Prim
+#include "../lesson3/lesson3/stack_vm.h"
+#undef Prim
+#undef Instr
+#undef StackVM
+
+#include "../common/mmio_devices.h"
+#include "../mini_TCG/mini_TCG/mini_tcg.h"
+#include "workloads.h"
+
+using Clock = std::chrono::steady_clock;
+
+namespace op {
+constexpr std::int32_t LOAD = 0x40000007;
+constexpr std::int32_t STORE = 0x40000008;
+constexpr std::int32_t VEC = 0x40000009;
+constexpr std::int32_t IRET = 0x4000000A;
+} // namespace op
+
+// lesson3's device window: host time to read, a console to print to
+constexpr std::int32_t DEV_TIMER = 0x1000'0000;
+constexpr std::int32_t DEV_CONSOLE = 0x1000'0010;
+constexpr std::int32_t NOW = DEV_TIMER + TimerDevice::NOW_LO;
+constexpr std::int32_t PRINT_INT = DEV_CONSOLE + ConsoleDevice::INT;
+
+// push H; vec; body; H: handler
+static std::vector<std::int32_t> with_handler(const std::vector<std::int32_t>& body,
+                                              const std::vector<std::int32_t>& handler) {
+    std::vector<std::int32_t> p{ 0, op::VEC };
+    p.insert(p.end(), body.begin(), body.end());
+    p[0] = static_cast<std::int32_t>(p.size());
+    p.insert(p.end(), handler.begin(), handler.end());
+    return p;
+}
+
+// push 0; (print; push 1; add)*k; halt -- the handler prints its line
+static std::vector<std::int32_t> printing_guest(std::size_t n) {
+    return with_handler(print_heavy(n).prog, { ops::PRINT, op::IRET });
+}
+
+// push 0; ((push 1; add)*8; push NOW; load; push PRINT_INT; store)*k; halt
+// -- the handler prints host time too
+static std::vector<std::int32_t> device_guest(std::size_t n) {
+    std::vector<std::int32_t> body{ 0 };
+    while (body.size() + 21 <= n) {
+        for (int i = 0; i < 8; ++i) body.insert(body.end(), { 1, ops::ADD });
+        body.insert(body.end(), { NOW, op::LOAD, PRINT_INT, op::STORE });
+    }
+    body.push_back(ops::HALT);
+    return with_handler(body, { NOW, op::LOAD, PRINT_INT, op::STORE, op::IRET });
+}
+
+// Guest output goes to a memfd, to compare the runs.
+struct Capture {
+    int fd = ::memfd_create("guest-output", MFD_CLOEXEC);
+    ~Capture() { ::close(fd); }
+    VirtualConsole::Options options() const {
+        VirtualConsole::Options o;
+        o.fd = fd;
+        return o;
+    }
+    std::string text() const {
+        std::string s(static_cast<std::size_t>(::lseek(fd, 0, SEEK_END)), '\0');
+        if (::pread(fd, s.data(), s.size(), 0) != static_cast<ssize_t>(s.size())) throw std::runtime_error("pread");
+        return s;
+    }
+};
+
+static void expect(bool ok, const std::string& what) {
+    if (!ok) throw std::runtime_error(what);
+}
+
+// Record `vm` in slices of 1..4000 instructions under a 20us host timer;
+// between slices, `between` may patch. Returns the log.
+template <class VM, class Between>
+static ReplayLog record(VM& vm, std::mt19937& rng, Between&& between) {
+    InterruptController irq;
+    VirtualTimer timer(irq, 3, VirtualTimer::Mode::HostTime, 20);
+    ReplayLog log;
+    vm.attachInterrupts(&irq, &timer);
+    vm.attachReplay(&log);
+    std::uniform_int_distribution<int> slice(1, 4000);
+    while (vm.runSlice(static_cast<std::uint64_t>(slice(rng)))) between();
+    vm.attachReplay(nullptr);
+    vm.attachInterrupts(nullptr);
+    return log;
+}
+
+template <class Run>
+static std::string diverged(Run&& run) {
+    try {
+        run();
+    }
+    catch (const std::runtime_error& e) {
+        return e.what();
+    }
+    return {};
+}
+
+static std::size_t check_lesson1(std::mt19937& rng) {
+    const std::vector<std::int32_t> prog = printing_guest(200'000);
+    Capture live;
+    StackVM vm(1024, live.options());
+    vm.loadProgram(prog);
+    // On one CPU the timer thread may otherwise not run in so short a run
+    const ReplayLog log = record(vm, rng, [] { std::this_thread::yield(); });
+    vm.console().flush();
+    for (bool checked : { false, true }) {
+        ReplayLog replay(log.bytes());
+        Capture again;
+        StackVM vm2(1024, again.options());
+        vm2.attachReplay(&replay);
+        vm2.loadProgram(prog);
+        if (checked) vm2.runChecked(false);
+        else vm2.run(false);
+        vm2.console().flush();
+        expect(again.text() == live.text(), std::string("lesson1 ") + (checked ? "checked" : "fast") + " replay output differs");
+        expect(replay.finished(), "lesson1 replay left events unused");
+    }
+    expect(log.events() > 0, "lesson1: no interrupts recorded");
+
+    // interrupts are replayed by count alone, so a changed program takes
+    // them as well; one that halts early leaves the rest of the log unused
+    ReplayLog replay(log.bytes());
+    Capture shorter;
+    StackVM vm3(1024, shorter.options());
+    vm3.attachReplay(&replay);
+    vm3.loadProgram(printing_guest(100'000));
+    vm3.run(false);
+    expect(!replay.finished(), "lesson1: shorter program used the whole log");
+    return log.events();
+}
+
+static std::size_t check_lesson3(std::mt19937& rng) {
+    const std::vector<std::int32_t> guest = device_guest(200'000);
+    const std::vector<std::uint32_t> prog(guest.begin(), guest.end());
+    auto make = [&](VirtualConsole& con, MmioBus& bus, TimerDevice& time, ConsoleDevice& dev) {
+        bus.map(static_cast<std::uint32_t>(DEV_TIMER), TimerDevice::WORDS, time);
+        bus.map(static_cast<std::uint32_t>(DEV_CONSOLE), ConsoleDevice::WORDS, dev);
+        auto vm = std::make_unique<Lesson3StackVM>(prog.size() + 200);
+        vm->attachBus(&bus);
+        (void)con;
+        return vm;
+    };
+    Capture live;
+    VirtualConsole con(live.options());
+    MmioBus bus;
+    TimerDevice time;
+    ConsoleDevice dev(con);
+    auto vm = make(con, bus, time, dev);
+    vm->loadProgram(prog);
+    const ReplayLog log = record(*vm, rng, [] {});
+    con.flush();
+    for (bool checked : { false, true }) {
+        ReplayLog replay(log.bytes());
+        Capture again;
+        VirtualConsole con2(again.options());
+        MmioBus bus2;
+        TimerDevice time2;
+        ConsoleDevice dev2(con2);
+        auto vm2 = make(con2, bus2, time2, dev2);
+        vm2->attachReplay(&replay);
+        vm2->loadProgram(prog);
+        if (checked) vm2->runChecked(false);
+        else vm2->run(false);
+        con2.flush();
+        expect(again.text() == live.text(), std::string("lesson3 ") + (checked ? "checked" : "fast") + " replay output differs");
+        expect(replay.finished(), "lesson3 replay left events unused");
+        expect(vm2->busStats().reads == 0, "lesson3 replay read a device");
+    }
+
+    std::vector<std::uint32_t> changed = prog;
+    changed.insert(changed.begin() + 3, { 0u, static_cast<std::uint32_t>(ops::ADD) });
+    changed[0] += 2;
+    ReplayLog replay(log.bytes());
+    MmioBus bus3;
+    TimerDevice time3;
+    VirtualConsole con3(Capture().options());
+    ConsoleDevice dev3(con3);
+    auto vm3 = make(con3, bus3, time3, dev3);
+    vm3->attachReplay(&replay);
+    vm3->loadProgram(changed);
+    expect(diverged([&] { vm3->run(false); }).find("replay diverged") == 0, "lesson3: changed program replayed");
+    return log.events();
+}
+
+static std::size_t check_minitcg(std::mt19937& rng, MiniTCGVM::Backend backend) {
+    const std::vector<std::int32_t> prog = printing_guest(200'000);
+    Capture live;
+    MiniTCGVM vm(8, live.options());
+    vm.setBackend(backend, 1u << 20);
+    vm.loadProgram(prog);
+    // between slices, sometimes turn a `push 1` of the body into `push 2` or back
+    std::uniform_int_distribution<std::size_t> at(1, (prog.size() - 5) / 3 - 1);
+    std::size_t patches = 0;
+    const ReplayLog log = record(vm, rng, [&] {
+        if (rng() % 8) return;
+        const std::size_t index = 2 + 3 * at(rng) + 2; // a push in the body
+        vm.patch(index, prog[index] == 1 && rng() % 2 ? 2 : 1);
+        ++patches;
+    });
+    vm.console().flush();
+    expect(patches > 0, "minitcg: no patches recorded");
+
+    ReplayLog replay(log.bytes());
+    Capture again;
+    MiniTCGVM vm2(8, again.options());
+    vm2.setBackend(backend, 1u << 20);
+    vm2.attachReplay(&replay);
+    vm2.loadProgram(prog);
+    vm2.run(false);
+    vm2.console().flush();
+    expect(again.text() == live.text(), "minitcg replay output differs");
+    expect(replay.finished(), "minitcg replay left events unused");
+    bool refused = false;
+    try {
+        vm2.patch(3, 1);
+    }
+    catch (const std::logic_error&) {
+        refused = true;
+    }
+    expect(refused, "minitcg: host patch accepted while replaying");
+    return log.events();
+}
+
+// ---- overhead ----
+
+struct Row {
+    double off = 0, rec = 0;
+    std::size_t bytes = 0, events = 0;
+};
+
+// One engine, one program, an instruction timer every 10k: the median of
+// `reps` runs without a log and recording, interleaved so drift hits both.
+// make() builds and loads the VM; only run() is timed.
+template <class Make, class Run>
+static Row measure(std::size_t insns, int reps, Make&& make, Run&& run) {
+    std::vector<double> t[2];
+    Row row;
+    for (int r = 0; r < reps; ++r) {
+        for (bool recording : { false, true }) {
+            InterruptController irq;
+            VirtualTimer timer(irq, 0, VirtualTimer::Mode::Instructions, 10'000);
+            ReplayLog log;
+            auto vm = make();
+            vm->attachInterrupts(&irq, &timer);
+            if (recording) vm->attachReplay(&log);
+            const auto t0 = Clock::now();
+            run(*vm);
+            t[recording].push_back(std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / double(insns));
+            row.bytes = log.bytes().size();
+            row.events = log.events();
+        }
+    }
+    for (auto& v : t) std::sort(v.begin(), v.end());
+    row.off = t[0][reps / 2];
+    row.rec = t[1][reps / 2];
+    return row;
+}
+
+static void print_row(const char* engine, const char* workload, std::size_t insns, const Row& r) {
+    std::cerr << std::left << std::setw(20) << engine << std::setw(15) << workload << std::right << std::fixed
+              << std::setprecision(2) << std::setw(8) << r.off << std::setw(8) << r.rec << std::setw(8)
+              << std::setprecision(1) << (r.rec / r.off - 1) * 100 << "%" << std::setw(9) << r.events
+              << std::setw(11) << std::setprecision(0) << double(r.bytes) * 1e6 / double(insns) << "\n";
+}
+
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::stoull(argv[1]) : 1'000'000ull;
+    const int reps = argc > 2 ? std::stoi(argv[2]) : 7;
+    try {
+        std::mt19937 rng(12345);
+        const std::size_t e1 = check_lesson1(rng);
+        const std::size_t e3 = check_lesson3(rng);
+        const std::size_t ec = check_minitcg(rng, MiniTCGVM::Backend::Closures);
+        const std::size_t ej = check_minitcg(rng, MiniTCGVM::Backend::CopyPatch);
+        std::cerr << "checks: replays match the recordings (events: lesson1 " << e1 << ", lesson3 " << e3
+                  << ", minitcg closures " << ec << ", copy-patch " << ej << "), changed programs diverge\n\n";
+
+        const int devnull = ::open("/dev/null", O_WRONLY);
+        VirtualConsole::Options quiet;
+        quiet.fd = devnull;
+
+        std::cerr << "icount timer every 10k insns, " << n << " insns, median of " << reps << "\n"
+                  << "engine              workload        ns/insn  record overhead  events  bytes/Minsn\n";
+        std::vector<Workload> ws = corpus(n);
+        for (const Workload& w : ws) {
+            const std::vector<std::int32_t> prog = with_handler(w.prog, { op::IRET });
+            const std::vector<std::uint32_t> words(prog.begin(), prog.end());
+            print_row("lesson1", w.name, prog.size(), measure(prog.size(), reps, [&] {
+                auto vm = std::make_unique<StackVM>(1024, quiet);
+                vm->loadProgram(prog);
+                return vm;
+            }, [](StackVM& vm) { vm.run(false); }));
+            if (w.name != std::string("print-heavy")) {
+                print_row("lesson3", w.name, prog.size(), measure(prog.size(), reps, [&] {
+                    auto vm = std::make_unique<Lesson3StackVM>(words.size() + 200);
+                    vm->loadProgram(words);
+                    return vm;
+                }, [](Lesson3StackVM& vm) { vm.run(false); }));
+            }
+            for (MiniTCGVM::Backend b : { MiniTCGVM::Backend::Closures, MiniTCGVM::Backend::CopyPatch }) {
+                print_row(b == MiniTCGVM::Backend::Closures ? "minitcg closures" : "minitcg copy-patch", w.name, prog.size(),
+                    measure(prog.size(), reps, [&] {
+                        auto vm = std::make_unique<MiniTCGVM>(8, quiet);
+                        vm->setBackend(b, 4u << 20);
+                        vm->loadProgram(prog);
+                        return vm;
+                    }, [](MiniTCGVM& vm) { vm.run(false); }));
+            }
+        }
+
+        // a device read every 16 instructions
+        std::vector<std::int32_t> body{ 0 };
+        while (body.size() + 17 <= n) {
+            for (int i = 0; i < 6; ++i) body.insert(body.end(), { 1, ops::ADD });
+            body.insert(body.end(), { NOW, op::LOAD, ops::ADD, 0, ops::ADD });
+        }
+        body.push_back(ops::HALT);
+        const std::vector<std::int32_t> dprog = with_handler(body, { op::IRET });
+        const std::vector<std::uint32_t> dwords(dprog.begin(), dprog.end());
+        MmioBus bus;
+        TimerDevice time;
+        bus.map(static_cast<std::uint32_t>(DEV_TIMER), TimerDevice::WORDS, time);
+        print_row("lesson3", "device-read", dprog.size(), measure(dprog.size(), reps, [&] {
+            auto vm = std::make_unique<Lesson3StackVM>(dwords.size() + 200);
+            vm->attachBus(&bus);
+            vm->loadProgram(dwords);
+            return vm;
+        }, [](Lesson3StackVM& vm) { vm.run(false); }));
+    }
+    catch (const std::exception& ex) {
+        std::cerr << "error: " << ex.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,182 @@
+// bench_scheduler.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 -pthread bench_scheduler.cpp ../lesson1/lesson1/stack_vm.cpp -o bench_scheduler
+// Usage: ./bench_scheduler [vms=4000] [max_workers=8] [slice=20000]
+//
+// Many short-lived guests on a VmScheduler (scheduler.h): each job builds
+// its VM on its first slice, runs an add-chain of 1k..64k instructions
+// (fixed-seed random lengths) in time slices of `slice` instructions, and
+// destroys the VM when it halts. All jobs are submitted at once.
+//
+// For lesson1, lesson3 (fast loop) and MiniTCGVM, with 1, 2, 4 .. max
+// workers, reports aggregate guest Minsn/s over the whole batch and the
+// per-VM completion latency (submit -> halt) percentiles. "serial" is the
+// same batch run to completion one after another on the calling thread,
+// without the scheduler.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../lesson1/lesson1/stack_vm.h"
+
+#define StackVM Lesson3StackVM
+#define Instr Lesson3Instr
+#define Prim Lesson3Prim
+#include "../lesson3/lesson3/stack_vm.h"
+#undef Prim
+#undef Instr
+#undef StackVM
+
+#include "../common/scheduler.h"
+#include "../mini_TCG/mini_TCG/mini_tcg.h"
+#include "workloads.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Guest {
+    std::vector<std::int32_t> prog;
+    std::vector<std::uint32_t> words; // lesson3 copy
+};
+
+// One VM per job; built lazily so only running jobs hold guest memory.
+struct Lesson1Kind {
+    static constexpr const char* NAME = "lesson1";
+    using VM = StackVM;
+    static std::unique_ptr<VM> make(const Guest& g) {
+        auto vm = std::make_unique<VM>();
+        vm->loadProgram(g.prog);
+        return vm;
+    }
+};
+
+struct Lesson3Kind {
+    static constexpr const char* NAME = "lesson3";
+    using VM = Lesson3StackVM;
+    static std::unique_ptr<VM> make(const Guest& g) {
+        auto vm = std::make_unique<VM>(g.words.size() + 200);
+        vm->loadProgram(g.words);
+        return vm;
+    }
+};
+
+struct MiniTcgKind {
+    static constexpr const char* NAME = "minitcg";
+    using VM = MiniTCGVM;
+    static std::unique_ptr<VM> make(const Guest& g) {
+        auto vm = std::make_unique<VM>(8);
+        vm->loadProgram(g.prog);
+        return vm;
+    }
+};
+
+struct Result {
+    double seconds = 0;
+    std::vector<double> latency_ms;
+    VmScheduler::Stats stats;
+};
+
+template <class Kind>
+static Result run_serial(const std::vector<const Guest*>& batch) {
+    Result r;
+    const auto t0 = Clock::now();
+    for (const Guest* g : batch) {
+        auto vm = Kind::make(*g);
+        vm->run(false);
+        r.latency_ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - t0).count());
+    }
+    r.seconds = std::chrono::duration<double>(Clock::now() - t0).count();
+    return r;
+}
+
+template <class Kind>
+static Result run_scheduled(const std::vector<const Guest*>& batch, unsigned workers, std::uint64_t slice) {
+    struct Job {
+        const Guest* guest;
+        std::unique_ptr<typename Kind::VM> vm;
+    };
+    Result r;
+    r.latency_ms.resize(batch.size());
+    VmScheduler::Options opt;
+    opt.workers = workers;
+    opt.slice_insns = slice;
+    VmScheduler sched(opt);
+
+    const auto t0 = Clock::now();
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        auto job = std::make_shared<Job>(Job{ batch[i], nullptr });
+        sched.submit(
+            [job](std::uint64_t budget) {
+                if (!job->vm) job->vm = Kind::make(*job->guest);
+                if (job->vm->runSlice(budget)) return true;
+                job->vm.reset();
+                return false;
+            },
+            [&r, i, t0](std::exception_ptr error) {
+                if (error) std::rethrow_exception(error); // a benchmark bug: terminate
+                r.latency_ms[i] = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+            });
+    }
+    sched.wait();
+    r.seconds = std::chrono::duration<double>(Clock::now() - t0).count();
+    r.stats = sched.stats();
+    return r;
+}
+
+static double percentile(std::vector<double> v, double p) {
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, static_cast<std::size_t>(p * double(v.size())))];
+}
+
+static void report(const std::string& label, const Result& r, double insns) {
+    std::cerr << std::left << std::setw(10) << label << std::right << std::fixed << std::setprecision(1)
+              << std::setw(9) << insns / r.seconds / 1e6 << std::setprecision(2) << std::setw(9)
+              << percentile(r.latency_ms, 0.50) << std::setw(9) << percentile(r.latency_ms, 0.99)
+              << std::setw(9) << percentile(r.latency_ms, 1.0) << std::setw(9) << r.stats.slices << std::setw(8)
+              << r.stats.steals << std::setw(8) << r.stats.parks << "\n";
+}
+
+template <class Kind>
+static void run_engine(const std::vector<const Guest*>& batch, double insns, unsigned max_workers,
+                       std::uint64_t slice) {
+    std::cerr << "\n" << Kind::NAME << "\n";
+    std::cerr << "workers    Minsn/s   p50 ms   p99 ms   max ms   slices  steals   parks\n";
+    report("serial", run_serial<Kind>(batch), insns);
+    for (unsigned w = 1; w <= max_workers; w *= 2) {
+        report(std::to_string(w), run_scheduled<Kind>(batch, w, slice), insns);
+    }
+}
+
+int main(int argc, char** argv) {
+    const std::size_t vms = argc > 1 ? std::stoull(argv[1]) : 4000;
+    const unsigned max_workers = argc > 2 ? static_cast<unsigned>(std::stoul(argv[2])) : 8u;
+    const std::uint64_t slice = argc > 3 ? std::stoull(argv[3]) : 20'000ull;
+
+    // 16 program lengths, 1k..64k instructions, shared by the jobs
+    std::mt19937 rng(42);
+    std::vector<Guest> guests;
+    for (std::size_t len = 1024; len <= 65536; len += 4032) {
+        Guest g;
+        g.prog = add_chain(len).prog;
+        g.words.assign(g.prog.begin(), g.prog.end());
+        guests.push_back(std::move(g));
+    }
+    std::vector<const Guest*> batch;
+    double insns = 0;
+    std::uniform_int_distribution<std::size_t> pick(0, guests.size() - 1);
+    for (std::size_t i = 0; i < vms; ++i) {
+        batch.push_back(&guests[pick(rng)]);
+        insns += double(batch.back()->prog.size());
+    }
+
+    std::cerr << vms << " VMs, " << insns / 1e6 << "M guest insns, slice " << slice << " insns, "
+              << std::thread::hardware_concurrency() << " hardware threads\n";
+    run_engine<Lesson1Kind>(batch, insns, max_workers, slice);
+    run_engine<Lesson3Kind>(batch, insns, max_workers, slice);
+    run_engine<MiniTcgKind>(batch, insns, max_workers, slice);
+    return 0;
+}
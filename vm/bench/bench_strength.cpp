@@ -0,0 +1,289 @@
+// bench_strength.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 -pthread bench_strength.cpp ../lesson1/lesson1/stack_vm.cpp -o bench_strength
+// Usage: ./bench_strength [instructions=2000000] [reps=7] [exhaustive=1]
+//
+// Strength reduction of `push c; mul` and `push c; div` in MiniTCGVM's
+// translator (common/strength_reduce.h), in three parts:
+//
+//   plans     MulPlan/DivPlan against the plain operators for every divisor
+//             in [-5000, 5000], every +-2^k, +-2^k+-1, the immediate limits
+//             and random ones, over edge and random dividends; then every
+//             one of the 2^32 dividends for the first `exhaustive` divisors
+//             of a fixed list (about 40 s each here; all 8 pass)
+//   programs  random programs of constant and plain mul/div (traps, INT_MIN
+//             and INT_MAX operands included) on lesson1's interpreter and
+//             on MiniTCGVM with the reduction off, then on both backends
+//             with it on, at several block sizes; output and errors must
+//             match byte for byte
+//   timing    push 7; (push c; mul; push c; div)* per constant, hot TB
+//             cache at tb 64, Minsn/s with the reduction off and on
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "../common/strength_reduce.h"
+#include "../lesson1/lesson1/stack_vm.h"
+#include "../mini_TCG/mini_TCG/mini_tcg.h"
+#include "workloads.h"
+
+using Clock = std::chrono::steady_clock;
+using Backend = MiniTCGVM::Backend;
+using i32 = std::int32_t;
+using u32 = std::uint32_t;
+
+namespace op {
+constexpr i32 FLUSH = 0x40000006;
+constexpr i32 IMM_MAX = 0x3FFFFFFF;
+} // namespace op
+
+constexpr i32 I32_MIN = std::numeric_limits<i32>::min();
+constexpr i32 I32_MAX = std::numeric_limits<i32>::max();
+
+static i32 imm(i32 v) { return v >= 0 ? MiniTCGVM::enc_pos_imm(v) : MiniTCGVM::enc_neg_imm(v); }
+
+static std::string fail(const char* what, i32 c, i32 x, i32 got, i32 want) {
+    return std::string(what) + " by " + std::to_string(c) + " of " + std::to_string(x) + ": " + std::to_string(got) +
+           ", expected " + std::to_string(want);
+}
+
+static void check_one(const MulPlan& m, const DivPlan& d, i32 x) {
+    const i32 c = m.c;
+    const i32 prod = static_cast<i32>(static_cast<u32>(x) * static_cast<u32>(c));
+    if (m.apply(x) != prod) throw std::runtime_error(fail("mul", c, x, m.apply(x), prod));
+    const bool traps = c == 0 || (c == -1 && x == I32_MIN);
+    if (d.traps(x) != traps) throw std::runtime_error("div by " + std::to_string(c) + ": wrong trap for " + std::to_string(x));
+    if (!traps && d.apply(x) != x / c) throw std::runtime_error(fail("div", c, x, d.apply(x), x / c));
+}
+
+static std::size_t check_plans(int exhaustive) {
+    std::mt19937 rng(46);
+    std::vector<i32> cs;
+    for (i32 c = -5000; c <= 5000; ++c) cs.push_back(c);
+    for (int k = 0; k < 31; ++k) {
+        const i32 p = i32(1) << k;
+        for (i32 c : { p, p - 1, p + 1 }) cs.insert(cs.end(), { c, -c });
+    }
+    cs.insert(cs.end(), { op::IMM_MAX, -op::IMM_MAX, I32_MAX, I32_MIN, I32_MIN + 1 });
+    for (int i = 0; i < 2000; ++i) cs.push_back(static_cast<i32>(rng()));
+
+    std::size_t checked = 0;
+    for (i32 c : cs) {
+        const MulPlan m = MulPlan::make(c);
+        const DivPlan d = DivPlan::make(c);
+        std::vector<i32> xs{ I32_MIN, I32_MIN + 1, -1, 0, 1, I32_MAX - 1, I32_MAX, c, -c };
+        if (c != 0) { // the quotient's steps next to the ends of the range
+            for (i32 end : { I32_MIN, I32_MAX }) {
+                const std::int64_t q = std::int64_t(end) / c * c;
+                for (std::int64_t x = q - 2; x <= q + 2; ++x) {
+                    if (x >= I32_MIN && x <= I32_MAX) xs.push_back(static_cast<i32>(x));
+                }
+            }
+        }
+        for (int i = 0; i < 64; ++i) xs.push_back(static_cast<i32>(rng()));
+        for (i32 x : xs) check_one(m, d, x);
+        checked += xs.size();
+    }
+
+    // magic with and without the add-back, both signs, power of two, the limits
+    static constexpr i32 FULL[] = { 7, 3, -641, op::IMM_MAX, 1 << 20, -10, 1000, -op::IMM_MAX };
+    for (int i = 0; i < exhaustive && i < int(std::size(FULL)); ++i) {
+        const auto t0 = Clock::now();
+        const MulPlan m = MulPlan::make(FULL[i]);
+        const DivPlan d = DivPlan::make(FULL[i]);
+        u32 u = 0;
+        do check_one(m, d, static_cast<i32>(u)); while (++u != 0);
+        checked += std::size_t(1) << 32;
+        std::cerr << "  all dividends by " << FULL[i] << ": "
+                  << std::chrono::duration<double>(Clock::now() - t0).count() << " s\n";
+    }
+    return checked;
+}
+
+// Console text plus the error, if any, of one run.
+template <class Run>
+static std::string capture(Run&& run) {
+    std::FILE* f = std::tmpfile();
+    if (!f) throw std::runtime_error("tmpfile failed");
+    std::string err;
+    VirtualConsole::Options con;
+    con.fd = ::fileno(f);
+    try {
+        run(con);
+    }
+    catch (const std::exception& ex) {
+        err = std::string("error: ") + ex.what() + "\n";
+    }
+    std::string text;
+    std::rewind(f);
+    char buf[4096];
+    for (std::size_t n; (n = std::fread(buf, 1, sizeof(buf), f)) > 0;) text.append(buf, n);
+    std::fclose(f);
+    return text + err;
+}
+
+static std::string run_lesson1(const std::vector<i32>& prog) {
+    std::string out = capture([&](const VirtualConsole::Options& con) {
+        StackVM vm(1024, con);
+        vm.loadProgram(prog);
+        vm.run(false);
+    });
+    // lesson1 labels its prints differently
+    const std::string from = "[prim] print: ", to = "[print] ";
+    for (std::size_t at = 0; (at = out.find(from, at)) != std::string::npos; at += to.size()) out.replace(at, from.size(), to);
+    return out;
+}
+
+static std::string run_minitcg(const std::vector<i32>& prog, Backend backend, std::size_t tb, bool reduce) {
+    return capture([&](const VirtualConsole::Options& con) {
+        MiniTCGVM vm(tb, con);
+        vm.setBackend(backend);
+        vm.setStrengthReduction(reduce);
+        vm.loadProgram(prog);
+        vm.run(false);
+    });
+}
+
+// Pushes one value: an immediate, or INT_MIN / INT_MAX built from two.
+static void operand(std::mt19937& rng, std::vector<i32>& p) {
+    std::uniform_int_distribution<int> pick(0, 9);
+    std::uniform_int_distribution<i32> small(-20, 20), big(-op::IMM_MAX, op::IMM_MAX);
+    switch (pick(rng)) {
+    case 0: p.insert(p.end(), { imm(op::IMM_MAX), imm(2), ops::MUL, imm(1), ops::ADD }); break;   // INT_MAX
+    case 1: p.insert(p.end(), { imm(-op::IMM_MAX), imm(2), ops::MUL, imm(2), ops::SUB }); break;  // INT_MIN
+    case 2: case 3: case 4: p.push_back(imm(big(rng))); break;
+    default: p.push_back(imm(small(rng))); break;
+    }
+}
+
+static i32 constant(std::mt19937& rng) {
+    static constexpr i32 SPECIAL[] = { 0, 1, -1, 2, -2, 3, -3, 5, 6, 7, -7, 9, 10, 24, -31, 641, 1 << 29, -(1 << 29),
+                                       op::IMM_MAX, -op::IMM_MAX };
+    std::uniform_int_distribution<int> pick(0, int(std::size(SPECIAL)) + 3);
+    const int k = pick(rng);
+    if (k < int(std::size(SPECIAL))) return SPECIAL[k];
+    return std::uniform_int_distribution<i32>(-op::IMM_MAX, op::IMM_MAX)(rng);
+}
+
+static std::vector<i32> random_program(std::mt19937& rng) {
+    std::uniform_int_distribution<int> len(1, 40), pick(0, 9);
+    std::vector<i32> p;
+    const int n = len(rng);
+    operand(rng, p);
+    int depth = 1;
+    for (int i = 0; i < n; ++i) {
+        const int k = pick(rng);
+        if (k < 5) { // push c; mul|div -- what the translator fuses
+            p.insert(p.end(), { imm(constant(rng)), k < 2 ? ops::MUL : ops::DIV });
+        }
+        else if (k < 7 || depth < 2) {
+            operand(rng, p);
+            ++depth;
+        }
+        else if (k < 9) {
+            p.push_back(k == 7 ? ops::MUL : ops::DIV);
+            --depth;
+        }
+        else {
+            p.push_back(rng() % 2 ? ops::PRINT : op::FLUSH);
+        }
+    }
+    p.push_back(ops::PRINT);
+    p.push_back(ops::HALT);
+    return p;
+}
+
+static std::size_t check_programs() {
+    std::mt19937 rng(47);
+    std::vector<std::vector<i32>> progs;
+    for (int i = 0; i < 1500; ++i) progs.push_back(random_program(rng));
+    std::size_t checked = 0;
+    for (const auto& p : progs) {
+        const std::string want = run_minitcg(p, Backend::Closures, 64, false);
+        const std::string ref = run_lesson1(p);
+        if (ref != want) throw std::runtime_error("MiniTCGVM differs from lesson1:\n" + ref + "--\n" + want);
+        for (Backend backend : { Backend::Closures, Backend::CopyPatch }) {
+            for (std::size_t tb : { 2, 5, 64 }) {
+                const std::string got = run_minitcg(p, backend, tb, true);
+                if (got != want) {
+                    throw std::runtime_error(std::string(backend == Backend::Closures ? "closures" : "copy-patch") +
+                                             " (tb " + std::to_string(tb) + ") differs when reduced:\n" + want + "--\n" + got);
+                }
+            }
+        }
+        ++checked;
+    }
+
+    // fused ops on a short stack fault like the pair they replace
+    const std::vector<std::vector<i32>> underflow{ { imm(3), ops::MUL, ops::HALT }, { imm(7), ops::DIV, ops::HALT },
+                                                   { imm(-1), ops::DIV, ops::HALT }, { imm(1), ops::DIV, ops::HALT },
+                                                   { imm(0), ops::DIV, ops::HALT } };
+    for (const auto& p : underflow) {
+        const std::string want = run_minitcg(p, Backend::Closures, 64, false);
+        for (Backend backend : { Backend::Closures, Backend::CopyPatch }) {
+            if (run_minitcg(p, backend, 64, true) != want) throw std::runtime_error("underflow differs when reduced");
+        }
+        ++checked;
+    }
+    return checked;
+}
+
+static double mips(const std::vector<i32>& prog, Backend backend, bool reduce, int reps) {
+    MiniTCGVM vm(64);
+    vm.setBackend(backend);
+    vm.setStrengthReduction(reduce);
+    vm.loadProgram(prog);
+    vm.run(false); // fill the TB cache
+    std::vector<double> t;
+    for (int r = 0; r < reps; ++r) {
+        const auto t0 = Clock::now();
+        vm.run(false);
+        t.push_back(std::chrono::duration<double>(Clock::now() - t0).count());
+    }
+    std::sort(t.begin(), t.end());
+    return double(prog.size()) / t[t.size() / 2] / 1e6;
+}
+
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::stoull(argv[1]) : 2'000'000ull;
+    const int reps = argc > 2 ? std::stoi(argv[2]) : 7;
+    const int exhaustive = argc > 3 ? std::stoi(argv[3]) : 1;
+    try {
+        const std::size_t plans = check_plans(exhaustive);
+        std::cerr << "plans: " << plans << " products and quotients == the plain operators\n";
+        std::cerr << "programs: " << check_programs()
+                  << " on lesson1 == MiniTCGVM unreduced == reduced (closures, copy-patch; tb 2, 5, 64)\n\n";
+
+        std::cerr << "x*c/c, c  plan (mul / div)            Minsn/s tb 64: closures  reduced      jit  reduced\n"
+                  << std::fixed << std::setprecision(1);
+        for (i32 c : { 3, 8, 10, -7, 641 }) {
+            std::vector<i32> prog{ 7 };
+            while (prog.size() + 5 <= n) prog.insert(prog.end(), { imm(c), ops::MUL, imm(c), ops::DIV });
+            prog.push_back(ops::HALT);
+            static const char* const MUL[] = { "zero", "identity", "neg", "shift", "shift-add", "shift-sub", "imul" };
+            static const char* const DIV[] = { "trap", "identity", "neg-one", "pow2", "magic" };
+            const DivPlan d = DivPlan::make(c);
+            const std::string plan = std::string(MUL[int(MulPlan::make(c).kind)]) + " / " + DIV[int(d.kind)] +
+                                     (d.add ? "+add" : "") + (d.neg ? ", neg" : "");
+            const double a = mips(prog, Backend::Closures, false, reps), b = mips(prog, Backend::Closures, true, reps);
+            const double j = mips(prog, Backend::CopyPatch, false, reps), k = mips(prog, Backend::CopyPatch, true, reps);
+            std::cerr << std::left << std::setw(10) << c << std::setw(28) << plan << std::right << std::setw(20) << a
+                      << std::setw(9) << b << std::setw(9) << j << std::setw(9) << k << "   x" << std::setprecision(2)
+                      << b / a << " x" << k / j << std::setprecision(1) << "\n";
+        }
+    }
+    catch (const std::exception& ex) {
+        std::cerr << "error: " << ex.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,223 @@
+// bench_suite.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 -pthread bench_suite.cpp engine_lesson1.cpp engine_lesson3.cpp engine_lesson6.cpp engine_minitcg.cpp ../lesson1/lesson1/stack_vm.cpp -o bench_suite
+// Usage: ./bench_suite [instructions=2000000] [reps=11] [warmup=2] [json=bench_suite.json]
+//
+// Every engine behind engine.h on the shared corpus of workloads.h, in the
+// checked loop and (where the engine has one) the verified fast path:
+//
+//   cold   a fresh engine per repetition: load, then time the first run
+//          (first-touch page faults, MiniTCGVM translating every block)
+//   hot    one engine, `warmup` untimed runs, then `reps` timed runs, each
+//          after Engine::rewind() (MiniTCGVM keeps its TB cache)
+//
+// load() (copy + verify) is never timed. Reports median / p99 / mean /
+// stddev per timing and guest Minsn/s at the hot median; a workload an
+// engine cannot run (unimplemented primitive, failed verification) is listed
+// as skipped with the reason. The same results go to `json` for tracking
+// across commits. stdout goes to /dev/null so print-heavy pays for real
+// writes without flooding the terminal; the table goes to stderr.
+//
+// No engine has a branch instruction yet, so the corpus is straight-line
+// only; a loop workload belongs here once one does.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <exception>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "engine.h"
+#include "workloads.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Stats {
+    double median_ns = 0;
+    double p99_ns = 0;
+    double mean_ns = 0;
+    double stddev_ns = 0;
+    double min_ns = 0;
+    double max_ns = 0;
+};
+
+// Nearest-rank percentiles; with 11 repetitions p99 is the slowest run.
+static Stats summarize(std::vector<double> ns) {
+    std::sort(ns.begin(), ns.end());
+    auto rank = [&](double p) {
+        const std::size_t k = static_cast<std::size_t>(std::ceil(p * double(ns.size())));
+        return ns[std::clamp<std::size_t>(k, 1, ns.size()) - 1];
+    };
+    Stats s;
+    s.median_ns = rank(0.50);
+    s.p99_ns = rank(0.99);
+    s.mean_ns = std::accumulate(ns.begin(), ns.end(), 0.0) / double(ns.size());
+    double var = 0;
+    for (double x : ns) var += (x - s.mean_ns) * (x - s.mean_ns);
+    s.stddev_ns = ns.size() > 1 ? std::sqrt(var / double(ns.size() - 1)) : 0.0;
+    s.min_ns = ns.front();
+    s.max_ns = ns.back();
+    return s;
+}
+
+struct Result {
+    std::string engine, workload, mode;
+    std::size_t insns = 0;
+    std::string skipped; // empty if it ran
+    Stats cold, hot;
+    double minsn_s() const { return double(insns) / hot.median_ns * 1e3; }
+};
+
+struct EngineKind {
+    const char* name;
+    std::unique_ptr<Engine> (*make)();
+};
+
+static double time_run(Engine& e, Engine::Mode mode) {
+    const auto t0 = Clock::now();
+    e.run(mode);
+    return std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+}
+
+static Result measure(const EngineKind& kind, const Workload& w, Engine::Mode mode, int reps, int warmup) {
+    Result r;
+    r.engine = kind.name;
+    r.workload = w.name;
+    r.mode = mode == Engine::Mode::Verified ? "verified" : "checked";
+    r.insns = w.prog.size();
+    try {
+        std::vector<double> cold, hot;
+        for (int i = 0; i < reps; ++i) {
+            auto e = kind.make();
+            e->load(w.prog);
+            if (mode == Engine::Mode::Verified && !e->verified()) {
+                r.skipped = "failed verification";
+                return r;
+            }
+            cold.push_back(time_run(*e, mode));
+        }
+        auto e = kind.make();
+        e->load(w.prog);
+        for (int i = 0; i < warmup; ++i) {
+            e->run(mode);
+            e->rewind();
+        }
+        for (int i = 0; i < reps; ++i) {
+            hot.push_back(time_run(*e, mode));
+            e->rewind();
+        }
+        r.cold = summarize(std::move(cold));
+        r.hot = summarize(std::move(hot));
+    }
+    catch (const std::exception& ex) {
+        r.skipped = ex.what();
+    }
+    return r;
+}
+
+static void write_stats(std::ostream& os, const Stats& s) {
+    os << "{\"median_ns\": " << s.median_ns << ", \"p99_ns\": " << s.p99_ns << ", \"mean_ns\": " << s.mean_ns
+       << ", \"stddev_ns\": " << s.stddev_ns << ", \"min_ns\": " << s.min_ns << ", \"max_ns\": " << s.max_ns << "}";
+}
+
+static std::string json_escape(const std::string& in) {
+    std::string out;
+    for (char c : in) {
+        if (c == '"' || c == '\\') out += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) continue;
+        out += c;
+    }
+    return out;
+}
+
+static void write_json(const std::string& path, const std::vector<Result>& results, std::size_t n, int reps,
+                       int warmup) {
+    std::ofstream os(path);
+    if (!os) throw std::runtime_error("cannot write " + path);
+    os << std::fixed << std::setprecision(1);
+    os << "{\n  \"schema\": 1,\n  \"timestamp\": " << std::time(nullptr) << ",\n  \"compiler\": \""
+       << json_escape(__VERSION__) << "\",\n  \"hardware_threads\": " << std::thread::hardware_concurrency()
+       << ",\n  \"instructions\": " << n << ",\n  \"reps\": " << reps << ",\n  \"warmup\": " << warmup
+       << ",\n  \"results\": [\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        os << "    {\"engine\": \"" << r.engine << "\", \"workload\": \"" << r.workload << "\", \"mode\": \""
+           << r.mode << "\", \"insns\": " << r.insns;
+        if (!r.skipped.empty()) {
+            os << ", \"skipped\": \"" << json_escape(r.skipped) << "\"}";
+        }
+        else {
+            os << ", \"minsn_s\": " << r.minsn_s() << ",\n     \"cold\": ";
+            write_stats(os, r.cold);
+            os << ",\n     \"hot\": ";
+            write_stats(os, r.hot);
+            os << "}";
+        }
+        os << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    os << "  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::stoull(argv[1]) : 2'000'000ull;
+    const int reps = argc > 2 ? std::stoi(argv[2]) : 11;
+    const int warmup = argc > 3 ? std::stoi(argv[3]) : 2;
+    const std::string json = argc > 4 ? argv[4] : "bench_suite.json";
+    if (reps < 1 || warmup < 0) {
+        std::cerr << "reps must be >= 1 and warmup >= 0\n";
+        return 1;
+    }
+
+    const int fd = ::open("/dev/null", O_WRONLY);
+    if (fd < 0 || ::dup2(fd, 1) < 0) {
+        std::perror("redirect stdout");
+        return 1;
+    }
+    ::close(fd);
+
+    const EngineKind engines[] = {
+        { "lesson1", make_lesson1_engine },
+        { "lesson3", make_lesson3_engine },
+        { "lesson6", make_lesson6_engine },
+        { "minitcg", make_minitcg_engine },
+    };
+
+    std::cerr << n << " insns per workload, " << reps << " reps, " << warmup << " warmup; ms per run\n";
+    std::cerr << "engine   workload       mode      cold p50  hot p50  hot p99  hot sd   Minsn/s  cold/hot\n";
+    std::vector<Result> results;
+    for (const Workload& w : corpus(n)) {
+        for (const EngineKind& k : engines) {
+            for (Engine::Mode mode : { Engine::Mode::Checked, Engine::Mode::Verified }) {
+                if (mode == Engine::Mode::Verified && !k.make()->hasVerifiedMode()) continue;
+                const Result r = measure(k, w, mode, reps, warmup);
+                std::cerr << std::left << std::setw(9) << r.engine << std::setw(15) << r.workload << std::setw(9)
+                          << r.mode << std::right;
+                if (!r.skipped.empty()) {
+                    std::cerr << "  skipped: " << r.skipped << "\n";
+                }
+                else {
+                    std::cerr << std::fixed << std::setprecision(2) << std::setw(9) << r.cold.median_ns / 1e6
+                              << std::setw(9) << r.hot.median_ns / 1e6 << std::setw(9) << r.hot.p99_ns / 1e6
+                              << std::setw(8) << r.hot.stddev_ns / 1e6 << std::setprecision(1) << std::setw(10)
+                              << r.minsn_s() << std::setprecision(2) << std::setw(9)
+                              << r.cold.median_ns / r.hot.median_ns << "x\n";
+                }
+                results.push_back(r);
+            }
+        }
+    }
+
+    write_json(json, results, n, reps, warmup);
+    std::cerr << "\nwrote " << json << "\n";
+    return 0;
+}
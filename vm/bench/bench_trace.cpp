@@ -0,0 +1,88 @@
+// bench_trace.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 -pthread bench_trace.cpp engine_lesson1.cpp engine_lesson3.cpp engine_lesson6.cpp engine_minitcg.cpp ../lesson1/lesson1/stack_vm.cpp -o bench_trace
+// Usage: ./bench_trace [instructions=1000000] [reps=5] [trace.bin]
+//
+// Cost of each tracing policy (common/trace.h) on the checked loops.
+// stdout goes to /dev/null so TraceText measures formatting + write cost,
+// not the terminal. With a third argument, the binary log of the last
+// TraceBinary run is dumped there for tools/trace_decode.
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "engine.h"
+#include "workloads.h"
+
+static double median_mips(Engine& e, const Workload& w, Engine::Mode mode, int reps) {
+    std::vector<double> mips;
+    for (int r = 0; r < reps; ++r) {
+        e.load(w.prog);
+        TraceRing::local().clear();
+        auto t0 = std::chrono::steady_clock::now();
+        e.run(mode);
+        auto t1 = std::chrono::steady_clock::now();
+        mips.push_back(double(w.prog.size()) / std::chrono::duration<double>(t1 - t0).count() / 1e6);
+    }
+    std::sort(mips.begin(), mips.end());
+    return mips[mips.size() / 2];
+}
+
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::stoull(argv[1]) : 1'000'000ull;
+    const int reps = argc > 2 ? std::stoi(argv[2]) : 5;
+    const char* dump = argc > 3 ? argv[3] : nullptr;
+
+    const int devnull = ::open("/dev/null", O_WRONLY);
+    if (devnull < 0 || ::dup2(devnull, 1) < 0) {
+        std::cerr << "cannot redirect stdout\n";
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<Engine>> engines;
+    engines.push_back(make_lesson1_engine());
+    engines.push_back(make_lesson3_engine());
+    engines.push_back(make_lesson6_engine());
+    engines.push_back(make_minitcg_engine());
+
+    const Workload w = add_chain(n);
+    const std::pair<const char*, Engine::Mode> policies[] = {
+        { "off", Engine::Mode::Checked },
+        { "counters", Engine::Mode::TraceCounters },
+        { "binary", Engine::Mode::TraceBinary },
+        { "text", Engine::Mode::TraceText },
+    };
+
+    std::cerr << std::fixed << std::setprecision(1);
+    std::cerr << "workload " << w.name << ", " << w.prog.size() << " insns, Minsn/s (overhead vs off)\n";
+    std::cerr << "engine   " << std::setw(16) << "off" << std::setw(18) << "counters"
+              << std::setw(18) << "binary" << std::setw(18) << "text" << "\n";
+    for (auto& e : engines) {
+        std::cerr << std::left << std::setw(9) << e->name() << std::right;
+        double off = 0;
+        for (const auto& [name, mode] : policies) {
+            const double mips = median_mips(*e, w, mode, reps);
+            if (mode == Engine::Mode::Checked) {
+                off = mips;
+                std::cerr << std::setw(16) << mips;
+            }
+            else {
+                std::cerr << std::setw(9) << mips << " (" << std::setw(5) << (off / mips - 1.0) * 100.0 << "%)";
+            }
+        }
+        std::cerr << "\n";
+    }
+
+    if (dump) {
+        engines[0]->load(w.prog);
+        TraceRing::local().clear();
+        engines[0]->run(Engine::Mode::TraceBinary);
+        TraceRing::local().dump(dump);
+        std::cerr << "binary trace of " << engines[0]->name() << " written to " << dump << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,423 @@
+// bench_traps.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 -pthread bench_traps.cpp ../lesson1/lesson1/stack_vm.cpp -o bench_traps
+// Usage: ./bench_traps [runs=200000] [reps=5]
+//
+// Guest traps without exceptions (common/trap.h), in three parts:
+//
+//   checks    every trap each engine can raise (underflow, division by zero
+//             and INT_MIN / -1, a missing halt, undecodable instructions,
+//             bad vec/iret targets, lesson3's unmapped address) must come
+//             back from tryRun as Trapped with the right code and pc, from
+//             run() as a TrapError, and with a trap handler installed as a
+//             handler entry that sees that pc and code; a trap inside the
+//             handler is a double fault, also when the handler runs in time
+//             slices of a few instructions (lesson1, lesson3: it must stay
+//             on the checked loop across the yields)
+//   code      bytes of the dispatch loops, read from this binary's own
+//             symbol table (the cold fault paths are out of line)
+//   faults    ns per run of a 4-instruction program that traps, against
+//             the same program without the trap: tryRun, run() plus
+//             catching TrapError, and a guest handler that halts
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cxxabi.h>
+#include <elf.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../lesson1/lesson1/stack_vm.h"
+
+#define StackVM Lesson3StackVM
+#define Instr Lesson3Instr
+#define Prim Lesson3Prim
+#include "../lesson3/lesson3/stack_vm.h"
+#undef Prim
+#undef Instr
+#undef StackVM
+
+#define StackVM Lesson6StackVM
+#include "../lesson6/lesson6/stack-vm.h"
+#undef StackVM
+
+#include "../mini_TCG/mini_TCG/mini_tcg.h"
+#include "workloads.h"
+
+using Clock = std::chrono::steady_clock;
+
+namespace op {
+constexpr i32 VEC = 0x40000009;
+constexpr i32 IRET = 0x4000000A;
+constexpr i32 LOAD = 0x40000007;
+constexpr i32 BAD_PRIM = 0x4000000D;
+constexpr i32 BAD_TYPE = static_cast<i32>(0xC0000000u);
+} // namespace op
+
+// One VM behind the calls the checks and timings need.
+class TrapEngine {
+public:
+    virtual ~TrapEngine() = default;
+    virtual const char* name() const = 0;
+    virtual bool lesson3Encoding() const { return false; } // negative immediates in two's complement
+    virtual bool hasVec() const { return true; }
+    virtual bool hasMemory() const { return false; }
+    virtual bool hasHandler() const { return true; }
+    virtual void load(const std::vector<i32>& prog) = 0;
+    virtual void rewind() = 0; // runnable again from the first instruction
+    virtual RunResult tryRun() = 0;
+    virtual void run() = 0;
+    virtual GuestTrap trap() const = 0;
+    virtual void setTrapHandler(std::size_t entry) = 0;
+
+    i32 imm(i32 v) const {
+        if (v >= 0) return v;
+        return lesson3Encoding() ? static_cast<i32>(Lesson3Instr::push(v)) : MiniTCGVM::enc_neg_imm(v);
+    }
+};
+
+// lesson1: tryRun takes the verified fast path when it can; `checked`
+// forces the checked loop (no handler there).
+class Lesson1Engine : public TrapEngine {
+public:
+    explicit Lesson1Engine(bool checked) : checked_(checked) {}
+    const char* name() const override { return checked_ ? "lesson1 checked" : "lesson1"; }
+    bool hasHandler() const override { return !checked_; }
+    void load(const std::vector<i32>& prog) override {
+        prog_ = prog;
+        vm_.loadProgram(prog_);
+    }
+    void rewind() override { vm_.loadProgram(prog_); }
+    RunResult tryRun() override {
+        if (!checked_) return vm_.tryRun(false);
+        vm_.runChecked(false);
+        return vm_.trap().code == TrapCode::None ? RunResult::Halted : RunResult::Trapped;
+    }
+    void run() override { vm_.run(false); }
+    GuestTrap trap() const override { return vm_.trap(); }
+    void setTrapHandler(std::size_t entry) override { vm_.setTrapHandler(entry); }
+
+private:
+    bool checked_;
+    StackVM vm_{ 1024 };
+    std::vector<i32> prog_;
+};
+
+class Lesson3Engine : public TrapEngine {
+public:
+    explicit Lesson3Engine(bool checked) : checked_(checked) {}
+    const char* name() const override { return checked_ ? "lesson3 checked" : "lesson3"; }
+    bool lesson3Encoding() const override { return true; }
+    bool hasMemory() const override { return true; }
+    bool hasHandler() const override { return !checked_; }
+    void load(const std::vector<i32>& prog) override {
+        prog_.assign(prog.begin(), prog.end());
+        vm_.loadProgram(prog_);
+    }
+    void rewind() override { vm_.loadProgram(prog_); }
+    RunResult tryRun() override {
+        if (!checked_) return vm_.tryRun(false);
+        vm_.runChecked(false);
+        return vm_.trap().code == TrapCode::None ? RunResult::Halted : RunResult::Trapped;
+    }
+    void run() override { vm_.run(false); }
+    GuestTrap trap() const override { return vm_.trap(); }
+    void setTrapHandler(std::size_t entry) override { vm_.setTrapHandler(entry); }
+
+private:
+    bool checked_;
+    Lesson3StackVM vm_{ 4096 };
+    std::vector<u32> prog_;
+};
+
+class Lesson6Engine : public TrapEngine {
+public:
+    const char* name() const override { return "lesson6"; }
+    bool hasVec() const override { return false; }
+    void load(const std::vector<i32>& prog) override {
+        prog_ = prog;
+        vm_.loadProgram(prog_);
+    }
+    void rewind() override { vm_.loadProgram(prog_); }
+    RunResult tryRun() override { return vm_.tryRun(false); }
+    void run() override { vm_.run(false); }
+    GuestTrap trap() const override { return vm_.trap(); }
+    void setTrapHandler(std::size_t entry) override { vm_.setTrapHandler(entry); }
+
+private:
+    Lesson6StackVM vm_;
+    std::vector<i32> prog_;
+};
+
+class MiniTcgEngine : public TrapEngine {
+public:
+    explicit MiniTcgEngine(MiniTCGVM::Backend b) : jit_(b == MiniTCGVM::Backend::CopyPatch) {
+        vm_.setBackend(b, 1u << 20);
+    }
+    const char* name() const override { return jit_ ? "minitcg copy-patch" : "minitcg closures"; }
+    void load(const std::vector<i32>& prog) override { vm_.loadProgram(prog); }
+    void rewind() override {} // each run starts at pc 0; keeps its blocks
+    RunResult tryRun() override { return vm_.tryRun(false); }
+    void run() override { vm_.run(false); }
+    GuestTrap trap() const override { return vm_.trap(); }
+    void setTrapHandler(std::size_t entry) override { vm_.setTrapHandler(entry); }
+
+private:
+    bool jit_;
+    MiniTCGVM vm_{ 8 };
+};
+
+static std::vector<std::unique_ptr<TrapEngine>> engines() {
+    std::vector<std::unique_ptr<TrapEngine>> v;
+    v.push_back(std::make_unique<Lesson1Engine>(false));
+    v.push_back(std::make_unique<Lesson1Engine>(true));
+    v.push_back(std::make_unique<Lesson3Engine>(false));
+    v.push_back(std::make_unique<Lesson3Engine>(true));
+    v.push_back(std::make_unique<Lesson6Engine>());
+    v.push_back(std::make_unique<MiniTcgEngine>(MiniTCGVM::Backend::Closures));
+#if TCG_JIT_SUPPORTED
+    v.push_back(std::make_unique<MiniTcgEngine>(MiniTCGVM::Backend::CopyPatch));
+#endif
+    return v;
+}
+
+struct TrapCase {
+    const char* what;
+    std::vector<i32> prog;
+    TrapCode code;
+    std::size_t pc;
+};
+
+// INT_MIN is -2^29 * 4, an immediate both encodings have.
+static std::vector<TrapCase> cases(const TrapEngine& e) {
+    const i32 m29 = e.imm(-(1 << 29));
+    std::vector<TrapCase> v{
+        { "underflow", { 1, ops::ADD, ops::HALT }, TrapCode::StackUnderflow, 1 },
+        { "underflow, empty", { ops::DIV, ops::HALT }, TrapCode::StackUnderflow, 0 },
+        { "div by zero", { 1, 0, ops::DIV, ops::HALT }, TrapCode::DivZero, 2 },
+        { "div by zero, late", { 5, 1, ops::ADD, 2, ops::MUL, 3, 3, ops::SUB, ops::DIV, ops::HALT }, TrapCode::DivZero, 8 },
+        { "INT_MIN / -1", { m29, 4, ops::MUL, 0, 1, ops::SUB, ops::DIV, ops::HALT }, TrapCode::DivOverflow, 6 },
+        { "INT_MIN / push -1", { m29, 4, ops::MUL, e.imm(-1), ops::DIV, ops::HALT }, TrapCode::DivOverflow, 4 },
+        { "type 3", { 1, op::BAD_TYPE, ops::HALT }, TrapCode::BadInstruction, 1 },
+        { "type 3 first", { op::BAD_TYPE, ops::HALT }, TrapCode::BadInstruction, 0 },
+        { "primitive 13", { 1, 2, op::BAD_PRIM, ops::HALT }, TrapCode::BadPrimitive, 2 },
+    };
+    if (e.hasVec()) {
+        v.push_back({ "vec outside", { 1, 99, op::VEC, ops::HALT }, TrapCode::BadVector, 2 });
+        v.push_back({ "iret, no irq", { 1, op::IRET, ops::HALT }, TrapCode::BadIret, 1 });
+    }
+    // lesson3's pc runs on through flat memory, so only the others can miss a halt
+    if (e.hasMemory()) v.push_back({ "load, no bus", { 1 << 29, op::LOAD, ops::HALT }, TrapCode::BadAddress, 1 });
+    else v.push_back({ "missing halt", { 1, 2, ops::ADD }, TrapCode::PcOutOfRange, 3 });
+    return v;
+}
+
+static void expect(bool ok, const TrapEngine& e, const TrapCase& c, const std::string& what) {
+    if (!ok) throw std::runtime_error(std::string(e.name()) + ", " + c.what + ": " + what);
+}
+
+static std::string show(const GuestTrap& t) {
+    return std::string(trapMessage(t.code)) + " at " + std::to_string(t.pc);
+}
+
+// A division by zero with a handler that adds too often, run in slices of
+// `budget` instructions: the handler's second add is a double fault. On the
+// fast loop the unverified handler would read below the stack instead.
+template <class VM, class Word>
+static std::size_t check_sliced_handler(const char* name) {
+    std::vector<Word> prog{ 1, 0, static_cast<Word>(ops::DIV), static_cast<Word>(ops::HALT) };
+    const std::size_t entry = prog.size();
+    prog.insert(prog.end(), 8, static_cast<Word>(ops::ADD));
+    prog.push_back(static_cast<Word>(ops::HALT));
+    std::size_t n = 0;
+    for (std::uint64_t budget : { 1, 2, 3, 7 }) {
+        VM vm(4096);
+        vm.loadProgram(prog);
+        vm.setTrapHandler(entry);
+        GuestTrap t;
+        try {
+            while (vm.runSlice(budget)) {}
+        }
+        catch (const TrapError& err) {
+            t = err.trap;
+        }
+        if (t.code != TrapCode::StackUnderflow || t.pc != entry + 1) {
+            throw std::runtime_error(std::string(name) + ", handler in slices of " + std::to_string(budget) +
+                                     ": " + (t.code == TrapCode::None ? std::string("no double fault") : show(t)));
+        }
+        ++n;
+    }
+    return n;
+}
+
+// tryRun, run() and the handler for every case; returns the runs checked.
+static std::size_t check_traps() {
+    std::size_t n = 0;
+    for (auto& e : engines()) {
+        for (const TrapCase& c : cases(*e)) {
+            e->setTrapHandler(TrapVector::NONE);
+            e->load(c.prog);
+            expect(e->tryRun() == RunResult::Trapped, *e, c, "tryRun did not trap");
+            expect(e->trap().code == c.code && e->trap().pc == c.pc, *e, c, "trapped with " + show(e->trap()));
+
+            e->rewind();
+            try {
+                e->run();
+                expect(false, *e, c, "run() did not throw");
+            }
+            catch (const TrapError& err) {
+                expect(err.trap.code == c.code && std::string(err.what()) == trapMessage(c.code), *e, c,
+                       std::string("run() threw ") + err.what());
+            }
+            n += 2;
+            // (appending a handler would give the missing halt something to run)
+            if (!e->hasHandler() || c.code == TrapCode::PcOutOfRange) continue;
+
+            // handler: ( pc code -- ) vec to (pc + code - expected) * 1000,
+            // a valid target only if both are what tryRun reported
+            std::vector<i32> prog = c.prog;
+            const std::size_t entry = prog.size();
+            const i32 expected = static_cast<i32>(c.pc) + static_cast<i32>(c.code);
+            if (e->hasVec()) prog.insert(prog.end(), { ops::ADD, expected, ops::SUB, 1000, ops::MUL, op::VEC, ops::HALT });
+            else prog.push_back(ops::HALT);
+            e->load(prog);
+            e->setTrapHandler(entry);
+            const RunResult r = e->tryRun();
+            expect(r == RunResult::Halted, *e, c, "handler saw the wrong trap (" + show(e->trap()) + ")");
+
+            // a division by zero inside the handler is a double fault
+            prog.resize(entry);
+            prog.insert(prog.end(), { 0, 0, ops::DIV, ops::HALT });
+            e->load(prog);
+            expect(e->tryRun() == RunResult::Trapped && e->trap().code == TrapCode::DivZero && e->trap().pc == entry + 2,
+                   *e, c, "double fault: " + show(e->trap()));
+            n += 2;
+        }
+    }
+    n += check_sliced_handler<StackVM, i32>("lesson1");
+    n += check_sliced_handler<Lesson3StackVM, u32>("lesson3");
+    return n;
+}
+
+// FUNC symbols of this executable whose demangled name contains one of
+// `parts`, with their sizes; empty if the binary is stripped.
+static std::vector<std::pair<std::string, std::size_t>> functions(std::initializer_list<const char*> parts) {
+    std::ifstream in("/proc/self/exe", std::ios::binary);
+    const std::string img((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::vector<std::pair<std::string, std::size_t>> out;
+    if (img.size() < sizeof(Elf64_Ehdr)) return out;
+    const auto* eh = reinterpret_cast<const Elf64_Ehdr*>(img.data());
+    const auto* sh = reinterpret_cast<const Elf64_Shdr*>(img.data() + eh->e_shoff);
+    for (int i = 0; i < eh->e_shnum; ++i) {
+        if (sh[i].sh_type != SHT_SYMTAB) continue;
+        const char* strtab = img.data() + sh[sh[i].sh_link].sh_offset;
+        const auto* sym = reinterpret_cast<const Elf64_Sym*>(img.data() + sh[i].sh_offset);
+        for (std::size_t k = 0; k < sh[i].sh_size / sizeof(Elf64_Sym); ++k) {
+            if (ELF64_ST_TYPE(sym[k].st_info) != STT_FUNC || sym[k].st_size == 0) continue;
+            int status = 0;
+            char* d = abi::__cxa_demangle(strtab + sym[k].st_name, nullptr, nullptr, &status);
+            const std::string name = status == 0 ? d : strtab + sym[k].st_name;
+            std::free(d);
+            for (const char* p : parts) {
+                if (name.find(p) != std::string::npos) {
+                    out.emplace_back(name, sym[k].st_size);
+                    break;
+                }
+            }
+        }
+    }
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+// Keeps the loops this binary uses in it, so the code table has them.
+static void instantiate_loops() {
+    const std::vector<i32> prog{ 1, 2, ops::ADD, ops::HALT };
+    StackVM a(16);
+    a.loadProgram(prog);
+    a.runUnchecked();
+    a.loadProgram(prog);
+    a.runChecked(false);
+    const std::vector<u32> words(prog.begin(), prog.end());
+    Lesson3StackVM b(4096);
+    b.loadProgram(words);
+    b.runUnchecked();
+    b.loadProgram(words);
+    b.runChecked(false);
+}
+
+// ns per run: `runs` runs of the engine's loaded program, median of `reps`
+template <class Run>
+static double ns_per_run(TrapEngine& e, std::size_t runs, int reps, Run&& run) {
+    std::vector<double> t;
+    for (int r = 0; r < reps; ++r) {
+        const auto t0 = Clock::now();
+        for (std::size_t i = 0; i < runs; ++i) {
+            e.rewind();
+            run();
+        }
+        t.push_back(std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / double(runs));
+    }
+    std::sort(t.begin(), t.end());
+    return t[t.size() / 2];
+}
+
+int main(int argc, char** argv) {
+    const std::size_t runs = argc > 1 ? std::stoull(argv[1]) : 200'000ull;
+    const int reps = argc > 2 ? std::stoi(argv[2]) : 5;
+    try {
+        std::cerr << "checks: " << check_traps() << " trapping runs, codes and pcs as expected on every engine\n\n";
+
+        instantiate_loops();
+        const auto loops = functions({ "::runFast<", "::runTraced<TraceOff>", "::runUnchecked()", "::execPrimitive<TraceOff>",
+                                       "::step<TraceOff>", "::execute<TraceOff>", "::fault(" });
+        if (loops.empty()) std::cerr << "code: no symbol table (stripped binary)\n";
+        for (const auto& [name, bytes] : loops) {
+            std::cerr << "  " << std::left << std::setw(72) << name.substr(0, 72) << std::right << std::setw(6) << bytes
+                      << " B\n";
+        }
+
+        std::cerr << "\nns/run, 4 insns    no trap   tryRun  run+catch  handler    trap cost: tryRun  throw  handler\n"
+                  << std::fixed << std::setprecision(1);
+        const std::vector<i32> ok{ 1, 1, ops::DIV, ops::HALT };
+        const std::vector<i32> div0{ 1, 0, ops::DIV, ops::HALT };
+        std::vector<i32> handled = div0;
+        handled.push_back(ops::HALT);
+        for (auto& e : engines()) {
+            if (!e->hasHandler()) continue;
+            e->setTrapHandler(TrapVector::NONE);
+            e->load(ok);
+            const double base = ns_per_run(*e, runs, reps, [&] { e->tryRun(); });
+            e->load(div0);
+            const double tr = ns_per_run(*e, runs, reps, [&] {
+                if (e->tryRun() != RunResult::Trapped) throw std::runtime_error("no trap");
+            });
+            const double th = ns_per_run(*e, runs, reps, [&] {
+                try {
+                    e->run();
+                }
+                catch (const TrapError&) {
+                }
+            });
+            e->load(handled);
+            e->setTrapHandler(div0.size());
+            const double hd = ns_per_run(*e, runs, reps, [&] {
+                if (e->tryRun() != RunResult::Halted) throw std::runtime_error("handler did not halt");
+            });
+            std::cerr << std::left << std::setw(18) << e->name() << std::right << std::setw(9) << base << std::setw(9)
+                      << tr << std::setw(11) << th << std::setw(9) << hd << std::setw(21) << tr - base << std::setw(7)
+                      << th - base << std::setw(9) << hd - base << "\n";
+        }
+    }
+    catch (const std::exception& ex) {
+        std::cerr << "error: " << ex.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
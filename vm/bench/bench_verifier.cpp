@@ -0,0 +1,61 @@
+// bench_verifier.cpp  (C++20)
+// g++ -std=c++20 -O2 -pthread bench_verifier.cpp engine_lesson1.cpp engine_lesson3.cpp engine_lesson6.cpp ../lesson1/lesson1/stack_vm.cpp -o bench_verifier
+// Usage: ./bench_verifier [instructions=4000000] [reps=7]
+//
+// Checked interpreter loop vs. the verifier-backed unchecked fast path, for
+// lesson1, lesson3 and lesson6. Reports the median over `reps` runs.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "engine.h"
+#include "workloads.h"
+
+
+static double median_mips(Engine& e, const Workload& w, Engine::Mode mode, int reps) {
+    std::vector<double> mips;
+    for (int r = 0; r < reps; ++r) {
+        e.load(w.prog);
+        auto t0 = std::chrono::steady_clock::now();
+        e.run(mode);
+        auto t1 = std::chrono::steady_clock::now();
+        double s = std::chrono::duration<double>(t1 - t0).count();
+        mips.push_back(double(w.prog.size()) / s / 1e6);
+    }
+    std::sort(mips.begin(), mips.end());
+    return mips[mips.size() / 2];
+}
+
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::stoull(argv[1]) : 4'000'000ull;
+    const int reps = argc > 2 ? std::stoi(argv[2]) : 7;
+
+    std::vector<std::unique_ptr<Engine>> engines;
+    engines.push_back(make_lesson1_engine());
+    engines.push_back(make_lesson3_engine());
+    engines.push_back(make_lesson6_engine());
+
+    const std::vector<Workload> workloads{ arith_chain(n), mul_div(n), deep_stack(n) };
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "engine   workload      checked Minsn/s  verified Minsn/s  speedup\n";
+    for (auto& e : engines) {
+        for (const auto& w : workloads) {
+            e->load(w.prog);
+            if (!e->verified()) {
+                std::cout << e->name() << ": " << w.name << " failed verification\n";
+                return 1;
+            }
+            double checked = median_mips(*e, w, Engine::Mode::Checked, reps);
+            double fast = median_mips(*e, w, Engine::Mode::Verified, reps);
+            std::cout << std::left << std::setw(9) << e->name() << std::setw(14) << w.name << std::right
+                      << std::setw(15) << checked << std::setw(18) << fast
+                      << std::setw(8) << fast / checked << "x\n";
+        }
+    }
+    return 0;
+}
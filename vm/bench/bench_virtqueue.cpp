@@ -0,0 +1,174 @@
+// bench_virtqueue.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 -pthread bench_virtqueue.cpp engine_lesson1.cpp ../lesson1/lesson1/stack_vm.cpp -o bench_virtqueue
+// Usage: ./bench_virtqueue [requests=1000000] [queue_size=1024]
+//
+// Guest output of N values, one value per request, three ways:
+//
+//   lesson1 print    one Print per value (trap into the console each time)
+//   lesson3 mmio     one store to the console device's INT register per value
+//   virtqueue B=..   lesson3 writes values into ring buffers with plain
+//                    stores and rings the VirtqueueDevice doorbell once per
+//                    batch of B; a backend thread prints them
+//
+// All output goes through a VirtualConsole into /dev/null (the report goes
+// to stderr). "exits" counts guest -> host transitions: Prints, or MMIO
+// accesses on lesson3. Times include draining the queue.
+//
+// The lesson VMs have no branches, so the guest program is generated
+// straight-line: before reusing ring slots it writes WAIT with the used
+// index it needs (a no-op exit unless the backend is behind).
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "engine.h"
+
+#define StackVM Lesson3StackVM
+#define Instr Lesson3Instr
+#define Prim Lesson3Prim
+#include "../lesson3/lesson3/stack_vm.h"
+#undef Prim
+#undef Instr
+#undef StackVM
+
+#include "../common/mmio_devices.h"
+#include "../common/virtqueue.h"
+#include "workloads.h" // ops::
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr u32 CONSOLE = Lesson3StackVM::MMIO_BASE;
+static constexpr u32 VQ = Lesson3StackVM::MMIO_BASE + 16;
+
+struct Program {
+    std::vector<u32> code;
+    void store(u32 value, u32 addr) {
+        code.insert(code.end(), { Lesson3Instr::push(static_cast<i32>(value)), Lesson3Instr::push(static_cast<i32>(addr)),
+                                  Lesson3Instr::prim(Lesson3Prim::Store) });
+    }
+};
+
+// Straight-line virtqueue driver for `n` requests in batches of `batch`,
+// queue at `qbase` with its `q` one-word buffers right after it.
+static std::vector<u32> virtqueue_program(u32 n, u32 q, u32 batch, u32 qbase) {
+    const VirtqueueLayout l{ qbase, q };
+    const u32 buf = l.end();
+    Program p;
+    for (u32 i = 0; i < q; ++i) {
+        p.store(buf + i, l.desc(i));
+        p.store(1, l.desc(i) + 1);
+        p.store(i, l.availRing(i));
+    }
+    p.store(n - 1, l.usedEvent()); // one interrupt, for the last request
+    p.store(qbase, VQ + VirtqueueDevice::QUEUE_ADDR);
+    p.store(q, VQ + VirtqueueDevice::QUEUE_SIZE);
+    p.store(1, VQ + VirtqueueDevice::READY);
+
+    const u32 laps = q / batch; // batches in flight before slots are reused
+    for (u32 j = 0; j * batch < n; ++j) {
+        if (j >= laps) p.store((j - laps + 1) * batch, VQ + VirtqueueDevice::WAIT);
+        const u32 end = std::min(n, (j + 1) * batch);
+        for (u32 k = j * batch; k < end; ++k) p.store(k, buf + (k & (q - 1)));
+        p.store(end, l.availIdx());
+        p.store(0, VQ + VirtqueueDevice::NOTIFY);
+    }
+    p.store(n, VQ + VirtqueueDevice::WAIT);
+    p.store(0, VQ + VirtqueueDevice::READY);
+    p.code.push_back(Lesson3Instr::prim(Lesson3Prim::Halt));
+    return p.code;
+}
+
+static void report(const std::string& name, u32 n, double s, double exits, const char* extra = "") {
+    std::cerr << std::left << std::setw(18) << name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(10) << n / s / 1e6 << std::setw(13) << std::setprecision(4) << exits / n << "  " << extra
+              << "\n";
+}
+
+int main(int argc, char** argv) {
+    const u32 n = argc > 1 ? static_cast<u32>(std::stoul(argv[1])) : 1'000'000u;
+    const u32 q = argc > 2 ? static_cast<u32>(std::stoul(argv[2])) : 1024u;
+    if (q == 0 || (q & (q - 1)) != 0) {
+        std::cerr << "queue_size must be a power of two\n";
+        return 1;
+    }
+
+    const int fd = ::open("/dev/null", O_WRONLY);
+    if (fd < 0 || ::dup2(fd, 1) < 0) {
+        std::cerr << "cannot redirect stdout\n";
+        return 1;
+    }
+    ::close(fd);
+
+    std::cerr << n << " requests (one value each), queue size " << q << "\n";
+    std::cerr << "case               M req/s  exits/req\n";
+
+    {
+        // push 0; (print; push 1; add) * n; halt
+        std::vector<i32> prog{ 0 };
+        for (u32 i = 0; i < n; ++i) prog.insert(prog.end(), { ops::PRINT, 1, ops::ADD });
+        prog.push_back(ops::HALT);
+        auto e = make_lesson1_engine();
+        e->load(prog);
+        const auto t0 = Clock::now();
+        e->run(Engine::Mode::Verified);
+        std::cout << std::flush;
+        report("lesson1 print", n, std::chrono::duration<double>(Clock::now() - t0).count(), n);
+    }
+
+    {
+        Program p;
+        for (u32 k = 0; k < n; ++k) p.store(k, CONSOLE + ConsoleDevice::INT);
+        p.code.push_back(Lesson3Instr::prim(Lesson3Prim::Halt));
+        VirtualConsole con;
+        ConsoleDevice console(con);
+        MmioBus bus;
+        bus.map(CONSOLE, ConsoleDevice::WORDS, console);
+        Lesson3StackVM vm(p.code.size() + 200);
+        vm.attachBus(&bus);
+        vm.loadProgram(p.code);
+        const auto t0 = Clock::now();
+        vm.run(false);
+        con.flush();
+        const auto& c = vm.busStats();
+        report("lesson3 mmio", n, std::chrono::duration<double>(Clock::now() - t0).count(), double(c.reads + c.writes));
+    }
+
+    for (u32 batch : { 1u, 8u, 64u, q / 4, q }) {
+        if (batch == 0 || batch > q) continue;
+        const u32 qbase = 100 + static_cast<u32>(virtqueue_program(n, q, batch, 0).size());
+        const std::vector<u32> prog = virtqueue_program(n, q, batch, qbase);
+
+        VirtualConsole con;
+        Lesson3StackVM vm(qbase + VirtqueueLayout::words(q) + q + 16);
+        VirtqueueDevice dev(std::span<u32>(vm.guestMemory().as<u32>(), vm.guestMemory().size() / sizeof(u32)),
+                            [&](std::span<const u32> b) {
+                                for (u32 v : b) con.printLine("", static_cast<i32>(v));
+                            });
+        MmioBus bus;
+        bus.map(VQ, VirtqueueDevice::WORDS, dev);
+        vm.attachBus(&bus);
+        vm.loadProgram(prog);
+        if (!vm.verified()) throw std::runtime_error("virtqueue program failed verification");
+
+        const auto t0 = Clock::now();
+        vm.run(false); // ends with WAIT n and READY 0: everything printed
+        con.flush();
+        const double s = std::chrono::duration<double>(Clock::now() - t0).count();
+
+        const VirtqueueDevice::Stats st = dev.stats();
+        const auto& c = vm.busStats();
+        if (st.chains != n) throw std::runtime_error("virtqueue lost requests");
+        const std::string extra = "notifies " + std::to_string(st.notifies) + ", backend wakeups " +
+                                  std::to_string(st.kicks) + ", waits " + std::to_string(st.waits) + ", interrupts " +
+                                  std::to_string(st.interrupts) + "/" +
+                                  std::to_string(st.interrupts + st.interrupts_suppressed);
+        report("virtqueue B=" + std::to_string(batch), n, s, double(c.reads + c.writes), extra.c_str());
+    }
+    return 0;
+}
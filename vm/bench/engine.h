@@ -0,0 +1,74 @@
+// engine.h
+// Common driver interface over the lesson VMs, used by the benchmarks in
+// this directory.
+//
+// lesson1, lesson3 and lesson6 each define a class called StackVM, so every
+// adapter lives in its own translation unit (engine_*.cpp) and renames the
+// class with a macro before including the lesson header. That keeps the
+// inline member functions of the different VMs from colliding at link time.
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <span>
+
+#include "../common/trace.h"
+#include "../common/trap.h"
+
+class Engine {
+public:
+    using i32 = std::int32_t;
+
+    enum class Mode {
+        Checked,       // per-instruction safety checks, TraceOff
+        Verified,      // verifier-backed unchecked fast path
+        TraceCounters, // checked loop, counters-only tracing
+        TraceText,     // checked loop, full text trace (what run(true) prints)
+        TraceBinary,   // checked loop, binary events into TraceRing::local()
+    };
+
+    virtual ~Engine() = default;
+
+    // Runs the lesson VM's templated loop for the tracing policy of `mode`.
+    // VM must provide runTraced<Trace>(Trace&).
+    template <class VM>
+    static void runWithPolicy(VM& vm, Mode mode, std::uint8_t engine_id) {
+        switch (mode) {
+        case Mode::TraceCounters: { TraceCounters t; vm.runTraced(t); break; }
+        case Mode::TraceText: { TraceText t; vm.runTraced(t); break; }
+        case Mode::TraceBinary: { TraceBinary t; t.engine = engine_id; vm.runTraced(t); break; }
+        default: { TraceOff t; vm.runTraced(t); break; }
+        }
+        checkTrap(vm);
+    }
+
+    // The loops leave a guest fault in trap() (trap.h); a run that trapped
+    // is an error to the driver, as run() makes it.
+    template <class VM>
+    static void checkTrap(const VM& vm) {
+        if (vm.trap().code != TrapCode::None) throw TrapError(vm.trap());
+    }
+
+    virtual const char* name() const = 0;
+
+    // Load a program; the engine keeps its own copy. Resets the VM.
+    virtual void load(std::span<const i32> prog) = 0;
+
+    // Whether the last load() passed the verifier.
+    virtual bool verified() const = 0;
+
+    // Whether run(Mode::Verified) is implemented.
+    virtual bool hasVerifiedMode() const { return true; }
+
+    // Run the loaded program to halt. One run per load() or rewind().
+    virtual void run(Mode mode) = 0;
+
+    // Make the loaded program runnable again from its first instruction,
+    // keeping whatever the engine caches across runs (MiniTCGVM's
+    // translated blocks); the lesson VMs cache nothing and reload.
+    virtual void rewind() = 0;
+};
+
+std::unique_ptr<Engine> make_lesson1_engine();
+std::unique_ptr<Engine> make_lesson3_engine();
+std::unique_ptr<Engine> make_lesson6_engine();
+std::unique_ptr<Engine> make_minitcg_engine();
@@ -0,0 +1,38 @@
+// engine_lesson1.cpp -- Engine adapter for lesson1 StackVM
+#include "engine.h"
+
+#include <vector>
+
+#include "../lesson1/lesson1/stack_vm.h"
+
+namespace {
+
+class Lesson1Engine final : public Engine {
+public:
+    const char* name() const override { return "lesson1"; }
+
+    void load(std::span<const i32> prog) override {
+        code_.assign(prog.begin(), prog.end());
+        vm_.loadProgram(code_);
+    }
+
+    bool verified() const override { return vm_.verified(); }
+
+    void run(Mode mode) override {
+        if (mode == Mode::Verified) {
+            vm_.runUnchecked();
+            checkTrap(vm_);
+        }
+        else runWithPolicy(vm_, mode, 1);
+    }
+
+    void rewind() override { vm_.loadProgram(code_); }
+
+private:
+    StackVM vm_;
+    std::vector<i32> code_;
+};
+
+} // namespace
+
+std::unique_ptr<Engine> make_lesson1_engine() { return std::make_unique<Lesson1Engine>(); }
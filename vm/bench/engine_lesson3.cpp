@@ -0,0 +1,52 @@
+// engine_lesson3.cpp -- Engine adapter for lesson3 StackVM
+#include "engine.h"
+
+#include <vector>
+
+#define StackVM Lesson3StackVM
+#define Instr Lesson3Instr
+#define Prim Lesson3Prim
+#include "../lesson3/lesson3/stack_vm.h"
+#undef Prim
+#undef Instr
+#undef StackVM
+
+namespace {
+
+class Lesson3Engine final : public Engine {
+public:
+    const char* name() const override { return "lesson3"; }
+
+    void load(std::span<const i32> prog) override {
+        // default memory is 1M words; grow it for large programs
+        const std::size_t words = prog.size() + PROGRAM_BASE + 1;
+        if (!vm_ || words > mem_words_) {
+            mem_words_ = words > 1'000'000 ? words : 1'000'000;
+            vm_ = std::make_unique<Lesson3StackVM>(mem_words_, PROGRAM_BASE);
+        }
+        code_.assign(prog.begin(), prog.end());
+        vm_->loadProgram(code_);
+    }
+
+    bool verified() const override { return vm_ && vm_->verified(); }
+
+    void run(Mode mode) override {
+        if (mode == Mode::Verified) {
+            vm_->runUnchecked();
+            checkTrap(*vm_);
+        }
+        else runWithPolicy(*vm_, mode, 3);
+    }
+
+    void rewind() override { vm_->loadProgram(code_); }
+
+private:
+    static constexpr std::size_t PROGRAM_BASE = 100;
+    std::unique_ptr<Lesson3StackVM> vm_;
+    std::size_t mem_words_ = 0;
+    std::vector<u32> code_;
+};
+
+} // namespace
+
+std::unique_ptr<Engine> make_lesson3_engine() { return std::make_unique<Lesson3Engine>(); }
@@ -0,0 +1,41 @@
+// engine_lesson6.cpp -- Engine adapter for lesson6 StackVM
+#include "engine.h"
+
+#include <vector>
+
+#define StackVM Lesson6StackVM
+#include "../lesson6/lesson6/stack-vm.h"
+#undef StackVM
+
+namespace {
+
+class Lesson6Engine final : public Engine {
+public:
+    const char* name() const override { return "lesson6"; }
+
+    // zero-copy load: the VM executes straight from code_
+    void load(std::span<const i32> prog) override {
+        code_.assign(prog.begin(), prog.end());
+        vm_->loadProgram(std::span<const i32>(code_));
+    }
+
+    bool verified() const override { return vm_->verified(); }
+
+    void run(Mode mode) override {
+        if (mode == Mode::Verified) {
+            vm_->runUnchecked();
+            checkTrap(*vm_);
+        }
+        else runWithPolicy(*vm_, mode, 6);
+    }
+
+    void rewind() override { vm_->loadProgram(std::span<const i32>(code_)); }
+
+private:
+    std::unique_ptr<Lesson6StackVM> vm_ = std::make_unique<Lesson6StackVM>();
+    std::vector<i32> code_;
+};
+
+} // namespace
+
+std::unique_ptr<Engine> make_lesson6_engine() { return std::make_unique<Lesson6Engine>(); }
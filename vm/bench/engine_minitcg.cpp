@@ -0,0 +1,32 @@
+// engine_minitcg.cpp -- Engine adapter for MiniTCGVM
+#include "engine.h"
+
+#include <vector>
+
+#include "../mini_TCG/mini_TCG/mini_tcg.h"
+
+namespace {
+
+class MiniTCGEngine final : public Engine {
+public:
+    const char* name() const override { return "minitcg"; }
+
+    // loadProgram() also flushes the TB cache, so each load starts cold
+    void load(std::span<const i32> prog) override { vm_.loadProgram(prog); }
+
+    // no verifier: the translator checks instructions once per TB instead
+    bool verified() const override { return false; }
+    bool hasVerifiedMode() const override { return false; }
+
+    void run(Mode mode) override { runWithPolicy(vm_, mode, 7); }
+
+    // every run starts at pc 0; the TB cache survives until the next load()
+    void rewind() override {}
+
+private:
+    MiniTCGVM vm_;
+};
+
+} // namespace
+
+std::unique_ptr<Engine> make_minitcg_engine() { return std::make_unique<MiniTCGEngine>(); }
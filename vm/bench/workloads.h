@@ -0,0 +1,92 @@
+// workloads.h
+// Guest programs shared by the benchmarks. Straight-line code only, using
+// the primitives every engine implements unless noted.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+struct Workload {
+    const char* name;
+    std::vector<std::int32_t> prog;
+};
+
+namespace ops {
+inline constexpr std::int32_t HALT = 0x40000000;
+inline constexpr std::int32_t ADD = 0x40000001;
+inline constexpr std::int32_t SUB = 0x40000002;
+inline constexpr std::int32_t MUL = 0x40000003;
+inline constexpr std::int32_t DIV = 0x40000004;
+inline constexpr std::int32_t PRINT = 0x40000005;
+} // namespace ops
+
+// push 1; (push 5; add; push 5; sub)*k; halt
+inline Workload arith_chain(std::size_t n) {
+    Workload w{ "arith-chain", { 1 } };
+    while (w.prog.size() + 5 <= n) w.prog.insert(w.prog.end(), { 5, ops::ADD, 5, ops::SUB });
+    w.prog.push_back(ops::HALT);
+    return w;
+}
+
+// push 7; (push 3; mul; push 3; div)*k; halt
+inline Workload mul_div(std::size_t n) {
+    Workload w{ "mul-div", { 7 } };
+    while (w.prog.size() + 5 <= n) w.prog.insert(w.prog.end(), { 3, ops::MUL, 3, ops::DIV });
+    w.prog.push_back(ops::HALT);
+    return w;
+}
+
+// push 0; (push 1 x32; add x32)*k; halt -- depth swings 1..33, within
+// lesson3's 99 stack slots
+inline Workload deep_stack(std::size_t n) {
+    Workload w{ "deep-stack", { 0 } };
+    while (w.prog.size() + 65 <= n) {
+        for (int i = 0; i < 32; ++i) w.prog.push_back(1);
+        for (int i = 0; i < 32; ++i) w.prog.push_back(ops::ADD);
+    }
+    w.prog.push_back(ops::HALT);
+    return w;
+}
+
+// MiniTCGVM implements only push/add/print/halt:
+// push 0; (push 1; add)*k; halt
+inline Workload add_chain(std::size_t n) {
+    Workload w{ "add-chain", { 0 } };
+    while (w.prog.size() + 3 <= n) w.prog.insert(w.prog.end(), { 1, ops::ADD });
+    w.prog.push_back(ops::HALT);
+    return w;
+}
+
+// push 0; (print; push 1; add)*k; halt -- lesson1 and MiniTCGVM only
+inline Workload print_heavy(std::size_t n) {
+    Workload w{ "print-heavy", { 0 } };
+    while (w.prog.size() + 4 <= n) w.prog.insert(w.prog.end(), { ops::PRINT, 1, ops::ADD });
+    w.prog.push_back(ops::HALT);
+    return w;
+}
+
+// push 1; then fixed-seed random steps (push c; add | push c; sub |
+// push c; mul; push c; div), c in 1..9; halt. No repeating pattern, so
+// neither the host branch predictor nor a block cache sees the same code
+// twice; the accumulator stays far from overflow.
+inline Workload straight_line(std::size_t n) {
+    Workload w{ "straight-line", { 1 } };
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> step(0, 2), imm(1, 9);
+    while (w.prog.size() + 5 <= n) {
+        const std::int32_t c = imm(rng);
+        switch (step(rng)) {
+        case 0: w.prog.insert(w.prog.end(), { c, ops::ADD }); break;
+        case 1: w.prog.insert(w.prog.end(), { c, ops::SUB }); break;
+        default: w.prog.insert(w.prog.end(), { c, ops::MUL, c, ops::DIV }); break;
+        }
+    }
+    w.prog.push_back(ops::HALT);
+    return w;
+}
+
+// The cross-engine corpus (bench_suite, bench_counters), n insns each.
+inline std::vector<Workload> corpus(std::size_t n) {
+    return { arith_chain(n), mul_div(n), add_chain(n), deep_stack(n), print_heavy(n), straight_line(n) };
+}
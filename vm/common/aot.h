@@ -0,0 +1,378 @@
+// aot.h
+// Ahead-of-time compilation of bytecode images to native code.
+//
+//   AotCompiler  image code -> one C++ translation unit (tools/aot_compile)
+//   AotLibrary   dlopen the shared object built from it, check that it was
+//                compiled from the program a VM is about to run
+//
+//   ./aot_compile out.bin out_aot.cpp
+//   g++ -std=c++20 -O2 -shared -fPIC -I<vm>/common out_aot.cpp -o out_aot.so
+//
+//   AotLibrary lib("./out_aot.so");
+//   vm.loadProgram(image.code());
+//   vm.attachAot(&lib);             // throws unless lib matches the program
+//   vm.run(false);                  // runs the compiled blocks
+//
+// The image must pass the verifier (verifier.h) with the lesson1 primitive
+// set plus vec/iret: the generated code has no bounds or underflow checks,
+// only the division traps. Since the instruction set has no branches, a
+// block is a straight run from a leader (pc 0, a vec target, or the end of
+// the previous block) to halt, iret, the next leader or a size cap. Inside a
+// block the stack depth relative to entry is known at every instruction, so
+// each value is a C++ local and the host compiler folds and schedules the
+// arithmetic; the words below the entry depth are loaded the first time the
+// block pops them, and the live ones are stored back once at the exit.
+//
+// Blocks end at leaders, so the VM can take interrupts at any block
+// boundary; an Instructions timer counts whole blocks, as in MiniTCGVM.
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "aot_abi.h"
+#include "bytecode_image.h"
+#include "verifier.h"
+
+#if !defined(_WIN32)
+#include <dlfcn.h>
+#endif
+
+struct AotCompiler {
+    using i32 = std::int32_t;
+    using u32 = std::uint32_t;
+
+    struct Options {
+        std::size_t max_block = 512; // guest instructions per block (function size for the host compiler)
+        std::string source_name;     // for the header comment
+    };
+
+    // The whole translation unit; throws if `code` does not verify.
+    static std::string translate(std::span<const i32> code) { return translate(code, Options{}); }
+    static std::string translate(std::span<const i32> code, const Options& opt) {
+        Verifier::Options vopt;
+        vopt.allowed_prims = Verifier::ALL_PRIMS | Verifier::IRQ_PRIMS;
+        const VerifyResult vr = Verifier::verify(code, vopt);
+        if (!vr.ok) {
+            throw std::runtime_error("aot: image does not verify (pc " + std::to_string(vr.error_pc) + ": " +
+                                     vr.error + ")");
+        }
+        if (opt.max_block == 0) throw std::invalid_argument("aot: max_block must be positive");
+
+        // leaders: pc 0 and every handler entry (the verifier made each vec
+        // operand the immediate right before it)
+        std::set<std::size_t> leaders{ 0 };
+        for (std::size_t pc = 1; pc < code.size(); ++pc) {
+            if (static_cast<u32>(code[pc]) == PRIM_TAG + Verifier::OP_VEC && type(code[pc - 1]) == 0u) {
+                leaders.insert(static_cast<u32>(code[pc - 1]) & DATA_MASK);
+            }
+        }
+
+        std::string body;
+        std::vector<BlockInfo> blocks;
+        u32 prims_used = 0;
+        std::vector<std::size_t> work(leaders.begin(), leaders.end());
+        std::set<std::size_t> done;
+        while (!work.empty()) {
+            const std::size_t start = work.back();
+            work.pop_back();
+            if (!done.insert(start).second) continue;
+            BlockInfo b = emitBlock(code, start, leaders, opt.max_block, body);
+            prims_used |= b.prims_used;
+            if (b.falls_through && !done.count(b.end)) {
+                leaders.insert(b.end);
+                work.push_back(b.end);
+            }
+            blocks.push_back(std::move(b));
+        }
+        std::sort(blocks.begin(), blocks.end(), [](const BlockInfo& a, const BlockInfo& b) { return a.pc < b.pc; });
+
+        const u32 crc = BytecodeImage::crc32(code.data(), code.size_bytes());
+        std::string out;
+        out += "// " + (opt.source_name.empty() ? std::string("image") : opt.source_name) +
+               " -- generated by tools/aot_compile; do not edit.\n";
+        out += "// g++ -std=c++20 -O2 -shared -fPIC -I<vm>/common <this file> -o <module>.so\n";
+        out += "// " + std::to_string(code.size()) + " code words, CRC-32 " + hex(crc) + ", " +
+               std::to_string(blocks.size()) + " blocks\n";
+        out += "#include <cstdint>\n\n#include \"aot_abi.h\"\n\n"
+               "namespace {\n"
+               "using i32 = std::int32_t;\n"
+               "using u32 = std::uint32_t;\n\n"
+               "// two's-complement wrap-around, as the interpreters\n"
+               "inline i32 add(i32 a, i32 b) { return static_cast<i32>(static_cast<u32>(a) + static_cast<u32>(b)); }\n"
+               "inline i32 sub(i32 a, i32 b) { return static_cast<i32>(static_cast<u32>(a) - static_cast<u32>(b)); }\n"
+               "inline i32 mul(i32 a, i32 b) { return static_cast<i32>(static_cast<u32>(a) * static_cast<u32>(b)); }\n\n"
+               "// Blocks call the host through these, so the thousands of call sites\n"
+               "// are direct calls and each indirect call is one well-predicted branch.\n"
+               "[[gnu::noinline]] void print(AotFrame* f, i32 v) { f->host->print(f, v); }\n"
+               "[[gnu::noinline]] void flush(AotFrame* f) { f->host->flush(f); }\n";
+        out += body;
+        out += "\nconst AotBlock blocks[] = {\n";
+        for (const BlockInfo& b : blocks) {
+            out += "    { " + std::to_string(b.pc) + ", " + std::to_string(b.end - b.pc) + ", " +
+                   std::to_string(b.grow) + ", " + std::to_string(b.prims.size()) + ", " +
+                   (b.prims.empty() ? std::string("nullptr") : "p" + std::to_string(b.pc)) + ", &b" +
+                   std::to_string(b.pc) + " },\n";
+        }
+        out += "};\n} // namespace\n\n";
+        out += "extern \"C\" const AotModule svm_aot_module = { AOT_ABI_VERSION, " + std::to_string(code.size()) +
+               "u, " + hex(crc) + "u, " + hex(prims_used) + "u, " + std::to_string(blocks.size()) + "u, blocks };\n";
+        return out;
+    }
+
+private:
+    static constexpr u32 DATA_MASK = 0x3FFF'FFFFu;
+    static constexpr u32 PRIM_TAG = 0x4000'0000u;
+
+    static u32 type(i32 ins) { return static_cast<u32>(ins) >> 30; }
+
+    static std::string hex(u32 v) {
+        static const char digits[] = "0123456789abcdef";
+        std::string s = "0x";
+        for (int shift = 28; shift >= 0; shift -= 4) s += digits[(v >> shift) & 0xFu];
+        return s;
+    }
+
+    struct BlockInfo {
+        std::size_t pc = 0;
+        std::size_t end = 0;        // one past the last instruction
+        std::size_t grow = 0;
+        std::vector<u32> prims;
+        u32 prims_used = 0;
+        bool falls_through = false; // ended at a leader or the cap, not halt/iret
+    };
+
+    // The guest stack of one block as C++ expressions: slot r holds the
+    // value at sp[r] relative to the entry sp. Slots below `low` were never
+    // touched; `home` marks a slot still holding the word loaded from it.
+    struct Stack {
+        struct Val {
+            std::string expr;
+            bool home = false;
+        };
+        std::vector<Val> vals; // slots low .. depth-1
+        long low = 0;
+        long depth = 0;
+        std::size_t grow = 0;
+        std::string& code;
+        int temps = 0;
+
+        explicit Stack(std::string& c) : code(c) {}
+
+        // make sure slot depth-1-k exists, loading it from the entry stack
+        void reach(long k) {
+            while (depth - 1 - k < low) {
+                --low;
+                const std::string name = "e" + std::to_string(-low);
+                code += "    const i32 " + name + " = sp[" + std::to_string(low) + "];\n";
+                vals.insert(vals.begin(), Val{ name, true });
+            }
+        }
+        const std::string& peek(long k = 0) {
+            reach(k);
+            return vals[static_cast<std::size_t>(depth - 1 - k - low)].expr;
+        }
+        std::string pop() {
+            std::string v = peek();
+            vals.pop_back();
+            --depth;
+            return v;
+        }
+        void push(std::string expr) {
+            vals.push_back(Val{ std::move(expr), false });
+            ++depth;
+            if (depth > 0 && static_cast<std::size_t>(depth) > grow) grow = static_cast<std::size_t>(depth);
+        }
+        std::string temp(const std::string& expr) {
+            const std::string name = "t" + std::to_string(temps++);
+            code += "    const i32 " + name + " = " + expr + ";\n";
+            return name;
+        }
+        // store the live slots back and publish sp
+        std::string spill(const char* indent) const {
+            std::string s;
+            for (long r = low; r < depth; ++r) {
+                const Val& v = vals[static_cast<std::size_t>(r - low)];
+                if (!v.home) s += std::string(indent) + "sp[" + std::to_string(r) + "] = " + v.expr + ";\n";
+            }
+            return s + indent + "f->sp = sp " + (depth < 0 ? "- " : "+ ") + std::to_string(depth < 0 ? -depth : depth) +
+                   ";\n";
+        }
+    };
+
+    static BlockInfo emitBlock(std::span<const i32> code, std::size_t start, const std::set<std::size_t>& leaders,
+                               std::size_t max_block, std::string& out) {
+        BlockInfo b;
+        b.pc = start;
+        std::string fn;
+        Stack st(fn);
+        std::size_t pc = start;
+        bool ended = false, trapped = false;
+        while (!ended) {
+            if (pc > start && (leaders.count(pc) || pc - start == max_block)) {
+                b.falls_through = true;
+                break;
+            }
+            const i32 ins = code[pc]; // verified: a block never runs off the end
+            const u32 data = static_cast<u32>(ins) & DATA_MASK;
+            switch (type(ins)) {
+            case 0: st.push(std::to_string(data)); break;
+            case 2: st.push("-" + std::to_string(data)); break;
+            default: {
+                b.prims.push_back(data);
+                b.prims_used |= 1u << data;
+                switch (data) {
+                case Verifier::OP_HALT:
+                    fn += "    f->running = 0;\n";
+                    ended = true;
+                    break;
+                case Verifier::OP_ADD:
+                case Verifier::OP_SUB:
+                case Verifier::OP_MUL: {
+                    const std::string rhs = st.pop(), lhs = st.pop();
+                    const char* op = data == Verifier::OP_ADD ? "add" : data == Verifier::OP_SUB ? "sub" : "mul";
+                    st.push(st.temp(std::string(op) + "(" + lhs + ", " + rhs + ")"));
+                    break;
+                }
+                case Verifier::OP_DIV: {
+                    const std::string rhs = st.peek(0), lhs = st.peek(1);
+                    const std::string trap = st.spill("        ") + "        f->next_pc = " + std::to_string(pc) + ";\n";
+                    if (rhs == "0" || rhs == "-0") { // always traps; the rest of the block is dead
+                        fn += "    {\n" + trap + "        return AOT_DIV_ZERO;\n    }\n";
+                        trapped = ended = true;
+                        break;
+                    }
+                    // an immediate divisor other than 0 and -1 cannot trap
+                    const bool imm = rhs[0] != 't' && rhs[0] != 'e';
+                    if (!imm) {
+                        fn += "    if (" + rhs + " == 0) [[unlikely]] {\n" + trap + "        return AOT_DIV_ZERO;\n    }\n";
+                    }
+                    if (!imm || rhs == "-1") {
+                        fn += "    if (" + lhs + " == INT32_MIN && " + rhs + " == -1) [[unlikely]] {\n" + trap +
+                              "        return AOT_DIV_OVERFLOW;\n    }\n";
+                    }
+                    st.pop();
+                    st.pop();
+                    st.push(st.temp(lhs + " / " + rhs));
+                    break;
+                }
+                case Verifier::OP_PRINT:
+                    fn += "    print(f, " + st.peek() + ");\n";
+                    break;
+                case Verifier::OP_FLUSH:
+                    fn += "    flush(f);\n";
+                    break;
+                case Verifier::OP_VEC:
+                    fn += "    f->host->vec(f, " + st.pop() + ");\n";
+                    break;
+                default: // OP_IRET; the verifier allowed nothing else
+                    st.pop();
+                    fn += st.spill("    ");
+                    fn += "    f->host->iret(f);\n    return AOT_OK;\n";
+                    ended = true;
+                    break;
+                }
+            }
+            }
+            ++pc;
+        }
+        b.end = pc;
+        b.grow = st.grow;
+
+        out += "\n// pc " + std::to_string(start) + " .. " + std::to_string(pc - 1) + "\n";
+        out += "std::uint32_t b" + std::to_string(start) + "(AotFrame* f) {\n";
+        out += "    i32* const sp = f->sp;\n";
+        out += fn;
+        if (!trapped && (code[pc - 1] != static_cast<i32>(PRIM_TAG + Verifier::OP_IRET) || b.falls_through)) {
+            out += st.spill("    ");
+            out += "    f->next_pc = " + std::to_string(pc) + ";\n    return AOT_OK;\n";
+        }
+        out += "}\n";
+        if (!b.prims.empty()) {
+            out += "const std::uint8_t p" + std::to_string(start) + "[] = {";
+            for (std::size_t i = 0; i < b.prims.size(); ++i) out += (i ? ", " : " ") + std::to_string(b.prims[i]);
+            out += " };\n";
+        }
+        return b;
+    }
+};
+
+// A compiled module loaded with dlopen. Blocks are looked up by pc in a
+// dense table built at open().
+class AotLibrary {
+public:
+    using i32 = std::int32_t;
+
+    AotLibrary() = default;
+    explicit AotLibrary(const char* path) { open(path); }
+    ~AotLibrary() { close(); }
+
+    AotLibrary(const AotLibrary&) = delete;
+    AotLibrary& operator=(const AotLibrary&) = delete;
+
+    void open(const char* path) {
+        close();
+#if defined(_WIN32)
+        (void)path;
+        throw std::runtime_error("AOT modules need dlopen");
+#else
+        handle_ = ::dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        if (!handle_) throw std::runtime_error(std::string("dlopen failed: ") + ::dlerror());
+        mod_ = static_cast<const AotModule*>(::dlsym(handle_, AOT_MODULE_SYMBOL));
+        if (!mod_) {
+            close();
+            throw std::runtime_error(std::string("not an AOT module (no ") + AOT_MODULE_SYMBOL + "): " + path);
+        }
+        if (mod_->abi != AOT_ABI_VERSION) {
+            const std::uint32_t abi = mod_->abi;
+            close();
+            throw std::runtime_error("AOT module ABI " + std::to_string(abi) + ", expected " +
+                                     std::to_string(AOT_ABI_VERSION) + ": " + path);
+        }
+        table_.assign(mod_->code_words, nullptr);
+        for (std::uint32_t i = 0; i < mod_->block_count; ++i) {
+            const AotBlock& b = mod_->blocks[i];
+            if (b.pc >= table_.size()) {
+                close();
+                throw std::runtime_error(std::string("AOT module block outside its image: ") + path);
+            }
+            table_[b.pc] = &b;
+        }
+#endif
+    }
+
+    void close() {
+#if !defined(_WIN32)
+        if (handle_) ::dlclose(handle_);
+#endif
+        handle_ = nullptr;
+        mod_ = nullptr;
+        table_.clear();
+    }
+
+    bool loaded() const { return mod_ != nullptr; }
+    const AotModule& module() const { return *mod_; }
+
+    // Compiled from exactly this code? (word count and CRC-32)
+    bool matches(std::span<const i32> code) const {
+        return mod_ && code.size() == mod_->code_words &&
+               BytecodeImage::crc32(code.data(), code.size_bytes()) == mod_->code_crc32;
+    }
+    void check(std::span<const i32> code) const {
+        if (!mod_) throw std::runtime_error("no AOT module loaded");
+        if (!matches(code)) throw std::runtime_error("AOT module was compiled from a different image");
+    }
+
+    // the block starting at `pc`, or null
+    const AotBlock* block(std::size_t pc) const { return pc < table_.size() ? table_[pc] : nullptr; }
+
+private:
+    void* handle_ = nullptr;
+    const AotModule* mod_ = nullptr;
+    std::vector<const AotBlock*> table_;
+};
@@ -0,0 +1,64 @@
+// aot_abi.h
+// What an ahead-of-time compiled image (the C++ written by AotCompiler,
+// aot.h) and the VMs that load it agree on. Plain C layout, no other
+// includes: the generated translation unit is built on its own with
+// -I<vm>/common and loaded with dlopen.
+//
+// A module is one exported AotModule (symbol AOT_MODULE_SYMBOL) describing
+// the image it was compiled from and its blocks. A block is one straight run
+// of guest code, entered with the guest stack pointer in the frame; it keeps
+// the stack in locals and stores it back on exit.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#define AOT_ABI_VERSION 1u
+#define AOT_MODULE_SYMBOL "svm_aot_module"
+
+struct AotHost;
+
+struct AotFrame {
+    std::int32_t* sp = nullptr;     // in/out: one past the top of the guest stack
+    std::size_t next_pc = 0;        // out: where execution continues (or the trapping pc)
+    std::uint32_t running = 1;      // cleared by halt
+    std::uint32_t reserved = 0;
+    void* vm = nullptr;             // for the host callbacks
+    const AotHost* host = nullptr;
+};
+
+// Services a block cannot do itself. They may throw: the module is ordinary
+// C++ with unwind tables, so the exception reaches the VM's run loop.
+struct AotHost {
+    void (*print)(AotFrame* f, std::int32_t value);
+    void (*flush)(AotFrame* f);
+    void (*vec)(AotFrame* f, std::int32_t target);
+    void (*iret)(AotFrame* f); // sets f->next_pc
+};
+
+// Block result. On a trap the stack is stored as it was before the
+// trapping instruction and next_pc is that instruction's pc.
+enum AotStatus : std::uint32_t {
+    AOT_OK = 0,
+    AOT_DIV_ZERO = 1,
+    AOT_DIV_OVERFLOW = 2, // INT_MIN / -1
+};
+
+using AotBlockFn = std::uint32_t (*)(AotFrame* f);
+
+struct AotBlock {
+    std::uint32_t pc;            // first guest instruction
+    std::uint32_t insns;         // guest instructions in the block
+    std::uint32_t grow;          // most words the block pushes above its entry depth
+    std::uint32_t prim_count;
+    const std::uint8_t* prims;   // primitive opcodes in the block, for metrics
+    AotBlockFn fn;
+};
+
+struct AotModule {
+    std::uint32_t abi;           // AOT_ABI_VERSION
+    std::uint32_t code_words;    // the image it was compiled from:
+    std::uint32_t code_crc32;    //   word count and CRC-32 of the code section
+    std::uint32_t prims_used;    // bit n set => primitive opcode n occurs in a block
+    std::uint32_t block_count;
+    const AotBlock* blocks;      // sorted by pc
+};
@@ -0,0 +1,293 @@
+// bytecode_image.h
+// Versioned object format for assembled stack-VM programs (out.bin).
+//
+// File layout (fields in the byte order of the host that wrote the file):
+//
+//   [ImageHeader, 32 bytes]
+//   [code section: code_words x i32]   at code_offset
+//   [data section: data_words x i32]   at data_offset (optional, may be empty)
+//
+// - magic  : "SVMB"
+// - endian : 0xFEFF as written by the producer; a reader that sees 0xFFFE
+//            knows the image came from a host with the opposite byte order
+// - crc32  : CRC-32 (IEEE 802.3) over the code and data section bytes
+//
+// Sections start on 4-byte boundaries, so a mapped file can be used directly
+// as an i32 array (see MappedImage below).
+//
+// Files without the magic are treated as legacy headerless images (raw i32
+// words, the format written by the first version of lexer_asm). A legacy file
+// can never start with the magic: 0x424D5653 decodes as a primitive with an
+// opcode far outside the instruction set.
+#pragma once
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct ImageHeader {
+    std::uint32_t magic;
+    std::uint16_t version;
+    std::uint16_t endian;
+    std::uint32_t flags;       // reserved, must be 0
+    std::uint32_t code_words;
+    std::uint32_t data_words;
+    std::uint32_t crc32;
+    std::uint32_t code_offset; // bytes from start of file
+    std::uint32_t data_offset; // bytes from start of file
+};
+static_assert(sizeof(ImageHeader) == 32, "ImageHeader must stay 32 bytes");
+
+// CRC-32 lookup tables (reflected, poly 0xEDB88320) for slicing-by-8.
+using Crc32Tables = std::array<std::array<std::uint32_t, 256>, 8>;
+
+constexpr Crc32Tables make_crc32_tables() {
+    Crc32Tables t{};
+    for (std::uint32_t i = 0; i < 256; ++i) {
+        std::uint32_t c = i;
+        for (int k = 0; k < 8; ++k) c = (c & 1u) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+        t[0][i] = c;
+    }
+    for (std::uint32_t i = 0; i < 256; ++i) {
+        for (std::size_t s = 1; s < 8; ++s) {
+            t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFFu];
+        }
+    }
+    return t;
+}
+
+inline constexpr Crc32Tables CRC32_TABLES = make_crc32_tables();
+
+struct BytecodeImage {
+    using i32 = std::int32_t;
+    using u32 = std::uint32_t;
+    using u16 = std::uint16_t;
+
+    static constexpr u32 MAGIC = 0x424D5653u; // 'S' 'V' 'M' 'B' on little-endian
+    static constexpr u16 VERSION = 1;
+    static constexpr u16 ENDIAN_MARK = 0xFEFFu;
+
+    // Sections of a parsed image. Spans point into the caller's buffer.
+    struct View {
+        std::span<const i32> code;
+        std::span<const i32> data;
+        bool legacy = false; // headerless raw words, no CRC
+    };
+
+    // ---------- CRC-32 (IEEE), slicing-by-8 ----------
+
+    // Incremental: crc32(b, nb, crc32(a, na)) == crc32(a ++ b)
+    static u32 crc32(const void* p, std::size_t n, u32 crc = 0) {
+        const auto& t = CRC32_TABLES;
+        const unsigned char* s = static_cast<const unsigned char*>(p);
+        crc = ~crc;
+
+        if constexpr (std::endian::native == std::endian::little) {
+            while (n >= 8) {
+                u32 lo = 0, hi = 0;
+                std::memcpy(&lo, s, 4);
+                std::memcpy(&hi, s + 4, 4);
+                lo ^= crc;
+                crc = t[7][lo & 0xFFu] ^ t[6][(lo >> 8) & 0xFFu] ^
+                      t[5][(lo >> 16) & 0xFFu] ^ t[4][lo >> 24] ^
+                      t[3][hi & 0xFFu] ^ t[2][(hi >> 8) & 0xFFu] ^
+                      t[1][(hi >> 16) & 0xFFu] ^ t[0][hi >> 24];
+                s += 8;
+                n -= 8;
+            }
+        }
+        while (n--) crc = t[0][(crc ^ *s++) & 0xFFu] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    // ---------- writer ----------
+
+    // Whole image (header + sections) in one contiguous buffer.
+    static std::vector<char> serialize(std::span<const i32> code, std::span<const i32> data = {}) {
+        const std::size_t code_bytes = code.size_bytes();
+        const std::size_t data_bytes = data.size_bytes();
+        if (code.size() > 0xFFFF'FFFFu || data.size() > 0xFFFF'FFFFu ||
+            sizeof(ImageHeader) + code_bytes + data_bytes > 0xFFFF'FFFFu) {
+            throw std::runtime_error("image too large for 32-bit section offsets");
+        }
+
+        ImageHeader h{};
+        h.magic = MAGIC;
+        h.version = VERSION;
+        h.endian = ENDIAN_MARK;
+        h.flags = 0;
+        h.code_words = static_cast<u32>(code.size());
+        h.data_words = static_cast<u32>(data.size());
+        h.code_offset = static_cast<u32>(sizeof(ImageHeader));
+        h.data_offset = static_cast<u32>(sizeof(ImageHeader) + code_bytes);
+        h.crc32 = crc32(data.data(), data_bytes, crc32(code.data(), code_bytes));
+
+        std::vector<char> buf(sizeof(ImageHeader) + code_bytes + data_bytes);
+        std::memcpy(buf.data(), &h, sizeof(h));
+        if (code_bytes) std::memcpy(buf.data() + h.code_offset, code.data(), code_bytes);
+        if (data_bytes) std::memcpy(buf.data() + h.data_offset, data.data(), data_bytes);
+        return buf;
+    }
+
+    // Single buffered write of the whole image.
+    static void write(const char* path, std::span<const i32> code, std::span<const i32> data = {}) {
+        const std::vector<char> buf = serialize(code, data);
+        std::ofstream out(path, std::ios::binary);
+        if (!out) throw std::runtime_error(std::string("Cannot open output file: ") + path);
+        out.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+        if (!out) throw std::runtime_error(std::string("Write failed: ") + path);
+    }
+
+    // ---------- reader ----------
+
+    // Validate an in-memory image and return views of its sections.
+    // `base` must be 4-byte aligned (mmap and operator new both are).
+    static View parse(const void* base, std::size_t size, bool verify_crc = true) {
+        const char* p = static_cast<const char*>(base);
+
+        u32 magic = 0;
+        if (size >= sizeof(magic)) std::memcpy(&magic, p, sizeof(magic));
+
+        if (magic != MAGIC) {
+            if (magic == byteswap32(MAGIC)) {
+                throw std::runtime_error("image byte order does not match this host");
+            }
+            if (size % sizeof(i32) != 0) {
+                throw std::runtime_error("not a bytecode image (bad magic, size not a multiple of 4)");
+            }
+            View v;
+            v.code = { reinterpret_cast<const i32*>(p), size / sizeof(i32) };
+            v.legacy = true;
+            return v;
+        }
+
+        if (size < sizeof(ImageHeader)) throw std::runtime_error("truncated image header");
+        ImageHeader h;
+        std::memcpy(&h, p, sizeof(h));
+
+        if (h.endian != ENDIAN_MARK) throw std::runtime_error("image byte order does not match this host");
+        if (h.version != VERSION) {
+            throw std::runtime_error("unsupported image version: " + std::to_string(h.version));
+        }
+        if (h.flags != 0) throw std::runtime_error("unsupported image flags");
+
+        const std::uint64_t code_end = std::uint64_t(h.code_offset) + std::uint64_t(h.code_words) * sizeof(i32);
+        const std::uint64_t data_end = std::uint64_t(h.data_offset) + std::uint64_t(h.data_words) * sizeof(i32);
+        if (h.code_offset < sizeof(ImageHeader) || h.data_offset < sizeof(ImageHeader) ||
+            h.code_offset % sizeof(i32) != 0 || h.data_offset % sizeof(i32) != 0) {
+            throw std::runtime_error("misaligned image section");
+        }
+        if (code_end > size || data_end > size) throw std::runtime_error("image section out of file bounds");
+
+        View v;
+        v.code = { reinterpret_cast<const i32*>(p + h.code_offset), h.code_words };
+        v.data = { reinterpret_cast<const i32*>(p + h.data_offset), h.data_words };
+
+        if (verify_crc) {
+            u32 crc = crc32(v.code.data(), v.code.size_bytes());
+            crc = crc32(v.data.data(), v.data.size_bytes(), crc);
+            if (crc != h.crc32) throw std::runtime_error("image checksum mismatch");
+        }
+        return v;
+    }
+
+private:
+    static constexpr u32 byteswap32(u32 x) {
+        return (x >> 24) | ((x >> 8) & 0xFF00u) | ((x << 8) & 0xFF0000u) | (x << 24);
+    }
+};
+
+// Read-only mapping of an image file. The VM can execute straight out of
+// code() without copying; the MappedImage must outlive any VM that uses it.
+// On Windows the file is read into one heap buffer instead.
+class MappedImage {
+public:
+    using i32 = std::int32_t;
+
+    MappedImage() = default;
+    explicit MappedImage(const char* path, bool verify_crc = true) { open(path, verify_crc); }
+    ~MappedImage() { close(); }
+
+    MappedImage(const MappedImage&) = delete;
+    MappedImage& operator=(const MappedImage&) = delete;
+
+    void open(const char* path, bool verify_crc = true) {
+        close();
+#if defined(_WIN32)
+        std::ifstream in(path, std::ios::binary);
+        if (!in) throw std::runtime_error(std::string("Failed to open file: ") + path);
+        in.seekg(0, std::ios::end);
+        const auto n = static_cast<std::size_t>(in.tellg());
+        in.seekg(0);
+        heap_.resize((n + sizeof(i32) - 1) / sizeof(i32));
+        in.read(reinterpret_cast<char*>(heap_.data()), static_cast<std::streamsize>(n));
+        base_ = heap_.data();
+        size_ = n;
+#else
+        const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) throw std::runtime_error(std::string("Failed to open file: ") + path);
+        struct stat st {};
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error(std::string("fstat failed: ") + path);
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        if (size_ != 0) {
+            void* m = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m == MAP_FAILED) {
+                ::close(fd);
+                size_ = 0;
+                throw std::runtime_error(std::string("mmap failed: ") + path);
+            }
+            base_ = m;
+            // the interpreter walks the code front to back
+            ::madvise(base_, size_, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+#endif
+        try {
+            view_ = BytecodeImage::parse(base_ ? base_ : &empty_, size_, verify_crc);
+        }
+        catch (...) {
+            close();
+            throw;
+        }
+    }
+
+    void close() {
+#if defined(_WIN32)
+        heap_.clear();
+#else
+        if (base_) ::munmap(base_, size_);
+#endif
+        base_ = nullptr;
+        size_ = 0;
+        view_ = {};
+    }
+
+    std::span<const i32> code() const { return view_.code; }
+    std::span<const i32> data() const { return view_.data; }
+    bool legacy() const { return view_.legacy; }
+
+private:
+    void* base_ = nullptr;
+    std::size_t size_ = 0;
+    BytecodeImage::View view_;
+    std::uint32_t empty_ = 0;
+#if defined(_WIN32)
+    std::vector<i32> heap_;
+#endif
+};
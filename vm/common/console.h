@@ -0,0 +1,269 @@
+// console.h
+// Virtual console device: buffered, batched guest output.
+//
+// Guest Print output is formatted with std::to_chars into a per-VM ring
+// buffer and handed to the kernel in batches -- one write(2)/writev(2) per
+// batch -- instead of going through std::cout on every instruction.
+//
+// A batch is flushed when
+//   - the buffered bytes reach the flush threshold,
+//   - the guest halts (the VM calls flush()),
+//   - the guest executes the flush primitive,
+//   - the console is destroyed.
+//
+// In Mode::IoThread a dedicated thread drains the ring, so the guest only
+// pays for a memcpy. There is exactly one consumer and it writes bytes in
+// ring order, so guest-visible ordering is the order of the Print calls.
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+class VirtualConsole {
+public:
+    enum class Mode {
+        Sync,     // the VM thread issues the write when a batch is due
+        IoThread, // a dedicated thread issues the writes
+    };
+
+    struct Options {
+        int fd = 1;                          // stdout
+        std::size_t capacity = 64 * 1024;    // ring size, rounded up to a power of two
+        std::size_t flush_threshold = 0;     // 0 => capacity / 2
+        Mode mode = Mode::Sync;
+    };
+
+    struct Stats {
+        std::uint64_t bytes = 0;   // bytes handed to the kernel
+        std::uint64_t writes = 0;  // write/writev syscalls issued
+    };
+
+    VirtualConsole() : VirtualConsole(Options{}) {}
+
+    explicit VirtualConsole(const Options& opt)
+        : fd_(opt.fd), mode_(opt.mode) {
+        std::size_t cap = 64;
+        while (cap < opt.capacity) cap <<= 1;
+        ring_.resize(cap);
+        mask_ = cap - 1;
+        threshold_ = opt.flush_threshold ? opt.flush_threshold : cap / 2;
+        if (threshold_ > cap) threshold_ = cap;
+
+        if (mode_ == Mode::IoThread) io_thread_ = std::thread([this] { ioLoop(); });
+    }
+
+    ~VirtualConsole() {
+        try {
+            flush();
+        }
+        catch (...) {
+            // nothing sensible to do with a failed write during teardown
+        }
+        if (io_thread_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lk(mu_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            io_thread_.join();
+        }
+    }
+
+    VirtualConsole(const VirtualConsole&) = delete;
+    VirtualConsole& operator=(const VirtualConsole&) = delete;
+
+    void write(std::string_view s) {
+        while (!s.empty()) {
+            const std::size_t n = reserve(s.size());
+            copyIn(s.data(), n);
+            s.remove_prefix(n);
+        }
+    }
+
+    void writeInt(std::int32_t v) {
+        char buf[16];
+        auto r = std::to_chars(buf, buf + sizeof(buf), v);
+        write(std::string_view(buf, static_cast<std::size_t>(r.ptr - buf)));
+    }
+
+    // prefix, decimal value, newline -- the shape of every Print line
+    void printLine(std::string_view prefix, std::int32_t v) {
+        char buf[64];
+        char* p = buf;
+        if (prefix.size() > sizeof(buf) - 16) {
+            write(prefix);
+        }
+        else {
+            std::memcpy(p, prefix.data(), prefix.size());
+            p += prefix.size();
+        }
+        p = std::to_chars(p, buf + sizeof(buf) - 1, v).ptr;
+        *p++ = '\n';
+        write(std::string_view(buf, static_cast<std::size_t>(p - buf)));
+    }
+
+    // Blocks until everything buffered so far has been handed to the kernel.
+    void flush() {
+        const std::size_t target = head_.load(std::memory_order_relaxed);
+        if (tail_.load(std::memory_order_acquire) == target) return;
+
+        if (mode_ == Mode::Sync) {
+            drain(target);
+            return;
+        }
+        std::unique_lock<std::mutex> lk(mu_);
+        if (requested_ < target) requested_ = target;
+        cv_.notify_all();
+        space_cv_.wait(lk, [&] { return tail_.load(std::memory_order_acquire) >= target || io_error_; });
+        if (io_error_) throw std::runtime_error("console write failed");
+    }
+
+    std::size_t buffered() const {
+        return head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_acquire);
+    }
+
+    Stats stats() const {
+        Stats s;
+        s.bytes = bytes_.load(std::memory_order_relaxed);
+        s.writes = writes_.load(std::memory_order_relaxed);
+        return s;
+    }
+
+private:
+    // Wait for room; returns how many of `want` bytes fit right now (>= 1).
+    std::size_t reserve(std::size_t want) {
+        const std::size_t cap = ring_.size();
+        for (;;) {
+            const std::size_t used = head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_acquire);
+            const std::size_t room = cap - used;
+            if (room >= want || (room > 0 && want > cap)) return want < room ? want : room;
+            // ring full: push the current contents out first
+            flush();
+        }
+    }
+
+    void copyIn(const char* p, std::size_t n) {
+        const std::size_t h = head_.load(std::memory_order_relaxed);
+        const std::size_t off = h & mask_;
+        const std::size_t first = n < ring_.size() - off ? n : ring_.size() - off;
+        std::memcpy(ring_.data() + off, p, first);
+        if (first < n) std::memcpy(ring_.data(), p + first, n - first);
+        head_.store(h + n, std::memory_order_release);
+
+        if (h + n - tail_.load(std::memory_order_acquire) >= threshold_) {
+            if (mode_ == Mode::Sync) {
+                drain(h + n);
+            }
+            else if (!kicked_.exchange(true, std::memory_order_acq_rel)) {
+                std::lock_guard<std::mutex> lk(mu_);
+                if (requested_ < h + n) requested_ = h + n;
+                cv_.notify_all();
+            }
+        }
+    }
+
+    // Write ring bytes [tail_, target) with one syscall per contiguous batch.
+    void drain(std::size_t target) {
+        std::size_t t = tail_.load(std::memory_order_relaxed);
+        while (t < target) {
+            const std::size_t off = t & mask_;
+            const std::size_t n = target - t;
+            const std::size_t first = n < ring_.size() - off ? n : ring_.size() - off;
+            const long w = writeOut(ring_.data() + off, first, ring_.data(), n - first);
+            if (w <= 0) throw std::runtime_error("console write failed"); // 0: no progress, retrying would spin
+            t += static_cast<std::size_t>(w);
+            bytes_.fetch_add(static_cast<std::uint64_t>(w), std::memory_order_relaxed);
+            writes_.fetch_add(1, std::memory_order_relaxed);
+            tail_.store(t, std::memory_order_release);
+        }
+    }
+
+    // One syscall for up to two ring segments; returns bytes written or -1.
+    // A nonblocking fd that is full is waited on with poll(2), so the
+    // console may share a pipe or socket with an event loop.
+    long writeOut(const char* a, std::size_t na, const char* b, std::size_t nb) {
+        for (;;) {
+#if defined(_WIN32)
+            (void)b;
+            (void)nb;
+            const int w = ::_write(fd_, a, static_cast<unsigned>(na));
+#else
+            iovec iov[2] = { { const_cast<char*>(a), na }, { const_cast<char*>(b), nb } };
+            const ssize_t w = nb ? ::writev(fd_, iov, 2) : ::write(fd_, a, na);
+#endif
+            if (w < 0 && errno == EINTR) continue;
+#if !defined(_WIN32)
+            if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                pollfd p{ fd_, POLLOUT, 0 };
+                if (::poll(&p, 1, -1) >= 0 || errno == EINTR) continue;
+            }
+#endif
+            return static_cast<long>(w);
+        }
+    }
+
+    void ioLoop() {
+        std::unique_lock<std::mutex> lk(mu_);
+        for (;;) {
+            cv_.wait(lk, [&] { return stop_ || requested_ > tail_.load(std::memory_order_relaxed); });
+            if (requested_ <= tail_.load(std::memory_order_relaxed) && stop_) return;
+
+            const std::size_t target = requested_;
+            kicked_.store(false, std::memory_order_release);
+            lk.unlock();
+            bool ok = true;
+            try {
+                drain(target);
+            }
+            catch (...) {
+                ok = false;
+            }
+            lk.lock();
+            if (!ok) {
+                io_error_ = true;
+                tail_.store(target, std::memory_order_release); // drop the batch, unblock the guest
+            }
+            space_cv_.notify_all();
+        }
+    }
+
+    int fd_;
+    Mode mode_;
+    std::vector<char> ring_;
+    std::size_t mask_ = 0;
+    std::size_t threshold_ = 0;
+
+    // monotonically increasing byte counters; ring index = counter & mask_
+    std::atomic<std::size_t> head_{ 0 }; // written by the VM thread
+    std::atomic<std::size_t> tail_{ 0 }; // written by whoever drains
+
+    std::atomic<std::uint64_t> bytes_{ 0 };
+    std::atomic<std::uint64_t> writes_{ 0 };
+
+    // IoThread mode
+    std::thread io_thread_;
+    std::mutex mu_;
+    std::condition_variable cv_;       // wakes the I/O thread
+    std::condition_variable space_cv_; // wakes the VM thread after a drain
+    std::size_t requested_ = 0;        // drain up to here (guarded by mu_)
+    std::atomic<bool> kicked_{ false };
+    bool stop_ = false;
+    bool io_error_ = false;
+};
@@ -0,0 +1,153 @@
+// guard_stack.h  (Linux)
+// Fixed-size guest operand stack between two PROT_NONE guard pages, so push
+// and pop need no bounds checks: running off either end touches a guard
+// page, and the SIGSEGV becomes a guest trap instead of a crash.
+//
+//   [ guard | words rounded up to whole pages | guard ]
+//             ^ base()                          ^ limit()
+//
+// An engine runs its checked loop inside guard(). A fault on a guard page
+// of that stack during the run unwinds back to guard() with siglongjmp and
+// reports which end was hit; the engine turns that into StackOverflow or
+// StackUnderflow (trap.h). Any other SIGSEGV goes to the handler that was
+// installed before (page_dedup.h chains the same way), so several guard
+// stacks, guest memory dedup and the default crash all coexist.
+//
+// siglongjmp skips the frames between guard() and the fault without running
+// destructors: the body must not own anything with a destructor (construct
+// trace sinks and the like outside). Engine state must be in memory at the
+// faulting access: a stack op reads or writes its deepest slot before it
+// moves the stack pointer, so the fault leaves the stack as it was before
+// the instruction.
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+class GuardStack {
+public:
+    enum class Hit { None, Overflow, Underflow };
+
+    // At least `words` slots; the rest of the last page is usable too.
+    explicit GuardStack(std::size_t words) {
+        page_ = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        const std::size_t bytes = (words * sizeof(std::int32_t) + page_ - 1) / page_ * page_;
+        // reserve everything inaccessible, then open the middle; the stack
+        // pages are backed on first touch like guest memory
+        void* p = ::mmap(nullptr, bytes + 2 * page_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) throw std::runtime_error("GuardStack: mmap failed");
+        map_ = static_cast<std::byte*>(p);
+        map_size_ = bytes + 2 * page_;
+        if (::mprotect(map_ + page_, bytes, PROT_READ | PROT_WRITE) != 0) {
+            ::munmap(map_, map_size_);
+            throw std::runtime_error("GuardStack: mprotect failed");
+        }
+        base_ = reinterpret_cast<std::int32_t*>(map_ + page_);
+        capacity_ = bytes / sizeof(std::int32_t);
+        installHandler();
+    }
+
+    ~GuardStack() { if (map_) ::munmap(map_, map_size_); }
+
+    GuardStack(const GuardStack&) = delete;
+    GuardStack& operator=(const GuardStack&) = delete;
+
+    std::int32_t* base() { return base_; }
+    const std::int32_t* base() const { return base_; }
+    std::int32_t* limit() { return base_ + capacity_; }
+    std::size_t capacity() const { return capacity_; }
+
+    // Which guard page, if any, `addr` is on.
+    Hit hitAt(const void* addr) const {
+        const std::byte* a = static_cast<const std::byte*>(addr);
+        if (a >= map_ && a < map_ + page_) return Hit::Underflow;
+        if (a >= map_ + map_size_ - page_ && a < map_ + map_size_) return Hit::Overflow;
+        return Hit::None;
+    }
+
+    // Run body(); a guard page fault of this stack during it returns the end
+    // that was hit. Nests (one catch frame per thread per level) and is
+    // per-thread, so each vCPU thread can run its own guarded loop. An
+    // exception from body() propagates with the outer catch frame restored.
+    template <class F>
+    Hit guard(F&& body) {
+        Catch c;
+        c.stack = this;
+        c.outer = active_;
+        // puts the outer frame back on every way out: return, jump or throw
+        // (constructed before sigsetjmp, so the jump does not skip it)
+        struct Restore {
+            Catch* outer;
+            ~Restore() { active_ = outer; }
+        } restore{ c.outer };
+        // savemask 0: no sigprocmask syscall per run; the handler is
+        // SA_NODEFER, so SIGSEGV is not left blocked after the jump
+        if (sigsetjmp(c.env, 0) != 0) return c.hit;
+        active_ = &c;
+        // keep the store: with body() inlined, nothing the compiler sees
+        // reads active_ before the restore overwrites it, but the handler does
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        std::forward<F>(body)();
+        return Hit::None;
+    }
+
+private:
+    struct Catch {
+        sigjmp_buf env;
+        GuardStack* stack = nullptr;
+        Catch* outer = nullptr;
+        Hit hit = Hit::None;
+    };
+
+    static void installHandler() {
+        static const bool installed = [] {
+            struct sigaction sa {};
+            sa.sa_sigaction = &GuardStack::onFault;
+            sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+            sigemptyset(&sa.sa_mask);
+            return ::sigaction(SIGSEGV, &sa, &previous_) == 0;
+        }();
+        if (!installed) throw std::runtime_error("GuardStack: sigaction failed");
+    }
+
+    static void onFault(int sig, siginfo_t* si, void* ctx) {
+        // only the innermost guarded run of this thread; an outer stack
+        // faulting inside an inner run is a host bug, not a guest trap
+        Catch* c = active_;
+        if (c && si->si_code == SEGV_ACCERR) {
+            const Hit hit = c->stack->hitAt(si->si_addr);
+            if (hit != Hit::None) {
+                c->hit = hit;
+                siglongjmp(c->env, 1);
+            }
+        }
+
+        // not ours: hand over to whoever was installed before us
+        const struct sigaction& prev = previous_;
+        if (prev.sa_flags & SA_SIGINFO) {
+            prev.sa_sigaction(sig, si, ctx);
+        }
+        else if (prev.sa_handler != SIG_DFL && prev.sa_handler != SIG_IGN) {
+            prev.sa_handler(sig);
+        }
+        else {
+            ::signal(sig, SIG_DFL); // the access repeats and takes the default action
+        }
+    }
+
+    static inline thread_local Catch* active_ = nullptr;
+    static inline struct sigaction previous_ {};
+
+    std::byte* map_ = nullptr;
+    std::size_t map_size_ = 0;
+    std::size_t page_ = 0;
+    std::int32_t* base_ = nullptr;
+    std::size_t capacity_ = 0;
+};
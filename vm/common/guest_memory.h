@@ -0,0 +1,237 @@
+// guest_memory.h
+// Guest-physical memory backed by an anonymous mapping with demand paging.
+//
+// Constructing a GuestMemory reserves address space only: no page is
+// allocated or zeroed until the guest touches it, and untouched pages read as
+// zero (the kernel maps them on first access). A VM with 4 MB of guest
+// memory whose guest only uses a few hundred words therefore costs one or two
+// resident pages, and creating it is one mmap(2) instead of a 4 MB memset.
+//
+// residentBytes() reports how much of the mapping is actually backed by RAM
+// (mincore(2)); discard() hands a range back to the kernel, which reads as
+// zero again afterwards.
+//
+// Options select the backing for large guests:
+//   pages      Base: 4 KiB pages. Transparent: 2 MiB-aligned mapping with
+//              MADV_HUGEPAGE so the kernel can back it with THP.
+//              HugeTlb: MAP_HUGETLB from the reserved pool, falling back to
+//              Transparent when the pool is empty or the kernel lacks it.
+//   numa_node  bind the mapping to one node with mbind(2) before any page
+//              is touched. -1 keeps the default first-touch policy: call
+//              prefault() from the thread that will run the vCPU to place
+//              the pages on that thread's node.
+//   mergeable  register with the process-wide page deduplicator
+//              (page_dedup.h, like madvise(MADV_MERGEABLE) for KSM).
+//              Linux, non-hugetlb mappings only.
+// Every option degrades gracefully; backing() reports what was applied.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX // keep std::numeric_limits<>::max() usable
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "page_dedup.h"
+#endif
+
+class GuestMemory {
+public:
+    static constexpr std::size_t PAGE_SIZE = 4096;
+    static constexpr std::size_t HUGE_PAGE_SIZE = 2u << 20;
+
+    enum class Pages {
+        Base,        // 4 KiB
+        Transparent, // THP via madvise(MADV_HUGEPAGE)
+        HugeTlb,     // MAP_HUGETLB, else Transparent
+    };
+
+    struct Options {
+        Pages pages = Pages::Base;
+        int numa_node = -1; // -1 => first touch
+        bool mergeable = false;
+    };
+
+    // What the constructor actually got.
+    struct Backing {
+        bool hugetlb = false;
+        bool transparent = false; // MADV_HUGEPAGE accepted
+        bool numa_bound = false;  // mbind succeeded
+        bool mergeable = false;   // registered with PageDedup
+    };
+
+    GuestMemory() = default;
+
+    explicit GuestMemory(std::size_t bytes) : GuestMemory(bytes, Options{}) {}
+
+    GuestMemory(std::size_t bytes, const Options& opt) {
+        if (bytes == 0) return;
+        size_ = (bytes + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+#if defined(_WIN32)
+        // committed pages are still zero-filled on first touch; large pages
+        // need SeLockMemoryPrivilege, so the options fall back to Base
+        (void)opt;
+        base_ = static_cast<std::byte*>(::VirtualAlloc(nullptr, size_, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+        if (!base_) throw std::bad_alloc();
+#else
+        const int prot = PROT_READ | PROT_WRITE;
+        const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+
+        if (opt.pages == Pages::HugeTlb) {
+            const std::size_t huge = (size_ + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+            // no MAP_NORESERVE here: reserving up front makes an empty pool
+            // fail now instead of SIGBUS on first touch
+            void* p = ::mmap(nullptr, huge, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                base_ = static_cast<std::byte*>(p);
+                size_ = huge;
+                backing_.hugetlb = true;
+            }
+        }
+        if (!base_ && opt.pages != Pages::Base) {
+            // over-map by one huge page and trim, so the range is 2 MiB aligned
+            // and every 2 MiB of it can be a huge page
+            const std::size_t len = (size_ + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+            void* p = ::mmap(nullptr, len + HUGE_PAGE_SIZE, prot, flags, -1, 0);
+            if (p == MAP_FAILED) throw std::bad_alloc();
+            const std::uintptr_t raw = reinterpret_cast<std::uintptr_t>(p);
+            const std::uintptr_t aligned = (raw + HUGE_PAGE_SIZE - 1) & ~std::uintptr_t(HUGE_PAGE_SIZE - 1);
+            if (aligned > raw) ::munmap(p, aligned - raw);
+            const std::uintptr_t end = raw + len + HUGE_PAGE_SIZE;
+            if (end > aligned + len) ::munmap(reinterpret_cast<void*>(aligned + len), end - (aligned + len));
+            base_ = reinterpret_cast<std::byte*>(aligned);
+            size_ = len;
+            backing_.transparent = ::madvise(base_, size_, MADV_HUGEPAGE) == 0;
+        }
+        if (!base_) {
+            void* p = ::mmap(nullptr, size_, prot, flags, -1, 0);
+            if (p == MAP_FAILED) throw std::bad_alloc();
+            base_ = static_cast<std::byte*>(p);
+        }
+        if (opt.numa_node >= 0) backing_.numa_bound = bindToNode(opt.numa_node);
+        if (opt.mergeable && !backing_.hugetlb) backing_.mergeable = PageDedup::instance().add(base_, size_);
+#endif
+    }
+
+    ~GuestMemory() { unmap(); }
+
+    GuestMemory(GuestMemory&& o) noexcept
+        : base_(std::exchange(o.base_, nullptr)), size_(std::exchange(o.size_, 0)),
+          backing_(std::exchange(o.backing_, Backing{})) {}
+
+    GuestMemory& operator=(GuestMemory&& o) noexcept {
+        if (this != &o) {
+            unmap();
+            base_ = std::exchange(o.base_, nullptr);
+            size_ = std::exchange(o.size_, 0);
+            backing_ = std::exchange(o.backing_, Backing{});
+        }
+        return *this;
+    }
+
+    GuestMemory(const GuestMemory&) = delete;
+    GuestMemory& operator=(const GuestMemory&) = delete;
+
+    std::byte* data() { return base_; }
+    const std::byte* data() const { return base_; }
+    std::size_t size() const { return size_; } // bytes, a whole number of pages
+    const Backing& backing() const { return backing_; }
+
+    // The memory viewed as an array of 32-bit guest words.
+    template <class Word>
+    Word* as() {
+        static_assert(sizeof(Word) == 4, "guest words are 32-bit");
+        return reinterpret_cast<Word*>(base_);
+    }
+    template <class Word>
+    const Word* as() const {
+        static_assert(sizeof(Word) == 4, "guest words are 32-bit");
+        return reinterpret_cast<const Word*>(base_);
+    }
+
+    // Bytes of the mapping currently backed by RAM.
+    std::size_t residentBytes() const {
+        if (!base_) return 0;
+#if defined(_WIN32)
+        return size_; // not tracked: commit charge is the whole mapping
+#else
+        std::vector<unsigned char> vec(size_ / PAGE_SIZE);
+        if (::mincore(base_, size_, vec.data()) != 0) return size_;
+        std::size_t pages = 0;
+        for (unsigned char v : vec) pages += v & 1u;
+        return pages * PAGE_SIZE;
+#endif
+    }
+
+    // Fault every page in now, from the calling thread. Under the default
+    // first-touch policy that places the memory on this thread's NUMA node.
+    void prefault() {
+        volatile std::byte* p = base_;
+        const std::size_t step = backing_.hugetlb ? HUGE_PAGE_SIZE : PAGE_SIZE;
+        for (std::size_t off = 0; off < size_; off += step) p[off] = p[off];
+    }
+
+    // Release the whole pages inside [offset, offset + len); they read as zero
+    // afterwards and no longer count as resident. hugetlb mappings release
+    // whole 2 MiB pages only. False if a merged page (PageDedup) could not be
+    // made private again: that page keeps its contents and stays shared.
+    bool discard(std::size_t offset, std::size_t len) {
+        if (offset >= size_) return true;
+        if (len > size_ - offset) len = size_ - offset;
+        const std::size_t gran = backing_.hugetlb ? HUGE_PAGE_SIZE : PAGE_SIZE;
+        const std::size_t first = (offset + gran - 1) & ~(gran - 1);
+        const std::size_t last = (offset + len) & ~(gran - 1);
+        if (first >= last) return true;
+        bool ok = true;
+#if !defined(_WIN32)
+        if (backing_.mergeable) ok = PageDedup::instance().unshare(base_ + first, last - first);
+#endif
+#if defined(_WIN32)
+        // decommit + recommit: the pages come back zero-filled on demand
+        ::VirtualFree(base_ + first, last - first, MEM_DECOMMIT);
+        ::VirtualAlloc(base_ + first, last - first, MEM_COMMIT, PAGE_READWRITE);
+#else
+        ::madvise(base_ + first, last - first, MADV_DONTNEED);
+#endif
+        return ok;
+    }
+
+private:
+#if !defined(_WIN32)
+    // mbind(2) through syscall(2), so there is no libnuma dependency.
+    // Fails (returns false) on kernels without NUMA support or bad nodes.
+    bool bindToNode(int node) {
+        constexpr int MPOL_BIND_ = 2;
+        if (node >= static_cast<int>(8 * sizeof(unsigned long))) return false;
+        const unsigned long mask = 1ul << node;
+        // the kernel reads maxnode - 1 bits, so + 1 for node 63
+        return ::syscall(SYS_mbind, base_, size_, MPOL_BIND_, &mask, 8 * sizeof(mask) + 1, 0u) == 0;
+    }
+#endif
+
+    void unmap() {
+        if (!base_) return;
+#if defined(_WIN32)
+        ::VirtualFree(base_, 0, MEM_RELEASE);
+#else
+        if (backing_.mergeable) PageDedup::instance().remove(base_);
+        ::munmap(base_, size_);
+#endif
+        base_ = nullptr;
+        size_ = 0;
+    }
+
+    std::byte* base_ = nullptr;
+    std::size_t size_ = 0;
+    Backing backing_;
+};
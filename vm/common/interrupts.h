@@ -0,0 +1,565 @@
+// interrupts.h
+// Virtual interrupt controller and timer: asynchronous events for a guest
+// without polling.
+//
+// InterruptController has 32 lines with pending and enable registers. A VM
+// never looks at those in its hot loop. It checks one word,
+// exitRequest(), at every instruction (lesson1, lesson3) or block boundary
+// (MiniTCGVM), and only takes the slow path when it is non-zero:
+//
+//   EXIT_IRQ     an enabled line is pending and the CPU accepts interrupts
+//   EXIT_STOP    the host asked the VM to stop (requestStop)
+//   EXIT_SAMPLE  a profiler wants the current guest pc (requestSample)
+//
+// The word is recomputed under a mutex on every control-plane change (raise,
+// claim, enable, CPU mask), so any thread may raise a line and the VM sees
+// it at its next boundary.
+//
+// Guest side: `vec` (pc --) installs the handler and unmasks the CPU. On
+// delivery the VM masks the CPU, claims the lowest pending line, pushes the
+// line number and jumps to the handler; `iret` (line --) pops it and resumes
+// the interrupted instruction stream. Handlers do not nest.
+//
+// VirtualTimer raises a line periodically, either every `period` guest
+// instructions (counted by the VM: a countdown folded into the same branch as
+// the exit check) or every `period` microseconds of host time (a timer
+// thread).
+//
+// The same countdown ends time slices: InterruptCpu::setSlice(n) makes the VM
+// leave its run loop after about n instructions (Action::Yield) with its
+// state intact, so a scheduler (scheduler.h) can multiplex many VMs over a
+// few threads, and drives instruction-count sampling for the profiler
+// (profiler.h): the VM hands its pc to a PcSampler from the slow path.
+//
+// The countdown also keeps the instruction count that stamps record/replay
+// events (replay.h): InterruptCpu logs each delivered interrupt, or when
+// replaying delivers them from the log at their counts, in the same slow
+// path.
+//
+// As an MmioDevice (lesson3) the controller exposes
+//   0 PENDING  R  pending lines    W  1 bits clear (acknowledge)
+//   1 ENABLE   RW enabled lines
+//   2 RAISE    W  raise line `value` (software interrupt)
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "mmio.h"
+#include "replay.h"
+
+class InterruptController final : public MmioDevice {
+public:
+    using u32 = std::uint32_t;
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr u32 LINES = 32;
+    static constexpr u32 EXIT_IRQ = 1u;
+    static constexpr u32 EXIT_STOP = 2u;
+    static constexpr u32 EXIT_SAMPLE = 4u;
+
+    enum Reg : u32 { PENDING = 0, ENABLE = 1, RAISE = 2, WORDS = 3 };
+
+    struct Stats {
+        std::uint64_t raised = 0;
+        std::uint64_t delivered = 0;
+        std::uint64_t coalesced = 0;  // raised while already pending
+        double latency_ns_total = 0;  // raise -> handler entry
+        double latency_ns_max = 0;
+        double latencyAvgNs() const { return delivered ? latency_ns_total / double(delivered) : 0.0; }
+    };
+
+    const char* name() const override { return "intc"; }
+
+    // The combined flag the VM polls; relaxed loads are enough, the slow
+    // path takes the mutex.
+    const std::atomic<u32>& exitRequest() const { return exit_; }
+
+    void raise(u32 line) {
+        check(line);
+        std::lock_guard<std::mutex> lk(mu_);
+        ++stats_.raised;
+        if (pending_ & bit(line)) {
+            ++stats_.coalesced;
+            return;
+        }
+        pending_ |= bit(line);
+        raised_at_[line] = Clock::now();
+        update();
+    }
+
+    void clear(u32 mask) {
+        std::lock_guard<std::mutex> lk(mu_);
+        pending_ &= ~mask;
+        update();
+    }
+
+    void setEnabled(u32 mask) {
+        std::lock_guard<std::mutex> lk(mu_);
+        enabled_ = mask;
+        update();
+    }
+
+    void enable(u32 line) {
+        check(line);
+        std::lock_guard<std::mutex> lk(mu_);
+        enabled_ |= bit(line);
+        update();
+    }
+
+    // VM side: whether the CPU accepts interrupts (set by vec and iret,
+    // cleared on handler entry).
+    void setCpuEnabled(bool on) {
+        std::lock_guard<std::mutex> lk(mu_);
+        cpu_enabled_ = on;
+        update();
+    }
+
+    // VM side, on EXIT_IRQ: take the lowest deliverable line, mark it no
+    // longer pending and mask the CPU. Returns LINES if nothing is left.
+    u32 claim() {
+        std::lock_guard<std::mutex> lk(mu_);
+        const u32 ready = cpu_enabled_ ? pending_ & enabled_ : 0u;
+        if (!ready) return LINES;
+        u32 line = 0;
+        while (!(ready & bit(line))) ++line;
+        pending_ &= ~bit(line);
+        cpu_enabled_ = false;
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - raised_at_[line]).count();
+        ++stats_.delivered;
+        stats_.latency_ns_total += ns;
+        if (ns > stats_.latency_ns_max) stats_.latency_ns_max = ns;
+        update();
+        return line;
+    }
+
+    void requestStop() {
+        std::lock_guard<std::mutex> lk(mu_);
+        stop_ = true;
+        update();
+    }
+
+    // VM side, after honouring a stop request.
+    void clearStop() {
+        std::lock_guard<std::mutex> lk(mu_);
+        stop_ = false;
+        update();
+    }
+
+    // Host-timer sampling: the VM records its pc at the next boundary.
+    void requestSample() {
+        std::lock_guard<std::mutex> lk(mu_);
+        sample_ = true;
+        update();
+    }
+
+    void clearSample() {
+        std::lock_guard<std::mutex> lk(mu_);
+        sample_ = false;
+        update();
+    }
+
+    u32 pending() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return pending_;
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return stats_;
+    }
+
+    void resetStats() {
+        std::lock_guard<std::mutex> lk(mu_);
+        stats_ = Stats{};
+    }
+
+    u32 read(u32 offset) override {
+        std::lock_guard<std::mutex> lk(mu_);
+        switch (offset) {
+        case PENDING: return pending_;
+        case ENABLE: return enabled_;
+        default: return 0;
+        }
+    }
+
+    void write(u32 offset, u32 value) override {
+        switch (offset) {
+        case PENDING: clear(value); break;
+        case ENABLE: setEnabled(value); break;
+        case RAISE: raise(value); break;
+        default: break;
+        }
+    }
+
+private:
+    static u32 bit(u32 line) { return 1u << line; }
+
+    static void check(u32 line) {
+        if (line >= LINES) throw std::out_of_range("interrupt line out of range");
+    }
+
+    // caller holds mu_
+    void update() {
+        u32 e = 0;
+        if (cpu_enabled_ && (pending_ & enabled_)) e |= EXIT_IRQ;
+        if (stop_) e |= EXIT_STOP;
+        if (sample_) e |= EXIT_SAMPLE;
+        exit_.store(e, std::memory_order_release);
+    }
+
+    mutable std::mutex mu_;
+    std::atomic<u32> exit_{ 0 };
+    u32 pending_ = 0;
+    u32 enabled_ = 0;
+    bool cpu_enabled_ = false;
+    bool stop_ = false;
+    bool sample_ = false;
+    Clock::time_point raised_at_[LINES]{};
+    Stats stats_;
+};
+
+class VirtualTimer {
+public:
+    enum class Mode {
+        Instructions, // every `period` guest instructions, counted by the VM
+        HostTime,     // every `period` microseconds, from a timer thread
+    };
+
+    VirtualTimer(InterruptController& irq, std::uint32_t line, Mode mode, std::uint64_t period)
+        : irq_(irq), line_(line), mode_(mode), period_(period) {
+        if (period_ == 0) throw std::invalid_argument("timer period must be non-zero");
+        irq_.enable(line_);
+        if (mode_ == Mode::HostTime) thread_ = std::thread([this] { tickLoop(); });
+    }
+
+    ~VirtualTimer() {
+        if (thread_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lk(mu_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            thread_.join();
+        }
+    }
+
+    VirtualTimer(const VirtualTimer&) = delete;
+    VirtualTimer& operator=(const VirtualTimer&) = delete;
+
+    Mode mode() const { return mode_; }
+    std::uint64_t period() const { return period_; }
+    std::uint64_t ticks() const { return ticks_.load(std::memory_order_relaxed); }
+
+    // Instructions mode: the VM calls this each time its countdown of
+    // period() instructions runs out.
+    void expire() {
+        ticks_.fetch_add(1, std::memory_order_relaxed);
+        irq_.raise(line_);
+    }
+
+    // Countdown a VM loads for this timer (never reaches zero when the timer
+    // runs on host time or there is none).
+    static std::uint64_t countdown(const VirtualTimer* t) {
+        return t && t->mode_ == Mode::Instructions ? t->period_ : std::numeric_limits<std::uint64_t>::max();
+    }
+
+private:
+    void tickLoop() {
+        std::unique_lock<std::mutex> lk(mu_);
+        auto next = InterruptController::Clock::now();
+        while (!stop_) {
+            next += std::chrono::microseconds(period_);
+            if (cv_.wait_until(lk, next, [&] { return stop_; })) return;
+            expire();
+        }
+    }
+
+    InterruptController& irq_;
+    std::uint32_t line_;
+    Mode mode_;
+    std::uint64_t period_;
+    std::atomic<std::uint64_t> ticks_{ 0 };
+
+    std::thread thread_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+};
+
+// Receives guest-pc samples from a VM's slow path (profiler.h). `pc` is a
+// program index; MiniTCGVM samples at block boundaries and reports the block
+// that just ran as [pc, tb_end); interpreters pass tb_end == 0.
+class PcSampler {
+public:
+    virtual ~PcSampler() = default;
+    // Guest instructions until the next sample, counted by the VM (asked
+    // again after every sample); 0 if samples come from a host timer through
+    // InterruptController::requestSample().
+    virtual std::uint64_t nextInterval() = 0;
+    virtual void sample(std::size_t pc, std::size_t tb_end, bool in_handler) = 0;
+};
+
+// Per-VM side of the controller: the handler vector, the interrupted pc and
+// the instruction countdown. The VM keeps the countdown in a register while
+// it runs and hands it back through the slow path.
+class InterruptCpu {
+public:
+    using u32 = std::uint32_t;
+
+    enum class Action {
+        None,    // nothing deliverable (or only the countdown expired)
+        Deliver, // enter the handler for `line`
+        Stop,    // host asked the VM to stop; state is resumable
+        Yield,   // the time slice ran out; state is resumable
+    };
+
+    static constexpr std::size_t NO_VECTOR = std::numeric_limits<std::size_t>::max();
+    static constexpr std::uint64_t NEVER = std::numeric_limits<std::uint64_t>::max();
+
+    void attach(InterruptController* irq, VirtualTimer* timer = nullptr) {
+        if (timer && !irq) throw std::invalid_argument("timer without an interrupt controller");
+        irq_ = irq;
+        timer_ = timer;
+        exit_ = irq ? &irq->exitRequest() : &never_;
+        timer_left_ = replaying() ? NEVER : VirtualTimer::countdown(timer);
+        cpuEnable(vector_ != NO_VECTOR && !in_handler_);
+    }
+
+    // Record into or replay from `log` (replay.h); null detaches. Replaying
+    // ignores the controller's lines and the timer; `patch` applies logged
+    // code patches (MiniTCGVM). Stamps count from here.
+    void attachReplay(ReplayLog* log, std::function<void(std::uint64_t, std::uint64_t)> patch = {}) {
+        log_ = log;
+        patch_ = std::move(patch);
+        replay_base_ = retired_;
+        timer_left_ = replaying() ? NEVER : VirtualTimer::countdown(timer_);
+        cpuEnable(vector_ != NO_VECTOR && !in_handler_);
+    }
+    bool recording() const { return log_ && !log_->replaying(); }
+    bool replaying() const { return log_ && log_->replaying(); }
+
+    // Instructions counted since attachReplay: between runs, or inside one
+    // from the running loop's `countdown`.
+    std::uint64_t retired() const { return retired_ - replay_base_; }
+    std::uint64_t retired(std::uint64_t countdown) const { return retired() + (armed_ - countdown); }
+
+    // Interpreters count an instruction at the exit check before it; one
+    // whose check returned Stop or Yield did not run, and is counted again
+    // on resume.
+    void undoCheck() { --retired_; }
+
+    // Block engines saturate the countdown at 0; the `n` instructions a
+    // block ran past it still count.
+    void overshoot(std::uint64_t n) { retired_ += n; }
+
+    // A device read during the instruction at `countdown` into `v`: read(v)
+    // when live, logged when recording; the logged value when replaying.
+    // read(v) returns false when the device has to wait (mmio.h); nothing is
+    // logged then, the instruction runs again later.
+    template <class Read>
+    bool deviceRead(std::uint64_t countdown, u32& v, Read&& read) {
+        if (!log_) [[likely]] return read(v);
+        if (replaying()) {
+            v = static_cast<u32>(log_->takeRead(retired(countdown)));
+            return true;
+        }
+        if (!read(v)) return false;
+        log_->record(ReplayLog::Kind::Read, retired(countdown), v);
+        return true;
+    }
+
+    // A code patch between runs, logged when recording.
+    void recordPatch(std::size_t index, u32 insn) {
+        if (replaying()) throw std::logic_error("patches come from the replay log while replaying");
+        if (log_) log_->record(ReplayLog::Kind::Patch, retired(), index, insn);
+    }
+
+    const std::atomic<u32>& exitRequest() const { return *exit_; }
+
+    // Host-timer samplers need a controller to reach the VM through.
+    void attachSampler(PcSampler* sampler) {
+        const std::uint64_t first = sampler ? sampler->nextInterval() : 0;
+        if (sampler && first == 0 && !irq_) {
+            throw std::invalid_argument("host-timer sampling needs an interrupt controller");
+        }
+        sampler_ = sampler;
+        sample_left_ = first ? first : NEVER;
+    }
+
+    // The countdown a run loop starts from (the nearer of the next timer
+    // tick and the end of the slice), and what is left of it when the loop
+    // returns.
+    std::uint64_t countdown() {
+        armed_ = std::min({ timer_left_, slice_left_, sample_left_, replayLeft() });
+        return armed_;
+    }
+    void saveCountdown(std::uint64_t c) {
+        consume(armed_ - c);
+        armed_ = c;
+    }
+
+    // Time slice for the next run: leave the loop with Action::Yield after
+    // about `insns` instructions (block granularity on MiniTCGVM). 0 means
+    // no limit. sliceExpired() tells a yield from a halt or a stop.
+    void setSlice(std::uint64_t insns) {
+        // +1: the countdown runs out at the check before the instruction
+        slice_left_ = insns ? insns + 1 : NEVER;
+        slice_expired_ = false;
+    }
+    bool sliceExpired() const { return slice_expired_; }
+
+    // vec: install the handler (a program index) and accept interrupts.
+    void installVector(std::size_t pc) {
+        vector_ = pc;
+        if (!in_handler_) cpuEnable(true);
+    }
+
+    std::size_t vector() const { return vector_; }
+    bool inHandler() const { return in_handler_; }
+
+    // Slow path, taken when the exit word is non-zero or `countdown` hit 0.
+    // `pc` (program index of the next instruction, or the block that just
+    // ran on MiniTCGVM) is only used for profiler samples.
+    // On Deliver the VM saves `resume_pc` via enter() and jumps to vector().
+    // On Stop and Yield it saves its state and returns from the run loop.
+    Action service(std::uint64_t& countdown, u32& line, std::size_t pc, std::size_t tb_end = 0) {
+        consume(armed_ - countdown);
+        if (timer_left_ == 0) {
+            timer_left_ = VirtualTimer::countdown(timer_);
+            timer_->expire();
+        }
+        bool take_sample = false;
+        if (sample_left_ == 0) {
+            sample_left_ = sampler_->nextInterval();
+            take_sample = true;
+        }
+        const bool yield = slice_left_ == 0;
+        if (yield) slice_left_ = NEVER;
+        countdown = this->countdown();
+        const u32 e = exit_->load(std::memory_order_acquire);
+        if (e & InterruptController::EXIT_SAMPLE) {
+            irq_->clearSample();
+            take_sample = sampler_ != nullptr;
+        }
+        if (take_sample) sampler_->sample(pc, tb_end, in_handler_);
+        if (e & InterruptController::EXIT_STOP) {
+            irq_->clearStop();
+            return Action::Stop;
+        }
+        if (yield) { // a pending line is taken on resume
+            slice_expired_ = true;
+            return Action::Yield;
+        }
+        if (replaying()) return replay(countdown, line);
+        if ((e & InterruptController::EXIT_IRQ) && vector_ != NO_VECTOR && !in_handler_) {
+            line = irq_->claim();
+            if (line < InterruptController::LINES) {
+                if (log_) log_->record(ReplayLog::Kind::Irq, retired(), line);
+                return Action::Deliver;
+            }
+        }
+        return Action::None;
+    }
+
+    void enter(std::size_t resume_pc) {
+        saved_pc_ = resume_pc;
+        in_handler_ = true;
+    }
+
+    // iret: returns the pc to resume at.
+    std::size_t leave() {
+        if (!in_handler_) throw std::runtime_error("iret outside an interrupt handler");
+        in_handler_ = false;
+        cpuEnable(true);
+        return saved_pc_;
+    }
+
+    // loadProgram: a new program has no handler yet. The slice is kept.
+    void reset() {
+        vector_ = NO_VECTOR;
+        in_handler_ = false;
+        timer_left_ = replaying() ? NEVER : VirtualTimer::countdown(timer_);
+        cpuEnable(false);
+    }
+
+private:
+    // `n` instructions ran since the countdown was armed.
+    void consume(std::uint64_t n) {
+        retired_ += n;
+        timer_left_ -= std::min(n, timer_left_);
+        slice_left_ -= std::min(n, slice_left_);
+        sample_left_ -= std::min(n, sample_left_);
+    }
+
+    // While replaying the controller never sees the CPU accept interrupts,
+    // so its lines cannot raise EXIT_IRQ; they come from the log.
+    void cpuEnable(bool on) {
+        if (irq_) irq_->setCpuEnabled(on && !replaying());
+    }
+
+    // Instructions until the next logged interrupt or patch.
+    std::uint64_t replayLeft() const {
+        if (!replaying()) return NEVER;
+        const ReplayLog::Event* ev = log_->nextAsync();
+        if (!ev) return NEVER;
+        if (ev->stamp < retired()) {
+            throw std::runtime_error("replay diverged: event logged at " + std::to_string(ev->stamp) +
+                                     " not reached, now at " + std::to_string(retired()));
+        }
+        return ev->stamp - retired();
+    }
+
+    // Slow path while replaying: apply the patches due now, then deliver
+    // the interrupt due now, if any. countdown() was armed before the
+    // events were taken; re-arm it.
+    Action replay(std::uint64_t& countdown, u32& line) {
+        Action action = Action::None;
+        for (const ReplayLog::Event* ev; (ev = log_->nextAsync()) && ev->stamp == retired();) {
+            if (ev->kind == ReplayLog::Kind::Patch) {
+                if (!patch_) throw std::runtime_error("replay log patches code this VM cannot patch");
+                const std::uint64_t index = ev->a, insn = ev->b;
+                log_->popAsync();
+                patch_(index, insn);
+                continue;
+            }
+            if (vector_ == NO_VECTOR || in_handler_) {
+                throw std::runtime_error("replay diverged: interrupt logged at " + std::to_string(ev->stamp) +
+                                         " while the guest does not accept one");
+            }
+            line = static_cast<u32>(ev->a);
+            log_->popAsync();
+            action = Action::Deliver;
+            break;
+        }
+        countdown = this->countdown();
+        return action;
+    }
+
+    InterruptController* irq_ = nullptr;
+    VirtualTimer* timer_ = nullptr;
+    PcSampler* sampler_ = nullptr;
+    static inline const std::atomic<u32> never_{ 0 };
+    const std::atomic<u32>* exit_ = &never_;
+    std::uint64_t timer_left_ = NEVER;
+    std::uint64_t slice_left_ = NEVER;
+    std::uint64_t sample_left_ = NEVER;
+    std::uint64_t armed_ = NEVER; // value the running loop's countdown started from
+    std::uint64_t retired_ = 0;   // instructions consumed from countdowns, ever
+    ReplayLog* log_ = nullptr;
+    std::function<void(std::uint64_t, std::uint64_t)> patch_;
+    std::uint64_t replay_base_ = 0; // retired_ at attachReplay
+    bool slice_expired_ = false;
+    std::size_t vector_ = NO_VECTOR;
+    std::size_t saved_pc_ = 0;
+    bool in_handler_ = false;
+};
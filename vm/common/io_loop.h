@@ -0,0 +1,355 @@
+// io_loop.h  (Linux)
+// Event loop for guests that wait on I/O. The VM run loop is a C++20
+// coroutine (VmTask, e.g. lesson3's runAsync()) that suspends where a device
+// access has to wait (mmio.h) and is resumed by epoll once the device's fd
+// is readable. A waiting guest holds its VM and a coroutine frame of a few
+// hundred bytes, not a parked thread with its stack.
+//
+//   IoLoop loop(4);                                  // 4 loop threads
+//   loop.spawn(vm.runAsync(loop), [](std::exception_ptr error) { ... });
+//   loop.wait();
+//
+// Each loop thread has its own epoll instance and run queue. spawn() deals
+// tasks out round-robin and a task stays on its thread, so its fds are
+// registered with one epoll only and resuming it takes no lock. Inside a
+// task:
+//   co_await loop.readable(fd)  suspend until fd is readable
+//   co_await loop.yield()       go to the back of the run queue (a time
+//                               slice ran out)
+//
+// fds are watched edge-triggered and stay registered until closed. The
+// device checks before it hands out its fd, and the thread only collects
+// events after the task has suspended, so an edge between the check and
+// the wait is still seen. Several tasks may wait on one fd: an edge resumes
+// all of them, and those whose access still cannot go ahead wait again
+// (EventDevice shares one eventfd among many guests this way).
+//
+// Like VmScheduler, destruction first waits for every spawned task, so a
+// task still waiting on an fd nobody will write keeps it alive.
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+class IoLoop;
+
+// A guest run as a coroutine, started by IoLoop::spawn(). Owns the frame
+// until then.
+class VmTask {
+public:
+    struct promise_type {
+        IoLoop* loop = nullptr;
+        std::function<void(std::exception_ptr)> done;
+        std::exception_ptr error;
+
+        struct Final {
+            bool await_ready() noexcept { return false; }
+            void await_suspend(std::coroutine_handle<promise_type> h) noexcept;
+            void await_resume() noexcept {}
+        };
+
+        VmTask get_return_object() { return VmTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; } // runs once spawned
+        Final final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { error = std::current_exception(); }
+
+        // frame sizes, for the memory a suspended guest costs
+        static void* operator new(std::size_t bytes) {
+            frame_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+            return ::operator new(bytes);
+        }
+        static void operator delete(void* p, std::size_t bytes) {
+            frame_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+            ::operator delete(p);
+        }
+    };
+    using Handle = std::coroutine_handle<promise_type>;
+
+    VmTask(VmTask&& o) noexcept : h_(std::exchange(o.h_, {})) {}
+    VmTask& operator=(VmTask&& o) noexcept {
+        if (this != &o) {
+            if (h_) h_.destroy();
+            h_ = std::exchange(o.h_, {});
+        }
+        return *this;
+    }
+    ~VmTask() {
+        if (h_) h_.destroy();
+    }
+
+    Handle release() { return std::exchange(h_, {}); }
+
+    // Bytes in coroutine frames of all live tasks.
+    static std::size_t liveFrameBytes() { return frame_bytes_.load(std::memory_order_relaxed); }
+
+private:
+    explicit VmTask(Handle h) : h_(h) {}
+    Handle h_;
+
+    static inline std::atomic<std::size_t> frame_bytes_{ 0 };
+};
+
+class IoLoop {
+public:
+    // Called on the loop thread once the task has finished; `error` is set
+    // if it threw. Must not throw.
+    using Done = std::function<void(std::exception_ptr error)>;
+
+    struct Stats {
+        std::uint64_t tasks = 0;   // finished
+        std::uint64_t resumes = 0;
+        std::uint64_t waits = 0;   // co_await readable()
+        std::uint64_t yields = 0;
+        std::uint64_t wakeups = 0; // epoll_wait calls that returned events
+    };
+
+    explicit IoLoop(unsigned threads = 1) {
+        if (threads == 0) threads = 1;
+        for (unsigned i = 0; i < threads; ++i) threads_.push_back(std::make_unique<Thread>());
+        for (auto& t : threads_) t->thread = std::thread([this, p = t.get()] { threadLoop(*p); });
+    }
+
+    // Finishes every spawned task, then stops the threads.
+    ~IoLoop() {
+        wait();
+        stop_.store(true);
+        for (auto& t : threads_) t->wake();
+        for (auto& t : threads_) t->thread.join();
+    }
+
+    IoLoop(const IoLoop&) = delete;
+    IoLoop& operator=(const IoLoop&) = delete;
+
+    unsigned threads() const { return static_cast<unsigned>(threads_.size()); }
+
+    // Start `task` on the next loop thread.
+    void spawn(VmTask task, Done done = {}) {
+        VmTask::Handle h = task.release();
+        if (!h) throw std::invalid_argument("spawn: empty task");
+        h.promise().loop = this;
+        h.promise().done = std::move(done);
+        outstanding_.fetch_add(1, std::memory_order_relaxed);
+        threads_[next_.fetch_add(1, std::memory_order_relaxed) % threads()]->post(h);
+    }
+
+    // Block until every task spawned so far has finished.
+    void wait() {
+        std::unique_lock<std::mutex> lk(done_mu_);
+        done_cv_.wait(lk, [&] { return outstanding_.load(std::memory_order_acquire) == 0; });
+    }
+
+    // co_await loop.readable(fd): resume on this task's loop thread once
+    // `fd` is readable.
+    auto readable(int fd) {
+        struct Awaiter {
+            int fd;
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) { current().watch(fd, h); }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{ fd };
+    }
+
+    // co_await loop.yield(): let the other ready tasks of this thread run.
+    auto yield() {
+        struct Awaiter {
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) {
+                Thread& t = current();
+                bump(t.yields);
+                t.ready.push_back(h);
+            }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{};
+    }
+
+    Stats stats() const {
+        Stats s;
+        for (const auto& t : threads_) {
+            s.tasks += t->tasks.load(std::memory_order_relaxed);
+            s.resumes += t->resumes.load(std::memory_order_relaxed);
+            s.waits += t->waits.load(std::memory_order_relaxed);
+            s.yields += t->yields.load(std::memory_order_relaxed);
+            s.wakeups += t->wakeups.load(std::memory_order_relaxed);
+        }
+        return s;
+    }
+
+private:
+    friend struct VmTask::promise_type::Final;
+
+    struct alignas(64) Thread {
+        int epfd = -1;
+        int wake_fd = -1; // eventfd: spawn() from another thread
+        std::thread thread;
+
+        std::mutex mu;
+        std::vector<std::coroutine_handle<>> inbox; // from other threads, under mu
+
+        // owner only
+        std::deque<std::coroutine_handle<>> ready;
+        std::vector<std::vector<std::coroutine_handle<>>> waiters; // by fd
+
+        alignas(64) std::atomic<std::uint64_t> tasks{ 0 };
+        std::atomic<std::uint64_t> resumes{ 0 };
+        std::atomic<std::uint64_t> waits{ 0 };
+        std::atomic<std::uint64_t> yields{ 0 };
+        std::atomic<std::uint64_t> wakeups{ 0 };
+
+        Thread() {
+            epfd = ::epoll_create1(EPOLL_CLOEXEC);
+            wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (epfd < 0 || wake_fd < 0) {
+                close();
+                throw std::runtime_error("IoLoop: epoll_create1/eventfd failed");
+            }
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.fd = wake_fd;
+            if (::epoll_ctl(epfd, EPOLL_CTL_ADD, wake_fd, &ev) != 0) {
+                close();
+                throw std::runtime_error("IoLoop: epoll_ctl failed");
+            }
+        }
+        ~Thread() { close(); }
+
+        void close() {
+            if (epfd >= 0) ::close(epfd);
+            if (wake_fd >= 0) ::close(wake_fd);
+            epfd = wake_fd = -1;
+        }
+
+        void wake() {
+            const std::uint64_t one = 1;
+            while (::write(wake_fd, &one, sizeof one) < 0 && errno == EINTR) {
+            }
+        }
+
+        // From any thread; one wakeup per batch that finds the inbox empty.
+        void post(std::coroutine_handle<> h) {
+            bool first;
+            {
+                std::lock_guard<std::mutex> lk(mu);
+                first = inbox.empty();
+                inbox.push_back(h);
+            }
+            if (first) wake();
+        }
+
+        // Owner: queue `h` for when `fd` is readable. The fd joins the epoll
+        // set with its first waiter; EEXIST means it already was.
+        void watch(int fd, std::coroutine_handle<> h) {
+            if (fd < 0) throw std::invalid_argument("IoLoop: waiting on a bad fd");
+            if (static_cast<std::size_t>(fd) >= waiters.size()) waiters.resize(static_cast<std::size_t>(fd) + 1);
+            auto& list = waiters[static_cast<std::size_t>(fd)];
+            if (list.empty()) {
+                epoll_event ev{};
+                ev.events = EPOLLIN | EPOLLET;
+                ev.data.fd = fd;
+                if (::epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0 && errno != EEXIST) {
+                    throw std::runtime_error("IoLoop: cannot watch fd");
+                }
+            }
+            list.push_back(h);
+            bump(waits);
+        }
+    };
+
+    static inline thread_local Thread* current_ = nullptr;
+
+    static Thread& current() {
+        if (!current_) throw std::logic_error("IoLoop: co_await outside a loop thread");
+        return *current_;
+    }
+
+    static void bump(std::atomic<std::uint64_t>& c) {
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void threadLoop(Thread& t) {
+        current_ = &t;
+        epoll_event events[256];
+        std::vector<std::coroutine_handle<>> inbox;
+        for (;;) {
+            // run what is ready now; tasks that yield go behind, for the
+            // next round after the I/O poll
+            for (std::size_t n = t.ready.size(); n > 0; --n) {
+                const std::coroutine_handle<> h = t.ready.front();
+                t.ready.pop_front();
+                bump(t.resumes);
+                h.resume();
+            }
+            {
+                std::lock_guard<std::mutex> lk(t.mu);
+                inbox.swap(t.inbox);
+            }
+            t.ready.insert(t.ready.end(), inbox.begin(), inbox.end());
+            inbox.clear();
+            if (t.ready.empty() && stop_.load()) return;
+
+            const int n = ::epoll_wait(t.epfd, events, 256, t.ready.empty() ? -1 : 0);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("IoLoop: epoll_wait failed");
+            }
+            if (n > 0) bump(t.wakeups);
+            for (int i = 0; i < n; ++i) {
+                const int fd = events[i].data.fd;
+                if (fd == t.wake_fd) {
+                    std::uint64_t v;
+                    while (::read(t.wake_fd, &v, sizeof v) < 0 && errno == EINTR) {
+                    }
+                    continue;
+                }
+                if (static_cast<std::size_t>(fd) >= t.waiters.size()) continue;
+                auto& list = t.waiters[static_cast<std::size_t>(fd)];
+                t.ready.insert(t.ready.end(), list.begin(), list.end());
+                list.clear();
+            }
+        }
+    }
+
+    // On the task's loop thread, from final_suspend.
+    void finish(VmTask::Handle h) {
+        Thread& t = *current_;
+        VmTask::promise_type& p = h.promise();
+        if (p.done) p.done(p.error);
+        h.destroy();
+        bump(t.tasks);
+        if (outstanding_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lk(done_mu_);
+            done_cv_.notify_all();
+        }
+    }
+
+    std::vector<std::unique_ptr<Thread>> threads_;
+    std::atomic<unsigned> next_{ 0 };
+    std::atomic<bool> stop_{ false };
+
+    std::atomic<std::size_t> outstanding_{ 0 }; // spawned, not finished
+    std::mutex done_mu_;
+    std::condition_variable done_cv_;
+};
+
+inline void VmTask::promise_type::Final::await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+    h.promise().loop->finish(h);
+}
@@ -0,0 +1,321 @@
+// metrics.h
+// Runtime metrics for running VMs: per-vCPU counters, aggregated on demand,
+// exported in the Prometheus text format.
+//
+//   MetricsRegistry reg;
+//   vm.attachMetrics(reg.vcpu("web-0"));        // one counter block per VM
+//   ...
+//   MetricsRegistry::Snapshot s = reg.snapshot(); // any thread, any time
+//   reg.dumpToFile("/var/lib/node_exporter/vm.prom");
+//   MetricsEndpoint ep(reg, "/run/vm-metrics.sock");
+//   // curl --unix-socket /run/vm-metrics.sock http://x/metrics
+//
+// Each vCPU gets one cache-line-aligned VcpuMetrics block, written only by
+// the thread running that VM: relaxed load + store, no lock, no atomic
+// read-modify-write, and no cache line shared with another vCPU. The run
+// loops keep their per-instruction counts (instructions, primitives) in
+// locals and add them to the block at loop exits and interrupt slow-path
+// entries, so a snapshot trails a running VM by at most one timer tick,
+// slice or profiler sample (the whole run if none is set). The verified
+// fast paths only count when metrics are attached: they switch to a counting
+// copy of the loop, and the uncounted loop is unchanged.
+//
+// Readers never lock either: blocks live in a fixed array allocated up
+// front and are published by a release store of the block count.
+// Registering a name that exists returns the same block, so a VM rebuilt
+// under the same name (a pool or scheduler slot) keeps its counters
+// monotonic, as Prometheus expects.
+//
+// Counters per vCPU:
+//   instructions      guest instructions executed
+//   prims[op]         primitives executed, by opcode
+//   tb_*              MiniTCGVM block cache: lookups that hit / missed,
+//                     blocks translated, blocks dropped by invalidation
+//   stack_hwm         deepest stack seen (a gauge); on the verified fast
+//                     paths this is the verifier's bound for the program
+//   traps             runs that ended in a guest error
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+struct alignas(64) VcpuMetrics {
+    using Counter = std::atomic<std::uint64_t>;
+    static constexpr std::size_t PRIMS = 16; // primitive opcodes are below 16
+
+    Counter instructions{ 0 };
+    Counter prims[PRIMS]{};
+    Counter tb_hits{ 0 };
+    Counter tb_misses{ 0 };
+    Counter tb_translations{ 0 };
+    Counter tb_invalidations{ 0 };
+    Counter stack_hwm{ 0 };
+    Counter traps{ 0 };
+
+    // Counts a run loop keeps in registers / on its stack until the next
+    // flush().
+    struct Local {
+        std::uint64_t instructions = 0;
+        std::uint64_t prims[PRIMS] = {};
+    };
+
+    // Writer side: only the VM's own thread.
+    static void add(Counter& c, std::uint64_t n) {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static void raise(Counter& c, std::uint64_t v) {
+        if (v > c.load(std::memory_order_relaxed)) c.store(v, std::memory_order_relaxed);
+    }
+    void flush(Local& l) {
+        add(instructions, l.instructions);
+        for (std::size_t i = 0; i < PRIMS; ++i) {
+            if (l.prims[i]) add(prims[i], l.prims[i]);
+        }
+        l = Local{};
+    }
+
+    // Plain copy of the counters, for readers.
+    struct Values {
+        std::uint64_t instructions = 0;
+        std::uint64_t prims[PRIMS] = {};
+        std::uint64_t tb_hits = 0;
+        std::uint64_t tb_misses = 0;
+        std::uint64_t tb_translations = 0;
+        std::uint64_t tb_invalidations = 0;
+        std::uint64_t stack_hwm = 0;
+        std::uint64_t traps = 0;
+
+        Values& operator+=(const Values& o) {
+            instructions += o.instructions;
+            for (std::size_t i = 0; i < PRIMS; ++i) prims[i] += o.prims[i];
+            tb_hits += o.tb_hits;
+            tb_misses += o.tb_misses;
+            tb_translations += o.tb_translations;
+            tb_invalidations += o.tb_invalidations;
+            stack_hwm = std::max(stack_hwm, o.stack_hwm);
+            traps += o.traps;
+            return *this;
+        }
+    };
+
+    Values read() const {
+        constexpr auto r = std::memory_order_relaxed;
+        Values v;
+        v.instructions = instructions.load(r);
+        for (std::size_t i = 0; i < PRIMS; ++i) v.prims[i] = prims[i].load(r);
+        v.tb_hits = tb_hits.load(r);
+        v.tb_misses = tb_misses.load(r);
+        v.tb_translations = tb_translations.load(r);
+        v.tb_invalidations = tb_invalidations.load(r);
+        v.stack_hwm = stack_hwm.load(r);
+        v.traps = traps.load(r);
+        return v;
+    }
+
+    // Mnemonic for a primitive opcode (the numbering all engines share).
+    static std::string primName(std::size_t op) {
+        static const char* const NAMES[] = { "halt",  "add",   "sub",  "mul", "div", "print",
+                                             "flush", "load", "store", "vec", "iret" };
+        return op < std::size(NAMES) ? NAMES[op] : "prim" + std::to_string(op);
+    }
+};
+
+class MetricsRegistry {
+public:
+    struct Snapshot {
+        std::vector<std::pair<std::string, VcpuMetrics::Values>> vcpus; // registration order
+        VcpuMetrics::Values total; // stack_hwm: the deepest of any vCPU
+    };
+
+    explicit MetricsRegistry(std::size_t max_vcpus = 1024)
+        : capacity_(max_vcpus), slots_(new VcpuMetrics[max_vcpus]), names_(new std::string[max_vcpus]) {}
+
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+    // The counter block for `name`, created on first use. The pointer stays
+    // valid for the registry's lifetime.
+    VcpuMetrics* vcpu(const std::string& name) {
+        std::lock_guard<std::mutex> lk(reg_mu_);
+        const std::size_t n = count_.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < n; ++i) {
+            if (names_[i] == name) return &slots_[i];
+        }
+        if (n == capacity_) throw std::runtime_error("metrics registry full");
+        names_[n] = name;
+        count_.store(n + 1, std::memory_order_release);
+        return &slots_[n];
+    }
+
+    std::size_t size() const { return count_.load(std::memory_order_acquire); }
+
+    Snapshot snapshot() const {
+        Snapshot s;
+        const std::size_t n = count_.load(std::memory_order_acquire);
+        s.vcpus.reserve(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            s.vcpus.emplace_back(names_[i], slots_[i].read());
+            s.total += s.vcpus.back().second;
+        }
+        return s;
+    }
+
+    // Prometheus text exposition format 0.0.4, one series per vCPU.
+    void writePrometheus(std::ostream& os, const std::string& prefix = "vm") const {
+        const Snapshot s = snapshot();
+        using V = VcpuMetrics::Values;
+        auto family = [&](const char* name, const char* type, const char* help, std::uint64_t V::*field) {
+            os << "# HELP " << prefix << "_" << name << " " << help << "\n";
+            os << "# TYPE " << prefix << "_" << name << " " << type << "\n";
+            for (const auto& [vcpu, v] : s.vcpus) {
+                os << prefix << "_" << name << "{vcpu=\"" << escape(vcpu) << "\"} " << v.*field << "\n";
+            }
+        };
+        family("instructions_total", "counter", "Guest instructions executed.", &V::instructions);
+        os << "# HELP " << prefix << "_primitives_total Guest primitives executed, by opcode.\n";
+        os << "# TYPE " << prefix << "_primitives_total counter\n";
+        for (const auto& [vcpu, v] : s.vcpus) {
+            for (std::size_t op = 0; op < VcpuMetrics::PRIMS; ++op) {
+                if (!v.prims[op]) continue;
+                os << prefix << "_primitives_total{vcpu=\"" << escape(vcpu) << "\",op=\""
+                   << VcpuMetrics::primName(op) << "\"} " << v.prims[op] << "\n";
+            }
+        }
+        family("tb_hits_total", "counter", "Translation block cache hits.", &V::tb_hits);
+        family("tb_misses_total", "counter", "Translation block cache misses.", &V::tb_misses);
+        family("tb_translations_total", "counter", "Translation blocks translated.", &V::tb_translations);
+        family("tb_invalidations_total", "counter", "Translation blocks dropped by invalidation.",
+               &V::tb_invalidations);
+        family("stack_high_water", "gauge", "Deepest guest stack seen, in words.", &V::stack_hwm);
+        family("traps_total", "counter", "Runs that ended in a guest error.", &V::traps);
+    }
+
+    // Writes to `path`.tmp and renames it over `path`, so a collector
+    // (node_exporter's textfile directory) never reads half a file.
+    void dumpToFile(const std::string& path, const std::string& prefix = "vm") const {
+        const std::string tmp = path + ".tmp";
+        {
+            std::ofstream f(tmp, std::ios::trunc);
+            if (!f) throw std::runtime_error("metrics: cannot write " + tmp);
+            writePrometheus(f, prefix);
+            if (!f.flush()) throw std::runtime_error("metrics: write failed: " + tmp);
+        }
+        if (std::rename(tmp.c_str(), path.c_str()) != 0) throw std::runtime_error("metrics: cannot rename to " + path);
+    }
+
+private:
+    static std::string escape(const std::string& in) {
+        std::string out;
+        for (char c : in) {
+            if (c == '\\' || c == '"') out += '\\';
+            if (c == '\n') {
+                out += "\\n";
+                continue;
+            }
+            out += c;
+        }
+        return out;
+    }
+
+    std::size_t capacity_;
+    std::unique_ptr<VcpuMetrics[]> slots_;
+    std::unique_ptr<std::string[]> names_; // written once, before the count publishes it
+    std::atomic<std::size_t> count_{ 0 };
+    std::mutex reg_mu_; // registration only
+};
+
+#if !defined(_WIN32)
+// Serves the registry on a Unix stream socket: every connection gets the
+// current Prometheus text and is closed. An HTTP request line is answered
+// with an HTTP/1.0 response, so `curl --unix-socket` works; a client that
+// sends nothing within 100 ms gets the bare text (`nc -U`, socat).
+class MetricsEndpoint {
+public:
+    MetricsEndpoint(const MetricsRegistry& reg, std::string path, std::string prefix = "vm")
+        : reg_(reg), path_(std::move(path)), prefix_(std::move(prefix)) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path_.size() >= sizeof(addr.sun_path)) throw std::invalid_argument("metrics: socket path too long");
+        std::copy(path_.begin(), path_.end(), addr.sun_path);
+        fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd_ < 0) throw std::runtime_error("metrics: socket() failed");
+        ::unlink(path_.c_str());
+        if (::bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd_, 16) != 0) {
+            ::close(fd_);
+            throw std::runtime_error("metrics: cannot listen on " + path_);
+        }
+        thread_ = std::thread([this] { serve(); });
+    }
+
+    ~MetricsEndpoint() {
+        stop_.store(true, std::memory_order_relaxed);
+        thread_.join();
+        ::close(fd_);
+        ::unlink(path_.c_str());
+    }
+
+    MetricsEndpoint(const MetricsEndpoint&) = delete;
+    MetricsEndpoint& operator=(const MetricsEndpoint&) = delete;
+
+    std::uint64_t served() const { return served_.load(std::memory_order_relaxed); }
+
+private:
+    void serve() {
+        while (!stop_.load(std::memory_order_relaxed)) {
+            pollfd p{ fd_, POLLIN, 0 };
+            if (::poll(&p, 1, 100) <= 0) continue; // wake up to check stop_
+            const int c = ::accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (c < 0) continue;
+            reply(c);
+            ::close(c);
+            served_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void reply(int c) const {
+        char req[512];
+        pollfd p{ c, POLLIN, 0 };
+        ssize_t got = ::poll(&p, 1, 100) > 0 ? ::recv(c, req, sizeof(req), 0) : 0;
+        std::ostringstream body;
+        reg_.writePrometheus(body, prefix_);
+        std::string out = body.str();
+        if (got > 0 && std::string(req, static_cast<std::size_t>(got)).rfind("GET ", 0) == 0) {
+            out = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                  std::to_string(out.size()) + "\r\n\r\n" + out;
+        }
+        for (std::size_t off = 0; off < out.size();) {
+            const ssize_t n = ::send(c, out.data() + off, out.size() - off, MSG_NOSIGNAL);
+            if (n <= 0) return;
+            off += static_cast<std::size_t>(n);
+        }
+    }
+
+    const MetricsRegistry& reg_;
+    std::string path_;
+    std::string prefix_;
+    int fd_ = -1;
+    std::atomic<bool> stop_{ false };
+    std::atomic<std::uint64_t> served_{ 0 };
+    std::thread thread_;
+};
+#endif
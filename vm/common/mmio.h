@@ -0,0 +1,127 @@
+// mmio.h
+// Memory-mapped I/O bus: guest address ranges routed to device callbacks.
+//
+// Guest addresses are word indices. RAM occupies [0, ram_words) and the VM
+// checks that range first, with the same compare it needs for the bounds
+// check anyway, so RAM loads and stores never touch the bus. Everything
+// above RAM goes here.
+//
+// The bus keeps its ranges sorted by base and finds a device by binary
+// search. In front of the search sits a per-vCPU last-hit cache
+// (MmioBus::Cache, owned by the caller): a driver usually hammers one
+// device, so the common case is one range compare.
+//
+// A device whose accesses can wait on the host (input with nothing to read
+// yet) says so with canWait(). The bus asks its waitFd() before each access
+// to it; an access that has to wait does not happen, and Cache::wait_fd
+// names the fd that becomes readable when it can. The VM suspends on that
+// instruction and runs it again later: in a poll(2) from run(), or from an
+// event loop (io_loop.h) without holding a thread. Other devices pay nothing
+// for this beyond a flag test on the range.
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class MmioDevice {
+public:
+    virtual ~MmioDevice() = default;
+    virtual const char* name() const = 0;
+    // `offset` is relative to the device's base, in words.
+    virtual std::uint32_t read(std::uint32_t offset) = 0;
+    virtual void write(std::uint32_t offset, std::uint32_t value) = 0;
+
+    // Whether any access may have to wait; asked once, by MmioBus::map().
+    virtual bool canWait() const { return false; }
+    // Before an access of a device that canWait(): -1 if it can go ahead
+    // now, else an fd that becomes readable when it can.
+    virtual int waitFd(std::uint32_t offset, bool write) {
+        (void)offset;
+        (void)write;
+        return -1;
+    }
+};
+
+class MmioBus {
+public:
+    using u32 = std::uint32_t;
+
+    struct Range {
+        u32 base = 0;
+        u32 end = 0; // exclusive
+        MmioDevice* dev = nullptr;
+        bool waits = false; // dev->canWait()
+    };
+
+    // Per-vCPU state: the last range used, plus that vCPU's counters (so
+    // the bus itself is never written on the access path).
+    struct Cache {
+        const Range* last = nullptr;
+        std::uint64_t generation = 0; // bus layout `last` belongs to
+
+        std::uint64_t reads = 0;
+        std::uint64_t writes = 0;
+        std::uint64_t hits = 0;    // served by `last`
+        std::uint64_t lookups = 0; // binary searches
+
+        int wait_fd = -1; // >= 0: the last access has to wait on it, and did not happen
+    };
+
+    // The device is not owned and must outlive the bus.
+    void map(u32 base, u32 words, MmioDevice& dev) {
+        if (words == 0 || base + words < base) throw std::invalid_argument("mmio: bad range");
+        const Range r{ base, base + words, &dev, dev.canWait() };
+        auto it = std::lower_bound(ranges_.begin(), ranges_.end(), base,
+                                   [](const Range& x, u32 b) { return x.base < b; });
+        if ((it != ranges_.end() && it->base < r.end) || (it != ranges_.begin() && std::prev(it)->end > base)) {
+            throw std::invalid_argument(std::string("mmio: ") + dev.name() + " overlaps another device");
+        }
+        ranges_.insert(it, r);
+        ++generation_; // Range pointers moved: invalidate every cache
+    }
+
+    // With a device that can wait, check c.wait_fd afterwards.
+    u32 read(u32 addr, Cache& c) {
+        ++c.reads;
+        const Range& r = find(addr, c);
+        if (r.waits && (c.wait_fd = r.dev->waitFd(addr - r.base, false)) >= 0) [[unlikely]] return 0;
+        return r.dev->read(addr - r.base);
+    }
+
+    void write(u32 addr, u32 value, Cache& c) {
+        ++c.writes;
+        const Range& r = find(addr, c);
+        if (r.waits && (c.wait_fd = r.dev->waitFd(addr - r.base, true)) >= 0) [[unlikely]] return;
+        r.dev->write(addr - r.base, value);
+    }
+
+    const std::vector<Range>& ranges() const { return ranges_; }
+
+private:
+    const Range& find(u32 addr, Cache& c) {
+        if (c.last && c.generation == generation_ && addr - c.last->base < c.last->end - c.last->base) {
+            ++c.hits;
+            return *c.last;
+        }
+        ++c.lookups;
+        auto it = std::upper_bound(ranges_.begin(), ranges_.end(), addr,
+                                   [](u32 a, const Range& x) { return a < x.base; });
+        if (it == ranges_.begin() || addr >= std::prev(it)->end) throw busError(addr);
+        c.last = &*std::prev(it);
+        c.generation = generation_;
+        return *c.last;
+    }
+
+    static std::runtime_error busError(u32 addr) {
+        static const char* digits = "0123456789abcdef";
+        std::string hex(8, '0');
+        for (int i = 7; i >= 0; --i, addr >>= 4) hex[static_cast<std::size_t>(i)] = digits[addr & 0xF];
+        return std::runtime_error("bus error: no device at 0x" + hex);
+    }
+
+    std::vector<Range> ranges_;
+    std::uint64_t generation_ = 1;
+};
@@ -0,0 +1,240 @@
+// mmio_devices.h
+// Sample MMIO devices for MmioBus (mmio.h). Register offsets are in words.
+//
+// ConsoleDevice (5 words), output through a VirtualConsole (console.h),
+// input from an optional fd:
+//   0 DATA    W  low byte is written as one character
+//   1 INT     W  value is written in decimal followed by '\n'
+//   2 FLUSH   W  push buffered output to the fd now
+//   3 STATUS  R  bytes currently buffered
+//   4 IN      R  next input byte; 0xFFFFFFFF at end of input (or with no
+//                input fd). Waits (mmio.h) while the fd has nothing to read.
+//
+// TimerDevice (4 words), host monotonic time in microseconds since the
+// device was created:
+//   0 NOW_LO    R  low 32 bits; latches the high half for NOW_HI
+//   1 NOW_HI    R  high 32 bits of the last NOW_LO read
+//   2 DEADLINE  W  arm a one-shot timer `value` us from now (0 disarms)
+//               R  us left until the deadline (0 when expired or disarmed)
+//   3 STATUS    R  1 once an armed deadline has passed
+//               W  any value acknowledges and disarms
+//
+// EventDevice (2 words, Linux), events posted by the host with signal():
+//   0 COUNT   R  events posted since the last read, then zero. Waits
+//                (mmio.h) while there are none, until the host close()s it
+//   1 POSTED  R  events posted so far, without waiting
+// A waiting guest is woken through an eventfd. Several devices may share
+// one (fds run out long before 10^5 guests do): a write wakes every guest
+// waiting on it, and those with nothing posted wait again. A shared eventfd
+// is never read back, since a read could swallow another device's wakeup,
+// so it needs an edge-triggered watcher (io_loop.h); run()'s poll(2) wants
+// an fd of the device's own.
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+#include "console.h"
+#include "mmio.h"
+
+class ConsoleDevice final : public MmioDevice {
+public:
+    enum Reg : std::uint32_t { DATA = 0, INT = 1, FLUSH = 2, STATUS = 3, IN = 4, WORDS = 5 };
+    static constexpr std::uint32_t END_OF_INPUT = 0xFFFFFFFFu;
+
+    // `in_fd` (not owned) is read for IN; -1: no input. On Linux it is made
+    // non-blocking, so a read with nothing there waits instead of blocking.
+    explicit ConsoleDevice(VirtualConsole& con, int in_fd = -1) : con_(con), in_fd_(in_fd) {
+#if !defined(_WIN32)
+        if (in_fd_ >= 0) ::fcntl(in_fd_, F_SETFL, ::fcntl(in_fd_, F_GETFL) | O_NONBLOCK);
+#endif
+    }
+
+    const char* name() const override { return "console"; }
+
+    std::uint32_t read(std::uint32_t offset) override {
+        if (offset == IN) {
+            if (in_pos_ == in_len_) fill(); // a caller that did not ask waitFd()
+            return in_pos_ < in_len_ ? static_cast<std::uint8_t>(in_buf_[in_pos_++]) : END_OF_INPUT;
+        }
+        return offset == STATUS ? static_cast<std::uint32_t>(con_.buffered()) : 0u;
+    }
+
+    void write(std::uint32_t offset, std::uint32_t value) override {
+        switch (offset) {
+        case DATA: {
+            const char c = static_cast<char>(value & 0xFFu);
+            con_.write(std::string_view(&c, 1));
+            break;
+        }
+        case INT: con_.printLine("", static_cast<std::int32_t>(value)); break;
+        case FLUSH: con_.flush(); break;
+        default: break; // read-only / reserved
+        }
+    }
+
+#if !defined(_WIN32)
+    bool canWait() const override { return in_fd_ >= 0; }
+
+    int waitFd(std::uint32_t offset, bool write) override {
+        if (write || offset != IN || in_pos_ < in_len_) return -1;
+        return fill();
+    }
+#endif
+
+private:
+    // Refill the input buffer; in_fd_ if there is nothing to read yet, else
+    // -1 (buffered, or end of input).
+    int fill() {
+        if (in_fd_ < 0 || in_eof_) return -1;
+        for (;;) {
+#if defined(_WIN32)
+            const int n = ::_read(in_fd_, in_buf_, sizeof in_buf_);
+#else
+            const ssize_t n = ::read(in_fd_, in_buf_, sizeof in_buf_);
+#endif
+            if (n > 0) {
+                in_pos_ = 0;
+                in_len_ = static_cast<std::size_t>(n);
+                return -1;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return in_fd_;
+            in_eof_ = true; // end of input, or an error that ends it
+            return -1;
+        }
+    }
+
+    VirtualConsole& con_;
+    int in_fd_ = -1;
+    char in_buf_[64];
+    std::size_t in_pos_ = 0;
+    std::size_t in_len_ = 0;
+    bool in_eof_ = false;
+};
+
+class TimerDevice final : public MmioDevice {
+public:
+    enum Reg : std::uint32_t { NOW_LO = 0, NOW_HI = 1, DEADLINE = 2, STATUS = 3, WORDS = 4 };
+
+    const char* name() const override { return "timer"; }
+
+    std::uint32_t read(std::uint32_t offset) override {
+        switch (offset) {
+        case NOW_LO: {
+            const std::uint64_t t = nowUs();
+            latched_hi_ = static_cast<std::uint32_t>(t >> 32);
+            return static_cast<std::uint32_t>(t);
+        }
+        case NOW_HI: return latched_hi_;
+        case DEADLINE: {
+            if (!armed_) return 0;
+            const std::uint64_t t = nowUs();
+            return t >= deadline_ ? 0u : static_cast<std::uint32_t>(deadline_ - t);
+        }
+        case STATUS: return armed_ && nowUs() >= deadline_ ? 1u : 0u;
+        default: return 0;
+        }
+    }
+
+    void write(std::uint32_t offset, std::uint32_t value) override {
+        if (offset == DEADLINE) {
+            armed_ = value != 0;
+            deadline_ = nowUs() + value;
+        }
+        else if (offset == STATUS) {
+            armed_ = false;
+        }
+    }
+
+private:
+    std::uint64_t nowUs() const {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch_).count());
+    }
+
+    std::chrono::steady_clock::time_point epoch_ = std::chrono::steady_clock::now();
+    std::uint64_t deadline_ = 0;
+    bool armed_ = false;
+    std::uint32_t latched_hi_ = 0;
+};
+
+#if !defined(_WIN32)
+class EventDevice final : public MmioDevice {
+public:
+    enum Reg : std::uint32_t { COUNT = 0, POSTED = 1, WORDS = 2 };
+
+    // `fd` is an eventfd from makeEventFd() (not owned); `shared` if other
+    // devices use it too.
+    explicit EventDevice(int fd, bool shared = false) : fd_(fd), shared_(shared) {}
+
+    static int makeEventFd() {
+        const int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0) throw std::runtime_error("eventfd failed");
+        return fd;
+    }
+
+    const char* name() const override { return "event"; }
+
+    // Host side, any thread: post `n` events and wake the waiters.
+    void signal(std::uint32_t n = 1) {
+        pending_.fetch_add(n, std::memory_order_release);
+        posted_.fetch_add(n, std::memory_order_relaxed);
+        ring();
+    }
+
+    // Host side: no more events. COUNT stops waiting (it reads 0 once the
+    // posted events are taken), so a guest still waiting runs on to its end.
+    void close() {
+        closed_.store(true, std::memory_order_release);
+        ring();
+    }
+
+    std::uint32_t read(std::uint32_t offset) override {
+        if (offset == POSTED) return posted_.load(std::memory_order_relaxed);
+        if (offset != COUNT) return 0;
+        return pending_.exchange(0, std::memory_order_acquire);
+    }
+
+    void write(std::uint32_t, std::uint32_t) override {}
+
+    bool canWait() const override { return true; }
+
+    int waitFd(std::uint32_t offset, bool write) override {
+        if (write || offset != COUNT) return -1;
+        if (!shared_) { // drain first: a signal() after the check below still wakes us
+            std::uint64_t v;
+            while (::read(fd_, &v, sizeof v) < 0 && errno == EINTR) {
+            }
+        }
+        if (pending_.load(std::memory_order_acquire) != 0 || closed_.load(std::memory_order_acquire)) return -1;
+        return fd_;
+    }
+
+    int fd() const { return fd_; }
+
+private:
+    void ring() {
+        const std::uint64_t one = 1;
+        while (::write(fd_, &one, sizeof one) < 0 && errno == EINTR) {
+        }
+    }
+
+    int fd_;
+    bool shared_;
+    std::atomic<std::uint32_t> pending_{ 0 };
+    std::atomic<std::uint32_t> posted_{ 0 };
+    std::atomic<bool> closed_{ false };
+};
+#endif
@@ -0,0 +1,463 @@
+// page_dedup.h  (Linux)
+// Content-based page deduplication across the guest memories of a process,
+// in the style of the kernel's KSM.
+//
+// A GuestMemory created with Options::mergeable registers its range here.
+// The scanner (scanOnce(), or a background thread via start()) hashes every
+// resident private page. A page whose hash is unchanged since the previous
+// pass is a merge candidate:
+//   - if a shared page with the same content exists (stable table), the
+//     guest page is replaced by a read-only mapping of it,
+//   - else if another candidate with the same hash was seen in this pass
+//     (unstable table), the content is copied into a new shared page and
+//     both guest pages are mapped onto it.
+// Shared pages live in one memfd, so N identical guest pages cost one page
+// of RAM and the guest's own copy is released.
+//
+// Merging write-protects the page first and compares the bytes before
+// remapping, so a concurrent guest write is never lost. A write to a shared
+// page faults; the SIGSEGV handler breaks sharing (copy-on-write): it copies
+// the content into a fresh private page in place and returns, and the write
+// is retried. Faults outside registered ranges go to the previous handler.
+//
+// Engines keep using raw pointers into guest memory; they never see the
+// sharing. Shared pages whose last user broke away are released at the
+// next scan.
+//
+// Unlike KSM, every merged page is a mapping of its own unless neighbouring
+// pages map neighbouring shared pages (then the kernel coalesces them). The
+// scanner stops merging before the process reaches vm.max_map_count, since
+// a failed MAP_FIXED can leave a hole in guest memory.
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+class PageDedup {
+public:
+    static constexpr std::size_t PAGE = 4096;
+    static constexpr std::size_t MAX_REGIONS = 1u << 16;
+    static constexpr std::size_t MAX_SHARED_PAGES = 1u << 18; // 1 GiB of distinct shared content
+
+    struct Stats {
+        std::uint64_t pages_scanned = 0;  // private pages hashed, all passes
+        std::uint64_t pages_shared = 0;   // distinct shared pages in use now
+        std::uint64_t pages_sharing = 0;  // guest pages currently mapped onto them
+        std::uint64_t pages_unshared = 0; // copy-on-write breaks, all time
+        std::uint64_t merges = 0;         // guest pages merged, all time
+        std::uint64_t full_scans = 0;
+    };
+
+    static PageDedup& instance() {
+        static PageDedup d;
+        return d;
+    }
+
+    // Register [base, base + size); false when dedup is unavailable.
+    bool add(std::byte* base, std::size_t size) {
+        if (!available_) return false;
+        std::lock_guard<std::mutex> lk(mu_);
+        for (std::size_t k = 0; k < MAX_REGIONS; ++k) {
+            Region& r = regions_[k];
+            if (r.base.load(std::memory_order_relaxed)) continue;
+            const std::size_t n = size / PAGE;
+            r.state = std::make_unique<std::atomic<std::uint8_t>[]>(n);
+            r.slot = std::make_unique<std::atomic<std::uint32_t>[]>(n);
+            r.last_hash = std::make_unique<std::uint64_t[]>(n);
+            r.pages.store(n, std::memory_order_relaxed);
+            r.base.store(base, std::memory_order_release); // publish to the fault handler
+            if (k + 1 > used_.load(std::memory_order_relaxed)) used_.store(k + 1, std::memory_order_release);
+            return true;
+        }
+        return false;
+    }
+
+    // Unregister before the range is unmapped.
+    void remove(std::byte* base) {
+        std::lock_guard<std::mutex> lk(mu_);
+        Region* r = find(base);
+        if (!r) return;
+        const std::size_t n = r->pages.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < n; ++i) {
+            if (r->state[i].load(std::memory_order_acquire) == Shared) {
+                refs_[r->slot[i].load(std::memory_order_relaxed)].fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        r->base.store(nullptr, std::memory_order_release);
+        r->pages.store(0, std::memory_order_relaxed);
+        r->state.reset();
+        r->slot.reset();
+        r->last_hash.reset();
+    }
+
+    // Turn the shared pages in [p, p + len) back into private zero pages
+    // (GuestMemory::discard). False if a page could not be remapped: it
+    // stays shared, with its reference and its contents.
+    bool unshare(std::byte* p, std::size_t len) {
+        std::lock_guard<std::mutex> lk(mu_);
+        bool ok = true;
+        for (std::size_t k = 0; k < used_.load(std::memory_order_relaxed); ++k) {
+            Region& r = regions_[k];
+            std::byte* const base = r.base.load(std::memory_order_relaxed);
+            const std::size_t n = r.pages.load(std::memory_order_relaxed);
+            if (!base || p < base || p >= base + n * PAGE) continue;
+            const std::size_t first = static_cast<std::size_t>(p - base) / PAGE;
+            const std::size_t last = std::min(n, (static_cast<std::size_t>(p - base) + len) / PAGE);
+            for (std::size_t i = first; i < last; ++i) {
+                std::uint8_t expect = Shared;
+                if (!r.state[i].compare_exchange_strong(expect, Breaking, std::memory_order_acq_rel)) continue;
+                if (::mmap(base + i * PAGE, PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) ==
+                    MAP_FAILED) {
+                    r.state[i].store(Shared, std::memory_order_release);
+                    ok = false;
+                    continue;
+                }
+                refs_[r.slot[i].load(std::memory_order_relaxed)].fetch_sub(1, std::memory_order_relaxed);
+                r.state[i].store(Private, std::memory_order_release);
+            }
+            return ok;
+        }
+        return ok;
+    }
+
+    // One full pass over every registered range.
+    void scanOnce() {
+        std::lock_guard<std::mutex> lk(mu_);
+        reclaimSlots();
+        maps_ = mapCount();
+
+        // unstable table: hash -> candidate page, rebuilt every pass
+        std::unordered_map<std::uint64_t, std::pair<Region*, std::size_t>> unstable;
+        std::vector<unsigned char> resident;
+
+        for (std::size_t k = 0; k < used_.load(std::memory_order_relaxed); ++k) {
+            Region& r = regions_[k];
+            std::byte* const base = r.base.load(std::memory_order_relaxed);
+            if (!base) continue;
+            const std::size_t n = r.pages.load(std::memory_order_relaxed);
+            resident.resize(n);
+            if (::mincore(base, n * PAGE, resident.data()) != 0) continue;
+
+            for (std::size_t i = 0; i < n; ++i) {
+                // untouched pages cost nothing already; shared ones are done
+                if (!(resident[i] & 1u) || r.state[i].load(std::memory_order_acquire) != Private) continue;
+                scanned_.fetch_add(1, std::memory_order_relaxed);
+
+                const std::byte* page = base + i * PAGE;
+                const std::uint64_t h = hashPage(page);
+                const bool settled = h == r.last_hash[i]; // skip pages still being written
+                r.last_hash[i] = h;
+                if (!settled) continue;
+
+                if (mergeWithStable(r, i, h)) continue;
+
+                auto [it, fresh] = unstable.try_emplace(h, &r, i);
+                if (fresh) continue;
+                auto [r2, i2] = it->second;
+                const std::byte* other = r2->base.load(std::memory_order_relaxed) + i2 * PAGE;
+                if (std::memcmp(page, other, PAGE) != 0) continue; // hash collision
+
+                const std::uint32_t slot = allocSlot();
+                if (slot == NO_SLOT) continue;
+                std::memcpy(view_ + std::size_t(slot) * PAGE, other, PAGE);
+                const bool a = tryMerge(*r2, i2, slot);
+                const bool b = tryMerge(r, i, slot);
+                if (a || b) {
+                    stable_.emplace(h, slot);
+                    unstable.erase(it);
+                }
+                else {
+                    free_.push_back(slot);
+                }
+            }
+        }
+        full_scans_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Background scanning every `interval` until stop().
+    void start(std::chrono::milliseconds interval) {
+        stop();
+        {
+            std::lock_guard<std::mutex> lk(run_mu_);
+            stop_ = false;
+        }
+        scanner_ = std::thread([this, interval] {
+            std::unique_lock<std::mutex> lk(run_mu_);
+            while (!run_cv_.wait_for(lk, interval, [&] { return stop_; })) {
+                lk.unlock();
+                scanOnce();
+                lk.lock();
+            }
+        });
+    }
+
+    void stop() {
+        if (!scanner_.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lk(run_mu_);
+            stop_ = true;
+        }
+        run_cv_.notify_all();
+        scanner_.join();
+    }
+
+    Stats stats() const {
+        Stats s;
+        s.pages_scanned = scanned_.load(std::memory_order_relaxed);
+        s.pages_unshared = unshared_.load(std::memory_order_relaxed);
+        s.merges = merges_.load(std::memory_order_relaxed);
+        s.full_scans = full_scans_.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lk(mu_);
+        for (const auto& [h, slot] : stable_) {
+            const std::uint32_t n = refs_[slot].load(std::memory_order_relaxed);
+            if (n) {
+                ++s.pages_shared;
+                s.pages_sharing += n;
+            }
+        }
+        return s;
+    }
+
+    bool available() const { return available_; }
+
+    ~PageDedup() { stop(); }
+
+    PageDedup(const PageDedup&) = delete;
+    PageDedup& operator=(const PageDedup&) = delete;
+
+private:
+    enum : std::uint8_t { Private = 0, Merging = 1, Shared = 2, Breaking = 3 };
+    static constexpr std::uint32_t NO_SLOT = ~0u;
+    static constexpr std::size_t MAP_HEADROOM = 4096; // mappings left for everyone else
+
+    struct Region {
+        std::atomic<std::byte*> base{ nullptr };
+        std::atomic<std::size_t> pages{ 0 };
+        std::unique_ptr<std::atomic<std::uint8_t>[]> state;
+        std::unique_ptr<std::atomic<std::uint32_t>[]> slot; // shared page while Shared
+        std::unique_ptr<std::uint64_t[]> last_hash;          // scanner only
+    };
+
+    PageDedup() {
+        // sparse: only shared pages that hold content use memory
+        fd_ = ::memfd_create("guest-dedup", MFD_CLOEXEC);
+        if (fd_ < 0) return;
+        if (::ftruncate(fd_, static_cast<off_t>(MAX_SHARED_PAGES * PAGE)) != 0) return;
+        void* v = ::mmap(nullptr, MAX_SHARED_PAGES * PAGE, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (v == MAP_FAILED) return;
+        view_ = static_cast<std::byte*>(v);
+        refs_ = std::make_unique<std::atomic<std::uint32_t>[]>(MAX_SHARED_PAGES);
+        regions_ = std::make_unique<Region[]>(MAX_REGIONS);
+        max_maps_ = maxMapCount();
+
+        struct sigaction sa {};
+        sa.sa_sigaction = &PageDedup::onFault;
+        sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&sa.sa_mask);
+        self_ = this;
+        if (::sigaction(SIGSEGV, &sa, &previous_) != 0) return;
+        available_ = true;
+    }
+
+    static std::uint64_t hashPage(const std::byte* p) {
+        std::uint64_t w[PAGE / 8];
+        std::memcpy(w, p, PAGE);
+        std::uint64_t h = 0x9E3779B97F4A7C15ull;
+        for (std::uint64_t x : w) {
+            h ^= x;
+            h *= 0xFF51AFD7ED558CCDull;
+            h ^= h >> 32;
+        }
+        return h;
+    }
+
+    // Lines in /proc/self/maps: the process's current mapping count.
+    static std::size_t mapCount() {
+        const int fd = ::open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return 0;
+        char buf[64 * 1024];
+        std::size_t lines = 0;
+        for (ssize_t n; (n = ::read(fd, buf, sizeof(buf))) > 0;) lines += static_cast<std::size_t>(std::count(buf, buf + n, '\n'));
+        ::close(fd);
+        return lines;
+    }
+
+    static std::size_t maxMapCount() {
+        std::size_t v = 65530; // kernel default
+        if (std::FILE* f = std::fopen("/proc/sys/vm/max_map_count", "r")) {
+            unsigned long x = 0;
+            if (std::fscanf(f, "%lu", &x) == 1) v = x;
+            std::fclose(f);
+        }
+        return v;
+    }
+
+    Region* find(std::byte* base) {
+        for (std::size_t k = 0; k < used_.load(std::memory_order_relaxed); ++k) {
+            if (regions_[k].base.load(std::memory_order_relaxed) == base) return &regions_[k];
+        }
+        return nullptr;
+    }
+
+    std::uint32_t allocSlot() {
+        if (!free_.empty()) {
+            const std::uint32_t s = free_.back();
+            free_.pop_back();
+            return s;
+        }
+        return next_slot_ < MAX_SHARED_PAGES ? static_cast<std::uint32_t>(next_slot_++) : NO_SLOT;
+    }
+
+    // Shared pages nobody maps any more go back to the free list.
+    void reclaimSlots() {
+        for (auto it = stable_.begin(); it != stable_.end();) {
+            if (refs_[it->second].load(std::memory_order_acquire) == 0) {
+                ::madvise(view_ + std::size_t(it->second) * PAGE, PAGE, MADV_REMOVE);
+                free_.push_back(it->second);
+                it = stable_.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    bool mergeWithStable(Region& r, std::size_t i, std::uint64_t h) {
+        const std::byte* page = r.base.load(std::memory_order_relaxed) + i * PAGE;
+        auto [b, e] = stable_.equal_range(h);
+        for (auto it = b; it != e; ++it) {
+            if (std::memcmp(page, view_ + std::size_t(it->second) * PAGE, PAGE) == 0) return tryMerge(r, i, it->second);
+        }
+        return false;
+    }
+
+    // Write-protect, compare, then swap the private page for the shared one.
+    bool tryMerge(Region& r, std::size_t i, std::uint32_t slot) {
+        // a merge can split one mapping into three; recount before giving up,
+        // neighbouring merges usually coalesce
+        if (maps_ + 2 + MAP_HEADROOM > max_maps_ && (maps_ = mapCount()) + 2 + MAP_HEADROOM > max_maps_) return false;
+        std::uint8_t expect = Private;
+        if (!r.state[i].compare_exchange_strong(expect, Merging, std::memory_order_acq_rel)) return false;
+        std::byte* const page = r.base.load(std::memory_order_relaxed) + i * PAGE;
+        const std::byte* const shared = view_ + std::size_t(slot) * PAGE;
+
+        ::mprotect(page, PAGE, PROT_READ); // guest writes now fault and wait for us
+        if (std::memcmp(page, shared, PAGE) != 0 ||
+            ::mmap(page, PAGE, PROT_READ, MAP_SHARED | MAP_FIXED, fd_, static_cast<off_t>(std::size_t(slot) * PAGE)) == MAP_FAILED) {
+            ::mprotect(page, PAGE, PROT_READ | PROT_WRITE);
+            r.state[i].store(Private, std::memory_order_release);
+            return false;
+        }
+        maps_ += 2;
+        refs_[slot].fetch_add(1, std::memory_order_relaxed);
+        r.slot[i].store(slot, std::memory_order_relaxed);
+        r.state[i].store(Shared, std::memory_order_release);
+        merges_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Copy-on-write break for a guest write at `addr`. Async-signal context:
+    // atomics and syscalls only, no locks, no allocation.
+    bool breakSharing(void* addr) {
+        std::byte* const a = static_cast<std::byte*>(addr);
+        const std::size_t used = used_.load(std::memory_order_acquire);
+        for (std::size_t k = 0; k < used; ++k) {
+            Region& r = regions_[k];
+            std::byte* const base = r.base.load(std::memory_order_acquire);
+            const std::size_t n = r.pages.load(std::memory_order_relaxed);
+            if (!base || a < base || a >= base + n * PAGE) continue;
+
+            const std::size_t i = static_cast<std::size_t>(a - base) / PAGE;
+            std::byte* const page = base + i * PAGE;
+            for (;;) {
+                std::uint8_t s = r.state[i].load(std::memory_order_acquire);
+                if (s == Merging || s == Breaking) { // the scanner is mid-merge
+                    ::sched_yield();
+                    continue;
+                }
+                if (s == Private) return true; // merge was abandoned; retry the write
+                if (!r.state[i].compare_exchange_strong(s, Breaking, std::memory_order_acq_rel)) continue;
+
+                // Build the private copy aside and swap it in with one mremap:
+                // the page is never mapped writable with anything but its data
+                void* copy = ::mmap(nullptr, PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (copy == MAP_FAILED) {
+                    r.state[i].store(Shared, std::memory_order_release);
+                    return false;
+                }
+                std::memcpy(copy, page, PAGE);
+                if (::mremap(copy, PAGE, PAGE, MREMAP_MAYMOVE | MREMAP_FIXED, page) == MAP_FAILED) {
+                    ::munmap(copy, PAGE);
+                    r.state[i].store(Shared, std::memory_order_release);
+                    return false;
+                }
+                refs_[r.slot[i].load(std::memory_order_relaxed)].fetch_sub(1, std::memory_order_release);
+                unshared_.fetch_add(1, std::memory_order_relaxed);
+                r.state[i].store(Private, std::memory_order_release);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void onFault(int sig, siginfo_t* si, void* ctx) {
+        PageDedup* d = self_;
+        if (d && si->si_code == SEGV_ACCERR && d->breakSharing(si->si_addr)) return;
+
+        // not ours: hand over to whoever was installed before us
+        const struct sigaction& prev = d->previous_;
+        if (prev.sa_flags & SA_SIGINFO) {
+            prev.sa_sigaction(sig, si, ctx);
+        }
+        else if (prev.sa_handler != SIG_DFL && prev.sa_handler != SIG_IGN) {
+            prev.sa_handler(sig);
+        }
+        else {
+            ::signal(sig, SIG_DFL); // the access repeats and takes the default action
+        }
+    }
+
+    static inline PageDedup* self_ = nullptr;
+
+    bool available_ = false;
+    int fd_ = -1;
+    std::byte* view_ = nullptr; // scanner's window on the shared pages
+    std::unique_ptr<std::atomic<std::uint32_t>[]> refs_;
+    std::unique_ptr<Region[]> regions_;
+    std::atomic<std::size_t> used_{ 0 }; // regions_[0 .. used_) may be live
+    struct sigaction previous_ {};
+
+    mutable std::mutex mu_; // registry, tables and scanning
+    std::unordered_multimap<std::uint64_t, std::uint32_t> stable_; // hash -> shared page
+    std::vector<std::uint32_t> free_;
+    std::size_t next_slot_ = 0;
+    std::size_t max_maps_ = 0;
+    std::size_t maps_ = 0; // estimate during a scan
+
+    std::atomic<std::uint64_t> scanned_{ 0 };
+    std::atomic<std::uint64_t> unshared_{ 0 };
+    std::atomic<std::uint64_t> merges_{ 0 };
+    std::atomic<std::uint64_t> full_scans_{ 0 };
+
+    std::thread scanner_;
+    std::mutex run_mu_;
+    std::condition_variable run_cv_;
+    bool stop_ = false;
+};
@@ -0,0 +1,164 @@
+// perf_counters.h
+// Hardware performance counters around a region of code, for telling apart
+// the usual reasons an interpreter is slow: branch mispredicts in dispatch,
+// i-cache misses in large or translated code, d-cache / dTLB misses on the
+// guest stack and memory.
+//
+//   PerfCounters pc;               // opens the counters, disabled
+//   auto s = pc.measure([&] { vm.run(false); });
+//   s.per(PerfCounters::BranchMisses, guest_insns);
+//
+// Linux perf_event_open(2), counting the calling thread in user mode only
+// (works at perf_event_paranoid <= 2). Each event is its own counter rather
+// than a group: a PMU with fewer counters than events multiplexes them and
+// the values are scaled by time_enabled / time_running, as perf stat does.
+//
+// Fallback: an event the kernel refuses (no PMU in a VM or container,
+// seccomp, paranoid level, another OS) is left out and reported as
+// unavailable with the reason; the rest still count. Page faults and task
+// clock are software events and usually survive where the hardware ones do
+// not. Sample::wall_ns is always valid.
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class PerfCounters {
+public:
+    enum Event {
+        Cycles,
+        Instructions,
+        BranchMisses,
+        L1iMisses,
+        L1dMisses,
+        DtlbMisses,
+        PageFaults, // software
+        TaskClock,  // software, ns
+        EVENT_COUNT
+    };
+
+    struct Sample {
+        std::uint64_t value[EVENT_COUNT] = {};
+        bool valid[EVENT_COUNT] = {};
+        double wall_ns = 0;
+
+        double ipc() const {
+            return valid[Cycles] && valid[Instructions] && value[Cycles] ? double(value[Instructions]) / double(value[Cycles])
+                                                                         : 0.0;
+        }
+        // value / n (e.g. per guest instruction); 0 if the event is unavailable
+        double per(Event e, double n) const { return valid[e] && n > 0 ? double(value[e]) / n : 0.0; }
+    };
+
+    PerfCounters() {
+        for (int e = 0; e < EVENT_COUNT; ++e) open(static_cast<Event>(e));
+    }
+    ~PerfCounters() {
+#if defined(__linux__)
+        for (int fd : fd_) {
+            if (fd >= 0) ::close(fd);
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available(Event e) const { return fd_[e] >= 0; }
+    bool anyHardware() const {
+        for (int e = Cycles; e <= DtlbMisses; ++e) {
+            if (fd_[e] >= 0) return true;
+        }
+        return false;
+    }
+    // why `e` is not available, empty if it is
+    const std::string& error(Event e) const { return error_[e]; }
+
+    static const char* name(Event e) {
+        static const char* const NAMES[EVENT_COUNT] = { "cycles",    "instructions", "branch-misses", "L1i-misses",
+                                                        "L1d-misses", "dTLB-misses", "page-faults",   "task-clock" };
+        return NAMES[e];
+    }
+
+    void start() {
+#if defined(__linux__)
+        for (int fd : fd_) {
+            if (fd < 0) continue;
+            ::ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+        t0_ = std::chrono::steady_clock::now();
+    }
+
+    Sample stop() {
+        Sample s;
+        const auto t1 = std::chrono::steady_clock::now();
+#if defined(__linux__)
+        for (int fd : fd_) {
+            if (fd >= 0) ::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+        for (int e = 0; e < EVENT_COUNT; ++e) {
+            if (fd_[e] < 0) continue;
+            std::uint64_t v[3] = {}; // value, time_enabled, time_running
+            if (::read(fd_[e], v, sizeof(v)) != static_cast<ssize_t>(sizeof(v)) || v[2] == 0) continue;
+            s.value[e] = v[2] == v[1] ? v[0] : static_cast<std::uint64_t>(double(v[0]) * double(v[1]) / double(v[2]));
+            s.valid[e] = true;
+        }
+#endif
+        s.wall_ns = std::chrono::duration<double, std::nano>(t1 - t0_).count();
+        return s;
+    }
+
+    template <class F>
+    Sample measure(F&& f) {
+        start();
+        f();
+        return stop();
+    }
+
+private:
+    void open(Event e) {
+#if defined(__linux__)
+        auto cache = [](std::uint64_t id) {
+            return id | (std::uint64_t(PERF_COUNT_HW_CACHE_OP_READ) << 8) |
+                   (std::uint64_t(PERF_COUNT_HW_CACHE_RESULT_MISS) << 16);
+        };
+        perf_event_attr a;
+        std::memset(&a, 0, sizeof(a));
+        a.size = sizeof(a);
+        a.disabled = 1;
+        a.exclude_kernel = 1;
+        a.exclude_hv = 1;
+        a.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        switch (e) {
+        case Cycles: a.type = PERF_TYPE_HARDWARE; a.config = PERF_COUNT_HW_CPU_CYCLES; break;
+        case Instructions: a.type = PERF_TYPE_HARDWARE; a.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+        case BranchMisses: a.type = PERF_TYPE_HARDWARE; a.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+        case L1iMisses: a.type = PERF_TYPE_HW_CACHE; a.config = cache(PERF_COUNT_HW_CACHE_L1I); break;
+        case L1dMisses: a.type = PERF_TYPE_HW_CACHE; a.config = cache(PERF_COUNT_HW_CACHE_L1D); break;
+        case DtlbMisses: a.type = PERF_TYPE_HW_CACHE; a.config = cache(PERF_COUNT_HW_CACHE_DTLB); break;
+        case PageFaults: a.type = PERF_TYPE_SOFTWARE; a.config = PERF_COUNT_SW_PAGE_FAULTS; break;
+        default: a.type = PERF_TYPE_SOFTWARE; a.config = PERF_COUNT_SW_TASK_CLOCK; break;
+        }
+        fd_[e] = static_cast<int>(::syscall(SYS_perf_event_open, &a, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+        if (fd_[e] < 0) error_[e] = std::strerror(errno);
+#else
+        error_[e] = "perf_event_open is Linux-only";
+#endif
+    }
+
+    int fd_[EVENT_COUNT] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+    std::string error_[EVENT_COUNT];
+    std::chrono::steady_clock::time_point t0_;
+};
@@ -0,0 +1,218 @@
+// profiler.h
+// Sampling profiler for guest code: where does a guest program spend its
+// instructions, without tracing every one of them.
+//
+// A sample is the guest pc a VM is at when the sampler asks, taken in the
+// VM's interrupt slow path (interrupts.h), so the hot loops carry no extra
+// code:
+//
+//   Instructions  every `period` guest instructions on average, folded into
+//                 the VM's countdown like the instruction timer. Each
+//                 interval is drawn from [period/2, 3*period/2) with a fixed
+//                 seed, so loops whose length divides the period are not
+//                 always caught at the same phase; runs stay reproducible.
+//   HostTime      every `period` microseconds: a timer thread sets
+//                 EXIT_SAMPLE in the VM's InterruptController and the VM
+//                 records its pc at the next instruction (block) boundary.
+//
+// A sample is keyed by pc, the block it belongs to (MiniTCGVM samples at
+// block boundaries and names the block that just ran) and whether the VM
+// was in its interrupt handler. Exports, given the program:
+//
+//   writeFolded   folded stacks for flamegraph.pl / speedscope:
+//                   <root>;main;12:add 37
+//                   <root>;irq;tb_40-48;40:push 3
+//   writeOpcodes  samples per opcode (a block's samples are spread over its
+//                 instructions)
+//   writeTop      hottest pcs
+//
+// Samples are recorded under a mutex: at most a few thousand per second.
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "interrupts.h"
+
+class SampleProfiler final : public PcSampler {
+public:
+    enum class Mode {
+        Instructions, // every `period` guest instructions
+        HostTime,     // every `period` microseconds, through `irq`
+    };
+
+    struct Site {
+        std::size_t pc = 0;
+        std::size_t tb_end = 0; // 0: a single instruction, else block [pc, tb_end)
+        bool in_handler = false;
+        std::uint64_t samples = 0;
+    };
+
+    SampleProfiler(Mode mode, std::uint64_t period, InterruptController* irq = nullptr)
+        : mode_(mode), period_(period), irq_(irq) {
+        if (period_ == 0) throw std::invalid_argument("sampling period must be non-zero");
+        if (mode_ == Mode::HostTime) {
+            if (!irq_) throw std::invalid_argument("host-time sampling needs an interrupt controller");
+            thread_ = std::thread([this] { tickLoop(); });
+        }
+    }
+
+    ~SampleProfiler() override {
+        if (thread_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lk(tick_mu_);
+                stop_ = true;
+            }
+            tick_cv_.notify_all();
+            thread_.join();
+        }
+    }
+
+    SampleProfiler(const SampleProfiler&) = delete;
+    SampleProfiler& operator=(const SampleProfiler&) = delete;
+
+    std::uint64_t nextInterval() override {
+        if (mode_ != Mode::Instructions) return 0;
+        // xorshift64
+        rng_ ^= rng_ << 13;
+        rng_ ^= rng_ >> 7;
+        rng_ ^= rng_ << 17;
+        return std::max<std::uint64_t>(1, period_ / 2 + rng_ % period_);
+    }
+
+    void sample(std::size_t pc, std::size_t tb_end, bool in_handler) override {
+        std::lock_guard<std::mutex> lk(mu_);
+        ++sites_[key(pc, tb_end, in_handler)];
+        ++samples_;
+    }
+
+    std::uint64_t samples() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return samples_;
+    }
+
+    // HostTime: sample requests made (a request the VM has not reached yet
+    // absorbs the next one).
+    std::uint64_t requests() const { return requests_.load(std::memory_order_relaxed); }
+
+    void clear() {
+        std::lock_guard<std::mutex> lk(mu_);
+        sites_.clear();
+        samples_ = 0;
+    }
+
+    // Every sampled site, by pc.
+    std::vector<Site> sites() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        std::vector<Site> out;
+        out.reserve(sites_.size());
+        for (const auto& [k, n] : sites_) out.push_back(unkey(k, n));
+        return out;
+    }
+
+    void writeFolded(std::ostream& os, std::span<const std::int32_t> program, const std::string& root = "guest") const {
+        for (const Site& s : sites()) {
+            os << root << (s.in_handler ? ";irq;" : ";main;");
+            if (s.tb_end) os << "tb_" << s.pc << "-" << s.tb_end << ";";
+            os << s.pc << ":" << opName(program, s.pc) << " " << s.samples << "\n";
+        }
+    }
+
+    void writeOpcodes(std::ostream& os, std::span<const std::int32_t> program) const {
+        std::map<std::string, double> by_op;
+        double total = 0;
+        for (const Site& s : sites()) {
+            const std::size_t end = s.tb_end ? s.tb_end : s.pc + 1;
+            const double share = double(s.samples) / double(end - s.pc);
+            for (std::size_t pc = s.pc; pc < end; ++pc) by_op[opName(program, pc)] += share;
+            total += double(s.samples);
+        }
+        std::vector<std::pair<std::string, double>> rows(by_op.begin(), by_op.end());
+        std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+        os << "opcode      samples      %\n";
+        for (const auto& [op, n] : rows) {
+            os << std::left << std::setw(8) << op << std::right << std::fixed << std::setprecision(1) << std::setw(11)
+               << n << std::setw(7) << (total > 0 ? 100.0 * n / total : 0.0) << "\n";
+        }
+    }
+
+    void writeTop(std::ostream& os, std::span<const std::int32_t> program, std::size_t n = 10) const {
+        std::vector<Site> v = sites();
+        std::sort(v.begin(), v.end(), [](const Site& a, const Site& b) { return a.samples > b.samples; });
+        if (v.size() > n) v.resize(n);
+        os << "pc         samples  insn\n";
+        for (const Site& s : v) {
+            os << std::left << std::setw(8) << s.pc << std::right << std::setw(10) << s.samples << "  "
+               << opName(program, s.pc);
+            if (s.tb_end) os << " (tb " << s.pc << "-" << s.tb_end << ")";
+            if (s.in_handler) os << " [irq]";
+            os << "\n";
+        }
+    }
+
+    // Mnemonic of program[pc] in the shared 2-bit type + 30-bit encoding.
+    static std::string opName(std::span<const std::int32_t> program, std::size_t pc) {
+        static const char* const PRIMS[] = { "halt", "add", "sub", "mul", "div", "print",
+                                             "flush", "load", "store", "vec", "iret" };
+        if (pc >= program.size()) return "?";
+        const std::uint32_t w = static_cast<std::uint32_t>(program[pc]);
+        switch (w >> 30) {
+        case 0:
+        case 2: return "push";
+        case 1: {
+            const std::uint32_t op = w & 0x3FFFFFFFu;
+            return op < std::size(PRIMS) ? PRIMS[op] : "prim" + std::to_string(op);
+        }
+        default: return "undef";
+        }
+    }
+
+private:
+    // pc and tb_end fit 31 bits each: program indices of 30-bit images
+    static std::uint64_t key(std::size_t pc, std::size_t tb_end, bool in_handler) {
+        return (std::uint64_t(pc) << 32) | (std::uint64_t(tb_end) << 1) | (in_handler ? 1u : 0u);
+    }
+    static Site unkey(std::uint64_t k, std::uint64_t n) {
+        return { static_cast<std::size_t>(k >> 32), static_cast<std::size_t>((k & 0xFFFFFFFFu) >> 1), (k & 1u) != 0, n };
+    }
+
+    void tickLoop() {
+        std::unique_lock<std::mutex> lk(tick_mu_);
+        auto next = std::chrono::steady_clock::now();
+        while (!stop_) {
+            next += std::chrono::microseconds(period_);
+            if (tick_cv_.wait_until(lk, next, [&] { return stop_; })) return;
+            requests_.fetch_add(1, std::memory_order_relaxed);
+            irq_->requestSample();
+        }
+    }
+
+    Mode mode_;
+    std::uint64_t period_;
+    InterruptController* irq_;
+    std::uint64_t rng_ = 0x9E3779B97F4A7C15ull; // interval jitter, VM thread only
+
+    mutable std::mutex mu_;
+    std::map<std::uint64_t, std::uint64_t> sites_; // key() -> samples
+    std::uint64_t samples_ = 0;
+
+    std::atomic<std::uint64_t> requests_{ 0 };
+    std::thread thread_;
+    std::mutex tick_mu_;
+    std::condition_variable tick_cv_;
+    bool stop_ = false;
+};
@@ -0,0 +1,160 @@
+// replay.h
+// Deterministic record/replay of a guest run.
+//
+// A guest is a function of its program and the few inputs it cannot compute
+// itself. Only those are logged, each stamped with the guest instruction
+// count at which it took effect (InterruptCpu::retired()):
+//
+//   Irq    an interrupt delivered to the guest         line
+//   Read   a device read on the MMIO bus (lesson3)     value
+//   Patch  MiniTCGVM::patch() between runs             index, instruction
+//
+// Replaying feeds them back at the same counts: interrupts come from the log
+// instead of the controller (its lines and the timer are ignored), device
+// reads return the logged value without touching the device, and the VM
+// applies the patches itself. A stamp that no longer matches is reported as
+// divergence (std::runtime_error) instead of silently running on.
+//
+// Stamps count instructions the way the recording engine's exit checks do
+// (the interpreters per instruction, MiniTCGVM and lesson1's AOT blocks per
+// block), so replay on the same engine and backend. Time slices, stop
+// requests and tracing may differ between the two runs.
+//
+// Format: one record per event, a LEB128 varint `stamp delta << 2 | kind`
+// followed by the payload as varints. Deltas are from the previous record,
+// so a timer interrupt every few thousand instructions takes 3-4 bytes.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+class ReplayLog {
+public:
+    enum class Mode { Record, Replay };
+    enum class Kind : std::uint8_t { Irq = 0, Read = 1, Patch = 2 };
+
+    struct Event {
+        Kind kind = Kind::Irq;
+        std::uint64_t stamp = 0;
+        std::uint64_t a = 0; // line, value or index
+        std::uint64_t b = 0; // instruction (Patch)
+    };
+
+    // An empty log to record into.
+    ReplayLog() = default;
+
+    // A recorded log to replay.
+    explicit ReplayLog(std::vector<std::uint8_t> bytes) : mode_(Mode::Replay), bytes_(std::move(bytes)) {
+        async_.advance(bytes_, Kind::Read, false);
+        reads_.advance(bytes_, Kind::Read, true);
+    }
+
+    static ReplayLog load(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) throw std::runtime_error("cannot open replay log " + path);
+        return ReplayLog(std::vector<std::uint8_t>(std::istreambuf_iterator<char>(in), {}));
+    }
+
+    void save(const std::string& path) const {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(bytes_.data()), static_cast<std::streamsize>(bytes_.size()));
+        if (!out) throw std::runtime_error("cannot write replay log " + path);
+    }
+
+    Mode mode() const { return mode_; }
+    bool replaying() const { return mode_ == Mode::Replay; }
+    const std::vector<std::uint8_t>& bytes() const { return bytes_; }
+    std::uint64_t events() const { return events_; }
+
+    // ---- recording ----
+
+    void record(Kind kind, std::uint64_t stamp, std::uint64_t a, std::uint64_t b = 0) {
+        if (mode_ != Mode::Record) throw std::logic_error("ReplayLog: recording into a log being replayed");
+        if (stamp < last_) throw std::logic_error("ReplayLog: stamps must not go back");
+        put(((stamp - last_) << 2) | static_cast<std::uint64_t>(kind));
+        put(a);
+        if (kind == Kind::Patch) put(b);
+        last_ = stamp;
+        ++events_;
+    }
+
+    // ---- replaying ----
+
+    // The next interrupt or patch, null once there are none left. Device
+    // reads are taken separately, in order, by takeRead().
+    const Event* nextAsync() const { return async_.done ? nullptr : &async_.ev; }
+    void popAsync() {
+        async_.advance(bytes_, Kind::Read, false);
+        ++events_;
+    }
+
+    // The value of the device read at `stamp`.
+    std::uint64_t takeRead(std::uint64_t stamp) {
+        if (reads_.done) throw std::runtime_error("replay diverged: device read at " + std::to_string(stamp) +
+                                                  " past the end of the log");
+        if (reads_.ev.stamp != stamp) {
+            throw std::runtime_error("replay diverged: device read at " + std::to_string(stamp) + ", logged at " +
+                                     std::to_string(reads_.ev.stamp));
+        }
+        const std::uint64_t v = reads_.ev.a;
+        reads_.advance(bytes_, Kind::Read, true);
+        ++events_;
+        return v;
+    }
+
+    // Every logged event was replayed.
+    bool finished() const { return async_.done && reads_.done; }
+
+private:
+    // Walks all records (stamps are deltas over all kinds), stopping at the
+    // ones of kind `k` (want) or of any other kind (!want).
+    struct Cursor {
+        std::size_t pos = 0;
+        std::uint64_t stamp = 0;
+        Event ev;
+        bool done = false;
+
+        void advance(const std::vector<std::uint8_t>& bytes, Kind k, bool want) {
+            while (pos < bytes.size()) {
+                const std::uint64_t head = get(bytes);
+                ev.kind = static_cast<Kind>(head & 3u);
+                stamp += head >> 2;
+                ev.stamp = stamp;
+                ev.a = get(bytes);
+                ev.b = ev.kind == Kind::Patch ? get(bytes) : 0;
+                if ((ev.kind == k) == want) return;
+            }
+            done = true;
+        }
+
+        std::uint64_t get(const std::vector<std::uint8_t>& bytes) {
+            std::uint64_t v = 0;
+            for (unsigned shift = 0;; shift += 7) {
+                if (pos >= bytes.size() || shift > 63) throw std::runtime_error("replay log truncated or corrupt");
+                const std::uint8_t byte = bytes[pos++];
+                v |= std::uint64_t(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) return v;
+            }
+        }
+    };
+
+    void put(std::uint64_t v) {
+        while (v >= 0x80) {
+            bytes_.push_back(static_cast<std::uint8_t>(v | 0x80));
+            v >>= 7;
+        }
+        bytes_.push_back(static_cast<std::uint8_t>(v));
+    }
+
+    Mode mode_ = Mode::Record;
+    std::vector<std::uint8_t> bytes_;
+    std::uint64_t last_ = 0;   // stamp of the last record written
+    std::uint64_t events_ = 0; // recorded, or replayed so far
+    Cursor async_;             // interrupts and patches
+    Cursor reads_;             // device reads
+};
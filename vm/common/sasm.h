@@ -0,0 +1,210 @@
+// sasm.h  (C++20)
+// Compile-time assembler for the lesson5 .sasm syntax.
+//
+//   constexpr auto prog = sasm_program<"3 4 + 5 - halt">;   // std::array<u32, 5>
+//
+// Tokenizing and encoding follow Lexer::lex / Assembler::compile in
+// lesson5/lexer_asm.cpp exactly, so the words are bit-identical to what the
+// runtime assembler writes to out.bin. Everything happens during constant
+// evaluation: there is no startup work, and an invalid program (unknown
+// mnemonic, out-of-range literal, string or paren block) fails the build.
+// The compiler error names one of the sasm_error_* functions below.
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+
+// Not constexpr on purpose: reaching one of these during constant evaluation
+// makes the expression non-constant, so the diagnostic points here.
+inline void sasm_error_unknown_mnemonic() {}
+inline void sasm_error_literal_out_of_range() {}
+inline void sasm_error_string_not_supported() {}
+inline void sasm_error_paren_block_not_supported() {}
+
+// String literal usable as a template argument.
+template <std::size_t N>
+struct FixedString {
+    char s[N]{};
+
+    consteval FixedString(const char (&str)[N]) {
+        for (std::size_t i = 0; i < N; ++i) s[i] = str[i];
+    }
+
+    constexpr std::string_view view() const { return { s, N - 1 }; }
+};
+
+struct Sasm {
+    using i32 = std::int32_t;
+    using u32 = std::uint32_t;
+
+    static constexpr u32 TYPE_POS = 0u;
+    static constexpr u32 TYPE_PRIM = 1u;
+    static constexpr u32 TYPE_NEG = 2u;
+
+    static constexpr u32 pack(u32 type, u32 data30) {
+        return (type << 30) | (data30 & 0x3FFFFFFFu);
+    }
+
+    // ---------- lexer (mirrors lesson5 Lexer::lex) ----------
+
+    static constexpr bool is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    static constexpr bool is_single_char_token(char c) {
+        switch (c) {
+        case '(': case ')': case '[': case ']': case '{': case '}':
+        case '+': case '-': case '*': case '/': case ',':
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Calls f(token) for every token of s, in order.
+    template <class F>
+    static constexpr void for_each_token(std::string_view s, F&& f) {
+        std::size_t i = 0;
+        auto peek = [&](std::size_t k) -> char { return i + k < s.size() ? s[i + k] : '\0'; };
+        auto starts_with_comment = [&] { return peek(0) == '/' && peek(1) == '/'; };
+        auto skip_line_comment = [&] {
+            i += 2;
+            while (i < s.size() && s[i] != '\n') i++;
+        };
+        auto skip_string = [&] {
+            i++; // opening "
+            while (i < s.size()) {
+                char c = s[i++];
+                if (c == '\\') {
+                    if (i < s.size()) i++;
+                    continue;
+                }
+                if (c == '"') break;
+            }
+        };
+
+        while (i < s.size()) {
+            if (is_space(peek(0))) { i++; continue; }
+            if (starts_with_comment()) { skip_line_comment(); continue; }
+
+            const std::size_t begin = i;
+            const char c = peek(0);
+
+            if (c == '"') {
+                skip_string();
+                f(s.substr(begin, i - begin));
+                continue;
+            }
+            if (c == '(') {
+                int depth = 0;
+                while (i < s.size()) {
+                    if (starts_with_comment()) { skip_line_comment(); continue; }
+                    if (s[i] == '"') { skip_string(); continue; }
+                    char x = s[i++];
+                    if (x == '(') depth++;
+                    else if (x == ')' && --depth == 0) break;
+                }
+                f(s.substr(begin, i - begin));
+                continue;
+            }
+            if (is_single_char_token(c)) {
+                i++;
+                f(s.substr(begin, 1));
+                continue;
+            }
+
+            while (i < s.size()) {
+                char x = peek(0);
+                if (is_space(x) || starts_with_comment() || x == '"' || x == '(' || is_single_char_token(x)) break;
+                i++;
+            }
+            if (i > begin) f(s.substr(begin, i - begin));
+        }
+    }
+
+    // ---------- assembler (mirrors lesson5 Assembler::compile) ----------
+
+    static constexpr bool parse_int32(std::string_view sv, i32& out) {
+        if (sv.empty()) return false;
+        std::size_t idx = 0;
+        bool neg = false;
+        if (sv[0] == '+' || sv[0] == '-') {
+            neg = (sv[0] == '-');
+            idx = 1;
+            if (idx >= sv.size()) return false;
+        }
+        i32 val = 0;
+        for (; idx < sv.size(); idx++) {
+            char c = sv[idx];
+            if (c < '0' || c > '9') return false;
+            int d = c - '0';
+            if (val > (std::numeric_limits<i32>::max() - d) / 10) return false;
+            val = val * 10 + d;
+        }
+        out = neg ? -val : val;
+        return true;
+    }
+
+    static constexpr u32 encode_literal(i32 v) {
+        constexpr i32 MAX30 = (1 << 30) - 1;
+        if (v >= 0) {
+            if (v > MAX30) sasm_error_literal_out_of_range();
+            return pack(TYPE_POS, static_cast<u32>(v));
+        }
+        i32 a = (v == std::numeric_limits<i32>::min()) ? (MAX30 + 1) : -v;
+        if (a > MAX30) sasm_error_literal_out_of_range();
+        return pack(TYPE_NEG, static_cast<u32>(a));
+    }
+
+    static constexpr bool lookup_prim(std::string_view t, u32& op) {
+        if (t == "halt") { op = 0; return true; }
+        if (t == "+") { op = 1; return true; }
+        if (t == "-") { op = 2; return true; }
+        if (t == "*") { op = 3; return true; }
+        if (t == "/") { op = 4; return true; }
+        if (t == "print") { op = 5; return true; }
+        if (t == "flush") { op = 6; return true; }
+        if (t == "load") { op = 7; return true; }
+        if (t == "store") { op = 8; return true; }
+        if (t == "vec") { op = 9; return true; }
+        if (t == "iret") { op = 10; return true; }
+        return false;
+    }
+
+    static constexpr u32 encode_token(std::string_view t) {
+        if (t.front() == '"' && t.size() >= 2 && t.back() == '"') sasm_error_string_not_supported();
+        if (t.front() == '(') sasm_error_paren_block_not_supported();
+
+        u32 op = 0;
+        if (lookup_prim(t, op)) return pack(TYPE_PRIM, op);
+
+        i32 v = 0;
+        if (parse_int32(t, v)) return encode_literal(v);
+
+        sasm_error_unknown_mnemonic();
+        return 0;
+    }
+
+    static consteval std::size_t count(std::string_view src) {
+        std::size_t n = 0;
+        for_each_token(src, [&](std::string_view) { ++n; });
+        return n;
+    }
+
+    template <std::size_t N>
+    static consteval std::array<u32, N> assemble(std::string_view src) {
+        std::array<u32, N> out{};
+        std::size_t n = 0;
+        for_each_token(src, [&](std::string_view t) { out[n++] = encode_token(t); });
+        return out;
+    }
+};
+
+template <FixedString Src>
+inline constexpr auto sasm_program = Sasm::assemble<Sasm::count(Src.view())>(Src.view());
+
+static_assert(sasm_program<"3 4 + halt"> ==
+              std::array<std::uint32_t, 4>{ 3u, 4u, 0x40000001u, 0x40000000u });
+static_assert(sasm_program<"7 -1 // comment\n print">.size() == 4); // "-1" lexes as "-" "1"
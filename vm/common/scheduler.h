@@ -0,0 +1,259 @@
+// scheduler.h
+// Work-stealing scheduler: many short-lived VMs multiplexed over a pool of
+// host threads.
+//
+// A job is a slice function, typically a VM's runSlice() (lesson1, lesson3,
+// MiniTCGVM): run about `budget` guest instructions, return true if there is
+// more to run. The VM leaves its loop through the same countdown branch that
+// drives the instruction timer (interrupts.h), so a time slice costs nothing
+// on the hot path. The VM resumes on the loop it left: a verified program
+// started on the unchecked fast loop stays there, a run on the checked loop
+// (tracing, paging, a trap handler) continues checked.
+//
+// Each worker owns a deque:
+//   - it takes jobs from the front and puts a job whose slice ran out at the
+//     back, so its own jobs are served round-robin;
+//   - an idle worker steals half of another worker's deque, from the back
+//     (the jobs that would wait longest there);
+//   - with nothing to run or steal it parks on a condition variable (a
+//     futex on Linux) until a job is queued.
+//
+// The deques are mutex-protected: a lock per slice is noise next to a slice
+// of 10^4..10^5 guest instructions.
+//
+// Counters are per worker, on their own cache lines, written only by their
+// owner; stats() sums them without stopping the workers.
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+class VmScheduler {
+public:
+    // One time slice of about `budget` guest instructions; true if the job
+    // has more to run.
+    using Slice = std::function<bool(std::uint64_t budget)>;
+    // Called on the worker once the job is finished; `error` is set if a
+    // slice threw. Must not throw.
+    using Done = std::function<void(std::exception_ptr error)>;
+
+    struct Options {
+        unsigned workers = 0;                // 0 => hardware_concurrency()
+        std::uint64_t slice_insns = 100'000; // time slice, guest instructions
+    };
+
+    struct Stats {
+        std::uint64_t jobs = 0;        // finished
+        std::uint64_t slices = 0;
+        std::uint64_t steals = 0;      // successful steal attempts
+        std::uint64_t stolen_jobs = 0; // jobs moved by them
+        std::uint64_t parks = 0;       // times a worker went to sleep
+    };
+
+    VmScheduler() : VmScheduler(Options{}) {}
+
+    explicit VmScheduler(const Options& opt) : slice_(opt.slice_insns) {
+        if (slice_ == 0) throw std::invalid_argument("time slice must be non-zero");
+        unsigned n = opt.workers ? opt.workers : std::thread::hardware_concurrency();
+        if (n == 0) n = 1;
+        for (unsigned i = 0; i < n; ++i) workers_.push_back(std::make_unique<Worker>());
+        for (unsigned i = 0; i < n; ++i) workers_[i]->thread = std::thread([this, i] { workerLoop(i); });
+    }
+
+    // Finishes every submitted job, then stops the workers.
+    ~VmScheduler() {
+        wait();
+        {
+            std::lock_guard<std::mutex> lk(park_mu_);
+            stop_ = true;
+        }
+        park_cv_.notify_all();
+        for (auto& w : workers_) w->thread.join();
+    }
+
+    VmScheduler(const VmScheduler&) = delete;
+    VmScheduler& operator=(const VmScheduler&) = delete;
+
+    unsigned workers() const { return static_cast<unsigned>(workers_.size()); }
+    std::uint64_t sliceInsns() const { return slice_; }
+
+    // Queue a job: on the calling worker's own deque when called from a job,
+    // otherwise round-robin over the workers.
+    void submit(Slice slice, Done done = {}) {
+        if (!slice) throw std::invalid_argument("submit: empty slice function");
+        auto* job = new Job{ std::move(slice), std::move(done) };
+        outstanding_.fetch_add(1, std::memory_order_relaxed);
+        const unsigned w = current_ == this ? current_worker_
+                                            : next_.fetch_add(1, std::memory_order_relaxed) % workers();
+        push(*workers_[w], job, true);
+    }
+
+    // Block until every job submitted so far has finished.
+    void wait() {
+        std::unique_lock<std::mutex> lk(done_mu_);
+        done_cv_.wait(lk, [&] { return outstanding_.load(std::memory_order_acquire) == 0; });
+    }
+
+    Stats stats() const {
+        Stats s;
+        for (const auto& w : workers_) {
+            s.jobs += w->jobs.load(std::memory_order_relaxed);
+            s.slices += w->slices.load(std::memory_order_relaxed);
+            s.steals += w->steals.load(std::memory_order_relaxed);
+            s.stolen_jobs += w->stolen_jobs.load(std::memory_order_relaxed);
+            s.parks += w->parks.load(std::memory_order_relaxed);
+        }
+        return s;
+    }
+
+private:
+    struct Job {
+        Slice slice;
+        Done done;
+    };
+
+    struct alignas(64) Worker {
+        std::mutex mu;
+        std::deque<Job*> jobs_q;
+        std::thread thread;
+        // owner-written counters
+        alignas(64) std::atomic<std::uint64_t> jobs{ 0 };
+        std::atomic<std::uint64_t> slices{ 0 };
+        std::atomic<std::uint64_t> steals{ 0 };
+        std::atomic<std::uint64_t> stolen_jobs{ 0 };
+        std::atomic<std::uint64_t> parks{ 0 };
+    };
+
+    static void bump(std::atomic<std::uint64_t>& c, std::uint64_t n = 1) {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // `wake`: a sleeping worker may steal it. A job requeued after its slice
+    // only wakes one if it is not the owner's only job, so a lone job does
+    // not bounce between workers.
+    void push(Worker& w, Job* job, bool wake) {
+        std::size_t depth;
+        {
+            std::lock_guard<std::mutex> lk(w.mu);
+            w.jobs_q.push_back(job);
+            depth = w.jobs_q.size();
+        }
+        queued_.fetch_add(1); // seq_cst, pairs with park()
+        if ((wake || depth > 1) && sleeping_.load() > 0) {
+            std::lock_guard<std::mutex> lk(park_mu_);
+            park_cv_.notify_one();
+        }
+    }
+
+    Job* popLocal(Worker& w) {
+        std::lock_guard<std::mutex> lk(w.mu);
+        if (w.jobs_q.empty()) return nullptr;
+        Job* job = w.jobs_q.front();
+        w.jobs_q.pop_front();
+        queued_.fetch_sub(1, std::memory_order_relaxed);
+        return job;
+    }
+
+    // Move half of the first non-empty victim's deque (from its back) to
+    // ours and return one of those jobs to run.
+    Job* steal(unsigned self) {
+        const unsigned n = workers();
+        Worker& me = *workers_[self];
+        for (unsigned k = 1; k < n; ++k) {
+            Worker& victim = *workers_[(self + k) % n];
+            std::vector<Job*> taken;
+            {
+                std::lock_guard<std::mutex> lk(victim.mu);
+                const std::size_t count = (victim.jobs_q.size() + 1) / 2;
+                for (std::size_t i = 0; i < count; ++i) {
+                    taken.push_back(victim.jobs_q.back());
+                    victim.jobs_q.pop_back();
+                }
+            }
+            if (taken.empty()) continue;
+            bump(me.steals);
+            bump(me.stolen_jobs, taken.size());
+            Job* run = taken.front();
+            queued_.fetch_sub(1, std::memory_order_relaxed);
+            if (taken.size() > 1) {
+                std::lock_guard<std::mutex> lk(me.mu);
+                me.jobs_q.insert(me.jobs_q.end(), taken.begin() + 1, taken.end());
+            }
+            return run;
+        }
+        return nullptr;
+    }
+
+    // Sleep until a job is queued anywhere; false when shutting down.
+    bool park(Worker& w) {
+        std::unique_lock<std::mutex> lk(park_mu_);
+        sleeping_.fetch_add(1); // seq_cst: a push either sees us or we see its job
+        bump(w.parks);
+        while (!stop_ && queued_.load() == 0) park_cv_.wait(lk);
+        sleeping_.fetch_sub(1);
+        return !stop_;
+    }
+
+    void finish(Worker& w, Job* job, std::exception_ptr error) {
+        if (job->done) job->done(error);
+        delete job;
+        bump(w.jobs);
+        if (outstanding_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lk(done_mu_);
+            done_cv_.notify_all();
+        }
+    }
+
+    void workerLoop(unsigned self) {
+        current_ = this;
+        current_worker_ = self;
+        Worker& w = *workers_[self];
+        for (;;) {
+            Job* job = popLocal(w);
+            if (!job) job = steal(self);
+            if (!job) {
+                if (!park(w)) return;
+                continue;
+            }
+            bool more = false;
+            std::exception_ptr error;
+            try {
+                more = job->slice(slice_);
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+            bump(w.slices);
+            if (more) push(w, job, false);
+            else finish(w, job, error);
+        }
+    }
+
+    std::uint64_t slice_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<unsigned> next_{ 0 };
+
+    std::atomic<std::size_t> queued_{ 0 };      // jobs sitting in deques
+    std::atomic<std::size_t> outstanding_{ 0 }; // submitted, not finished
+
+    std::mutex park_mu_;
+    std::condition_variable park_cv_;
+    std::atomic<unsigned> sleeping_{ 0 };
+    bool stop_ = false;
+
+    std::mutex done_mu_;
+    std::condition_variable done_cv_;
+
+    static inline thread_local const VmScheduler* current_ = nullptr;
+    static inline thread_local unsigned current_worker_ = 0;
+};
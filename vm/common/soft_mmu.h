@@ -0,0 +1,190 @@
+// soft_mmu.h
+// Soft-MMU: guest-virtual to guest-physical translation with a software TLB.
+//
+// Addresses are word indices, as everywhere else in the VMs. A page is 1024
+// words (4 KiB), so a page table is exactly one page of 32-bit entries.
+//
+// Guest page-table format (two levels, like a 32-bit x86 / Sv32 walk):
+//
+//   virtual address  [29:20] L1 index   [19:10] L2 index   [9:0] offset
+//   PTE (32-bit)     [31:10] frame number                  [9:0] flags
+//
+//   flags: V (valid), R, W, X. A valid L1 entry points at an L2 table; its
+//   R/W/X bits are ignored. Leaf permissions come from the L2 entry.
+//
+// The root table's frame number is the MMU's only register (setRoot()).
+// Page tables live in guest-physical memory, so a guest could in principle
+// edit them itself; after changing an entry, call invalidatePage() (or
+// flush()) exactly as a guest kernel would issue invlpg / sfence.vma.
+//
+// The TLB is direct-mapped on the virtual page number. Each entry keeps one
+// tag per access type, so a hit is a single compare and a pointer add:
+// an entry filled for a read-only page never satisfies a write.
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+class PageFault : public std::runtime_error {
+public:
+    PageFault(std::uint32_t vaddr, const char* access, const char* why)
+        : std::runtime_error(std::string("page fault: ") + access + " at 0x" + hex(vaddr) + " (" + why + ")"),
+          vaddr_(vaddr) {}
+
+    std::uint32_t vaddr() const { return vaddr_; }
+
+private:
+    static std::string hex(std::uint32_t v) {
+        static const char* digits = "0123456789abcdef";
+        std::string s(8, '0');
+        for (int i = 7; i >= 0; --i, v >>= 4) s[static_cast<std::size_t>(i)] = digits[v & 0xF];
+        return s;
+    }
+
+    std::uint32_t vaddr_;
+};
+
+class SoftMmu {
+public:
+    using u32 = std::uint32_t;
+
+    static constexpr u32 PAGE_SHIFT = 10;
+    static constexpr u32 PAGE_WORDS = 1u << PAGE_SHIFT;
+    static constexpr u32 OFFSET_MASK = PAGE_WORDS - 1;
+    static constexpr u32 VA_BITS = 30;
+
+    static constexpr u32 PTE_V = 1u << 0;
+    static constexpr u32 PTE_R = 1u << 1;
+    static constexpr u32 PTE_W = 1u << 2;
+    static constexpr u32 PTE_X = 1u << 3;
+    static constexpr u32 FLAG_MASK = PAGE_WORDS - 1;
+
+    static constexpr std::size_t TLB_ENTRIES = 64; // power of two
+
+    struct Stats {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;  // page walks
+        std::uint64_t faults = 0;
+        std::uint64_t flushes = 0; // flush() calls
+        std::uint64_t invalidations = 0;
+
+        double hitRate() const {
+            const std::uint64_t n = hits + misses;
+            return n ? double(hits) / double(n) : 0.0;
+        }
+    };
+
+    static constexpr u32 pte(u32 frame, u32 flags) { return (frame << PAGE_SHIFT) | (flags & FLAG_MASK); }
+
+    // Guest-physical memory the page tables and frames live in.
+    void attach(u32* phys, std::size_t phys_words) {
+        phys_ = phys;
+        phys_frames_ = phys_words >> PAGE_SHIFT;
+        tlb_.fill(Entry{});
+    }
+
+    // Switch address spaces. Empties the TLB.
+    void setRoot(u32 root_frame) {
+        if (root_frame >= phys_frames_) throw std::out_of_range("page-table root outside guest memory");
+        root_ = root_frame;
+        tlb_.fill(Entry{});
+    }
+    u32 root() const { return root_; }
+
+    u32 load(u32 va) { return *translate<Read>(va); }
+    void store(u32 va, u32 v) { *translate<Write>(va) = v; }
+    u32 fetch(u32 va) { return *translate<Exec>(va); }
+
+    void flush() {
+        tlb_.fill(Entry{});
+        ++stats_.flushes;
+    }
+
+    void invalidatePage(u32 va) {
+        const u32 vpn = va >> PAGE_SHIFT;
+        Entry& e = tlb_[vpn & (TLB_ENTRIES - 1)];
+        if (e.tag[Read] == vpn || e.tag[Write] == vpn || e.tag[Exec] == vpn) e = Entry{};
+        ++stats_.invalidations;
+    }
+
+    // Host-side page-table editing (what a guest kernel would do): install
+    // va -> frame with `flags` (PTE_R/W/X). Missing L2 tables are taken from
+    // alloc_frame(), which must return a zeroed guest-physical frame.
+    template <class AllocFrame>
+    void map(u32 va, u32 frame, u32 flags, AllocFrame&& alloc_frame) {
+        if (frame >= phys_frames_) throw std::out_of_range("map: frame outside guest memory");
+        u32* l1 = table(root_);
+        u32& l1e = l1[(va >> (2 * PAGE_SHIFT)) & OFFSET_MASK];
+        if (!(l1e & PTE_V)) {
+            const u32 t = alloc_frame();
+            if (t >= phys_frames_) throw std::out_of_range("map: page table outside guest memory");
+            l1e = pte(t, PTE_V);
+        }
+        table(l1e >> PAGE_SHIFT)[(va >> PAGE_SHIFT) & OFFSET_MASK] = pte(frame, flags | PTE_V);
+        invalidatePage(va);
+    }
+
+    const Stats& stats() const { return stats_; }
+    void resetStats() { stats_ = Stats{}; }
+
+private:
+    enum Access : u32 { Read = 0, Write = 1, Exec = 2 };
+
+    static constexpr u32 NO_TAG = ~0u; // never a valid VPN (VA is 30-bit)
+
+    struct Entry {
+        std::array<u32, 3> tag{ NO_TAG, NO_TAG, NO_TAG }; // VPN per access type
+        u32* host = nullptr;                               // host address of the frame
+    };
+
+    u32* table(u32 frame) { return phys_ + (static_cast<std::size_t>(frame) << PAGE_SHIFT); }
+
+    template <Access A>
+    u32* translate(u32 va) {
+        const u32 vpn = va >> PAGE_SHIFT;
+        Entry& e = tlb_[vpn & (TLB_ENTRIES - 1)];
+        if (e.tag[A] == vpn) {
+            ++stats_.hits;
+            return e.host + (va & OFFSET_MASK);
+        }
+        return refill(e, va, A);
+    }
+
+    // TLB miss: walk the two-level table and refill the entry.
+    u32* refill(Entry& e, u32 va, Access a) {
+        ++stats_.misses;
+        static constexpr const char* names[] = { "read", "write", "fetch" };
+        static constexpr u32 need[] = { PTE_R, PTE_W, PTE_X };
+
+        auto fault = [&](const char* why) {
+            ++stats_.faults;
+            return PageFault(va, names[a], why);
+        };
+
+        if (va >> VA_BITS) throw fault("address outside the 30-bit space");
+        const u32 l1e = table(root_)[(va >> (2 * PAGE_SHIFT)) & OFFSET_MASK];
+        if (!(l1e & PTE_V)) throw fault("no page table");
+        if ((l1e >> PAGE_SHIFT) >= phys_frames_) throw fault("page table outside guest memory");
+
+        const u32 l2e = table(l1e >> PAGE_SHIFT)[(va >> PAGE_SHIFT) & OFFSET_MASK];
+        if (!(l2e & PTE_V)) throw fault("page not mapped");
+        if (!(l2e & need[a])) throw fault("permission denied");
+        const u32 frame = l2e >> PAGE_SHIFT;
+        if (frame >= phys_frames_) throw fault("frame outside guest memory");
+
+        const u32 vpn = va >> PAGE_SHIFT;
+        e.host = table(frame);
+        e.tag[Read] = (l2e & PTE_R) ? vpn : NO_TAG;
+        e.tag[Write] = (l2e & PTE_W) ? vpn : NO_TAG;
+        e.tag[Exec] = (l2e & PTE_X) ? vpn : NO_TAG;
+        return e.host + (va & OFFSET_MASK);
+    }
+
+    u32* phys_ = nullptr;
+    std::size_t phys_frames_ = 0;
+    u32 root_ = 0;
+    std::array<Entry, TLB_ENTRIES> tlb_{};
+    Stats stats_;
+};
@@ -0,0 +1,192 @@
+// strength_reduce.h
+// Multiplication and division by a constant without imul/idiv, for
+// translators that see `push c; mul` or `push c; div` (mini_tcg.h).
+//
+//   MulPlan  x * c as nothing, a negate, a shift, or two shifts and an
+//            add/sub (what a compiler does with lea), else a plain multiply
+//   DivPlan  x / c (truncating, as the interpreters) as a shift with a
+//            rounding bias for powers of two, else a multiply-high by a
+//            magic number (Hacker's Delight, 10-1) and a shift
+//
+// Both wrap like the interpreters (32-bit two's complement). apply() is the
+// reference: a translator reads the plan's fields and emits the sequence,
+// and bench_strength checks every plan kind against the plain operators.
+// A divisor of 0 or -1 still traps (always, or for INT_MIN only); for every
+// other constant the division can neither trap nor overflow, so the checks
+// disappear.
+#pragma once
+#include <cstdint>
+#include <limits>
+
+struct MulPlan {
+    using i32 = std::int32_t;
+    using u32 = std::uint32_t;
+
+    enum class Kind : std::uint8_t {
+        Zero,     // 0
+        Identity, // x
+        Neg,      // -x
+        Shift,    // x << a, negated if neg
+        ShiftAdd, // (x << a) + (x << b), negated if neg   c = +-(2^a + 2^b)
+        ShiftSub, // (x << a) - (x << b), negated if neg   c = +-(2^a - 2^b)
+        Imul,     // x * c
+    };
+
+    Kind kind = Kind::Imul;
+    bool neg = false;
+    std::uint8_t a = 0, b = 0;
+    i32 c = 0;
+
+    static constexpr MulPlan make(i32 c) {
+        MulPlan p;
+        p.c = c;
+        if (c == 0) return p.with(Kind::Zero);
+        if (c == 1) return p.with(Kind::Identity);
+        if (c == -1) return p.with(Kind::Neg);
+        p.neg = c < 0;
+        const u32 m = p.neg ? 0u - static_cast<u32>(c) : static_cast<u32>(c);
+        if ((m & (m - 1)) == 0) {
+            p.a = log2(m);
+            return p.with(Kind::Shift);
+        }
+        const u32 low = m & (0u - m); // lowest set bit
+        if (((m - low) & (m - low - 1)) == 0) { // two bits set
+            p.a = log2(m - low);
+            p.b = log2(low);
+            return p.with(Kind::ShiftAdd);
+        }
+        if (((m + low) & (m + low - 1)) == 0 && m + low != 0) { // one run of ones
+            p.a = log2(m + low);
+            p.b = log2(low);
+            return p.with(Kind::ShiftSub);
+        }
+        p.neg = false;
+        return p.with(Kind::Imul);
+    }
+
+    constexpr i32 apply(i32 x) const {
+        const u32 u = static_cast<u32>(x);
+        u32 r = 0;
+        switch (kind) {
+        case Kind::Zero: return 0;
+        case Kind::Identity: return x;
+        case Kind::Neg: return static_cast<i32>(0u - u);
+        case Kind::Shift: r = u << a; break;
+        case Kind::ShiftAdd: r = (u << a) + (u << b); break;
+        case Kind::ShiftSub: r = (u << a) - (u << b); break;
+        case Kind::Imul: return static_cast<i32>(u * static_cast<u32>(c));
+        }
+        return static_cast<i32>(neg ? 0u - r : r);
+    }
+
+private:
+    constexpr MulPlan with(Kind k) const {
+        MulPlan p = *this;
+        p.kind = k;
+        return p;
+    }
+    static constexpr std::uint8_t log2(u32 v) {
+        std::uint8_t n = 0;
+        while (v >>= 1) ++n;
+        return n;
+    }
+};
+
+struct DivPlan {
+    using i32 = std::int32_t;
+    using u32 = std::uint32_t;
+    using i64 = std::int64_t;
+
+    enum class Kind : std::uint8_t {
+        Trap,     // c == 0: always "division by zero"
+        Identity, // c == 1
+        NegOne,   // c == -1: -x, "division overflow" for INT_MIN
+        Pow2,     // |c| == 2^shift: (x + bias) >> shift, negated if neg
+        Magic,    // mulhi(magic, x) (+ x if add) >> shift, rounded toward zero, negated if neg
+    };
+
+    Kind kind = Kind::Trap;
+    bool neg = false;   // c < 0: x / c == -(x / |c|), |c| < 2^31 so the negate cannot overflow
+    bool add = false;   // magic >= 2^31: add x back after the multiply-high
+    std::uint8_t shift = 0;
+    i32 magic = 0;
+    i32 c = 0;
+
+    static constexpr DivPlan make(i32 c) {
+        DivPlan p;
+        p.c = c;
+        if (c == 0) return p;
+        if (c == 1) return p.with(Kind::Identity);
+        if (c == -1) return p.with(Kind::NegOne);
+        if (c == std::numeric_limits<i32>::min()) { // 2^31, no positive |c|; only INT_MIN / INT_MIN == 1
+            p.shift = 31;
+            return p.with(Kind::Pow2);
+        }
+        p.neg = c < 0;
+        const u32 d = p.neg ? 0u - static_cast<u32>(c) : static_cast<u32>(c);
+        if ((d & (d - 1)) == 0) {
+            while ((1u << p.shift) != d) ++p.shift;
+            return p.with(Kind::Pow2);
+        }
+        // Hacker's Delight, figure 10-1, for 2 <= d < 2^31
+        constexpr u32 two31 = 0x8000'0000u;
+        const u32 anc = two31 - 1 - two31 % d; // |nc|
+        u32 sh = 31;
+        u32 q1 = two31 / anc, r1 = two31 - q1 * anc;
+        u32 q2 = two31 / d, r2 = two31 - q2 * d;
+        u32 delta = 0;
+        do {
+            ++sh;
+            q1 *= 2;
+            r1 *= 2;
+            if (r1 >= anc) {
+                ++q1;
+                r1 -= anc;
+            }
+            q2 *= 2;
+            r2 *= 2;
+            if (r2 >= d) {
+                ++q2;
+                r2 -= d;
+            }
+            delta = d - r2;
+        } while (q1 < delta || (q1 == delta && r1 == 0));
+        const u32 m = q2 + 1;
+        p.magic = static_cast<i32>(m);
+        p.add = m >= two31;
+        p.shift = static_cast<std::uint8_t>(sh - 32);
+        return p.with(Kind::Magic);
+    }
+
+    // Can x / c trap? (only for the kinds that keep a check)
+    constexpr bool traps(i32 x) const {
+        return kind == Kind::Trap || (kind == Kind::NegOne && x == std::numeric_limits<i32>::min());
+    }
+
+    // x / c for every x with !traps(x)
+    constexpr i32 apply(i32 x) const {
+        i32 q = 0;
+        switch (kind) {
+        case Kind::Trap: return 0;
+        case Kind::Identity: return x;
+        case Kind::NegOne: return static_cast<i32>(0u - static_cast<u32>(x));
+        case Kind::Pow2:
+            if (shift == 31) return x == std::numeric_limits<i32>::min() ? 1 : 0;
+            q = (x + static_cast<i32>(static_cast<u32>(x >> 31) >> (32 - shift))) >> shift;
+            break;
+        case Kind::Magic:
+            q = static_cast<i32>((i64(magic) * x) >> 32);
+            if (add) q += x;
+            q = (q >> shift) - (x >> 31);
+            break;
+        }
+        return neg ? -q : q;
+    }
+
+private:
+    constexpr DivPlan with(Kind k) const {
+        DivPlan p = *this;
+        p.kind = k;
+        return p;
+    }
+};
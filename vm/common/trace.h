@@ -0,0 +1,150 @@
+// trace.h
+// Compile-time tracing policies for the interpreter loops.
+//
+// Engines template their run loop on a policy type instead of testing a
+// `bool trace` on every instruction:
+//
+//   TraceOff      - every hook is an empty inline function, and text tracing
+//                   sits behind `if constexpr (Trace::TEXT)`, so the
+//                   instantiated loop contains no trace code at all
+//   TraceCounters - instruction / primitive / TB counters, no I/O
+//   TraceText     - the engine's human-readable trace on std::cout (what
+//                   run(true) always printed)
+//   TraceBinary   - fixed-size records appended to a per-thread ring buffer
+//                   (flight recorder); dump() writes it to a file, and
+//                   tools/trace_decode prints it offline
+//
+// Hooks, called by the engines:
+//   insn(pc, word)    before an instruction executes
+//   tb(kind, pc)      TB lookup / execution events (MiniTCGVM)
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+enum class TraceKind : std::uint8_t {
+    Insn = 1,   // data = instruction word
+    TbHit = 2,  // data = 0
+    TbMiss = 3, // data = 0
+    TbExec = 4, // data = next_pc
+};
+
+struct TraceOff {
+    static constexpr bool TEXT = false;
+    void insn(std::size_t, std::uint32_t) {}
+    void tb(TraceKind, std::size_t, std::uint32_t = 0) {}
+};
+
+struct TraceText {
+    static constexpr bool TEXT = true;
+    void insn(std::size_t, std::uint32_t) {}
+    void tb(TraceKind, std::size_t, std::uint32_t = 0) {}
+};
+
+struct TraceCounters {
+    static constexpr bool TEXT = false;
+
+    std::uint64_t insns = 0;
+    std::array<std::uint64_t, 4> by_type{};  // indexed by the 2-bit type
+    std::array<std::uint64_t, 16> by_prim{}; // primitive opcodes 0..15
+    std::uint64_t tb_hits = 0;
+    std::uint64_t tb_misses = 0;
+    std::uint64_t tb_execs = 0;
+
+    void insn(std::size_t, std::uint32_t w) {
+        ++insns;
+        ++by_type[w >> 30];
+        if ((w >> 30) == 1u) ++by_prim[w & 15u];
+    }
+
+    void tb(TraceKind k, std::size_t, std::uint32_t = 0) {
+        if (k == TraceKind::TbHit) ++tb_hits;
+        else if (k == TraceKind::TbMiss) ++tb_misses;
+        else if (k == TraceKind::TbExec) ++tb_execs;
+    }
+};
+
+// One binary trace record. 12 bytes, written in host byte order.
+struct TraceRecord {
+    std::uint32_t pc;
+    std::uint32_t data;
+    std::uint8_t kind;   // TraceKind
+    std::uint8_t engine; // free-form id chosen by the host
+    std::uint16_t reserved;
+};
+static_assert(sizeof(TraceRecord) == 12, "TraceRecord is part of the file format");
+
+// Per-thread flight recorder: keeps the newest `capacity` records.
+class TraceRing {
+public:
+    static constexpr std::uint32_t FILE_MAGIC = 0x52545653u; // "SVTR"
+    static constexpr std::uint32_t FILE_VERSION = 1;
+
+    explicit TraceRing(std::size_t capacity = 1u << 20) {
+        std::size_t cap = 1;
+        while (cap < capacity) cap <<= 1;
+        buf_.resize(cap);
+        mask_ = cap - 1;
+    }
+
+    // The ring of the calling thread (default capacity).
+    static TraceRing& local() {
+        thread_local TraceRing ring;
+        return ring;
+    }
+
+    void put(TraceKind kind, std::size_t pc, std::uint32_t data, std::uint8_t engine) {
+        TraceRecord& r = buf_[head_ & mask_];
+        r.pc = static_cast<std::uint32_t>(pc);
+        r.data = data;
+        r.kind = static_cast<std::uint8_t>(kind);
+        r.engine = engine;
+        r.reserved = 0;
+        ++head_;
+    }
+
+    std::uint64_t written() const { return head_; }
+    std::uint64_t dropped() const { return head_ > buf_.size() ? head_ - buf_.size() : 0; }
+    void clear() { head_ = 0; }
+
+    // File: magic, version, record size, record count (u32 each), dropped
+    // (u64), then the records oldest first.
+    void dump(const char* path) const {
+        std::FILE* f = std::fopen(path, "wb");
+        if (!f) throw std::runtime_error(std::string("Cannot open trace file: ") + path);
+
+        const std::uint64_t n = head_ - dropped();
+        const std::uint32_t hdr[4] = { FILE_MAGIC, FILE_VERSION, sizeof(TraceRecord), static_cast<std::uint32_t>(n) };
+        const std::uint64_t lost = dropped();
+        bool ok = std::fwrite(hdr, sizeof(hdr), 1, f) == 1 && std::fwrite(&lost, sizeof(lost), 1, f) == 1;
+
+        // oldest record first: [start, end of buffer) then [0, start)
+        const std::size_t start = static_cast<std::size_t>((head_ - n) & mask_);
+        const std::size_t first = static_cast<std::size_t>(n) < buf_.size() - start ? static_cast<std::size_t>(n) : buf_.size() - start;
+        if (ok && first) ok = std::fwrite(&buf_[start], sizeof(TraceRecord), first, f) == first;
+        if (ok && n > first) {
+            const std::size_t rest = static_cast<std::size_t>(n) - first;
+            ok = std::fwrite(&buf_[0], sizeof(TraceRecord), rest, f) == rest;
+        }
+        if (std::fclose(f) != 0 || !ok) throw std::runtime_error(std::string("Write failed: ") + path);
+    }
+
+private:
+    std::vector<TraceRecord> buf_;
+    std::size_t mask_ = 0;
+    std::uint64_t head_ = 0;
+};
+
+struct TraceBinary {
+    static constexpr bool TEXT = false;
+
+    TraceRing* ring = &TraceRing::local();
+    std::uint8_t engine = 0;
+
+    void insn(std::size_t pc, std::uint32_t w) { ring->put(TraceKind::Insn, pc, w, engine); }
+    void tb(TraceKind k, std::size_t pc, std::uint32_t data = 0) { ring->put(k, pc, data, engine); }
+};
@@ -0,0 +1,105 @@
+// trap.h
+// Guest traps: how the engines report a fault in guest code (a pop on an
+// empty stack, a division by zero, a pc off the end of the program) without
+// a C++ exception on the hot path.
+//
+// A faulting instruction records a TrapCode and its own pc in the VM and
+// leaves the dispatch loop through a cold path; the run entry points then
+// report it:
+//
+//   RunResult r = vm.tryRun(false);   // Halted, Suspended, Trapped or Blocked
+//   if (r == RunResult::Trapped) log(trapMessage(vm.trap().code), vm.trap().pc);
+//
+//   vm.run(false);                    // the same, but throws TrapError
+//
+// run() keeps the old contract (a guest error is a std::runtime_error, now
+// with the trapMessage() text), so callers that catch are unchanged. Errors
+// of the host itself (console writes, device callbacks, MMU page faults with
+// their address) are still exceptions.
+//
+// Guest trap handler: with setTrapHandler(entry) the VM does not stop on a
+// trap. It drops the operand stack, pushes the faulting pc and the trap
+// code, and continues at program index `entry`:
+//
+//   handler:  ( pc code -- )  e.g. print the code, flush, halt
+//
+// The ISA has no branches, so a handler runs to its halt; a second trap
+// before that is a double fault and ends the run as Trapped. The lesson
+// VMs run a handler on their checked loop until its halt, never on a
+// verified fast path (not even on resuming after a slice ran out in it),
+// since the verifier never saw the stack it starts with; MiniTCGVM enters
+// it from the block loop, checking its block cache as usual.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+enum class TrapCode : std::uint8_t {
+    None = 0,
+    StackUnderflow,
+    StackOverflow,
+    DivZero,
+    DivOverflow,    // INT_MIN / -1
+    PcOutOfRange,   // ran off the end of the program (missing halt)
+    BadInstruction, // type 3
+    BadPrimitive,   // unknown primitive opcode
+    BadVector,      // vec target outside the program
+    BadIret,        // iret outside an interrupt handler
+    CodeWrite,      // store into verified code (lesson3)
+    BadAddress,     // load/store outside RAM with no device bus
+};
+
+// The text each engine used to throw; TrapError carries it.
+constexpr const char* trapMessage(TrapCode code) {
+    switch (code) {
+    case TrapCode::None: return "no trap";
+    case TrapCode::StackUnderflow: return "stack underflow";
+    case TrapCode::StackOverflow: return "stack overflow";
+    case TrapCode::DivZero: return "division by zero";
+    case TrapCode::DivOverflow: return "division overflow (INT_MIN / -1)";
+    case TrapCode::PcOutOfRange: return "pc out of program range (missing halt?)";
+    case TrapCode::BadInstruction: return "undefined instruction type";
+    case TrapCode::BadPrimitive: return "unknown primitive opcode";
+    case TrapCode::BadVector: return "vec: handler outside the program";
+    case TrapCode::BadIret: return "iret outside an interrupt handler";
+    case TrapCode::CodeWrite: return "store into verified code";
+    case TrapCode::BadAddress: return "address outside guest memory";
+    }
+    return "unknown trap";
+}
+
+struct GuestTrap {
+    TrapCode code = TrapCode::None;
+    std::size_t pc = 0; // program index of the faulting instruction
+};
+
+enum class RunResult : std::uint8_t {
+    Halted,    // the guest executed halt
+    Suspended, // stop or yield (interrupts.h); run again to resume
+    Trapped,   // trap() says why, and where
+    Blocked,   // at a device access that has to wait (mmio.h); run again
+               // once waitFd() is readable (lesson3)
+};
+
+class TrapError : public std::runtime_error {
+public:
+    explicit TrapError(const GuestTrap& t) : std::runtime_error(trapMessage(t.code)), trap(t) {}
+    GuestTrap trap;
+};
+
+// Per-VM trap-handler state, shared by the engines.
+struct TrapVector {
+    static constexpr std::size_t NONE = std::numeric_limits<std::size_t>::max();
+
+    std::size_t entry = NONE; // program index, NONE: no handler
+    bool active = false;      // in the handler; cleared by a fresh program
+
+    // Whether a trap should enter the handler rather than end the run; marks
+    // the handler active.
+    bool take() {
+        if (entry == NONE || active) return false;
+        active = true;
+        return true;
+    }
+};
@@ -0,0 +1,169 @@
+// verifier.h
+// Load-time bytecode verifier for the 2-bit-type / 30-bit-data encoding.
+//
+// The instruction set has no branches, so control flow is the straight line
+// from pc 0 to the first Halt. The verifier walks it once, tracking the
+// operand-stack depth at every pc, and proves that
+//   - every instruction has a defined type and an opcode the engine knows,
+//   - no instruction pops more than the stack holds (no underflow),
+//   - the depth never exceeds the engine's stack capacity,
+//   - execution reaches a Halt before running off the end of the program.
+//
+// Interrupt handlers are the one other way in. `vec` installs a handler at a
+// program index; its operand must be the immediate pushed right before it,
+// so every handler entry is known here. Each handler is verified as its own
+// straight line: entered with the interrupt line on the stack (depth 1), it
+// must reach `iret` with exactly that one word left (or Halt). A handler can
+// run on top of any main-line depth, so max_depth is the main line's maximum
+// plus the deepest handler.
+//
+// A verified program can run on an engine's unchecked fast path: no pc bounds
+// checks, no stack under/overflow checks, no undefined-type traps. Division
+// by zero (and INT_MIN / -1) depend on runtime values and stay checked.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+
+struct VerifyResult {
+    bool ok = false;
+    std::size_t max_depth = 0;   // highest operand-stack depth reached (handlers included)
+    std::size_t halt_pc = 0;     // pc of the terminating Halt
+    std::size_t error_pc = 0;    // first offending pc when !ok
+    const char* error = nullptr; // static string, no allocation
+};
+
+struct Verifier {
+    using u32 = std::uint32_t;
+
+    // primitive opcodes shared by all engines (lesson1 numbering)
+    static constexpr u32 OP_HALT = 0;
+    static constexpr u32 OP_ADD = 1;
+    static constexpr u32 OP_SUB = 2;
+    static constexpr u32 OP_MUL = 3;
+    static constexpr u32 OP_DIV = 4;
+    static constexpr u32 OP_PRINT = 5;
+    static constexpr u32 OP_FLUSH = 6;
+    static constexpr u32 OP_LOAD = 7;  // addr -- value
+    static constexpr u32 OP_STORE = 8; // value addr --
+    static constexpr u32 OP_VEC = 9;   // pc --     install the interrupt handler at program index pc
+    static constexpr u32 OP_IRET = 10; // line --   return from the handler
+
+    static constexpr u32 ARITH_PRIMS = 0x1Fu;              // halt, add, sub, mul, div
+    static constexpr u32 ALL_PRIMS = ARITH_PRIMS | (1u << OP_PRINT) | (1u << OP_FLUSH); // lesson1 set
+    static constexpr u32 MEM_PRIMS = (1u << OP_LOAD) | (1u << OP_STORE);
+    static constexpr u32 IRQ_PRIMS = (1u << OP_VEC) | (1u << OP_IRET);
+
+    static constexpr std::size_t MAX_HANDLERS = 8;
+
+    struct Options {
+        u32 allowed_prims = ARITH_PRIMS; // bit n set => opcode n is implemented
+        std::size_t stack_capacity = std::numeric_limits<std::size_t>::max();
+    };
+
+    template <class Word>
+    static VerifyResult verify(std::span<const Word> code, const Options& opt = {}) {
+        static_assert(sizeof(Word) == sizeof(u32), "instructions are 32-bit words");
+
+        VerifyResult r;
+        std::size_t handlers[MAX_HANDLERS];
+        std::size_t n_handlers = 0;
+
+        auto fail = [&](std::size_t pc, const char* why) {
+            r.ok = false;
+            r.error_pc = pc;
+            r.error = why;
+            return r;
+        };
+
+        // Walk one straight line from `start`. Returns nullptr and fills
+        // `end`/`peak` on success, or the error string.
+        auto walk = [&](std::size_t start, std::size_t depth, bool handler, std::size_t& end,
+                        std::size_t& peak) -> const char* {
+            peak = depth;
+            bool have_imm = false; // previous instruction pushed a non-negative immediate
+            u32 imm = 0;
+            for (std::size_t pc = start; pc < code.size(); ++pc) {
+                end = pc;
+                const u32 ins = static_cast<u32>(code[pc]);
+                const u32 type = ins >> 30;
+                const u32 data = ins & 0x3FFF'FFFFu;
+
+                if (type == 0u || type == 2u) { // push immediate
+                    if (++depth > opt.stack_capacity) return "stack overflow";
+                    if (depth > peak) peak = depth;
+                    have_imm = type == 0u;
+                    imm = data;
+                    continue;
+                }
+                if (type != 1u) return "undefined instruction type";
+                if (data >= 32u || ((opt.allowed_prims >> data) & 1u) == 0u) return "unknown primitive opcode";
+
+                const bool vec_imm = have_imm;
+                have_imm = false;
+                switch (data) {
+                case OP_HALT:
+                    return nullptr;
+                case OP_ADD:
+                case OP_SUB:
+                case OP_MUL:
+                case OP_DIV:
+                    if (depth < 2) return "stack underflow";
+                    --depth;
+                    break;
+                case OP_PRINT:
+                    if (depth < 1) return "stack underflow";
+                    break;
+                case OP_FLUSH:
+                    break;
+                case OP_LOAD:
+                    if (depth < 1) return "stack underflow";
+                    break;
+                case OP_STORE:
+                    if (depth < 2) return "stack underflow";
+                    depth -= 2;
+                    break;
+                case OP_VEC: {
+                    if (depth < 1) return "stack underflow";
+                    if (!vec_imm) return "vec target must be an immediate";
+                    if (imm >= code.size()) return "vec target outside the program";
+                    --depth;
+                    bool known = false;
+                    for (std::size_t h = 0; h < n_handlers; ++h) known = known || handlers[h] == imm;
+                    if (!known) {
+                        if (n_handlers == MAX_HANDLERS) return "too many interrupt handlers";
+                        handlers[n_handlers++] = imm;
+                    }
+                    break;
+                }
+                case OP_IRET:
+                    if (!handler) return "iret outside an interrupt handler";
+                    if (depth != 1) return "iret with a dirty handler stack";
+                    return nullptr;
+                default:
+                    return "unknown primitive opcode";
+                }
+            }
+            end = code.size();
+            return handler ? "handler does not end in iret" : "program does not end in halt";
+        };
+
+        std::size_t end = 0;
+        std::size_t main_peak = 0;
+        if (const char* e = walk(0, 0, false, end, main_peak)) return fail(end, e);
+        r.halt_pc = end;
+
+        std::size_t handler_peak = 0;
+        for (std::size_t h = 0; h < n_handlers; ++h) { // handlers may install more handlers
+            std::size_t hend = 0;
+            std::size_t peak = 0;
+            if (const char* e = walk(handlers[h], 1, true, hend, peak)) return fail(hend, e);
+            if (peak > handler_peak) handler_peak = peak;
+        }
+        r.max_depth = main_peak + handler_peak;
+        if (r.max_depth > opt.stack_capacity) return fail(r.halt_pc, "stack overflow (handler on top of main line)");
+        r.ok = true;
+        return r;
+    }
+};
@@ -0,0 +1,322 @@
+// virtqueue.h
+// Paravirtual I/O: a virtio-style split virtqueue in guest memory, drained by
+// a host backend thread.
+//
+// The queue lives in guest RAM at a word address the guest chooses, for a
+// power-of-two size Q. All fields are 32-bit words and every index is
+// free-running (ring slot = index & (Q-1)), as in the rings of
+// C_prerequisites ex02/ex03:
+//
+//   desc   Q x { addr, len, flags, next }   buffers; flags NEXT chains to `next`
+//   avail  flags, idx, ring[Q], used_event  guest -> device: chain heads
+//   used   flags, idx, ring[Q] x { id, len }, avail_event
+//                                           device -> guest: finished chains
+//
+// The guest fills buffers and descriptors, appends chain heads to the avail
+// ring, bumps avail.idx with plain stores (no exit), and then rings the
+// doorbell once for the whole batch: one MMIO write, one exit.
+//
+// Notifications are suppressed in both directions with event indices:
+//   - the backend publishes avail_event, the avail index it has processed up
+//     to; a doorbell only wakes it when the new batch crosses that index.
+//     While the backend is still draining it picks new work up by itself.
+//   - the guest publishes used_event; the device only raises ISR when the
+//     used index crosses it.
+// A guest with branches checks avail_event before writing NOTIFY at all; the
+// lesson VMs have none, so they ring once per batch and the device applies
+// the same test to decide whether the wakeup (a futex syscall) is needed.
+//
+// Registers (word offsets):
+//   0 QUEUE_ADDR  RW  guest word address of the desc table
+//   1 QUEUE_SIZE  RW  Q, a power of two
+//   2 READY       RW  1 starts the backend; 0 drains the queue and stops it
+//   3 NOTIFY      W   doorbell: publish avail.idx to the backend
+//   4 WAIT        W   block until used.idx has reached `value` (the guest's
+//                     way to reclaim descriptors without branches)
+//   5 ISR         R   1 if a used-buffer interrupt is pending; read clears
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <span>
+#include <stdexcept>
+#include <thread>
+
+#include "mmio.h"
+
+// Word offsets of the queue fields for a given base and size.
+struct VirtqueueLayout {
+    using u32 = std::uint32_t;
+
+    static constexpr u32 DESC_WORDS = 4;
+    static constexpr u32 F_NEXT = 1;
+
+    u32 base = 0;
+    u32 size = 0;
+
+    static constexpr u32 words(u32 q) { return DESC_WORDS * q + (q + 3) + (2 * q + 3); }
+
+    u32 desc(u32 i) const { return base + DESC_WORDS * i; } // addr, len, flags, next
+    u32 avail() const { return base + DESC_WORDS * size; }
+    u32 availIdx() const { return avail() + 1; }
+    u32 availRing(u32 slot) const { return avail() + 2 + slot; }
+    u32 usedEvent() const { return avail() + 2 + size; }
+    u32 used() const { return avail() + size + 3; }
+    u32 usedIdx() const { return used() + 1; }
+    u32 usedRing(u32 slot) const { return used() + 2 + 2 * slot; } // id, len
+    u32 availEvent() const { return used() + 2 + 2 * size; }
+    u32 end() const { return base + words(size); }
+};
+
+class VirtqueueDevice final : public MmioDevice {
+public:
+    using u32 = std::uint32_t;
+    enum Reg : u32 { QUEUE_ADDR = 0, QUEUE_SIZE = 1, READY = 2, NOTIFY = 3, WAIT = 4, ISR = 5, WORDS = 6 };
+
+    // Called on the backend thread for every buffer of every chain, in ring
+    // order.
+    using Handler = std::function<void(std::span<const u32>)>;
+
+    struct Stats {
+        std::uint64_t notifies = 0;             // NOTIFY writes (guest exits)
+        std::uint64_t kicks = 0;                // notifies that had to wake the backend
+        std::uint64_t waits = 0;                // WAIT writes
+        std::uint64_t chains = 0;               // requests completed
+        std::uint64_t buffers = 0;
+        std::uint64_t words = 0;
+        std::uint64_t interrupts = 0;           // ISR raised
+        std::uint64_t interrupts_suppressed = 0; // used.idx did not cross used_event
+    };
+
+    // `ram` is the host view of guest RAM; it must outlive the device.
+    VirtqueueDevice(std::span<u32> ram, Handler handler) : ram_(ram), handler_(std::move(handler)) {}
+
+    ~VirtqueueDevice() override {
+        try {
+            stop();
+        }
+        catch (...) {
+            // a backend failure nobody collected; nothing to report it to
+        }
+    }
+
+    VirtqueueDevice(const VirtqueueDevice&) = delete;
+    VirtqueueDevice& operator=(const VirtqueueDevice&) = delete;
+
+    const char* name() const override { return "virtqueue"; }
+
+    u32 read(u32 offset) override {
+        switch (offset) {
+        case QUEUE_ADDR: return q_.base;
+        case QUEUE_SIZE: return q_.size;
+        case READY: return backend_.joinable() ? 1u : 0u;
+        case ISR: return isr_.exchange(0, std::memory_order_acq_rel);
+        default: return 0;
+        }
+    }
+
+    void write(u32 offset, u32 value) override {
+        switch (offset) {
+        case QUEUE_ADDR: configure().base = value; break;
+        case QUEUE_SIZE: configure().size = value; break;
+        case READY:
+            if (value) start();
+            else stop();
+            break;
+        case NOTIFY: notify(); break;
+        case WAIT: wait(value); break;
+        default: break;
+        }
+    }
+
+    // Exact once the queue is stopped; approximate while it runs.
+    Stats stats() const {
+        Stats s = guest_stats_;
+        s.chains = chains_.load(std::memory_order_relaxed);
+        s.buffers = buffers_.load(std::memory_order_relaxed);
+        s.words = words_.load(std::memory_order_relaxed);
+        s.interrupts = interrupts_.load(std::memory_order_relaxed);
+        s.interrupts_suppressed = interrupts_suppressed_.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    // event-index test: did the index move from `old_idx` past `event`?
+    static bool needEvent(u32 event, u32 new_idx, u32 old_idx) {
+        return static_cast<u32>(new_idx - event - 1) < static_cast<u32>(new_idx - old_idx);
+    }
+
+private:
+    VirtqueueLayout& configure() {
+        if (backend_.joinable()) throw std::logic_error("virtqueue: reconfigured while ready");
+        return q_;
+    }
+
+    void start() {
+        if (backend_.joinable()) return;
+        if (q_.size == 0 || (q_.size & (q_.size - 1)) != 0) throw std::invalid_argument("virtqueue: size must be a power of two");
+        if (q_.base == 0 || q_.end() > ram_.size() || q_.end() < q_.base) {
+            throw std::out_of_range("virtqueue: queue outside guest RAM");
+        }
+        const u32 avail = word(q_.availIdx());
+        published_.store(avail, std::memory_order_relaxed);
+        last_avail_ = avail;
+        used_idx_ = word(q_.usedIdx());
+        used_done_.store(used_idx_, std::memory_order_relaxed);
+        avail_event_.store(avail, std::memory_order_relaxed); // the first batch always kicks
+        stop_.store(false, std::memory_order_relaxed);
+        broken_ = nullptr;
+        failed_.store(false, std::memory_order_relaxed);
+        backend_ = std::thread([this] { backendLoop(); });
+    }
+
+    void stop() {
+        if (!backend_.joinable()) return;
+        stop_.store(true, std::memory_order_seq_cst);
+        doorbell_.fetch_add(1, std::memory_order_seq_cst);
+        doorbell_.notify_one();
+        backend_.join();
+        rethrowIfFailed();
+    }
+
+    // Guest thread. avail.idx was written by this thread, so reading it is a
+    // plain load; publishing it through `published_` (release) makes every
+    // buffer and descriptor written before the doorbell visible to the
+    // backend.
+    void notify() {
+        if (!backend_.joinable()) throw std::logic_error("virtqueue: notify before READY");
+        rethrowIfFailed();
+        ++guest_stats_.notifies;
+        const u32 idx = word(q_.availIdx());
+        const u32 old = published_.exchange(idx, std::memory_order_seq_cst);
+        if (!needEvent(avail_event_.load(std::memory_order_seq_cst), idx, old)) return;
+        ++guest_stats_.kicks;
+        doorbell_.fetch_add(1, std::memory_order_seq_cst);
+        doorbell_.notify_one();
+    }
+
+    void wait(u32 target) {
+        ++guest_stats_.waits;
+        for (;;) {
+            const u32 gen = completions_.load(std::memory_order_acquire);
+            rethrowIfFailed();
+            if (static_cast<std::int32_t>(used_done_.load(std::memory_order_acquire) - target) >= 0) return;
+            if (!backend_.joinable()) throw std::logic_error("virtqueue: wait while not ready");
+            completions_.wait(gen, std::memory_order_acquire);
+        }
+    }
+
+    void backendLoop() {
+        try {
+            for (;;) {
+                const u32 bell = doorbell_.load(std::memory_order_seq_cst);
+                const u32 avail = published_.load(std::memory_order_acquire);
+                if (avail != last_avail_) {
+                    drain(avail);
+                    continue;
+                }
+                if (stop_.load(std::memory_order_seq_cst)) return;
+                // Going idle: tell the guest where to kick, then re-check so
+                // a doorbell suppressed against the old avail_event is not lost.
+                avail_event_.store(last_avail_, std::memory_order_seq_cst);
+                std::atomic_ref<u32>(ram_[q_.availEvent()]).store(last_avail_, std::memory_order_release);
+                if (published_.load(std::memory_order_seq_cst) != last_avail_) continue;
+                doorbell_.wait(bell, std::memory_order_seq_cst);
+            }
+        }
+        catch (...) {
+            broken_ = std::current_exception();
+            failed_.store(true, std::memory_order_release);
+            completions_.fetch_add(1, std::memory_order_release);
+            completions_.notify_all();
+        }
+    }
+
+    // Complete every chain up to avail index `avail`, then publish used.idx
+    // once for the batch.
+    void drain(u32 avail) {
+        const u32 mask = q_.size - 1;
+        const u32 old_used = used_idx_;
+        std::uint64_t buffers = 0;
+        std::uint64_t words = 0;
+        while (last_avail_ != avail) {
+            const u32 head = ram_[q_.availRing(last_avail_ & mask)];
+            u32 len = 0;
+            u32 d = head;
+            for (u32 hops = 0;; ++hops) {
+                if (d >= q_.size || hops == q_.size) throw std::runtime_error("virtqueue: bad descriptor chain");
+                const u32 at = q_.desc(d);
+                const u32 addr = ram_[at];
+                const u32 n = ram_[at + 1];
+                const u32 flags = ram_[at + 2];
+                if (addr >= ram_.size() || n > ram_.size() - addr) throw std::runtime_error("virtqueue: buffer outside guest RAM");
+                handler_(ram_.subspan(addr, n));
+                len += n;
+                ++buffers;
+                if (!(flags & VirtqueueLayout::F_NEXT)) break;
+                d = ram_[at + 3];
+            }
+            const u32 slot = q_.usedRing(used_idx_ & mask);
+            ram_[slot] = head;
+            ram_[slot + 1] = len;
+            words += len;
+            ++used_idx_;
+            ++last_avail_;
+        }
+        std::atomic_ref<u32>(ram_[q_.usedIdx()]).store(used_idx_, std::memory_order_release);
+
+        const u32 used_event = std::atomic_ref<u32>(ram_[q_.usedEvent()]).load(std::memory_order_acquire);
+        if (needEvent(used_event, used_idx_, old_used)) {
+            isr_.store(1, std::memory_order_release);
+            bump(interrupts_, 1);
+        }
+        else {
+            bump(interrupts_suppressed_, 1);
+        }
+        bump(chains_, static_cast<u32>(used_idx_ - old_used));
+        bump(buffers_, buffers);
+        bump(words_, words);
+
+        used_done_.store(used_idx_, std::memory_order_release);
+        completions_.fetch_add(1, std::memory_order_release);
+        completions_.notify_all();
+    }
+
+    void rethrowIfFailed() {
+        if (failed_.load(std::memory_order_acquire) && broken_) std::rethrow_exception(broken_);
+    }
+
+    u32 word(u32 addr) const { return ram_[addr]; }
+
+    // single writer: no read-modify-write needed
+    static void bump(std::atomic<std::uint64_t>& c, std::uint64_t n) {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::span<u32> ram_;
+    Handler handler_;
+    VirtqueueLayout q_;
+
+    std::thread backend_;
+    std::atomic<u32> published_{ 0 };   // avail.idx as of the last doorbell
+    std::atomic<u32> avail_event_{ 0 }; // host mirror of used.avail_event
+    std::atomic<u32> doorbell_{ 0 };    // bumped to wake the backend
+    std::atomic<u32> used_done_{ 0 };   // used.idx as last published
+    std::atomic<u32> completions_{ 0 }; // bumped to wake WAIT
+    std::atomic<u32> isr_{ 0 };
+    std::atomic<bool> stop_{ false };
+    std::atomic<bool> failed_{ false };
+    std::exception_ptr broken_;
+
+    // backend thread only
+    u32 last_avail_ = 0;
+    u32 used_idx_ = 0;
+
+    Stats guest_stats_; // notifies, kicks, waits: guest thread only
+    std::atomic<std::uint64_t> chains_{ 0 };
+    std::atomic<std::uint64_t> buffers_{ 0 };
+    std::atomic<std::uint64_t> words_{ 0 };
+    std::atomic<std::uint64_t> interrupts_{ 0 };
+    std::atomic<std::uint64_t> interrupts_suppressed_{ 0 };
+};
@@ -0,0 +1,154 @@
+// vm_pool.h
+// Pool of pre-constructed VM instances, for many short requests.
+//
+// Constructing a lesson3/lesson6 StackVM maps a 1M-word guest memory, and
+// every page the guest touches is a fresh page fault. The pool keeps
+// released instances instead: release() calls VM::reset(), which clears only
+// what the last guest wrote (stack high-water mark, dirty program pages,
+// pc/sp/running), so the next request reuses warm, already-resident pages.
+//
+//   VmPool<StackVM> pool([] { return std::make_unique<StackVM>(); }, 64);
+//   {
+//       auto vm = pool.acquire(); // hit: a pooled instance; miss: factory()
+//       vm->loadProgram(prog);
+//       vm->run(false);
+//   }                             // back to the pool, reset
+//
+// acquire() prefers the most recently released instance (its pages are the
+// most likely to still be in cache). Up to `capacity` idle instances are
+// kept; extra releases destroy the VM. Thread-safe; reset and construction
+// run outside the lock.
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+template <class VM>
+class VmPool {
+public:
+    using Factory = std::function<std::unique_ptr<VM>()>;
+
+    struct Stats {
+        std::uint64_t hits = 0;     // acquire() served from the pool
+        std::uint64_t misses = 0;   // acquire() had to construct
+        std::uint64_t released = 0;
+        std::uint64_t dropped = 0;  // released while the pool was full
+        double reset_ns_total = 0;  // time spent in VM::reset()
+        double hitRate() const { return hits + misses ? double(hits) / double(hits + misses) : 0.0; }
+        double resetAvgNs() const { return released ? reset_ns_total / double(released) : 0.0; }
+    };
+
+    // Handle to an acquired VM; returns it to the pool when destroyed.
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(Lease&& o) noexcept : pool_(std::exchange(o.pool_, nullptr)), vm_(std::move(o.vm_)) {}
+        Lease& operator=(Lease&& o) noexcept {
+            if (this != &o) {
+                giveBack();
+                pool_ = std::exchange(o.pool_, nullptr);
+                vm_ = std::move(o.vm_);
+            }
+            return *this;
+        }
+        ~Lease() { giveBack(); }
+
+        VM* operator->() const { return vm_.get(); }
+        VM& operator*() const { return *vm_; }
+        VM* get() const { return vm_.get(); }
+        explicit operator bool() const { return vm_ != nullptr; }
+
+    private:
+        friend class VmPool;
+        Lease(VmPool* pool, std::unique_ptr<VM> vm) : pool_(pool), vm_(std::move(vm)) {}
+
+        void giveBack() noexcept {
+            if (pool_ && vm_) pool_->release(std::move(vm_));
+            pool_ = nullptr;
+        }
+
+        VmPool* pool_ = nullptr;
+        std::unique_ptr<VM> vm_;
+    };
+
+    // `prewarm` instances are constructed now (at most `capacity`).
+    VmPool(Factory factory, std::size_t capacity, std::size_t prewarm = 0)
+        : factory_(std::move(factory)), capacity_(capacity) {
+        if (!factory_) throw std::invalid_argument("VmPool: empty factory");
+        if (prewarm > capacity_) prewarm = capacity_;
+        idle_.reserve(capacity_);
+        for (std::size_t i = 0; i < prewarm; ++i) idle_.push_back(factory_());
+    }
+
+    VmPool(const VmPool&) = delete;
+    VmPool& operator=(const VmPool&) = delete;
+
+    Lease acquire() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            if (!idle_.empty()) {
+                std::unique_ptr<VM> vm = std::move(idle_.back());
+                idle_.pop_back();
+                ++stats_.hits;
+                return Lease(this, std::move(vm));
+            }
+            ++stats_.misses;
+        }
+        return Lease(this, factory_());
+    }
+
+    std::size_t idle() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return idle_.size();
+    }
+    std::size_t capacity() const { return capacity_; }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return stats_;
+    }
+
+    void resetStats() {
+        std::lock_guard<std::mutex> lk(mu_);
+        stats_ = Stats{};
+    }
+
+private:
+    // A VM whose reset() throws is not trusted again: it is destroyed.
+    void release(std::unique_ptr<VM> vm) noexcept {
+        const auto t0 = std::chrono::steady_clock::now();
+        bool clean = true;
+        try {
+            vm->reset();
+        }
+        catch (...) {
+            clean = false;
+        }
+        const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+
+        std::unique_ptr<VM> drop; // destroyed after the lock is released
+        std::lock_guard<std::mutex> lk(mu_);
+        ++stats_.released;
+        stats_.reset_ns_total += ns;
+        if (clean && idle_.size() < capacity_) {
+            idle_.push_back(std::move(vm));
+        }
+        else {
+            ++stats_.dropped;
+            drop = std::move(vm);
+        }
+    }
+
+    Factory factory_;
+    std::size_t capacity_;
+
+    mutable std::mutex mu_;
+    std::vector<std::unique_ptr<VM>> idle_;
+    Stats stats_;
+};
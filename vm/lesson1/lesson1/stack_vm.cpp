@@ -1,12 +1,31 @@
 #include "stack_vm.h"
 
-StackVM::StackVM(std::size_t stack_capacity) {
+StackVM::StackVM(std::size_t stack_capacity, const VirtualConsole::Options& console)
+    : console_(console) {
     stack_.reserve(stack_capacity);
 }
 
 void StackVM::loadProgram(std::span<const i32> prog) {
     program_.assign(prog.begin(), prog.end());
     pc_ = 0;
+    stack_.clear();
+    sp_ = 0;
+    suspended_ = false;
+    resume_fast_ = false;
+    handler_unverified_ = false;
+    trap_ = GuestTrap{};
+    trap_vec_.active = false;
+
+    Verifier::Options opt;
+    opt.allowed_prims = Verifier::ALL_PRIMS | Verifier::IRQ_PRIMS;
+    verify_ = Verifier::verify(std::span<const i32>(program_), opt);
+    intr_.reset();
+    if (aot_ && !aot_->matches(program_)) aot_ = nullptr;
+}
+
+void StackVM::attachAot(const AotLibrary* lib) {
+    if (lib) lib->check(program_);
+    aot_ = lib;
 }
 
 StackVM::Type StackVM::getType(i32 ins) {
@@ -26,10 +45,10 @@ void StackVM::push(i32 v) {
     // if (stack_.size() == stack_.capacity()) throw std::runtime_error("stack overflow");
     stack_.push_back(v);
     sp_ = stack_.size();
+    if (sp_ > stack_hwm_) stack_hwm_ = sp_;
 }
 
 StackVM::i32 StackVM::pop() {
-    if (stack_.empty()) throw std::runtime_error("stack underflow");
     i32 v = stack_.back();
     stack_.pop_back();
     sp_ = stack_.size();
@@ -37,23 +56,381 @@ StackVM::i32 StackVM::pop() {
 }
 
 StackVM::i32 StackVM::peek(std::size_t from_top) const {
-    if (stack_.size() <= from_top) throw std::runtime_error("stack underflow (peek)");
     return stack_[stack_.size() - 1 - from_top];
 }
 
+// For the primitive at pc_ - 1 (step() has advanced pc_).
+bool StackVM::need(std::size_t n) {
+    if (stack_.size() >= n) [[likely]] return true;
+    fault(TrapCode::StackUnderflow, pc_ - 1);
+    return false;
+}
+
+void StackVM::fault(TrapCode code, std::size_t pc) {
+    trap_ = GuestTrap{ code, pc };
+    running_ = false;
+}
+
+void StackVM::fastTrap(TrapCode code, std::uint64_t countdown, VcpuMetrics::Local& counts) {
+    fault(code, pc_ - 1);
+    intr_.saveCountdown(countdown);
+    publish(counts, true);
+}
+
+bool StackVM::enterTrapHandler() {
+    if (!trap_vec_.take()) return false;
+    stack_.clear();
+    push(static_cast<i32>(trap_.pc));
+    push(static_cast<i32>(trap_.code));
+    pc_ = trap_vec_.entry;
+    suspended_ = false;
+    resume_fast_ = false;
+    handler_unverified_ = true;
+    return true;
+}
+
+RunResult StackVM::tryRun(bool trace) {
+    for (;;) {
+        if (!trace && verify_.ok && !handler_unverified_ && (resume_fast_ || (pc_ == 0 && stack_.empty()))) runUnchecked();
+        else runChecked(trace);
+        if (trap_.code == TrapCode::None) {
+            if (suspended_) return RunResult::Suspended;
+            handler_unverified_ = false;
+            return RunResult::Halted;
+        }
+        if (!enterTrapHandler()) return RunResult::Trapped;
+    }
+}
+
 void StackVM::run(bool trace) {
+    if (tryRun(trace) == RunResult::Trapped) throw TrapError(trap_);
+}
+
+bool StackVM::runSlice(std::uint64_t budget) {
+    intr_.setSlice(budget);
+    run(false);
+    const bool more = intr_.sliceExpired();
+    intr_.setSlice(0);
+    return more;
+}
+
+void StackVM::runChecked(bool trace) {
+    if (trace) {
+        TraceText t;
+        runTraced(t);
+    }
+    else {
+        TraceOff t;
+        runTraced(t);
+    }
+}
+
+void StackVM::publish(VcpuMetrics::Local& counts, bool trap) {
+    if (!metrics_) {
+        counts = VcpuMetrics::Local{};
+        return;
+    }
+    metrics_->flush(counts);
+    VcpuMetrics::raise(metrics_->stack_hwm, stack_hwm_);
+    if (trap) VcpuMetrics::add(metrics_->traps, 1);
+}
+
+template <class Trace>
+void StackVM::runTraced(Trace& t) {
+    trap_ = GuestTrap{};
     if (program_.empty()) return;
 
     running_ = true;
-    while (running_) {
-        if (pc_ >= program_.size()) {
-            throw std::runtime_error("pc out of program range (missing halt?)");
+    suspended_ = false;
+    resume_fast_ = false;
+    const std::atomic<u32>& exit = intr_.exitRequest();
+    std::uint64_t countdown = intr_.countdown();
+    std::uint64_t mark = countdown; // instructions executed = mark - countdown, as in runFast()
+    try {
+        while (running_) {
+            if ((exit.load(std::memory_order_relaxed) != 0) | (--countdown == 0)) {
+                counts_.instructions += mark - countdown - 1;
+                publish(counts_, false);
+                const bool go = interrupt<Trace>(countdown);
+                mark = go ? countdown + 1 : countdown;
+                if (!go) break;
+            }
+            if (pc_ >= program_.size()) [[unlikely]] {
+                fault(TrapCode::PcOutOfRange, pc_);
+                break;
+            }
+            step(t);
+        }
+    }
+    catch (...) { // host errors only
+        counts_.instructions += mark - countdown;
+        publish(counts_, true);
+        throw;
+    }
+    counts_.instructions += mark - countdown;
+    publish(counts_, trap_.code != TrapCode::None);
+    intr_.saveCountdown(countdown);
+}
+
+template <class Trace>
+bool StackVM::interrupt(std::uint64_t& countdown) {
+    u32 line = 0;
+    switch (intr_.service(countdown, line, pc_)) {
+    case InterruptCpu::Action::Stop:
+    case InterruptCpu::Action::Yield:
+        running_ = false;
+        suspended_ = true;
+        intr_.undoCheck();
+        return false;
+    case InterruptCpu::Action::Deliver:
+        if constexpr (Trace::TEXT) std::cout << "[irq] line " << line << " -> pc " << intr_.vector() << "\n";
+        push(static_cast<i32>(line));
+        intr_.enter(pc_);
+        pc_ = intr_.vector();
+        return true;
+    default:
+        return true;
+    }
+}
+
+// Fast path for verified programs: the verifier proved every pc up to the
+// halt is in range, every pop has an operand and the depth never exceeds
+// max_depth, so the loop runs on raw pointers with no checks except division.
+// A VM this loop suspended on stop or yield is still on a path the verifier
+// covered, so it resumes here too; one the checked loop suspended resumes
+// there, since that loop may have run code or built a stack the verifier
+// never saw.
+void StackVM::runUnchecked() {
+    if (!verify_.ok) throw std::logic_error("runUnchecked: program not verified");
+    if (!resume_fast_ && (pc_ != 0 || !stack_.empty())) {
+        throw std::logic_error("runUnchecked: VM not fresh after loadProgram");
+    }
+    suspended_ = false;
+    resume_fast_ = false;
+    trap_ = GuestTrap{};
+    if (aot_ && aot_->block(pc_)) runAot(); // a suspended run may stop mid-block
+    else if (metrics_) runFast<true>();
+    else runFast<false>();
+}
+
+// Host side of the compiled blocks; the program is verified, so no checks.
+const AotHost StackVM::AOT_HOST = {
+    [](AotFrame* f, i32 v) { static_cast<StackVM*>(f->vm)->console_.printLine("[prim] print: ", v); },
+    [](AotFrame* f) { static_cast<StackVM*>(f->vm)->console_.flush(); },
+    [](AotFrame* f, i32 target) { static_cast<StackVM*>(f->vm)->intr_.installVector(static_cast<std::size_t>(target)); },
+    [](AotFrame* f) { f->next_pc = static_cast<StackVM*>(f->vm)->intr_.leave(); },
+};
+
+// runFast with the compiled blocks of aot_ in place of the switch. Every
+// block ends where another starts, so the exit check runs once per block and
+// an Instructions timer counts whole blocks.
+void StackVM::runAot() {
+    stack_hwm_ = std::max(stack_hwm_, verify_.max_depth);
+    VcpuMetrics::Local counts;
+
+    stack_.resize(verify_.max_depth);
+    std::size_t pc = pc_;
+    AotFrame f;
+    f.sp = stack_.data() + sp_;
+    f.vm = this;
+    f.host = &AOT_HOST;
+
+    auto sync = [&] {
+        pc_ = pc;
+        sp_ = static_cast<std::size_t>(f.sp - stack_.data());
+        stack_.resize(sp_);
+    };
+
+    const std::atomic<u32>& exit = intr_.exitRequest();
+    std::uint64_t countdown = intr_.countdown();
+
+    running_ = true;
+    try {
+        for (;;) {
+            if ((exit.load(std::memory_order_relaxed) != 0) | (countdown == 0)) [[unlikely]] {
+                publish(counts, false);
+                u32 line = 0;
+                const auto action = intr_.service(countdown, line, pc);
+                if (action == InterruptCpu::Action::Stop || action == InterruptCpu::Action::Yield) {
+                    running_ = false;
+                    suspended_ = true;
+                    resume_fast_ = true;
+                    sync();
+                    intr_.saveCountdown(countdown);
+                    return;
+                }
+                if (action == InterruptCpu::Action::Deliver) {
+                    *f.sp++ = static_cast<i32>(line);
+                    intr_.enter(pc);
+                    pc = intr_.vector();
+                }
+            }
+            const AotBlock* b = aot_->block(pc);
+            if (!b) throw std::logic_error("runAot: no compiled block at pc " + std::to_string(pc));
+            const u32 status = b->fn(&f);
+            if (status != AOT_OK) [[unlikely]] { // f.next_pc is the division
+                counts.instructions += f.next_pc - pc + 1;
+                pc = f.next_pc;
+                sync();
+                fault(status == AOT_DIV_ZERO ? TrapCode::DivZero : TrapCode::DivOverflow, pc);
+                intr_.saveCountdown(countdown);
+                publish(counts, true);
+                return;
+            }
+            pc = f.next_pc;
+            if (countdown > b->insns) countdown -= b->insns;
+            else {
+                intr_.overshoot(b->insns - countdown);
+                countdown = 0;
+            }
+            if (metrics_) {
+                counts.instructions += b->insns;
+                for (u32 i = 0; i < b->prim_count; ++i) ++counts.prims[b->prims[i] & (VcpuMetrics::PRIMS - 1)];
+            }
+            if (!f.running) {
+                running_ = false;
+                sync();
+                intr_.saveCountdown(countdown);
+                console_.flush();
+                publish(counts, false);
+                return;
+            }
         }
-        step(trace);
+    }
+    catch (...) { // host errors only
+        publish(counts, true);
+        throw;
     }
 }
 
-void StackVM::step(bool trace) {
+template <bool COUNT>
+void StackVM::runFast() {
+    stack_hwm_ = std::max(stack_hwm_, verify_.max_depth); // the verifier's bound; no per-push tracking
+    VcpuMetrics::Local counts;
+
+    stack_.resize(verify_.max_depth);
+    const i32* pc = program_.data() + pc_;
+    i32* sp = stack_.data() + sp_; // one past top of stack
+
+    // write back pc_/sp_ so the VM state is consistent after halt or a throw
+    auto sync = [&] {
+        pc_ = static_cast<std::size_t>(pc - program_.data());
+        sp_ = static_cast<std::size_t>(sp - stack_.data());
+        stack_.resize(sp_);
+    };
+
+    // One exit check per instruction: the interrupt controller's exit word
+    // and the instruction-timer countdown share a single branch.
+    const std::atomic<u32>& exit = intr_.exitRequest();
+    std::uint64_t countdown = intr_.countdown();
+    // Instructions are counted by the countdown, which drops by one per
+    // instruction: executed = mark - countdown (unsigned wrap-around is fine).
+    std::uint64_t mark = countdown;
+    TrapCode trap = TrapCode::None; // set before `goto trapped`
+
+    running_ = true;
+    try {
+        for (;;) {
+            if ((exit.load(std::memory_order_relaxed) != 0) | (--countdown == 0)) [[unlikely]] {
+                if constexpr (COUNT) {
+                    counts.instructions += mark - countdown - 1; // the next one is not executed yet
+                    publish(counts, false);
+                }
+                u32 line = 0;
+                const auto action = intr_.service(countdown, line, static_cast<std::size_t>(pc - program_.data()));
+                mark = countdown + 1;
+                if (action == InterruptCpu::Action::Stop || action == InterruptCpu::Action::Yield) {
+                    running_ = false;
+                    suspended_ = true; // resumable through run()
+                    resume_fast_ = true;
+                    sync();
+                    intr_.saveCountdown(countdown);
+                    intr_.undoCheck();
+                    return;
+                }
+                if (action == InterruptCpu::Action::Deliver) {
+                    *sp++ = static_cast<i32>(line); // the verifier counted the handler's depth
+                    intr_.enter(static_cast<std::size_t>(pc - program_.data()));
+                    pc = program_.data() + intr_.vector();
+                }
+            }
+            const i32 ins = *pc++;
+            const u32 dat = getData(ins);
+
+            switch (getType(ins)) {
+            case Type::PosImm:
+                *sp++ = static_cast<i32>(dat);
+                break;
+            case Type::NegImm:
+                *sp++ = -static_cast<i32>(dat);
+                break;
+            default: // Type::Prim; Undef was rejected by the verifier
+                if constexpr (COUNT) ++counts.prims[dat & (VcpuMetrics::PRIMS - 1)];
+                switch (static_cast<Prim>(dat)) {
+                case Prim::Halt:
+                    running_ = false;
+                    sync();
+                    intr_.saveCountdown(countdown);
+                    console_.flush();
+                    if constexpr (COUNT) {
+                        counts.instructions += mark - countdown;
+                        publish(counts, false);
+                    }
+                    return;
+                case Prim::Add:
+                    sp[-2] = sp[-2] + sp[-1];
+                    --sp;
+                    break;
+                case Prim::Sub:
+                    sp[-2] = sp[-2] - sp[-1];
+                    --sp;
+                    break;
+                case Prim::Mul:
+                    sp[-2] = sp[-2] * sp[-1];
+                    --sp;
+                    break;
+                case Prim::Div: {
+                    const i32 b = sp[-1];
+                    const i32 a = sp[-2];
+                    if (b == 0 || (a == std::numeric_limits<i32>::min() && b == -1)) [[unlikely]] {
+                        trap = b == 0 ? TrapCode::DivZero : TrapCode::DivOverflow;
+                        goto trapped;
+                    }
+                    sp[-2] = a / b;
+                    --sp;
+                    break;
+                }
+                case Prim::Print:
+                    console_.printLine("[prim] print: ", sp[-1]);
+                    break;
+                case Prim::Flush:
+                    console_.flush();
+                    break;
+                case Prim::Vec:
+                    intr_.installVector(static_cast<std::size_t>(*--sp)); // verified: a handler entry
+                    break;
+                case Prim::Iret:
+                    --sp;
+                    pc = program_.data() + intr_.leave();
+                    break;
+                }
+            }
+        }
+    trapped: // pc is past the faulting instruction, the stack as before it
+        sync();
+        if constexpr (COUNT) counts.instructions += mark - countdown;
+        fastTrap(trap, countdown, counts);
+    }
+    catch (...) { // host errors only
+        if constexpr (COUNT) counts.instructions += mark - countdown;
+        publish(counts, true);
+        throw;
+    }
+}
+
+template <class Trace>
+void StackVM::step(Trace& t) {
+    t.insn(pc_, static_cast<u32>(program_[pc_]));
     const i32 ins = program_[pc_++];
 
     const auto typ = getType(ins);
@@ -63,7 +440,7 @@ void StackVM::step(bool trace) {
     case Type::PosImm: {
         // +dat
         push(static_cast<i32>(dat));
-        if (trace) {
+        if constexpr (Trace::TEXT) {
             std::cout << "[imm +] push " << static_cast<i32>(dat)
                 << " | tos=" << peek() << "\n";
         }
@@ -73,7 +450,7 @@ void StackVM::step(bool trace) {
         // -dat
         // Note: dat is 0..(2^30-1), so -dat fits i32
         push(-static_cast<i32>(dat));
-        if (trace) {
+        if constexpr (Trace::TEXT) {
             std::cout << "[imm -] push " << -static_cast<i32>(dat)
                 << " | tos=" << peek() << "\n";
         }
@@ -81,76 +458,121 @@ void StackVM::step(bool trace) {
     }
     case Type::Prim: {
         auto op = static_cast<Prim>(dat);
-        execPrimitive(op, trace);
-        if (trace && !stack_.empty()) {
-            std::cout << "        tos=" << peek() << "\n";
-        }
-        else if (trace && stack_.empty()) {
-            std::cout << "        tos=<empty>\n";
+        ++counts_.prims[dat & (VcpuMetrics::PRIMS - 1)];
+        execPrimitive<Trace>(op);
+        if constexpr (Trace::TEXT) {
+            if (!stack_.empty()) {
+                std::cout << "        tos=" << peek() << "\n";
+            }
+            else {
+                std::cout << "        tos=<empty>\n";
+            }
         }
         break;
     }
     case Type::Undef:
     default:
-        throw std::runtime_error("undefined instruction type (11)");
+        fault(TrapCode::BadInstruction, pc_ - 1);
+        break;
     }
 }
 
-void StackVM::execPrimitive(Prim op, bool trace) {
+template <class Trace>
+void StackVM::execPrimitive(Prim op) {
     switch (op) {
     case Prim::Halt:
-        if (trace) std::cout << "[prim] halt\n";
+        if constexpr (Trace::TEXT) std::cout << "[prim] halt\n";
         running_ = false;
+        console_.flush();
         return;
 
     case Prim::Add: {
+        if (!need(2)) return;
         i32 b = pop();
         i32 a = pop();
         i32 r = a + b;
-        if (trace) std::cout << "[prim] add " << a << " " << b << " => " << r << "\n";
+        if constexpr (Trace::TEXT) std::cout << "[prim] add " << a << " " << b << " => " << r << "\n";
         push(r);
         return;
     }
 
     case Prim::Sub: {
+        if (!need(2)) return;
         i32 b = pop();
         i32 a = pop();
         i32 r = a - b;
-        if (trace) std::cout << "[prim] sub " << a << " " << b << " => " << r << "\n";
+        if constexpr (Trace::TEXT) std::cout << "[prim] sub " << a << " " << b << " => " << r << "\n";
         push(r);
         return;
     }
 
     case Prim::Mul: {
+        if (!need(2)) return;
         i32 b = pop();
         i32 a = pop();
         i32 r = a * b;
-        if (trace) std::cout << "[prim] mul " << a << " " << b << " => " << r << "\n";
+        if constexpr (Trace::TEXT) std::cout << "[prim] mul " << a << " " << b << " => " << r << "\n";
         push(r);
         return;
     }
 
     case Prim::Div: {
-        i32 b = pop();
-        i32 a = pop();
-        if (b == 0) throw std::runtime_error("division by zero");
-        // optional: check INT_MIN / -1 overflow
-        if (a == std::numeric_limits<i32>::min() && b == -1) {
-            throw std::runtime_error("division overflow (INT_MIN / -1)");
-        }
+        if (!need(2)) return;
+        const i32 b = peek();
+        const i32 a = peek(1);
+        if (b == 0) return fault(TrapCode::DivZero, pc_ - 1);
+        if (a == std::numeric_limits<i32>::min() && b == -1) return fault(TrapCode::DivOverflow, pc_ - 1);
+        pop();
+        pop();
         i32 r = a / b;
-        if (trace) std::cout << "[prim] div " << a << " " << b << " => " << r << "\n";
+        if constexpr (Trace::TEXT) std::cout << "[prim] div " << a << " " << b << " => " << r << "\n";
         push(r);
         return;
     }
 
     case Prim::Print: {
+        if (!need(1)) return;
         i32 v = peek();
-        std::cout << "[prim] print: " << v << "\n";
+        if constexpr (Trace::TEXT) std::cout.flush(); // keep trace lines and guest output in order
+        console_.printLine("[prim] print: ", v);
+        if constexpr (Trace::TEXT) console_.flush();
+        return;
+    }
+
+    case Prim::Flush:
+        if constexpr (Trace::TEXT) std::cout << "[prim] flush\n";
+        console_.flush();
+        return;
+
+    case Prim::Vec: {
+        if (!need(1)) return;
+        const i32 target = peek();
+        if (target < 0 || static_cast<std::size_t>(target) >= program_.size()) {
+            return fault(TrapCode::BadVector, pc_ - 1);
+        }
+        pop();
+        if constexpr (Trace::TEXT) std::cout << "[prim] vec " << target << "\n";
+        intr_.installVector(static_cast<std::size_t>(target));
+        return;
+    }
+
+    case Prim::Iret: {
+        if (!need(1)) return;
+        if (!intr_.inHandler()) return fault(TrapCode::BadIret, pc_ - 1);
+        i32 line = pop();
+        pc_ = intr_.leave();
+        if constexpr (Trace::TEXT) std::cout << "[prim] iret " << line << " -> pc " << pc_ << "\n";
         return;
     }
 
     default:
-        throw std::runtime_error("unknown primitive opcode");
+        fault(TrapCode::BadPrimitive, pc_ - 1);
+        return;
     }
 }
+
+// tracing policies available to callers of runTraced()
+template void StackVM::runTraced<TraceOff>(TraceOff&);
+template void StackVM::runTraced<TraceCounters>(TraceCounters&);
+template void StackVM::runTraced<TraceText>(TraceText&);
+template void StackVM::runTraced<TraceBinary>(TraceBinary&);
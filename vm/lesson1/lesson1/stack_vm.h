@@ -6,6 +6,14 @@
 #include <stdexcept>
 #include <limits>
 
+#include "../../common/aot.h"
+#include "../../common/console.h"
+#include "../../common/interrupts.h"
+#include "../../common/metrics.h"
+#include "../../common/trace.h"
+#include "../../common/trap.h"
+#include "../../common/verifier.h"
+
 class StackVM {
 public:
     using i32 = std::int32_t;
@@ -27,16 +35,77 @@ public:
         Mul = 3,
         Div = 4,
         Print = 5,
+        Flush = 6,    // push buffered console output to the host
+        Vec = 9,      // pc --    install the interrupt handler (interrupts.h)
+        Iret = 10,    // line --  return from the interrupt handler
     };
 
-    explicit StackVM(std::size_t stack_capacity = 1024);
+    explicit StackVM(std::size_t stack_capacity = 1024, const VirtualConsole::Options& console = {});
 
-    // Load "bytecode" program (vector of encoded 32-bit instructions)
+    // Load "bytecode" program (vector of encoded 32-bit instructions).
+    // The program is verified here; see verifier.h.
     void loadProgram(std::span<const i32> prog);
 
-    // Run until halt or error
+    // Run until halt, stop/yield or a guest trap (trap.h). A verified
+    // program runs on the unchecked fast path unless tracing. A trap enters
+    // the guest trap handler if one is installed.
+    RunResult tryRun(bool trace = false);
+
+    // tryRun, throwing TrapError if the guest trapped.
     void run(bool trace = true);
 
+    // The two engines behind run(), exposed for benchmarking. A guest fault
+    // ends them with trap() set; they never enter the trap handler.
+    void runChecked(bool trace);
+    void runUnchecked(); // requires verified(), fresh after loadProgram or suspended
+
+    // The trap that ended the last run (code None if it did not trap).
+    const GuestTrap& trap() const { return trap_; }
+
+    // Guest trap handler at program index `entry` (trap.h);
+    // TrapVector::NONE removes it.
+    void setTrapHandler(std::size_t entry) { trap_vec_.entry = entry; }
+
+    // Run for a time slice of about `budget` instructions (scheduler.h).
+    // Returns true if the slice ran out and the program can be resumed with
+    // another runSlice(); false once it halted or the host stopped it.
+    bool runSlice(std::uint64_t budget);
+
+    // Checked loop instantiated for one tracing policy (trace.h).
+    // Instantiated in stack_vm.cpp for TraceOff/Counters/Text/Binary.
+    template <class Trace>
+    void runTraced(Trace& t);
+
+    VirtualConsole& console() { return console_; }
+
+    // Interrupts are checked at every instruction boundary through the
+    // controller's exit word. `timer` may count this VM's instructions.
+    void attachInterrupts(InterruptController* irq, VirtualTimer* timer = nullptr) { intr_.attach(irq, timer); }
+
+    // Guest-pc sampling (profiler.h); host-timer sampling needs the
+    // interrupt controller attached first.
+    void attachSampler(PcSampler* sampler) { intr_.attachSampler(sampler); }
+
+    // Record delivered interrupts into, or replay them from, `log`
+    // (replay.h); null detaches. Replay on the same engine: with or without
+    // the AOT module, as recorded.
+    void attachReplay(ReplayLog* log) { intr_.attachReplay(log); }
+
+    // Runtime counters (metrics.h), published at loop exits and interrupt
+    // slow-path entries; null detaches. With metrics attached the fast path
+    // runs its counting copy.
+    void attachMetrics(VcpuMetrics* metrics) { metrics_ = metrics; }
+
+    // Run verified programs as the natively compiled blocks of `lib` (aot.h)
+    // instead of interpreting them; null detaches. Throws unless `lib` was
+    // compiled from the loaded program; a later loadProgram of a different
+    // program detaches it. Interrupts are then taken at block boundaries.
+    void attachAot(const AotLibrary* lib);
+    bool aotActive() const { return aot_ != nullptr; }
+
+    bool verified() const { return verify_.ok; }
+    const VerifyResult& verifyResult() const { return verify_; }
+
 private:
     // program
     std::vector<i32> program_;
@@ -47,6 +116,25 @@ private:
     std::size_t sp_ = 0;              // stack pointer = size
 
     bool running_ = false;
+    bool suspended_ = false;          // left a run loop on stop or yield; resumable through run()
+    bool resume_fast_ = false;        // suspended by the unchecked loop, which resumes it
+    bool handler_unverified_ = false; // in a trap handler until halt: checked loop only
+
+    GuestTrap trap_;
+    TrapVector trap_vec_;
+
+    VerifyResult verify_;
+
+    // guest output device (Print / Flush)
+    VirtualConsole console_;
+
+    InterruptCpu intr_;
+
+    const AotLibrary* aot_ = nullptr;
+
+    VcpuMetrics* metrics_ = nullptr;
+    VcpuMetrics::Local counts_; // checked loop; the fast path counts in a local
+    std::size_t stack_hwm_ = 0;
 
 private:
     static constexpr u32 TYPE_MASK = 0xC000'0000u; // top 2 bits
@@ -55,12 +143,34 @@ private:
     static Type getType(i32 ins);
     static u32  getData(i32 ins);
 
-    // stack helpers
+    // stack helpers; pop and peek are unchecked, the primitives check
+    // need(n) before touching the stack
     void push(i32 v);
     i32  pop();
     i32  peek(std::size_t from_top = 0) const;
+    bool need(std::size_t n);
+
+    // Record a guest trap at `pc` and stop the loop (the cold path).
+    [[gnu::cold]] [[gnu::noinline]] void fault(TrapCode code, std::size_t pc);
+    // Enter the guest trap handler for trap_, if there is one to enter.
+    bool enterTrapHandler();
+
+    // runUnchecked's loop; COUNT: keep instruction/primitive counts
+    template <bool COUNT> void runFast();
+    // its exit on a guest fault, out of line
+    [[gnu::cold]] [[gnu::noinline]] void fastTrap(TrapCode code, std::uint64_t countdown, VcpuMetrics::Local& counts);
+
+    // runUnchecked with an AOT module attached: dispatch compiled blocks
+    void runAot();
+    static const AotHost AOT_HOST;
+
+    // Hands `counts` (and a trap) to metrics_, if attached.
+    void publish(VcpuMetrics::Local& counts, bool trap);
+
+    // interrupt slow path for the checked loop; false on a stop request
+    template <class Trace> bool interrupt(std::uint64_t& countdown);
 
     // execute
-    void step(bool trace);
-    void execPrimitive(Prim op, bool trace);
+    template <class Trace> void step(Trace& t);
+    template <class Trace> void execPrimitive(Prim op);
 };
@@ -0,0 +1,921 @@
+// stack_vm.h
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../../common/guest_memory.h"
+#include "../../common/interrupts.h"
+#include "../../common/metrics.h"
+#include "../../common/mmio.h"
+#include "../../common/soft_mmu.h"
+#include "../../common/trace.h"
+#include "../../common/trap.h"
+#include "../../common/verifier.h"
+
+#if !defined(_WIN32)
+#include <poll.h>
+
+#include "../../common/io_loop.h"
+#endif
+
+using i32 = std::int32_t;
+using u32 = std::uint32_t;
+
+enum class Prim : u32 {
+    Halt = 0,
+    Add = 1,
+    Sub = 2,
+    Mul = 3,
+    Div = 4,
+    Load = 7,  // addr -- value
+    Store = 8, // value addr --
+    Vec = 9,   // pc --    install the interrupt handler at program index pc
+    Iret = 10, // line --  return from the interrupt handler
+};
+
+
+//The program area and stack are separated(avoiding cramming them together into the same vector).
+//
+//The instruction format remains 2 - bit type + 30 - bit data.
+//
+//Negative number push is supported(when type = 2, the 30 - bit data is interpreted as a signed 30 - bit and sign - extended).
+//
+//Boundary checks and division by zero checks have been added.
+
+struct Instr {
+    // type: 0 => push non-negative
+    // type: 1 => primitive
+    // type: 2 => push negative (signed 30-bit)
+    // type: 3 => unused
+    static constexpr u32 TYPE_MASK = 0xC0000000u;
+    static constexpr u32 DATA_MASK = 0x3FFFFFFFu;
+
+    static constexpr u32 prim(Prim p) {
+        return (1u << 30) | (static_cast<u32>(p) & DATA_MASK);
+    }
+
+    // Encode an int32 into your instruction format.
+    // Non-negative -> type 0, store magnitude in 30-bit.
+    // Negative     -> type 2, store 30-bit two's-complement in data field.
+    static constexpr u32 push(i32 x) {
+        if (x >= 0) {
+            u32 ux = static_cast<u32>(x);
+            if (ux > DATA_MASK) throw std::out_of_range("push: value too large for 30-bit immediate");
+            return (0u << 30) | (ux & DATA_MASK);
+        }
+        else {
+            // store signed 30-bit two's complement in data
+            // range for signed 30-bit: [-2^29, 2^29 - 1]
+            constexpr i32 MIN30 = -(1 << 29);
+            constexpr i32 MAX30 = (1 << 29) - 1;
+            if (x < MIN30 || x > MAX30) throw std::out_of_range("push: negative value out of signed 30-bit range");
+
+            // Convert to 30-bit two's complement
+            // Example: -1 -> 0x3FFFFFFF (30 ones)
+            u32 data = static_cast<u32>(x) & DATA_MASK;
+            return (2u << 30) | data;
+        }
+    }
+
+    static u32 type(u32 instruction) {
+        return (instruction & TYPE_MASK) >> 30;
+    }
+
+    static u32 data(u32 instruction) {
+        return (instruction & DATA_MASK);
+    }
+
+    // Decode push-immediate into i32.
+    static i32 decode_push(u32 instruction) {
+        u32 t = type(instruction);
+        u32 d = data(instruction);
+
+        if (t == 0u) {
+            return static_cast<i32>(d);
+        }
+        if (t == 2u) {
+            // d is 30-bit signed two's complement -> sign-extend to 32-bit
+            // If bit 29 is set, it's negative.
+            constexpr u32 SIGN_BIT_30 = 1u << 29;
+            if (d & SIGN_BIT_30) {
+                // fill upper bits with 1s
+                u32 extended = d | ~DATA_MASK;
+                return static_cast<i32>(extended);
+            }
+            return static_cast<i32>(d);
+        }
+
+        throw std::runtime_error("decode_push called on non-push instruction");
+    }
+};
+
+class StackVM {
+public:
+    // `mem` selects huge pages / NUMA placement for guest memory.
+    explicit StackVM(std::size_t mem_words = 1'000'000, std::size_t program_base = 100,
+                     const GuestMemory::Options& mem = {})
+        : mem_(mem_words * sizeof(u32), mem), mem_words_(mem_words), program_base_(program_base),
+          dirty_pages_((mem_words + SoftMmu::PAGE_WORDS - 1) / SoftMmu::PAGE_WORDS, 0) {
+        if (program_base_ >= mem_words_) throw std::out_of_range("program_base out of memory range");
+    }
+
+    // Route fetch, push and pop through the soft-MMU (soft_mmu.h). Call
+    // before loadProgram(): the program is then placed on its own pages
+    // (mapped R|X) at the first page boundary >= program_base, the stack
+    // pages are mapped R|W and nothing else is mapped, so writing to code
+    // or executing the stack raises PageFault.
+    void enablePaging() {
+        paging_ = true;
+        mmu_.attach(mem_.as<u32>(), mem_words_);
+    }
+
+    // Loads and stores to addresses outside RAM go to `bus` (mmio.h). With
+    // paging enabled, addresses below MMIO_BASE are virtual and translated;
+    // MMIO_BASE and up is the untranslated device window.
+    static constexpr u32 MMIO_BASE = 0x1000'0000u;
+
+    void attachBus(MmioBus* bus) {
+        bus_ = bus;
+        bus_cache_ = MmioBus::Cache{};
+    }
+    const MmioBus::Cache& busStats() const { return bus_cache_; }
+
+    // Interrupts (interrupts.h) are checked at every instruction boundary
+    // through the controller's exit word. The controller can also be mapped
+    // on the bus for guest acknowledge/mask.
+    void attachInterrupts(InterruptController* irq, VirtualTimer* timer = nullptr) { intr_.attach(irq, timer); }
+
+    // Guest-pc sampling (profiler.h), program-relative pcs; host-timer
+    // sampling needs the interrupt controller attached first.
+    void attachSampler(PcSampler* sampler) { intr_.attachSampler(sampler); }
+
+    // Record delivered interrupts and device reads into, or replay them
+    // from, `log` (replay.h); null detaches. Replaying, device reads return
+    // the logged values and never reach the bus; writes still do.
+    void attachReplay(ReplayLog* log) { intr_.attachReplay(log); }
+
+    // Runtime counters (metrics.h), published at loop exits and interrupt
+    // slow-path entries; null detaches. With metrics attached the fast path
+    // runs its counting copy.
+    void attachMetrics(VcpuMetrics* metrics) { metrics_ = metrics; }
+
+    void loadProgram(std::span<const u32> prog) {
+        code_base_ = paging_ ? roundUpToPage(program_base_) : program_base_;
+        if (code_base_ + prog.size() > mem_words_) throw std::out_of_range("program too large for memory");
+        u32* const mem = mem_.as<u32>();
+        for (std::size_t i = 0; i < prog.size(); ++i) {
+            mem[code_base_ + i] = prog[i];
+        }
+        markDirty(code_base_, prog.size());
+        if (paging_) buildPageTables(prog.size());
+        code_words_ = prog.size();
+        pc_ = code_base_;
+        sp_ = 0;
+        running_ = true;
+        suspended_ = false;
+        resume_fast_ = false;
+        handler_unverified_ = false;
+        wait_fd_ = -1;
+        trap_ = GuestTrap{};
+        trap_vec_.active = false;
+
+        // the stack lives in mem_[1 .. program_base_-1]
+        Verifier::Options opt;
+        opt.allowed_prims = Verifier::ARITH_PRIMS | Verifier::MEM_PRIMS | Verifier::IRQ_PRIMS;
+        opt.stack_capacity = program_base_ - 1;
+        verify_ = Verifier::verify(prog, opt);
+        intr_.reset();
+    }
+
+    // Run until halt, stop/yield, a guest trap (trap.h) or a device access
+    // that has to wait (mmio.h); verified programs run on the unchecked fast
+    // path unless tracing. A trap enters the guest trap handler if one is
+    // installed. Trap pcs are relative to the program, as the profiler's.
+    RunResult tryRun(bool trace = false) {
+        for (;;) {
+            if (!trace && !paging_ && verify_.ok && !handler_unverified_ &&
+                (resume_fast_ || (pc_ == program_base_ && sp_ == 0))) {
+                runUnchecked();
+            }
+            else {
+                runChecked(trace);
+            }
+            if (wait_fd_ >= 0) return RunResult::Blocked;
+            if (trap_.code == TrapCode::None) {
+                if (suspended_) return RunResult::Suspended;
+                handler_unverified_ = false;
+                return RunResult::Halted;
+            }
+            if (!enterTrapHandler()) return RunResult::Trapped;
+        }
+    }
+
+    // tryRun, throwing TrapError if the guest trapped. A device access that
+    // has to wait blocks the calling thread in poll(2); runAsync() does not.
+    void run(bool trace = true) {
+        for (;;) {
+            const RunResult r = tryRun(trace);
+            if (r == RunResult::Trapped) throw TrapError(trap_);
+            if (r != RunResult::Blocked) return;
+#if !defined(_WIN32)
+            pollfd p{ wait_fd_, POLLIN, 0 };
+            while (::poll(&p, 1, -1) < 0 && errno == EINTR) {
+            }
+#endif
+        }
+    }
+
+    // After RunResult::Blocked: the fd that becomes readable when the access
+    // can go ahead. The VM is suspended on that instruction; run again then.
+    int waitFd() const { return wait_fd_; }
+
+#if !defined(_WIN32)
+    // The run loop as a coroutine on `loop` (io_loop.h): time slices of
+    // `budget` instructions with the other tasks of its loop thread in
+    // between, and at a device access that has to wait it suspends until
+    // the fd is readable, holding no thread. Ends when the guest halts or
+    // the host stops it; a guest trap ends it with TrapError. The VM must
+    // outlive the task.
+    VmTask runAsync(IoLoop& loop, std::uint64_t budget = 100'000) {
+        for (;;) {
+            intr_.setSlice(budget);
+            const RunResult r = tryRun(false);
+            const bool more = intr_.sliceExpired();
+            intr_.setSlice(0);
+            if (r == RunResult::Trapped) throw TrapError(trap_);
+            if (r == RunResult::Blocked) co_await loop.readable(wait_fd_);
+            else if (more) co_await loop.yield();
+            else co_return;
+        }
+    }
+#endif
+
+    // The trap that ended the last run (code None if it did not trap).
+    const GuestTrap& trap() const { return trap_; }
+
+    // Guest trap handler at program index `entry` (trap.h);
+    // TrapVector::NONE removes it.
+    void setTrapHandler(std::size_t entry) { trap_vec_.entry = entry; }
+
+    // Run for a time slice of about `budget` instructions (scheduler.h).
+    // Returns true if the slice ran out and another runSlice() resumes the
+    // program; false once it halted or the host stopped it.
+    bool runSlice(std::uint64_t budget) {
+        intr_.setSlice(budget);
+        run(false);
+        const bool more = intr_.sliceExpired();
+        intr_.setSlice(0);
+        return more;
+    }
+
+    void runChecked(bool trace) {
+        if (trace) {
+            TraceText t;
+            runTraced(t);
+        }
+        else {
+            TraceOff t;
+            runTraced(t);
+        }
+    }
+
+    // Checked loop for one tracing policy (trace.h); TraceOff compiles to
+    // the bare loop. A guest fault ends it with trap() set.
+    template <class Trace>
+    void runTraced(Trace& t) {
+        suspended_ = false;
+        resume_fast_ = false;
+        wait_fd_ = -1;
+        trap_ = GuestTrap{};
+        const std::atomic<u32>& exit = intr_.exitRequest();
+        countdown_ = intr_.countdown(); // a member: device reads in execute() stamp from it
+        std::uint64_t& countdown = countdown_;
+        std::uint64_t mark = countdown; // instructions executed = mark - countdown, as in runFast()
+        try {
+            while (running_) {
+                if ((exit.load(std::memory_order_relaxed) != 0) | (--countdown == 0)) {
+                    counts_.instructions += mark - countdown - 1;
+                    publish(counts_, false);
+                    const bool go = interrupt<Trace>(countdown);
+                    mark = go ? countdown + 1 : countdown;
+                    if (!go) break;
+                }
+                if (!paging_ && pc_ >= mem_words_) [[unlikely]] {
+                    fault(TrapCode::PcOutOfRange, pc_);
+                    break;
+                }
+                u32 instr = fetch();
+                t.insn(pc_ - 1, instr);
+                if constexpr (Trace::TEXT) {
+                    std::cout << "[pc=" << pc_ - 1 << "] instr=0x" << std::hex << instr << std::dec << "\n";
+                }
+                execute<Trace>(instr);
+                if constexpr (Trace::TEXT) {
+                    if (sp_ > 0) std::cout << "  tos: " << stackTop() << "\n";
+                }
+            }
+        }
+        catch (...) { // host errors only (and PageFault, which carries its address)
+            counts_.instructions += mark - countdown;
+            publish(counts_, true);
+            throw;
+        }
+        if (wait_fd_ >= 0) { // stopped at a device access that waits; resumable as on a yield
+            running_ = true;
+            suspended_ = true;
+            --mark; // the access did not run
+            intr_.undoCheck();
+        }
+        counts_.instructions += mark - countdown;
+        publish(counts_, trap_.code != TrapCode::None);
+        intr_.saveCountdown(countdown);
+    }
+
+    // No pc, stack or instruction-type checks: the verifier proved them at
+    // load time. Division by zero and load/store addresses depend on data and
+    // are still checked; a store into the verified code traps, since the
+    // verifier's proof would no longer hold. A VM this loop suspended (stop,
+    // yield or a device wait) resumes here; one the checked loop suspended
+    // resumes there. A guest fault ends it with trap() set.
+    void runUnchecked() {
+        if (!verify_.ok) throw std::logic_error("runUnchecked: program not verified");
+        if (paging_) throw std::logic_error("runUnchecked: raw indexing only, paging is enabled");
+        if (!resume_fast_ && (pc_ != program_base_ || sp_ != 0)) {
+            throw std::logic_error("runUnchecked: VM not fresh after loadProgram");
+        }
+        suspended_ = false;
+        resume_fast_ = false;
+        wait_fd_ = -1;
+        trap_ = GuestTrap{};
+        if (metrics_) runFast<true>();
+        else runFast<false>();
+    }
+
+    // Back to the state of a freshly constructed VM (vm_pool.h), clearing
+    // only what the last guest can have written: the stack up to its
+    // high-water mark and the pages dirtied by loadProgram, page tables and
+    // stores. Attached bus, interrupts and paging mode are kept.
+    void reset() {
+        u32* const mem = mem_.as<u32>();
+        std::fill_n(mem, std::min(stack_hwm_ + 1, mem_words_), 0u);
+        for (std::size_t p = 0; p < dirty_pages_.size(); ++p) {
+            if (!dirty_pages_[p]) continue;
+            dirty_pages_[p] = 0;
+            const std::size_t first = p * SoftMmu::PAGE_WORDS;
+            std::fill_n(mem + first, std::min<std::size_t>(SoftMmu::PAGE_WORDS, mem_words_ - first), 0u);
+        }
+        stack_hwm_ = 0;
+        code_base_ = program_base_;
+        code_words_ = 0;
+        pc_ = program_base_;
+        sp_ = 0;
+        running_ = true;
+        suspended_ = false;
+        resume_fast_ = false;
+        handler_unverified_ = false;
+        wait_fd_ = -1;
+        trap_ = GuestTrap{};
+        trap_vec_ = TrapVector{};
+        verify_ = VerifyResult{};
+        bus_cache_ = MmioBus::Cache{};
+        intr_.reset();
+        if (paging_) mmu_.flush();
+    }
+
+    bool verified() const { return verify_.ok; }
+    const VerifyResult& verifyResult() const { return verify_; }
+
+    // Guest memory actually backed by RAM (pages the guest has touched).
+    std::size_t residentBytes() const { return mem_.residentBytes(); }
+    GuestMemory& guestMemory() { return mem_; }
+
+    bool paging() const { return paging_; }
+    SoftMmu& mmu() { return mmu_; }
+
+private:
+    // memory[0] unused for stack; stack uses mem_[1..sp_].
+    // Demand-paged: only touched pages become resident.
+    GuestMemory mem_;
+    std::size_t mem_words_ = 0;
+    std::size_t program_base_ = 100;
+    std::size_t code_base_ = 100; // == program_base_ unless paging
+    std::size_t code_words_ = 0;
+
+    MmioBus* bus_ = nullptr;
+    MmioBus::Cache bus_cache_;
+
+    InterruptCpu intr_;
+    std::uint64_t countdown_ = 0; // the checked loop's exit countdown
+
+    bool paging_ = false;
+    SoftMmu mmu_;
+
+    std::size_t pc_ = 100; // points to next instruction to fetch
+    std::size_t sp_ = 0;   // number of items on stack
+
+    // What reset() has to clear: the highest stack slot used and one flag
+    // per page written outside the stack.
+    std::size_t stack_hwm_ = 0;
+    std::vector<std::uint8_t> dirty_pages_;
+    bool running_ = true;
+    bool suspended_ = false;          // left a run loop on stop, yield or a device wait
+    bool resume_fast_ = false;        // suspended by the unchecked loop, which resumes it
+    bool handler_unverified_ = false; // in a trap handler until halt: checked loop only
+    int wait_fd_ = -1;                // >= 0: suspended at a device access waiting on this fd
+
+    GuestTrap trap_;
+    TrapVector trap_vec_;
+
+    VerifyResult verify_;
+
+    VcpuMetrics* metrics_ = nullptr;
+    VcpuMetrics::Local counts_; // checked loop; the fast path counts in a local
+
+    static std::size_t roundUpToPage(std::size_t w) {
+        return (w + SoftMmu::PAGE_WORDS - 1) & ~static_cast<std::size_t>(SoftMmu::PAGE_WORDS - 1);
+    }
+
+    // Identity-map the stack (R|W) and the program (R|X). The page tables
+    // are taken from the top of guest memory downwards.
+    void buildPageTables(std::size_t prog_words) {
+        u32* const mem = mem_.as<u32>();
+        std::size_t next_table = mem_words_ / SoftMmu::PAGE_WORDS;
+        const std::size_t code_end_frame = roundUpToPage(code_base_ + prog_words) / SoftMmu::PAGE_WORDS;
+        auto alloc_frame = [&]() -> u32 {
+            if (next_table == 0 || --next_table < code_end_frame) {
+                throw std::out_of_range("no room for page tables above the program");
+            }
+            std::fill_n(mem + next_table * SoftMmu::PAGE_WORDS, SoftMmu::PAGE_WORDS, 0u);
+            dirty_pages_[next_table] = 1;
+            return static_cast<u32>(next_table);
+        };
+
+        mmu_.setRoot(alloc_frame());
+        for (std::size_t va = 0; va < program_base_; va += SoftMmu::PAGE_WORDS) {
+            const u32 page = static_cast<u32>(va / SoftMmu::PAGE_WORDS);
+            mmu_.map(static_cast<u32>(va), page, SoftMmu::PTE_R | SoftMmu::PTE_W, alloc_frame);
+        }
+        for (std::size_t va = code_base_; va < code_base_ + prog_words; va += SoftMmu::PAGE_WORDS) {
+            const u32 page = static_cast<u32>(va / SoftMmu::PAGE_WORDS);
+            mmu_.map(static_cast<u32>(va), page, SoftMmu::PTE_R | SoftMmu::PTE_X, alloc_frame);
+        }
+    }
+
+    // runUnchecked's loop; COUNT: keep instruction/primitive counts.
+    template <bool COUNT>
+    void runFast() {
+        stack_hwm_ = std::max(stack_hwm_, verify_.max_depth); // the verifier's bound; no per-push tracking
+        VcpuMetrics::Local counts;
+
+        u32* const mem = mem_.as<u32>();
+        std::uint8_t* const dirty = dirty_pages_.data();
+        const u32* pc = mem + pc_;
+        u32* sp = mem + sp_; // points at top of stack (mem[0] when empty)
+        const std::size_t ram = mem_words_;
+        auto sync = [&] {
+            pc_ = static_cast<std::size_t>(pc - mem);
+            sp_ = static_cast<std::size_t>(sp - mem);
+        };
+
+        // One exit check per instruction: the interrupt controller's exit
+        // word and the instruction-timer countdown share a single branch.
+        const std::atomic<u32>& exit = intr_.exitRequest();
+        std::uint64_t countdown = intr_.countdown();
+        // Instructions are counted by the countdown, which drops by one per
+        // instruction: executed = mark - countdown (unsigned wrap-around is fine).
+        std::uint64_t mark = countdown;
+        TrapCode trap = TrapCode::None; // set before `goto trapped`
+
+        try {
+            for (;;) {
+                if ((exit.load(std::memory_order_relaxed) != 0) | (--countdown == 0)) [[unlikely]] {
+                    if constexpr (COUNT) {
+                        counts.instructions += mark - countdown - 1; // the next one is not executed yet
+                        publish(counts, false);
+                    }
+                    u32 line = 0;
+                    const auto action = intr_.service(countdown, line, static_cast<std::size_t>(pc - mem) - code_base_);
+                    mark = countdown + 1;
+                    if (action == InterruptCpu::Action::Stop || action == InterruptCpu::Action::Yield) {
+                        suspended_ = true; // resumable through run()
+                        resume_fast_ = true;
+                        sync();
+                        intr_.saveCountdown(countdown);
+                        intr_.undoCheck();
+                        return;
+                    }
+                    if (action == InterruptCpu::Action::Deliver) {
+                        *++sp = line; // the verifier counted the handler's depth
+                        intr_.enter(static_cast<std::size_t>(pc - mem));
+                        pc = mem + code_base_ + intr_.vector();
+                    }
+                }
+                const u32 instr = *pc++;
+                const u32 t = Instr::type(instr);
+
+                if (t != 1u) { // push; type 3 was rejected by the verifier
+                    *++sp = static_cast<u32>(Instr::decode_push(instr));
+                    continue;
+                }
+
+                const u32 op = Instr::data(instr);
+                if constexpr (COUNT) ++counts.prims[op & (VcpuMetrics::PRIMS - 1)];
+                if (op == static_cast<u32>(Prim::Halt)) {
+                    sync();
+                    intr_.saveCountdown(countdown);
+                    running_ = false;
+                    if constexpr (COUNT) {
+                        counts.instructions += mark - countdown;
+                        publish(counts, false);
+                    }
+                    return;
+                }
+                if (op == static_cast<u32>(Prim::Load)) {
+                    const u32 addr = *sp;
+                    if (addr < ram) {
+                        *sp = mem[addr];
+                    }
+                    else {
+                        sync();
+                        const u32 v = busRead(addr, countdown);
+                        if ((trap = trap_.code) != TrapCode::None) goto trapped;
+                        if (wait_fd_ >= 0) [[unlikely]] goto blocked;
+                        *sp = v;
+                    }
+                    continue;
+                }
+                if (op == static_cast<u32>(Prim::Store)) {
+                    const u32 addr = sp[0];
+                    const u32 v = sp[-1];
+                    if (addr < ram) {
+                        if (addr - program_base_ < code_words_) [[unlikely]] {
+                            trap = TrapCode::CodeWrite;
+                            goto trapped;
+                        }
+                        mem[addr] = v;
+                        dirty[addr / SoftMmu::PAGE_WORDS] = 1;
+                    }
+                    else {
+                        sync();
+                        busWrite(addr, v);
+                        if ((trap = trap_.code) != TrapCode::None) goto trapped;
+                        if (wait_fd_ >= 0) [[unlikely]] goto blocked;
+                    }
+                    sp -= 2;
+                    continue;
+                }
+                if (op >= static_cast<u32>(Prim::Vec)) [[unlikely]] { // vec or iret
+                    if (op == static_cast<u32>(Prim::Vec)) {
+                        intr_.installVector(*sp--); // verified: a handler entry
+                    }
+                    else {
+                        --sp;
+                        pc = mem + intr_.leave();
+                    }
+                    continue;
+                }
+
+                // verified: every remaining primitive has two operands
+                const i32 b = static_cast<i32>(sp[0]);
+                const i32 a = static_cast<i32>(sp[-1]);
+                switch (static_cast<Prim>(op)) {
+                case Prim::Add: *--sp = static_cast<u32>(a + b); break;
+                case Prim::Sub: *--sp = static_cast<u32>(a - b); break;
+                case Prim::Mul: *--sp = static_cast<u32>(a * b); break;
+                default: // Prim::Div
+                    if (b == 0 || (a == std::numeric_limits<i32>::min() && b == -1)) [[unlikely]] {
+                        trap = b == 0 ? TrapCode::DivZero : TrapCode::DivOverflow;
+                        goto trapped;
+                    }
+                    *--sp = static_cast<u32>(a / b);
+                    break;
+                }
+            }
+        blocked: // the device access runs again on resume, the stack as before it
+            --pc;
+            sync();
+            running_ = true;
+            suspended_ = true;
+            resume_fast_ = true;
+            intr_.saveCountdown(countdown);
+            intr_.undoCheck();
+            if constexpr (COUNT) {
+                counts.instructions += mark - countdown - 1;
+                publish(counts, false);
+            }
+            return;
+        trapped: // pc is past the faulting instruction, the stack as before it
+            sync();
+            if constexpr (COUNT) counts.instructions += mark - countdown;
+            fastTrap(trap, countdown, counts);
+        }
+        catch (...) { // host errors only
+            if constexpr (COUNT) counts.instructions += mark - countdown;
+            publish(counts, true);
+            throw;
+        }
+    }
+
+    // Hands `counts` (and a trap) to metrics_, if attached.
+    // runFast's exit on a guest fault, out of line (the cold path).
+    [[gnu::cold]] [[gnu::noinline]] void fastTrap(TrapCode code, std::uint64_t countdown, VcpuMetrics::Local& counts) {
+        fault(code, pc_ - 1);
+        intr_.saveCountdown(countdown);
+        publish(counts, true);
+    }
+
+    void publish(VcpuMetrics::Local& counts, bool trap) {
+        if (!metrics_) {
+            counts = VcpuMetrics::Local{};
+            return;
+        }
+        metrics_->flush(counts);
+        VcpuMetrics::raise(metrics_->stack_hwm, stack_hwm_);
+        if (trap) VcpuMetrics::add(metrics_->traps, 1);
+    }
+
+    // The checked loop has range-checked pc_ (or the MMU does).
+    u32 fetch() {
+        if (paging_) return mmu_.fetch(static_cast<u32>(pc_++));
+        return mem_.as<u32>()[pc_++]; // fetch then advance
+    }
+
+    // Record a guest trap at absolute pc `pc` and stop the loop (the cold
+    // path).
+    [[gnu::cold]] [[gnu::noinline]] void fault(TrapCode code, std::size_t pc) {
+        trap_ = GuestTrap{ code, pc - code_base_ };
+        running_ = false;
+    }
+
+    // Enter the guest trap handler for trap_, if there is one to enter.
+    bool enterTrapHandler() {
+        if (!trap_vec_.take()) return false;
+        const GuestTrap t = trap_;
+        sp_ = 0;
+        running_ = true;
+        suspended_ = false;
+        resume_fast_ = false;
+        handler_unverified_ = true;
+        push(static_cast<i32>(t.pc));
+        push(static_cast<i32>(t.code));
+        if (!running_) return false; // no room for the two words
+        pc_ = code_base_ + trap_vec_.entry;
+        return true;
+    }
+
+    // For the instruction at pc_ - 1 (fetch() has advanced pc_); pop is
+    // unchecked, the primitives check need(n) before touching the stack.
+    bool need(std::size_t n) {
+        if (sp_ >= n) [[likely]] return true;
+        fault(TrapCode::StackUnderflow, pc_ - 1);
+        return false;
+    }
+
+    i32 pop() {
+        // stack values stored in low 32 bits
+        i32 v = static_cast<i32>(paging_ ? mmu_.load(static_cast<u32>(sp_)) : mem_.as<u32>()[sp_]);
+        --sp_;
+        return v;
+    }
+
+    // Traps instead of overflowing into the program area.
+    void push(i32 v) {
+        if (sp_ + 1 >= program_base_) [[unlikely]] {
+            fault(TrapCode::StackOverflow, pc_ - 1);
+            return;
+        }
+        ++sp_;
+        if (sp_ > stack_hwm_) stack_hwm_ = sp_;
+        if (paging_) mmu_.store(static_cast<u32>(sp_), static_cast<u32>(v));
+        else mem_.as<u32>()[sp_] = static_cast<u32>(v);
+    }
+
+    void markDirty(std::size_t first, std::size_t words) {
+        if (words == 0) return;
+        for (std::size_t p = first / SoftMmu::PAGE_WORDS; p <= (first + words - 1) / SoftMmu::PAGE_WORDS; ++p) {
+            dirty_pages_[p] = 1;
+        }
+    }
+
+    // RAM first: for RAM this is the same single compare as the bounds check.
+    u32 loadWord(u32 addr) {
+        if (!paging_) {
+            if (addr < mem_words_) return mem_.as<u32>()[addr];
+        }
+        else if (addr < MMIO_BASE) {
+            return mmu_.load(addr);
+        }
+        const u32 v = busRead(addr, countdown_);
+        if (wait_fd_ >= 0) [[unlikely]] again(1);
+        return v;
+    }
+
+    // Pages are identity-mapped, so a virtual address names its dirty page.
+    // Verified code traps on a store into itself, as on the fast loop, so a
+    // resume there never runs code the verifier did not see.
+    void storeWord(u32 addr, u32 v) {
+        if (!paging_) {
+            if (addr < mem_words_) {
+                if (addr - code_base_ < code_words_ && verify_.ok) [[unlikely]] {
+                    fault(TrapCode::CodeWrite, pc_ - 1);
+                    return;
+                }
+                mem_.as<u32>()[addr] = v;
+                dirty_pages_[addr / SoftMmu::PAGE_WORDS] = 1;
+                return;
+            }
+        }
+        else if (addr < MMIO_BASE) {
+            mmu_.store(addr, v);
+            dirty_pages_[addr / SoftMmu::PAGE_WORDS] = 1;
+            return;
+        }
+        busWrite(addr, v);
+        if (wait_fd_ >= 0) [[unlikely]] again(2);
+    }
+
+    // The checked loop's load or store at pc_ - 1 has to wait: put its
+    // `operands` back and run it again on resume.
+    void again(std::size_t operands) {
+        sp_ += operands;
+        --pc_;
+    }
+
+    // Interrupt slow path for the checked loop; false on a stop request.
+    template <class Trace>
+    bool interrupt(std::uint64_t& countdown) {
+        u32 line = 0;
+        switch (intr_.service(countdown, line, pc_ - code_base_)) {
+        case InterruptCpu::Action::Stop: // running_ stays set: run() resumes here
+        case InterruptCpu::Action::Yield:
+            suspended_ = true;
+            intr_.undoCheck();
+            return false;
+        case InterruptCpu::Action::Deliver:
+            if constexpr (Trace::TEXT) std::cout << "  irq " << line << " -> " << intr_.vector() << "\n";
+            push(static_cast<i32>(line));
+            if (!running_) return false; // stack overflow
+            intr_.enter(pc_);
+            pc_ = code_base_ + intr_.vector();
+            return true;
+        default:
+            return true;
+        }
+    }
+
+    // Outside RAM with no bus: a BadAddress trap for the instruction at
+    // pc_ - 1. Out of line, the slow path of every load and store.
+    // `countdown` is the running loop's, to stamp logged reads (replay.h).
+    // An access that has to wait sets wait_fd_, did not happen and ends the
+    // loop.
+    [[gnu::noinline]] u32 busRead(u32 addr, std::uint64_t countdown) {
+        if (!bus_) [[unlikely]] {
+            fault(TrapCode::BadAddress, pc_ - 1);
+            return 0;
+        }
+        u32 v = 0;
+        const bool done = intr_.deviceRead(countdown, v, [&](u32& out) {
+            out = bus_->read(addr, bus_cache_);
+            return bus_cache_.wait_fd < 0;
+        });
+        if (!done) {
+            wait_fd_ = std::exchange(bus_cache_.wait_fd, -1);
+            running_ = false;
+        }
+        return v;
+    }
+
+    [[gnu::noinline]] void busWrite(u32 addr, u32 v) {
+        if (!bus_) [[unlikely]] {
+            fault(TrapCode::BadAddress, pc_ - 1);
+            return;
+        }
+        bus_->write(addr, v, bus_cache_);
+        if (bus_cache_.wait_fd >= 0) [[unlikely]] {
+            wait_fd_ = std::exchange(bus_cache_.wait_fd, -1);
+            running_ = false;
+        }
+    }
+
+    i32 stackTop() {
+        if (sp_ == 0) throw std::runtime_error("stack empty");
+        return static_cast<i32>(paging_ ? mmu_.load(static_cast<u32>(sp_)) : mem_.as<u32>()[sp_]);
+    }
+
+    template <class Trace>
+    void execute(u32 instr) {
+        u32 t = Instr::type(instr);
+        u32 d = Instr::data(instr);
+
+        if (t == 0u || t == 2u) {
+            i32 imm = Instr::decode_push(instr);
+            if constexpr (Trace::TEXT) std::cout << "  push " << imm << "\n";
+            push(imm);
+            return;
+        }
+
+        if (t != 1u) {
+            fault(TrapCode::BadInstruction, pc_ - 1);
+            return;
+        }
+        ++counts_.prims[d & (VcpuMetrics::PRIMS - 1)];
+
+        switch (static_cast<Prim>(d)) {
+        case Prim::Halt: {
+            if constexpr (Trace::TEXT) std::cout << "  halt\n";
+            running_ = false;
+            break;
+        }
+        case Prim::Add: {
+            if (!need(2)) break;
+            i32 b = pop();
+            i32 a = pop();
+            if constexpr (Trace::TEXT) std::cout << "  add " << a << " " << b << "\n";
+            push(a + b);
+            break;
+        }
+        case Prim::Sub: {
+            if (!need(2)) break;
+            i32 b = pop();
+            i32 a = pop();
+            if constexpr (Trace::TEXT) std::cout << "  sub " << a << " " << b << "\n";
+            push(a - b);
+            break;
+        }
+        case Prim::Mul: {
+            if (!need(2)) break;
+            i32 b = pop();
+            i32 a = pop();
+            if constexpr (Trace::TEXT) std::cout << "  mul " << a << " " << b << "\n";
+            push(a * b);
+            break;
+        }
+        case Prim::Div: {
+            if (!need(2)) break;
+            i32 b = pop();
+            i32 a = pop();
+            if (b == 0) {
+                fault(TrapCode::DivZero, pc_ - 1);
+                break;
+            }
+            if (a == std::numeric_limits<i32>::min() && b == -1) {
+                fault(TrapCode::DivOverflow, pc_ - 1);
+                break;
+            }
+            if constexpr (Trace::TEXT) std::cout << "  div " << a << " " << b << "\n";
+            push(a / b);
+            break;
+        }
+        case Prim::Load: {
+            if (!need(1)) break;
+            const u32 addr = static_cast<u32>(pop());
+            const u32 v = loadWord(addr);
+            if (!running_) break;
+            if constexpr (Trace::TEXT) std::cout << "  load [" << addr << "] = " << static_cast<i32>(v) << "\n";
+            push(static_cast<i32>(v));
+            break;
+        }
+        case Prim::Store: {
+            if (!need(2)) break;
+            const u32 addr = static_cast<u32>(pop());
+            const i32 v = pop();
+            if constexpr (Trace::TEXT) std::cout << "  store [" << addr << "] = " << v << "\n";
+            storeWord(addr, static_cast<u32>(v));
+            break;
+        }
+        case Prim::Vec: {
+            if (!need(1)) break;
+            const i32 target = pop();
+            if (target < 0 || static_cast<std::size_t>(target) >= code_words_) {
+                fault(TrapCode::BadVector, pc_ - 1);
+                break;
+            }
+            if constexpr (Trace::TEXT) std::cout << "  vec " << target << "\n";
+            intr_.installVector(static_cast<std::size_t>(target));
+            break;
+        }
+        case Prim::Iret: {
+            if (!need(1)) break;
+            if (!intr_.inHandler()) {
+                fault(TrapCode::BadIret, pc_ - 1);
+                break;
+            }
+            const i32 line = pop();
+            pc_ = intr_.leave();
+            if constexpr (Trace::TEXT) std::cout << "  iret " << line << "\n";
+            break;
+        }
+        default:
+            fault(TrapCode::BadPrimitive, pc_ - 1);
+            break;
+        }
+    }
+};
@@ -1,8 +1,11 @@
 #include <cstdint>
 #include <iostream>
+#include <span>
 #include <vector>
 #include <stdexcept>
 
+#include "../../common/sasm.h"
+
 using i32 = int32_t;
 using u32 = uint32_t;
 
@@ -13,7 +16,7 @@ public:
         stack.resize(1024);    // runtime stack
     }
 
-    void loadProgram(const std::vector<u32>& prog) {
+    void loadProgram(std::span<const u32> prog) {
         pc = 0;
         for (size_t i = 0; i < prog.size(); ++i) {
             memory[i] = prog[i];
@@ -123,15 +126,8 @@ private:
 int main() {
 	StackVM vm;
 
-	// Sample program: computes (3 + 4) * 5
-	std::vector<u32> program = {
-		(0 << 30) | 3,      // push 3
-		(0 << 30) | 4,      // push 4
-		(1 << 30) | 1,      // add
-		(0 << 30) | 5,      // push 5
-		(1 << 30) | 3,      // mul
-		(1 << 30) | 0       // halt
-	};
+	// Sample program: computes (3 + 4) * 5, assembled at compile time
+	static constexpr auto program = sasm_program<"3 4 + 5 * halt">;
 
 	vm.loadProgram(program);
 	vm.run();
@@ -11,6 +11,8 @@
 #include <unordered_map>
 #include <vector>
 
+#include "../common/bytecode_image.h"
+
 using i32 = std::int32_t;
 using u32 = std::uint32_t;
 using strings = std::vector<std::string>;
@@ -201,6 +203,14 @@ struct Assembler {
     //  opcode 2 sub (-)
     //  opcode 3 mul (*)
     //  opcode 4 div (/)
+    //  opcode 5 print
+    //  opcode 6 flush (console output)
+    //  opcode 7 load  (addr -- value)
+    //  opcode 8 store (value addr --)
+    //  opcode 9 vec   (pc --)    install the interrupt handler
+    //  opcode 10 iret (line --)  return from the interrupt handler
+    //
+    // common/sasm.h mirrors this encoding at compile time; keep them in sync.
 
     static constexpr u32 TYPE_POS = 0u;
     static constexpr u32 TYPE_PRIM = 1u;
@@ -269,6 +279,12 @@ struct Assembler {
             {"-", 2},
             {"*", 3},
             {"/", 4},
+            {"print", 5},
+            {"flush", 6},
+            {"load", 7},
+            {"store", 8},
+            {"vec", 9},
+            {"iret", 10},
         };
 
         std::vector<i32> out;
@@ -316,12 +332,10 @@ static std::string read_all_text(const char* path) {
     return s;
 }
 
+// Writes a versioned image (header + code section + CRC), see bytecode_image.h.
+// The whole file goes out in a single buffered write.
 static void write_bin(const char* path, const std::vector<i32>& code) {
-    std::ofstream out(path, std::ios::binary);
-    if (!out) throw std::runtime_error(std::string("Cannot open output file: ") + path);
-    for (i32 ins : code) {
-        out.write(reinterpret_cast<const char*>(&ins), sizeof(ins));
-    }
+    BytecodeImage::write(path, code);
 }
 
 int main(int argc, char** argv) {
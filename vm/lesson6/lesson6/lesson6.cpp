@@ -3,6 +3,7 @@
 #include <iostream>
 #include <vector>
 #include "stack-vm.h"
+#include "../../common/bytecode_image.h"
 
 int main(int argc, char** argv) {
     if (argc < 2) {
@@ -10,22 +11,13 @@ int main(int argc, char** argv) {
         return 0;
     }
 
-    std::ifstream r(argv[1], std::ios::binary);
-    if (!r) {
-        std::cerr << "Failed to open file: " << argv[1] << "\n";
-        return 1;
-    }
-
-    std::vector<i32> prog;
-    i32 word = 0;
-
-    while (r.read(reinterpret_cast<char*>(&word), sizeof(word))) {
-        prog.push_back(word);
-    }
-
     try {
+        // Maps the image (header/CRC checked) and runs the code in place.
+        // Legacy headerless files are accepted as raw words.
+        MappedImage image(argv[1]);
+
         StackVM vm;
-        vm.loadProgram(prog);
+        vm.loadProgram(image.code());
         vm.run(true);
     }
     catch (const std::exception& e) {
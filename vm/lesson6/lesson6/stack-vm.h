@@ -1,20 +1,40 @@
 // stack-vm.h
 #pragma once
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <span>
 #include <vector>
 #include <stdexcept>
 #include <iostream>
+#include <limits>
 #include <sstream>
 
+#include "../../common/guard_stack.h"
+#include "../../common/guest_memory.h"
+#include "../../common/trace.h"
+#include "../../common/trap.h"
+#include "../../common/verifier.h"
+
 using i32 = int32_t;
 
 class StackVM {
-    i32 pc_ = 100;      // program counter
+    static constexpr i32 PROGRAM_BASE = 100;
+    static constexpr size_t MEMORY_WORDS = 1'000'000;
+    static constexpr size_t STACK_WORDS = 1'000'000;
+
+    i32 pc_ = 0;        // program counter (index into code_)
     i32 sp_ = -1;       // stack pointer: -1 means empty stack
-    std::vector<i32> memory_;
+    GuardStack stack_;  // operand stack; running off either end faults
+    GuestMemory memory_; // demand-paged, touched pages only
+    std::span<const i32> code_; // program: memory_[PROGRAM_BASE..] or an external (mapped) image
     i32 typ_ = 0;
     i32 dat_ = 0;
     bool running_ = true;
+    GuestTrap trap_;
+    TrapVector trap_vec_;
+    VerifyResult verify_;
+    size_t copied_words_ = 0; // program words copied to PROGRAM_BASE; what reset() clears
 
     static i32 getType(i32 instruction) {
         return (instruction >> 30) & 0x3;
@@ -23,22 +43,55 @@ class StackVM {
         return instruction & 0x3fffffff;
     }
 
+    // Record a guest trap at pc_ and stop the loop (the cold path).
+    [[gnu::cold]] [[gnu::noinline]] void fault(TrapCode code) {
+        trap_ = GuestTrap{ code, static_cast<size_t>(pc_) };
+        running_ = false;
+    }
+
+    // Enter the guest trap handler for trap_, if there is one to enter.
+    bool enterTrapHandler() {
+        if (!trap_vec_.take() || trap_vec_.entry >= code_.size()) return false;
+        sp_ = -1;
+        push(static_cast<i32>(trap_.pc));
+        push(static_cast<i32>(trap_.code));
+        pc_ = static_cast<i32>(trap_vec_.entry);
+        return true;
+    }
+
     void fetch() { ++pc_; }
-    void decode() {
-        typ_ = getType(memory_.at(pc_));
-        dat_ = getData(memory_.at(pc_));
+    bool decode() {
+        if (pc_ < 0 || static_cast<size_t>(pc_) >= code_.size()) [[unlikely]] {
+            fault(TrapCode::PcOutOfRange);
+            return false;
+        }
+        const i32 ins = code_[static_cast<size_t>(pc_)];
+        typ_ = getType(ins);
+        dat_ = getData(ins);
+        return true;
     }
 
+    // No bounds checks: stack_ has guard pages at both ends, and the checked
+    // loop runs under stack_.guard(). Every op touches its deepest slot
+    // before sp_ moves (push stores, then bumps; binary ops read the lower
+    // operand first), so a guard fault leaves the stack as it was before the
+    // instruction.
     void push(i32 v) {
-        if (sp_ + 1 >= static_cast<i32>(memory_.size())) {
-            throw std::runtime_error("stack overflow");
-        }
-        memory_[++sp_] = v;
+        stack_.base()[sp_ + 1] = v;
+        ++sp_;
     }
 
     i32 pop() {
-        if (sp_ < 0) throw std::runtime_error("stack underflow");
-        return memory_[sp_--];
+        return stack_.base()[sp_--];
+    }
+
+    // a op b for the top two words, the deeper one read first
+    template <class Op>
+    void binary(Op op) {
+        i32* const top = stack_.base() + sp_;
+        const i32 a = top[-1];
+        top[-1] = op(a, top[0]);
+        --sp_;
     }
 
     void doPrimitive() {
@@ -47,36 +100,34 @@ class StackVM {
             running_ = false;
             return;
 
-        case 1: { // add
-            i32 b = pop();
-            i32 a = pop();
-            push(a + b);
-            return;
-        }
-        case 2: { // sub
-            i32 b = pop();
-            i32 a = pop();
-            push(a - b);
-            return;
-        }
-        case 3: { // mul
-            i32 b = pop();
-            i32 a = pop();
-            push(a * b);
-            return;
-        }
+        case 1: // add
+            return binary([](i32 a, i32 b) { return a + b; });
+        case 2: // sub
+            return binary([](i32 a, i32 b) { return a - b; });
+        case 3: // mul
+            return binary([](i32 a, i32 b) { return a * b; });
         case 4: { // div
-            i32 b = pop();
-            i32 a = pop();
-            if (b == 0) throw std::runtime_error("division by zero");
+            const i32* const top = stack_.base() + sp_;
+            const i32 a = top[-1];
+            const i32 b = top[0];
+            if (b == 0) return fault(TrapCode::DivZero);
+            if (a == std::numeric_limits<i32>::min() && b == -1) return fault(TrapCode::DivOverflow);
+            sp_ -= 2;
             push(a / b);
             return;
         }
         default:
-            throw std::runtime_error("unknown primitive opcode: " + std::to_string(dat_));
+            fault(TrapCode::BadPrimitive);
+            return;
         }
     }
 
+    void verifyCode(size_t stack_capacity) {
+        Verifier::Options opt;
+        opt.stack_capacity = stack_capacity;
+        verify_ = Verifier::verify(code_, opt);
+    }
+
     void execute() {
         if (typ_ == 0) {              // positive integer
             push(dat_);
@@ -88,36 +139,171 @@ class StackVM {
             doPrimitive();
         }
         else {
-            throw std::runtime_error("undefined instruction header: " + std::to_string(typ_));
+            fault(TrapCode::BadInstruction);
         }
     }
 
 public:
-    StackVM() {
-        memory_.resize(1'000'000); // IMPORTANT: resize, not reserve
-    }
+    // `mem` selects huge pages / NUMA placement for guest memory.
+    explicit StackVM(const GuestMemory::Options& mem = {})
+        : stack_(STACK_WORDS), memory_(MEMORY_WORDS * sizeof(i32), mem) {}
 
+    // Copies the program into guest memory at PROGRAM_BASE.
     void loadProgram(const std::vector<i32>& prog) {
-        if (pc_ < 0) throw std::runtime_error("invalid pc");
-        if (static_cast<size_t>(pc_) + prog.size() > memory_.size()) {
+        if (static_cast<size_t>(PROGRAM_BASE) + prog.size() > MEMORY_WORDS) {
             throw std::runtime_error("program too large for memory");
         }
+        i32* const mem = memory_.as<i32>();
         for (size_t i = 0; i < prog.size(); ++i) {
-            memory_[static_cast<size_t>(pc_) + i] = prog[i];
+            mem[static_cast<size_t>(PROGRAM_BASE) + i] = prog[i];
+        }
+        code_ = std::span<const i32>(mem + PROGRAM_BASE, prog.size());
+        copied_words_ = std::max(copied_words_, prog.size());
+        pc_ = 0;
+        sp_ = -1;
+        trap_ = GuestTrap{};
+        trap_vec_.active = false;
+        verifyCode(stack_.capacity());
+    }
+
+    // Executes straight from `prog` (e.g. MappedImage::code()) without copying.
+    // The caller keeps the storage alive for as long as the VM runs.
+    void loadProgram(std::span<const i32> prog) {
+        code_ = prog;
+        pc_ = 0;
+        sp_ = -1;
+        trap_ = GuestTrap{};
+        trap_vec_.active = false;
+        verifyCode(stack_.capacity());
+    }
+
+    // Back to the state of a freshly constructed VM (vm_pool.h), clearing
+    // only the copied program instead of the whole 1M-word memory. Stack
+    // words above sp_ are never read before they are written.
+    void reset() {
+        std::fill_n(memory_.as<i32>() + PROGRAM_BASE, copied_words_, 0);
+        copied_words_ = 0;
+        code_ = {};
+        pc_ = 0;
+        sp_ = -1;
+        running_ = true;
+        trap_ = GuestTrap{};
+        trap_vec_ = TrapVector{};
+        verify_ = VerifyResult{};
+    }
+
+    bool verified() const { return verify_.ok; }
+    const VerifyResult& verifyResult() const { return verify_; }
+
+    // Guest memory actually backed by RAM (pages the guest has touched).
+    size_t residentBytes() const { return memory_.residentBytes(); }
+    GuestMemory& guestMemory() { return memory_; }
+
+    // Run until halt or a guest trap (trap.h); verified programs run on the
+    // unchecked fast path unless tracing. A trap enters the guest trap
+    // handler if one is installed.
+    RunResult tryRun(bool trace = false) {
+        if (!trace && verify_.ok && pc_ == 0 && sp_ == -1) runUnchecked();
+        else runChecked(trace);
+        while (trap_.code != TrapCode::None) {
+            if (!enterTrapHandler()) return RunResult::Trapped;
+            runChecked(trace);
         }
+        return RunResult::Halted;
     }
 
+    // tryRun, throwing TrapError if the guest trapped.
     void run(bool trace = true) {
+        if (tryRun(trace) == RunResult::Trapped) throw TrapError(trap_);
+    }
+
+    // The trap that ended the last run (code None if it did not trap).
+    const GuestTrap& trap() const { return trap_; }
+
+    // Guest trap handler at program index `entry` (trap.h);
+    // TrapVector::NONE removes it.
+    void setTrapHandler(size_t entry) { trap_vec_.entry = entry; }
+
+    // Fast path: the verifier proved pc, stack depth and instruction types,
+    // so only division by zero and overflow are left to check.
+    void runUnchecked() {
+        if (!verify_.ok) throw std::logic_error("runUnchecked: program not verified");
+        if (pc_ != 0 || sp_ != -1) throw std::logic_error("runUnchecked: VM not fresh after loadProgram");
+
+        const i32* const code = code_.data();
+        const i32* pc = code;
+        i32* const base = stack_.base();
+        i32* sp = base; // one past top of stack
+
+        running_ = true;
+        trap_ = GuestTrap{};
+        for (;;) {
+            const i32 ins = *pc++;
+            const i32 typ = getType(ins);
+            const i32 dat = getData(ins);
+
+            if (typ == 0) { *sp++ = dat; continue; }
+            if (typ == 2) { *sp++ = -dat; continue; }
+
+            // typ == 1: primitive (3 was rejected by the verifier)
+            if (dat == 0) {
+                pc_ = static_cast<i32>(pc - code) - 1;
+                sp_ = static_cast<i32>(sp - base) - 1;
+                running_ = false;
+                return;
+            }
+            const i32 b = sp[-1];
+            const i32 a = sp[-2];
+            switch (dat) {
+            case 1: sp[-2] = a + b; --sp; break;
+            case 2: sp[-2] = a - b; --sp; break;
+            case 3: sp[-2] = a * b; --sp; break;
+            default: // 4: div
+                if (b == 0 || (a == std::numeric_limits<i32>::min() && b == -1)) [[unlikely]] {
+                    pc_ = static_cast<i32>(pc - code) - 1;
+                    sp_ = static_cast<i32>(sp - base) - 1;
+                    return fault(b == 0 ? TrapCode::DivZero : TrapCode::DivOverflow);
+                }
+                sp[-2] = a / b;
+                --sp;
+                break;
+            }
+        }
+    }
+
+    void runChecked(bool trace) {
+        GuardStack::Hit hit;
+        if (trace) {
+            TraceText t;
+            hit = stack_.guard([&] { runTraced(t); });
+        }
+        else {
+            TraceOff t;
+            hit = stack_.guard([&] { runTraced(t); });
+        }
+        if (hit != GuardStack::Hit::None) {
+            fault(hit == GuardStack::Hit::Overflow ? TrapCode::StackOverflow : TrapCode::StackUnderflow);
+        }
+    }
+
+    // Checked loop for one tracing policy (trace.h).
+    template <class Trace>
+    void runTraced(Trace& t) {
         // set pc_ to just before first instruction, so fetch() lands on first
         pc_ -= 1;
+        running_ = true;
+        trap_ = GuestTrap{};
 
         while (running_) {
             fetch();
-            decode();
+            // pc_ and sp_ in memory before the stack is touched, for a guard fault
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            if (!decode()) break;
+            t.insn(static_cast<size_t>(pc_), static_cast<std::uint32_t>(code_[static_cast<size_t>(pc_)]));
             execute();
 
-            if (trace && sp_ >= 0) {
-                std::cout << "pc=" << pc_ << " sp=" << sp_ << " tos=" << memory_[sp_] << "\n";
+            if constexpr (Trace::TEXT) {
+                if (sp_ >= 0) std::cout << "pc=" << pc_ << " sp=" << sp_ << " tos=" << stack_.base()[sp_] << "\n";
             }
         }
     }
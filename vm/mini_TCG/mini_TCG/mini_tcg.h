@@ -0,0 +1,940 @@
+// mini_tcg.h
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <span>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <functional>
+#include <stdexcept>
+#include <limits>
+#include <memory>
+#include <string>
+
+#include "../../common/aot.h"
+#include "../../common/console.h"
+#include "../../common/interrupts.h"
+#include "../../common/metrics.h"
+#include "../../common/strength_reduce.h"
+#include "../../common/trace.h"
+#include "../../common/trap.h"
+#include "tcg_jit.h"
+
+class MiniTCGVM {
+public:
+    using i32 = std::int32_t;
+    using u32 = std::uint32_t;
+
+    // 2-bit type (same idea as your encoding)
+    enum class Type : u32 { PosImm = 0, Prim = 1, NegImm = 2, Undef = 3 };
+    enum class Prim : u32 { Halt = 0, Add = 1, Sub = 2, Mul = 3, Div = 4, Print = 5, Flush = 6, Vec = 9, Iret = 10 };
+
+    // How translated blocks are executed: a chain of std::function closures,
+    // or host code pasted together from precompiled stencils (tcg_jit.h).
+    enum class Backend { Closures, CopyPatch };
+
+    struct State {
+        std::size_t pc = 0;
+        bool running = false;
+        std::vector<i32> stack;
+        GuestTrap trap; // set (and running cleared) by a faulting op
+    };
+
+    // Translation Block: compiled host "code" for a guest pc
+    struct TB {
+        std::size_t guest_pc = 0;
+        std::size_t next_pc = 0;           // pc after executing this TB (iret overrides it)
+        std::size_t insns = 0;             // guest instructions in the block
+        std::vector<std::uint8_t> prims;   // primitive opcodes in the block, for metrics
+        std::size_t pushes = 0;            // stack growth bound, for the JIT
+        std::size_t need = 0;              // stack depth the block pops below its entry depth
+        TrapCode fault = TrapCode::None;   // guest_pc itself does not decode (an empty block)
+        u32 compiled_version = 0;          // invalidation check
+        std::function<void(State&)> exec;  // "host code" (Closures)
+        TcgJitEntry jit = nullptr;         // host code (CopyPatch)
+        const AotBlock* aot = nullptr;     // host code (attached AOT module)
+        std::string debug;                 // optional: what got compiled
+    };
+
+public:
+    explicit MiniTCGVM(std::size_t max_tb_insns = 8, const VirtualConsole::Options& console = {})
+        : max_tb_insns_(max_tb_insns), console_(console) {}
+
+    void loadProgram(std::span<const i32> prog) {
+        program_.assign(prog.begin(), prog.end());
+        // program changed => invalidate all TBs (like code page write)
+        program_version_++;
+        if (aot_ && !aot_->matches(program_)) aot_ = nullptr;
+        flushTBs();
+        suspended_ = false;
+        state_.trap = GuestTrap{};
+    }
+
+    // simulate "self-modifying code": patch one instruction. Logged when
+    // recording (replay.h); a replaying VM takes its patches from the log.
+    void patch(std::size_t index, i32 new_insn) {
+        if (index >= program_.size()) throw std::runtime_error("patch out of range");
+        intr_.recordPatch(index, static_cast<u32>(new_insn));
+        applyPatch(index, new_insn);
+    }
+
+    // Record delivered interrupts and patch() calls into, or replay them
+    // from, `log` (replay.h); null detaches. Stamps count whole blocks, so
+    // replay with the recording's backend, max_tb_insns and AOT module.
+    void attachReplay(ReplayLog* log) {
+        intr_.attachReplay(log, [this](std::uint64_t index, std::uint64_t insn) {
+            if (index >= program_.size()) throw std::runtime_error("replay diverged: logged patch out of range");
+            applyPatch(static_cast<std::size_t>(index), static_cast<i32>(static_cast<u32>(insn)));
+        });
+    }
+
+    // Switch backends; flushes the TB cache. CopyPatch throws if the JIT
+    // cannot run here (not x86-64 Linux, or no executable memory);
+    // `jit_bytes` sizes its code buffer on first use (pages are only backed
+    // once written).
+    void setBackend(Backend b, std::size_t jit_bytes = 64u << 20) {
+        if (b == Backend::CopyPatch && !jit_) {
+            auto jit = std::make_unique<TcgJit>(jit_bytes);
+            if (!jit->available()) throw std::runtime_error("copy-and-patch JIT unavailable: " + jit->error());
+#if TCG_JIT_SUPPORTED
+            jit->setHelper(tcg_stencils::Helper::print, &jitPrint);
+            jit->setHelper(tcg_stencils::Helper::flush, &jitFlush);
+            jit->setHelper(tcg_stencils::Helper::vec, &jitVec);
+            jit->setHelper(tcg_stencils::Helper::iret, &jitIret);
+#endif
+            jit_ = std::move(jit);
+        }
+        backend_ = b;
+        flushTBs();
+    }
+    Backend backend() const { return backend_; }
+
+    // Lower `push c; mul` and `push c; div` to shifts and multiply-highs
+    // (on by default; off to measure or bisect). Flushes the TB cache.
+    void setStrengthReduction(bool on) {
+        strength_reduce_ = on;
+        flushTBs();
+    }
+
+    // Take blocks from the natively compiled module `lib` (aot.h) instead of
+    // translating them, whatever the backend; null detaches. Throws unless
+    // `lib` was compiled from the loaded program and uses only primitives
+    // this VM implements; loading or patching a different program detaches
+    // it. AOT blocks ignore max_tb_insns. Flushes the TB cache.
+    void attachAot(const AotLibrary* lib) {
+        if (lib) {
+            lib->check(program_);
+            if (lib->module().prims_used & ~AOT_PRIMS) {
+                throw std::runtime_error("AOT module uses primitives MiniTCGVM does not implement");
+            }
+        }
+        aot_ = lib;
+        flushTBs();
+    }
+    bool aotActive() const { return aot_ != nullptr; }
+
+    // bytes of host code in the JIT buffer (0 for Closures)
+    std::size_t jitCodeBytes() const { return jit_ ? jit_->used() : 0; }
+
+    // Run until halt, stop/yield or a guest trap (trap.h). A trap ends the
+    // block at the faulting op and enters the guest trap handler if one is
+    // installed; otherwise the run returns Trapped with trap() set.
+    RunResult tryRun(bool trace = false) {
+        if (trace) {
+            TraceText t;
+            runTraced(t);
+        }
+        else {
+            TraceOff t;
+            runTraced(t);
+        }
+        if (state_.trap.code != TrapCode::None) return RunResult::Trapped;
+        return suspended_ ? RunResult::Suspended : RunResult::Halted;
+    }
+
+    // tryRun, throwing TrapError if the guest trapped.
+    void run(bool trace = true) {
+        if (tryRun(trace) == RunResult::Trapped) throw TrapError(state_.trap);
+    }
+
+    // The trap that ended the last run (code None if it did not trap).
+    const GuestTrap& trap() const { return state_.trap; }
+
+    // Guest trap handler at program index `entry` (trap.h);
+    // TrapVector::NONE removes it.
+    void setTrapHandler(std::size_t entry) { trap_vec_.entry = entry; }
+
+    // Run for a time slice of about `budget` guest instructions, rounded up
+    // to a block (scheduler.h). Returns true if the slice ran out and another
+    // runSlice() resumes the program; false once it halted or was stopped.
+    bool runSlice(std::uint64_t budget) {
+        intr_.setSlice(budget);
+        run(false);
+        const bool more = intr_.sliceExpired();
+        intr_.setSlice(0);
+        return more;
+    }
+
+    // Dispatch loop for one tracing policy (trace.h). Events are per TB:
+    // hit/miss at lookup and exec before running the block. Interrupts are
+    // taken at block boundaries only. Each run starts the program from pc 0
+    // unless the last one was suspended on stop or yield. A guest fault ends
+    // the loop with state_.trap set, unless the trap handler takes it.
+    template <class Trace>
+    void runTraced(Trace& t) {
+        State& s = state_;
+        if (!suspended_) {
+            s.running = true;
+            s.pc = 0;
+            s.stack.clear();
+            intr_.reset();
+            trap_vec_.active = false;
+        }
+        suspended_ = false;
+        s.trap = GuestTrap{};
+
+        const std::atomic<u32>& exit = intr_.exitRequest();
+        std::uint64_t countdown = intr_.countdown();
+        std::size_t last_tb = s.pc, last_tb_end = 0; // block that just ran, for samples
+        try {
+            while (s.running) {
+                if ((exit.load(std::memory_order_relaxed) != 0) | (countdown == 0)) {
+                    publish(false);
+                    u32 line = 0;
+                    const auto action = intr_.service(countdown, line, last_tb, last_tb_end);
+                    if (action == InterruptCpu::Action::Stop || action == InterruptCpu::Action::Yield) {
+                        suspended_ = true;
+                        intr_.saveCountdown(countdown);
+                        return; // output stays buffered until halt
+                    }
+                    if (action == InterruptCpu::Action::Deliver) {
+                        if constexpr (Trace::TEXT) std::cout << ">> irq " << line << " -> pc " << intr_.vector() << "\n";
+                        push(s, static_cast<i32>(line));
+                        intr_.enter(s.pc);
+                        s.pc = intr_.vector();
+                    }
+                }
+                if (s.pc >= program_.size()) [[unlikely]] {
+                    fault(s, TrapCode::PcOutOfRange, s.pc);
+                    if (enterTrapHandler(s)) continue;
+                    break;
+                }
+
+                TB& tb = getOrTranslateTB(s.pc, t);
+                t.tb(TraceKind::TbExec, tb.guest_pc, static_cast<u32>(tb.next_pc));
+
+                if constexpr (Trace::TEXT) {
+                    std::cout << ">> exec TB @pc=" << tb.guest_pc
+                        << " (next_pc=" << tb.next_pc
+                        << ", ver=" << tb.compiled_version << ")\n";
+                    std::cout.flush(); // keep trace lines and guest output in order
+                }
+
+                s.pc = tb.next_pc;       // emulate "pc update" at TB exit
+                if (tb.fault != TrapCode::None) [[unlikely]] fault(s, tb.fault, tb.guest_pc);
+                else if (tb.aot) execAot(s, *tb.aot);
+                else if (tb.jit) execJit(s, tb);
+                else tb.exec(s);         // run host code
+                if (s.trap.code != TrapCode::None) [[unlikely]] {
+                    // the ops before the faulting one ran, and it counts
+                    counts_.instructions += s.trap.pc - tb.guest_pc + 1;
+                    if (enterTrapHandler(s)) continue;
+                    break;
+                }
+                if (metrics_) {
+                    counts_.instructions += tb.insns;
+                    for (std::uint8_t op : tb.prims) ++counts_.prims[op];
+                    if (s.stack.size() > stack_hwm_) stack_hwm_ = s.stack.size();
+                }
+                if (countdown > tb.insns) countdown -= tb.insns;
+                else {
+                    intr_.overshoot(tb.insns - countdown);
+                    countdown = 0;
+                }
+                last_tb = tb.guest_pc;
+                last_tb_end = tb.guest_pc + tb.insns;
+
+                if constexpr (Trace::TEXT) {
+                    console_.flush();
+                    if (!s.stack.empty()) std::cout << "   tos=" << s.stack.back() << "\n";
+                    else std::cout << "   tos=<empty>\n";
+                }
+            }
+        }
+        catch (...) { // host errors only
+            publish(true);
+            throw;
+        }
+        intr_.saveCountdown(countdown);
+        if (s.trap.code != TrapCode::None) {
+            publish(true);
+            return;
+        }
+        publish(false);
+        console_.flush(); // halt: guest output is complete
+    }
+
+    VirtualConsole& console() { return console_; }
+
+    // Interrupts (interrupts.h) are checked at block boundaries through the
+    // controller's exit word; an Instructions timer counts whole blocks.
+    void attachInterrupts(InterruptController* irq, VirtualTimer* timer = nullptr) { intr_.attach(irq, timer); }
+
+    // Guest-pc sampling (profiler.h) at block boundaries: each sample names
+    // the block that just ran. Host-timer sampling needs the interrupt
+    // controller attached first.
+    void attachSampler(PcSampler* sampler) { intr_.attachSampler(sampler); }
+
+    // Runtime counters (metrics.h): block cache hits, misses, translations
+    // and invalidations, plus instructions and primitives per completed
+    // block (the stack high-water mark is sampled at block boundaries). Null
+    // detaches; without metrics the loop skips all of it on one branch per
+    // block.
+    void attachMetrics(VcpuMetrics* metrics) { metrics_ = metrics; }
+
+    // helpers to build encoded instructions (like assembler)
+    // constexpr: a bad immediate in a constant-initialized program fails the build
+    static constexpr i32 enc_pos_imm(i32 x) {
+        if (x < 0) throw std::runtime_error("use enc_neg_imm for negative");
+        u32 ux = static_cast<u32>(x);
+        if (ux > DATA_MASK) throw std::runtime_error("imm too large");
+        return static_cast<i32>((static_cast<u32>(Type::PosImm) << 30) | (ux & DATA_MASK));
+    }
+    static constexpr i32 enc_neg_imm(i32 x) { // x should be negative
+        if (x > 0) throw std::runtime_error("use enc_pos_imm for positive");
+        u32 mag = static_cast<u32>(-x);
+        if (mag > DATA_MASK) throw std::runtime_error("imm too large");
+        return static_cast<i32>((static_cast<u32>(Type::NegImm) << 30) | (mag & DATA_MASK));
+    }
+    static constexpr i32 enc_prim(Prim p) {
+        return static_cast<i32>((static_cast<u32>(Type::Prim) << 30) | (static_cast<u32>(p) & DATA_MASK));
+    }
+
+private:
+    static constexpr u32 TYPE_MASK = 0xC0000000u;
+    static constexpr u32 DATA_MASK = 0x3FFFFFFFu;
+
+    static Type getType(i32 ins) {
+        u32 u = static_cast<u32>(ins);
+        return static_cast<Type>((u & TYPE_MASK) >> 30);
+    }
+    static u32 getData(i32 ins) {
+        u32 u = static_cast<u32>(ins);
+        return (u & DATA_MASK);
+    }
+
+    // Record a guest trap for the instruction at `pc` and stop the block
+    // (the cold path).
+    [[gnu::cold]] [[gnu::noinline]] static void fault(State& s, TrapCode code, std::size_t pc) {
+        s.trap = GuestTrap{ code, pc };
+        s.running = false;
+    }
+
+    // Enter the guest trap handler for s.trap, if there is one to enter.
+    bool enterTrapHandler(State& s) {
+        if (!trap_vec_.take() || trap_vec_.entry >= program_.size()) return false;
+        const GuestTrap t = std::exchange(s.trap, GuestTrap{});
+        s.stack.clear();
+        push(s, static_cast<i32>(t.pc));
+        push(s, static_cast<i32>(t.code));
+        s.pc = trap_vec_.entry;
+        s.running = true;
+        return true;
+    }
+
+    // pop and top are unchecked; the ops check need(n) first.
+    static bool need(State& s, std::size_t n, std::size_t pc) {
+        if (s.stack.size() >= n) [[likely]] return true;
+        fault(s, TrapCode::StackUnderflow, pc);
+        return false;
+    }
+    static void push(State& s, i32 v) { s.stack.push_back(v); }
+    static i32 pop(State& s) {
+        i32 v = s.stack.back();
+        s.stack.pop_back();
+        return v;
+    }
+    static i32& top(State& s) { return s.stack.back(); }
+
+    template <class Trace>
+    TB& getOrTranslateTB(std::size_t pc, Trace& t) {
+        auto it = tb_cache_.find(pc);
+        if (it != tb_cache_.end() && it->second.compiled_version == program_version_) {
+            if (metrics_) VcpuMetrics::add(metrics_->tb_hits, 1);
+            t.tb(TraceKind::TbHit, pc);
+            if constexpr (Trace::TEXT) std::cout << "[TB HIT]  pc=" << pc << "\n";
+            return it->second;
+        }
+        t.tb(TraceKind::TbMiss, pc);
+        if constexpr (Trace::TEXT) std::cout << "[TB MISS] pc=" << pc << " -> translating...\n";
+        if (metrics_) VcpuMetrics::add(metrics_->tb_misses, 1);
+        TB tb = translateTB(pc);
+        if (metrics_) VcpuMetrics::add(metrics_->tb_translations, 1);
+        auto [ins_it, _] = tb_cache_.emplace(pc, std::move(tb));
+        return ins_it->second;
+    }
+
+    // One decoded guest instruction of a block, lowered to either backend.
+    struct MicroOp {
+        Prim op;    // Halt for a push when imm_push is set
+        bool imm_push = false;
+        i32 imm = 0;
+        std::size_t pc = 0; // guest pc, for traps
+    };
+
+    TB translateTB(std::size_t start_pc) {
+        TB tb;
+        tb.guest_pc = start_pc;
+        tb.compiled_version = program_version_;
+        if (const AotBlock* b = aot_ ? aot_->block(start_pc) : nullptr) {
+            tb.aot = b;
+            tb.insns = b->insns;
+            tb.next_pc = start_pc + b->insns;
+            tb.prims.assign(b->prims, b->prims + b->prim_count);
+            tb.debug = "AOT block, " + std::to_string(b->insns) + " insns\n";
+            return tb;
+        }
+        const std::vector<MicroOp> uops = decodeTB(tb);
+        if (tb.fault != TrapCode::None) return tb;
+
+        if (backend_ == Backend::CopyPatch) {
+            tb.jit = lowerJit(uops);
+            if (!tb.jit) { // code buffer full: drop every block, as QEMU's tb_flush does
+                flushTBs();
+                tb.jit = lowerJit(uops);
+                if (!tb.jit) throw std::runtime_error("TB does not fit in the JIT buffer");
+            }
+        }
+        else {
+            tb.exec = lowerClosures(uops);
+        }
+        return tb;
+    }
+
+    // Decode the block at tb.guest_pc and fill in its bookkeeping. The block
+    // ends before an instruction that does not decode, so that it traps at
+    // its own pc; at guest_pc itself the block is empty with tb.fault set.
+    std::vector<MicroOp> decodeTB(TB& tb) const {
+        std::vector<MicroOp> uops;
+
+        std::size_t pc = tb.guest_pc;
+        std::size_t insn_count = 0;
+        bool ended = false;
+        std::ptrdiff_t depth = 0, low = 0; // relative to the entry depth
+
+        tb.debug.clear();
+
+        while (!ended && pc < program_.size() && insn_count < max_tb_insns_) {
+            i32 ins = program_[pc];
+            Type typ = getType(ins);
+            u32 dat = getData(ins);
+
+            // This is the only "switch-heavy" part: translation.
+            switch (typ) {
+            case Type::PosImm:
+            case Type::NegImm: {
+                i32 imm = typ == Type::PosImm ? static_cast<i32>(dat) : -static_cast<i32>(dat);
+                uops.push_back({ Prim::Halt, true, imm, pc });
+                tb.debug += (imm >= 0 ? "PUSH +" : "PUSH ") + std::to_string(imm) + "\n";
+                tb.pushes++;
+                depth++;
+                break;
+            }
+            case Type::Prim: {
+                auto op = static_cast<Prim>(dat);
+                if (!known(op)) {
+                    undecodable(tb, TrapCode::BadPrimitive, insn_count);
+                    ended = true;
+                    continue;
+                }
+                tb.prims.push_back(static_cast<std::uint8_t>(dat & (VcpuMetrics::PRIMS - 1)));
+                switch (op) {
+                case Prim::Halt: tb.debug += "HALT\n"; ended = true; break; // stop TB at halt
+                case Prim::Add: tb.debug += "ADD\n"; break;
+                case Prim::Sub: tb.debug += "SUB\n"; break;
+                case Prim::Mul: tb.debug += "MUL\n"; break;
+                case Prim::Div: tb.debug += "DIV\n"; break;
+                case Prim::Print: tb.debug += "PRINT\n"; break;
+                case Prim::Flush: tb.debug += "FLUSH\n"; break;
+                case Prim::Vec: tb.debug += "VEC\n"; break;
+                default: tb.debug += "IRET\n"; ended = true; break; // the next pc is dynamic
+                }
+                if (op == Prim::Add || op == Prim::Sub || op == Prim::Mul || op == Prim::Div) { // pops two, pushes one
+                    low = std::min(low, depth - 2);
+                    depth--;
+                }
+                else if (op == Prim::Vec || op == Prim::Iret) {
+                    low = std::min(low, --depth);
+                }
+                uops.push_back({ op, false, 0, pc });
+                break;
+            }
+            case Type::Undef:
+            default:
+                undecodable(tb, TrapCode::BadInstruction, insn_count);
+                ended = true;
+                continue;
+            }
+            pc++; insn_count++;
+
+            // In real TCG, TB also often ends at control-flow boundaries.
+            // Here we only end on HALT, IRET or max_tb_insns.
+        }
+
+        tb.next_pc = pc;
+        tb.insns = insn_count;
+        tb.need = static_cast<std::size_t>(-low);
+        return uops;
+    }
+
+    static constexpr bool known(Prim op) {
+        return op <= Prim::Flush || op == Prim::Vec || op == Prim::Iret;
+    }
+
+    // An undecodable instruction after `insns` good ones in the block.
+    static void undecodable(TB& tb, TrapCode code, std::size_t insns) {
+        if (insns == 0) tb.fault = code;
+        tb.debug += std::string(trapMessage(code)) + "\n";
+    }
+
+    // `push c; mul` or `push c; div` with c != 0, which lower to one
+    // strength-reduced op (strength_reduce.h) instead of two.
+    bool fusesConst(const std::vector<MicroOp>& uops, std::size_t i) const {
+        if (!strength_reduce_ || !uops[i].imm_push || i + 1 >= uops.size() || uops[i + 1].imm_push) return false;
+        const Prim op = uops[i + 1].op;
+        return op == Prim::Mul || (op == Prim::Div && uops[i].imm != 0); // x / 0 keeps its trap
+    }
+
+    // Each op is a lambda that mutates VM state (like TCG IR lowered to host)
+    std::function<void(State&)> lowerClosures(const std::vector<MicroOp>& uops) {
+        std::vector<std::function<void(State&)>> ops;
+        for (std::size_t i = 0; i < uops.size(); ++i) {
+            const MicroOp& u = uops[i];
+            if (fusesConst(uops, i)) {
+                const MicroOp& op = uops[++i];
+                ops.push_back(op.op == Prim::Mul ? mulConst(u.imm, op.pc) : divConst(u.imm, op.pc));
+                continue;
+            }
+            if (u.imm_push) {
+                ops.emplace_back([imm = u.imm](State& s) { push(s, imm); });
+                continue;
+            }
+            switch (u.op) {
+            case Prim::Halt:
+                ops.emplace_back([](State& s) { s.running = false; });
+                break;
+            case Prim::Add:
+                ops.emplace_back([pc = u.pc](State& s) {
+                    if (!need(s, 2, pc)) return;
+                    i32 b = pop(s);
+                    i32 a = pop(s);
+                    push(s, a + b);
+                    });
+                break;
+            case Prim::Sub:
+                ops.emplace_back([pc = u.pc](State& s) {
+                    if (!need(s, 2, pc)) return;
+                    i32 b = pop(s);
+                    i32 a = pop(s);
+                    push(s, static_cast<i32>(static_cast<u32>(a) - static_cast<u32>(b)));
+                    });
+                break;
+            case Prim::Mul:
+                ops.emplace_back([pc = u.pc](State& s) {
+                    if (!need(s, 2, pc)) return;
+                    i32 b = pop(s);
+                    i32 a = pop(s);
+                    push(s, static_cast<i32>(static_cast<u32>(a) * static_cast<u32>(b)));
+                    });
+                break;
+            case Prim::Div:
+                ops.emplace_back([pc = u.pc](State& s) {
+                    if (!need(s, 2, pc)) return;
+                    i32 b = pop(s);
+                    i32 a = pop(s);
+                    if (b == 0) return fault(s, TrapCode::DivZero, pc);
+                    if (a == std::numeric_limits<i32>::min() && b == -1) return fault(s, TrapCode::DivOverflow, pc);
+                    push(s, a / b);
+                    });
+                break;
+            case Prim::Print:
+                ops.emplace_back([con = &console_](State& s) {
+                    if (s.stack.empty()) con->write("[print] <empty>\n");
+                    else con->printLine("[print] ", s.stack.back());
+                    });
+                break;
+            case Prim::Flush:
+                ops.emplace_back([con = &console_](State&) { con->flush(); });
+                break;
+            case Prim::Vec:
+                ops.emplace_back([this, pc = u.pc](State& s) {
+                    if (!need(s, 1, pc)) return;
+                    const i32 target = pop(s);
+                    if (target < 0 || static_cast<std::size_t>(target) >= program_.size()) {
+                        return fault(s, TrapCode::BadVector, pc);
+                    }
+                    intr_.installVector(static_cast<std::size_t>(target));
+                    });
+                break;
+            default: // Iret
+                ops.emplace_back([this, pc = u.pc](State& s) {
+                    if (!need(s, 1, pc)) return;
+                    pop(s);
+                    if (!intr_.inHandler()) return fault(s, TrapCode::BadIret, pc);
+                    s.pc = intr_.leave();
+                    });
+                break;
+            }
+        }
+
+        // "compile": fuse ops into one callable (host code); halt ends a
+        // block anyway, so the running check only costs on a trap
+        return [ops = std::move(ops)](State& s) {
+            for (auto& f : ops) {
+                f(s);
+                if (!s.running) [[unlikely]] return;
+            }
+            };
+    }
+
+    // x * c on the top of the stack. Negation is (r ^ m) - m with m all ones.
+    // `pc` is the mul's, whose underflow the fused op reports.
+    static std::function<void(State&)> mulConst(i32 c, std::size_t pc) {
+        using K = MulPlan::Kind;
+        const MulPlan p = MulPlan::make(c);
+        const u32 m = p.neg ? ~0u : 0u;
+        switch (p.kind) {
+        case K::Zero:
+            return [pc](State& s) {
+                if (need(s, 1, pc)) top(s) = 0;
+                };
+        case K::Identity: return [pc](State& s) { need(s, 1, pc); };
+        case K::Neg:
+            return [pc](State& s) {
+                if (!need(s, 1, pc)) return;
+                i32& x = top(s);
+                x = static_cast<i32>(0u - static_cast<u32>(x));
+                };
+        case K::Shift:
+            return [a = p.a, m, pc](State& s) {
+                if (!need(s, 1, pc)) return;
+                i32& x = top(s);
+                x = static_cast<i32>(((static_cast<u32>(x) << a) ^ m) - m);
+                };
+        case K::ShiftAdd:
+            return [a = p.a, b = p.b, m, pc](State& s) {
+                if (!need(s, 1, pc)) return;
+                i32& x = top(s);
+                const u32 u = static_cast<u32>(x);
+                x = static_cast<i32>((((u << a) + (u << b)) ^ m) - m);
+                };
+        case K::ShiftSub:
+            return [a = p.a, b = p.b, m, pc](State& s) {
+                if (!need(s, 1, pc)) return;
+                i32& x = top(s);
+                const u32 u = static_cast<u32>(x);
+                x = static_cast<i32>((((u << a) - (u << b)) ^ m) - m);
+                };
+        default:
+            return [c, pc](State& s) {
+                if (!need(s, 1, pc)) return;
+                i32& x = top(s);
+                x = static_cast<i32>(static_cast<u32>(x) * static_cast<u32>(c));
+                };
+        }
+    }
+
+    // x / c on the top of the stack, c != 0. Only c == -1 keeps a check; an
+    // immediate is below 2^30 in magnitude, so the quotient negates safely.
+    // `pc` is the div's.
+    static std::function<void(State&)> divConst(i32 c, std::size_t pc) {
+        using K = DivPlan::Kind;
+        const DivPlan p = DivPlan::make(c);
+        const i32 m = p.neg ? -1 : 0;
+        switch (p.kind) {
+        case K::Identity: return [pc](State& s) { need(s, 1, pc); };
+        case K::NegOne:
+            return [pc](State& s) {
+                if (!need(s, 1, pc)) return;
+                i32& x = top(s);
+                if (x == std::numeric_limits<i32>::min()) {
+                    pop(s);
+                    return fault(s, TrapCode::DivOverflow, pc);
+                }
+                x = -x;
+                };
+        case K::Pow2:
+            return [k = p.shift, bias = (1u << p.shift) - 1, m, pc](State& s) {
+                if (!need(s, 1, pc)) return;
+                i32& x = top(s);
+                const i32 q = static_cast<i32>(static_cast<u32>(x) + (static_cast<u32>(x >> 31) & bias)) >> k;
+                x = (q ^ m) - m;
+                };
+        default:
+            if (p.add) {
+                return [magic = std::int64_t(p.magic), k = p.shift, m, pc](State& s) {
+                    if (!need(s, 1, pc)) return;
+                    i32& x = top(s);
+                    const i32 q = ((static_cast<i32>((magic * x) >> 32) + x) >> k) - (x >> 31);
+                    x = (q ^ m) - m;
+                    };
+            }
+            return [magic = std::int64_t(p.magic), k = p.shift, m, pc](State& s) {
+                if (!need(s, 1, pc)) return;
+                i32& x = top(s);
+                const i32 q = (static_cast<i32>((magic * x) >> 32) >> k) - (x >> 31);
+                x = (q ^ m) - m;
+                };
+        }
+    }
+
+    // Copy one stencil per op (push imm fused with a following add, sub, mul
+    // or div) and patch the holes; null if the code buffer is full. The stencils do not check for
+    // underflow: execJit checks the block's `need` once on entry.
+    TcgJitEntry lowerJit(const std::vector<MicroOp>& uops) {
+#if TCG_JIT_SUPPORTED
+        namespace st = tcg_stencils;
+        jit_->begin();
+        for (std::size_t i = 0; i < uops.size(); ++i) {
+            const MicroOp& u = uops[i];
+            if (fusesConst(uops, i)) {
+                const MicroOp& op = uops[++i];
+                if (op.op == Prim::Mul) jitMulConst(u.imm);
+                else jitDivConst(u.imm, op.pc);
+                continue;
+            }
+            if (u.imm_push) {
+                const Prim next = i + 1 < uops.size() && !uops[i + 1].imm_push ? uops[i + 1].op : Prim::Halt;
+                if (next == Prim::Add || next == Prim::Sub) {
+                    jit_->emit(st::add_imm, next == Prim::Add ? u.imm : -u.imm);
+                    ++i;
+                }
+                else {
+                    jit_->emit(st::push, u.imm);
+                }
+                continue;
+            }
+            switch (u.op) {
+            case Prim::Halt: jit_->emit(st::halt); break;
+            case Prim::Add: jit_->emit(st::add); break;
+            case Prim::Sub: jit_->emit(st::sub); break;
+            case Prim::Mul: jit_->emit(st::mul); break;
+            case Prim::Div: jit_->emit(st::div, guestPc(u)); break;
+            case Prim::Print: jit_->emit(st::print); break;
+            case Prim::Flush: jit_->emit(st::flush); break;
+            case Prim::Vec: jit_->emit(st::vec, guestPc(u)); break;
+            default: jit_->emit(st::iret, guestPc(u)); break;
+            }
+        }
+        return jit_->end();
+#else
+        (void)uops;
+        return nullptr;
+#endif
+    }
+
+#if TCG_JIT_SUPPORTED
+    // The operand of a stencil that can trap (TcgJitFrame::fault_pc).
+    static i32 guestPc(const MicroOp& u) { return static_cast<i32>(u.pc); }
+
+    // x86 imul by an immediate is one instruction, so only a power of two
+    // beats it here (the shift-and-add plans are for the closures).
+    void jitMulConst(i32 c) {
+        namespace st = tcg_stencils;
+        const MulPlan p = MulPlan::make(c);
+        switch (p.kind) {
+        case MulPlan::Kind::Identity: break;
+        case MulPlan::Kind::Neg: jit_->emit(st::neg); break;
+        case MulPlan::Kind::Shift:
+            jit_->emit(st::shl_imm, p.a);
+            if (p.neg) jit_->emit(st::neg);
+            break;
+        default: jit_->emit(st::mul_imm, c); break;
+        }
+    }
+
+    void jitDivConst(i32 c, std::size_t pc) {
+        namespace st = tcg_stencils;
+        const DivPlan p = DivPlan::make(c);
+        switch (p.kind) {
+        case DivPlan::Kind::Identity: return;
+        case DivPlan::Kind::NegOne: jit_->emit(st::div_neg1, static_cast<i32>(pc)); return;
+        case DivPlan::Kind::Pow2: jit_->emit(st::div_pow2, p.shift, static_cast<i32>((1u << p.shift) - 1)); break;
+        default: jit_->emit(p.add ? st::div_magic_add : st::div_magic, p.magic, p.shift); break;
+        }
+        if (p.neg) jit_->emit(st::neg);
+    }
+#endif
+
+    // The stack is grown by the block's pushes up front and trimmed to the
+    // exit sp after, so stencils store through a raw pointer. A block that
+    // would underflow runs as closures instead, which fault at the same op
+    // with the same state as the other backend.
+    void execJit(State& s, TB& tb) {
+        const std::size_t depth = s.stack.size();
+        if (depth < tb.need) {
+            if (!tb.exec) {
+                TB scratch;
+                scratch.guest_pc = tb.guest_pc;
+                tb.exec = lowerClosures(decodeTB(scratch));
+            }
+            tb.exec(s);
+            return;
+        }
+        s.stack.resize(depth + tb.pushes);
+        i32* base = s.stack.data();
+        TcgJitFrame f;
+        f.next_pc = s.pc;
+        f.vm = this;
+        const u32 status = tb.jit(&f, base + depth, base);
+        s.stack.resize(static_cast<std::size_t>(f.sp - base));
+        s.pc = f.next_pc;
+        if (!f.running) s.running = false;
+        switch (status) {
+        case TCG_JIT_OK: return;
+        case TCG_JIT_BAD_VECTOR: return fault(s, TrapCode::BadVector, f.fault_pc);
+        case TCG_JIT_BAD_IRET: return fault(s, TrapCode::BadIret, f.fault_pc);
+        case TCG_JIT_DIV_ZERO: return fault(s, TrapCode::DivZero, f.fault_pc);
+        case TCG_JIT_DIV_OVERFLOW: return fault(s, TrapCode::DivOverflow, f.fault_pc);
+        default: std::rethrow_exception(std::exchange(jit_error_, nullptr));
+        }
+    }
+
+    // A compiled block of the AOT module. Its image verified, so it never
+    // underflows; the stack only has to have room for its pushes. A division
+    // trap leaves the operands on the stack (aot_abi.h).
+    void execAot(State& s, const AotBlock& b) {
+        const std::size_t depth = s.stack.size();
+        s.stack.resize(depth + b.grow);
+        AotFrame f;
+        f.sp = s.stack.data() + depth;
+        f.next_pc = s.pc;
+        f.vm = this;
+        f.host = &aotHost();
+        u32 status = AOT_OK;
+        try {
+            status = b.fn(&f);
+        }
+        catch (...) {
+            s.stack.resize(depth);
+            throw;
+        }
+        s.stack.resize(static_cast<std::size_t>(f.sp - s.stack.data()));
+        s.pc = f.next_pc;
+        if (status != AOT_OK) [[unlikely]] { // f.next_pc is the division
+            return fault(s, status == AOT_DIV_ZERO ? TrapCode::DivZero : TrapCode::DivOverflow, f.next_pc);
+        }
+        if (!f.running) s.running = false;
+    }
+
+    static constexpr u32 AOT_PRIMS = (1u << 0) | (1u << 1) | (1u << 2) | (1u << 3) | (1u << 4) | (1u << 5) | (1u << 6) |
+                                     (1u << 9) | (1u << 10);
+
+    static const AotHost& aotHost() {
+        static const AotHost host{ &aotPrint, &aotFlush, &aotVec, &aotIret };
+        return host;
+    }
+    static void aotPrint(AotFrame* f, i32 v) { static_cast<MiniTCGVM*>(f->vm)->console_.printLine("[print] ", v); }
+    static void aotFlush(AotFrame* f) { static_cast<MiniTCGVM*>(f->vm)->console_.flush(); }
+    static void aotVec(AotFrame* f, i32 target) {
+        MiniTCGVM& vm = *static_cast<MiniTCGVM*>(f->vm);
+        if (target < 0 || static_cast<std::size_t>(target) >= vm.program_.size()) {
+            throw std::runtime_error("vec: handler outside the program");
+        }
+        vm.intr_.installVector(static_cast<std::size_t>(target));
+    }
+    static void aotIret(AotFrame* f) { f->next_pc = static_cast<MiniTCGVM*>(f->vm)->intr_.leave(); }
+
+    // Runs a helper body, parking any exception for execJit to rethrow.
+    template <class F>
+    static u32 jitGuard(TcgJitFrame* f, F&& body) {
+        try {
+            return body(*static_cast<MiniTCGVM*>(f->vm));
+        }
+        catch (...) {
+            static_cast<MiniTCGVM*>(f->vm)->jit_error_ = std::current_exception();
+            return TCG_JIT_HOST_ERROR;
+        }
+    }
+
+    // Helpers called from the stencils (tcg_jit_abi.h)
+    static u32 jitPrint(TcgJitFrame* f, const i32* sp, const i32* base) {
+        return jitGuard(f, [&](MiniTCGVM& vm) {
+            if (sp == base) vm.console_.write("[print] <empty>\n");
+            else vm.console_.printLine("[print] ", sp[-1]);
+            return u32(TCG_JIT_OK);
+            });
+    }
+    static u32 jitFlush(TcgJitFrame* f, const i32*, const i32*) {
+        return jitGuard(f, [](MiniTCGVM& vm) {
+            vm.console_.flush();
+            return u32(TCG_JIT_OK);
+            });
+    }
+    static u32 jitVec(TcgJitFrame* f, const i32* sp, const i32*) {
+        return jitGuard(f, [&](MiniTCGVM& vm) {
+            const i32 target = sp[0];
+            if (target < 0 || static_cast<std::size_t>(target) >= vm.program_.size()) return u32(TCG_JIT_BAD_VECTOR);
+            vm.intr_.installVector(static_cast<std::size_t>(target));
+            return u32(TCG_JIT_OK);
+            });
+    }
+    static u32 jitIret(TcgJitFrame* f, const i32*, const i32*) {
+        return jitGuard(f, [&](MiniTCGVM& vm) {
+            if (!vm.intr_.inHandler()) return u32(TCG_JIT_BAD_IRET);
+            f->next_pc = vm.intr_.leave();
+            return u32(TCG_JIT_OK);
+            });
+    }
+
+    void applyPatch(std::size_t index, i32 new_insn) {
+        program_[index] = new_insn;
+        program_version_++;
+        if (aot_ && !aot_->matches(program_)) aot_ = nullptr;
+        // in real QEMU you might invalidate only TBs on the affected page/range
+        flushTBs();
+    }
+
+    void flushTBs() {
+        if (metrics_) VcpuMetrics::add(metrics_->tb_invalidations, tb_cache_.size());
+        tb_cache_.clear();
+        if (jit_) jit_->reset();
+    }
+
+private:
+    std::vector<i32> program_;
+    u32 program_version_ = 1;
+
+    State state_;
+    bool suspended_ = false; // resume state_ on the next run
+
+    std::unordered_map<std::size_t, TB> tb_cache_;
+    std::size_t max_tb_insns_;
+
+    Backend backend_ = Backend::Closures;
+    bool strength_reduce_ = true;
+    std::unique_ptr<TcgJit> jit_; // created by the first setBackend(CopyPatch)
+    std::exception_ptr jit_error_; // thrown by a helper under JIT code
+    const AotLibrary* aot_ = nullptr;
+
+    VirtualConsole console_;
+
+    InterruptCpu intr_;
+
+    TrapVector trap_vec_;
+
+    VcpuMetrics* metrics_ = nullptr;
+    VcpuMetrics::Local counts_;
+    std::size_t stack_hwm_ = 0; // at block boundaries
+
+    void publish(bool trap) {
+        if (!metrics_) return;
+        metrics_->flush(counts_);
+        VcpuMetrics::raise(metrics_->stack_hwm, stack_hwm_);
+        if (trap) VcpuMetrics::add(metrics_->traps, 1);
+    }
+};
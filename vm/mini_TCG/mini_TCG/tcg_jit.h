@@ -0,0 +1,181 @@
+// tcg_jit.h
+// Copy-and-patch code generation for MiniTCGVM: a translated block is the
+// precompiled stencils of its micro-ops (tcg_stencils.h) copied back to back
+// into an executable buffer, with each stencil's immediate and continuation
+// holes patched in. No instruction encoder; the compiler that built the
+// stencils did that once.
+//
+//   TcgJit jit;                      // maps the code buffer
+//   jit.setHelper(tcg_stencils::Helper::print, &my_print);
+//   jit.begin();
+//   jit.emit(tcg_stencils::push, 5);
+//   jit.emit(tcg_stencils::add);
+//   TcgJitEntry fn = jit.end();      // null: buffer full, reset() and retry
+//
+// The buffer is one memfd mapped twice, writable for the emitter and
+// executable for the blocks, so no page is ever writable and executable
+// through the same mapping and no mprotect is needed per block. Blocks are
+// never freed one by one: reset() drops them all, as on a TB cache flush.
+//
+// Helper calls in the stencils are bare direct calls, patched to a veneer
+// per helper at the start of the buffer. The veneer saves the registers the
+// block lives in, calls the helper wherever it is, and ends the block on a
+// fault, so a call site costs 5 bytes and the only indirect branch is one
+// shared, predicted site per helper (see tools/tcg_stencils.cpp for why that
+// matters).
+//
+// x86-64 Linux only (the stencils are SysV x86-64 code); elsewhere
+// available() is false and MiniTCGVM keeps the closure backend.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "tcg_jit_abi.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define TCG_JIT_SUPPORTED 1
+#include <cerrno>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "tcg_stencils.h"
+#else
+#define TCG_JIT_SUPPORTED 0
+#endif
+
+class TcgJit {
+public:
+    explicit TcgJit(std::size_t capacity = 64u << 20) {
+#if TCG_JIT_SUPPORTED
+        const long page = ::sysconf(_SC_PAGESIZE);
+        capacity_ = (capacity + static_cast<std::size_t>(page) - 1) & ~(static_cast<std::size_t>(page) - 1);
+        const int fd = ::memfd_create("tcg-jit", MFD_CLOEXEC);
+        if (fd < 0 || ::ftruncate(fd, static_cast<off_t>(capacity_)) != 0) {
+            error_ = std::string("memfd: ") + std::strerror(errno);
+            if (fd >= 0) ::close(fd);
+            return;
+        }
+        void* rw = ::mmap(nullptr, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        void* rx = ::mmap(nullptr, capacity_, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+        const int err = errno;
+        ::close(fd);
+        if (rw == MAP_FAILED || rx == MAP_FAILED) {
+            error_ = std::string("mmap: ") + std::strerror(err);
+            if (rw != MAP_FAILED) ::munmap(rw, capacity_);
+            if (rx != MAP_FAILED) ::munmap(rx, capacity_);
+            return;
+        }
+        rw_ = static_cast<std::uint8_t*>(rw);
+        rx_ = static_cast<std::uint8_t*>(rx);
+        used_ = block_ = VENEERS;
+#else
+        (void)capacity;
+        error_ = "copy-and-patch JIT needs x86-64 Linux";
+#endif
+    }
+
+    ~TcgJit() {
+#if TCG_JIT_SUPPORTED
+        if (rw_) ::munmap(rw_, capacity_);
+        if (rx_) ::munmap(rx_, capacity_);
+#endif
+    }
+
+    TcgJit(const TcgJit&) = delete;
+    TcgJit& operator=(const TcgJit&) = delete;
+
+    bool available() const { return rx_ != nullptr; }
+    // why the JIT is not available, empty if it is
+    const std::string& error() const { return error_; }
+
+    std::size_t used() const { return used_; }
+    std::size_t capacity() const { return capacity_; }
+
+    // Drop every block (helpers stay bound). Entries returned so far must
+    // not be called again.
+    void reset() { used_ = block_ = rx_ ? VENEERS : 0; }
+
+#if TCG_JIT_SUPPORTED
+    using Stencil = tcg_stencils::Stencil;
+
+    // Bind helper `h` before emitting a stencil that calls it: writes its
+    // veneer, the `veneer` stencil with the helper's address patched in.
+    void setHelper(tcg_stencils::Helper h, TcgJitHelperFn fn) {
+        const tcg_stencils::Stencil& st = tcg_stencils::veneer;
+        std::uint8_t* v = rw_ + (veneer(h) - rx_);
+        std::memcpy(v, st.code, st.size);
+        for (std::uint8_t i = 0; i < st.hole_count; ++i) {
+            const std::uint64_t target = reinterpret_cast<std::uint64_t>(fn) + std::uint64_t(st.holes[i].addend);
+            std::memcpy(v + st.holes[i].offset, &target, sizeof(target)); // only Address holes
+        }
+    }
+
+    void begin() {
+        block_ = used_;
+        full_ = false;
+    }
+
+    // Append one stencil. Every stencil but the last is followed by another,
+    // so its trailing jump to the continuation is dropped and the code falls
+    // through; a continuation hole in the middle of the stencil (ahead of a
+    // cold path) is patched to the same place.
+    void emit(const Stencil& st, std::int32_t operand = 0, std::int32_t operand2 = 0) {
+        if (full_ || capacity_ - used_ < st.size) {
+            full_ = true;
+            return;
+        }
+        std::uint8_t* w = rw_ + used_;
+        std::memcpy(w, st.code, st.body);
+        const std::uint8_t* next = rx_ + used_ + st.body;
+        for (std::uint8_t i = 0; i < st.hole_count; ++i) {
+            const tcg_stencils::Hole& h = st.holes[i];
+            if (h.offset >= st.body) continue; // the dropped trailing jump
+            const std::uint8_t* p = rx_ + used_ + h.offset;
+            std::int64_t v;
+            switch (h.kind) {
+            case tcg_stencils::HoleKind::Operand: v = std::int64_t(operand) + h.addend; break;  // S + A
+            case tcg_stencils::HoleKind::Operand2: v = std::int64_t(operand2) + h.addend; break;
+            case tcg_stencils::HoleKind::Continue: v = (next - p) + h.addend; break;            // S + A - P
+            case tcg_stencils::HoleKind::Call: v = (veneer(h.helper) - p) + h.addend; break;
+            default: continue; // Address: veneer only
+            }
+            const std::int32_t v32 = static_cast<std::int32_t>(v);
+            std::memcpy(w + h.offset, &v32, sizeof(v32));
+        }
+        used_ += st.body;
+    }
+
+    // Close the block with the exit stencil; null if the buffer ran out,
+    // in which case nothing of the block is kept.
+    TcgJitEntry end() {
+        emit(tcg_stencils::block_exit);
+        if (full_) {
+            used_ = block_;
+            return nullptr;
+        }
+        used_ = (used_ + 15) & ~std::size_t(15); // next block starts aligned
+        if (used_ > capacity_) used_ = capacity_;
+        return reinterpret_cast<TcgJitEntry>(rx_ + block_);
+    }
+#endif
+
+private:
+#if TCG_JIT_SUPPORTED
+    static constexpr std::size_t VENEER_SIZE = (tcg_stencils::veneer.size + 15) & ~std::size_t(15);
+    static constexpr std::size_t VENEERS = VENEER_SIZE * static_cast<std::size_t>(tcg_stencils::Helper::COUNT);
+
+    const std::uint8_t* veneer(tcg_stencils::Helper h) const { return rx_ + VENEER_SIZE * static_cast<std::size_t>(h); }
+#else
+    static constexpr std::size_t VENEERS = 0;
+#endif
+
+    std::uint8_t* rw_ = nullptr; // writable view
+    std::uint8_t* rx_ = nullptr; // executable view of the same pages
+    std::size_t capacity_ = 0;
+    std::size_t used_ = 0;
+    std::size_t block_ = 0;     // start of the block being emitted
+    bool full_ = false;
+    std::string error_;
+};
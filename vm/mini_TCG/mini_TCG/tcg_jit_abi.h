@@ -0,0 +1,43 @@
+// tcg_jit_abi.h
+// What the copy-and-patch stencils (tools/tcg_stencils.cpp) and the JIT
+// backend (tcg_jit.h) agree on. Plain C layout: the stencils are compiled
+// separately, and their machine code is pasted into tcg_stencils.h.
+//
+// A translated block is a chain of stencils entered as a TcgJitEntry. The
+// guest stack pointer and stack base stay in argument registers across the
+// chain (each stencil tail-calls the next with the same signature); only the
+// exit stencil and the fault paths store sp back into the frame. Stencils do
+// not check for underflow: the block's stack need is checked once on entry.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+struct TcgJitFrame {
+    std::int32_t* sp = nullptr;     // out: guest stack pointer at block exit
+    std::uint32_t running = 1;      // cleared by halt
+    std::uint32_t fault_pc = 0;     // out: guest pc of a trapping op (its operand)
+    std::size_t next_pc = 0;        // in: fall-through pc; iret overwrites it
+    void* vm = nullptr;             // the MiniTCGVM, for the helpers
+};
+
+enum TcgJitStatus : std::uint32_t {
+    TCG_JIT_OK = 0,
+    // all but TCG_JIT_HOST_ERROR are guest traps (trap.h) at f->fault_pc
+    TCG_JIT_BAD_VECTOR = 1, // vec target outside the program
+    TCG_JIT_BAD_IRET = 2,   // iret outside an interrupt handler
+    TCG_JIT_HOST_ERROR = 3, // a helper caught an exception; the VM rethrows it
+    TCG_JIT_DIV_ZERO = 4,
+    TCG_JIT_DIV_OVERFLOW = 5, // INT_MIN / -1
+};
+
+// Block entry: sp is one past the top of the guest stack, base its bottom.
+using TcgJitEntry = std::uint32_t (*)(TcgJitFrame* f, std::int32_t* sp, std::int32_t* base);
+
+// Host services a stencil cannot do inline, called as _JIT_CALL_<name> from
+// the stencils and bound with TcgJit::setHelper. All share one signature:
+// sp is the guest stack pointer after the op's pops (vec and iret find the
+// popped value at sp[0]). Each returns a TcgJitStatus; anything but
+// TCG_JIT_OK ends the block with f->sp stored. They must not throw: the
+// pasted code has no unwind information, so an exception is parked in the
+// VM and reported as TCG_JIT_HOST_ERROR.
+using TcgJitHelperFn = std::uint32_t (*)(TcgJitFrame* f, const std::int32_t* sp, const std::int32_t* base);
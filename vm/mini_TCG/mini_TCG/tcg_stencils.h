@@ -0,0 +1,243 @@
+// tcg_stencils.h
+// Generated by tools/gen_stencils from tools/tcg_stencils.cpp; do not edit.
+// x86-64 SysV machine code for the copy-and-patch backend (tcg_jit.h).
+#pragma once
+#include <cstdint>
+
+namespace tcg_stencils {
+
+enum class HoleKind : std::uint8_t {
+    Operand,  // absolute 32-bit: the op's immediate
+    Operand2, // absolute 32-bit: its second immediate
+    Continue, // jmp rel32 to the next stencil
+    Call,     // call rel32 to a helper's veneer
+    Address,  // absolute 64-bit: the helper (veneer only)
+};
+
+enum class Helper : std::uint8_t { flush, iret, print, vec, COUNT };
+
+struct Hole {
+    std::uint16_t offset;
+    HoleKind kind;
+    std::int32_t addend;
+    Helper helper; // Call holes
+};
+
+struct Stencil {
+    const std::uint8_t* code;
+    std::uint16_t size;
+    std::uint16_t body; // size without a trailing jmp to the next stencil
+    const Hole* holes;
+    std::uint8_t hole_count;
+};
+
+inline constexpr std::uint8_t veneer_code[39] = {
+    0x57, 0x56, 0x52, 0x48, 0x83, 0xec, 0x08, 0x48, 0xb8, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0xd0, 0x48, 0x83, 0xc4, 0x08, 0x5a,
+    0x5e, 0x5f, 0x85, 0xc0, 0x75, 0x01, 0xc3, 0x48, 0x89, 0x37, 0x48, 0x83,
+    0xc4, 0x08, 0xc3
+};
+inline constexpr Hole veneer_holes[1] = {
+    { 9, HoleKind::Address, 0, Helper::COUNT }
+};
+inline constexpr Stencil veneer = { veneer_code, 39, 39, veneer_holes, 1 };
+
+inline constexpr std::uint8_t push_code[17] = {
+    0xb8, 0x00, 0x00, 0x00, 0x00, 0x48, 0x83, 0xc6, 0x04, 0x89, 0x46, 0xfc,
+    0xe9, 0x00, 0x00, 0x00, 0x00
+};
+inline constexpr Hole push_holes[2] = {
+    { 1, HoleKind::Operand, 0, Helper::COUNT },
+    { 13, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil push = { push_code, 17, 12, push_holes, 2 };
+
+inline constexpr std::uint8_t add_code[15] = {
+    0x8b, 0x46, 0xfc, 0x01, 0x46, 0xf8, 0x48, 0x83, 0xee, 0x04, 0xe9, 0x00,
+    0x00, 0x00, 0x00
+};
+inline constexpr Hole add_holes[1] = {
+    { 11, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil add = { add_code, 15, 10, add_holes, 1 };
+
+inline constexpr std::uint8_t add_imm_code[13] = {
+    0xb8, 0x00, 0x00, 0x00, 0x00, 0x01, 0x46, 0xfc, 0xe9, 0x00, 0x00, 0x00,
+    0x00
+};
+inline constexpr Hole add_imm_holes[2] = {
+    { 1, HoleKind::Operand, 0, Helper::COUNT },
+    { 9, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil add_imm = { add_imm_code, 13, 8, add_imm_holes, 2 };
+
+inline constexpr std::uint8_t sub_code[15] = {
+    0x8b, 0x46, 0xfc, 0x29, 0x46, 0xf8, 0x48, 0x83, 0xee, 0x04, 0xe9, 0x00,
+    0x00, 0x00, 0x00
+};
+inline constexpr Hole sub_holes[1] = {
+    { 11, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil sub = { sub_code, 15, 10, sub_holes, 1 };
+
+inline constexpr std::uint8_t mul_code[19] = {
+    0x8b, 0x46, 0xf8, 0x0f, 0xaf, 0x46, 0xfc, 0x48, 0x83, 0xee, 0x04, 0x89,
+    0x46, 0xfc, 0xe9, 0x00, 0x00, 0x00, 0x00
+};
+inline constexpr Hole mul_holes[1] = {
+    { 15, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil mul = { mul_code, 19, 14, mul_holes, 1 };
+
+inline constexpr std::uint8_t div_code[93] = {
+    0x8b, 0x4e, 0xfc, 0x8b, 0x46, 0xf8, 0x49, 0x89, 0xd0, 0x85, 0xc9, 0x74,
+    0x3b, 0x3d, 0x00, 0x00, 0x00, 0x80, 0x75, 0x1c, 0x83, 0xf9, 0xff, 0x75,
+    0x17, 0x48, 0x83, 0xee, 0x08, 0xb8, 0x00, 0x00, 0x00, 0x00, 0x89, 0x47,
+    0x0c, 0xb8, 0x05, 0x00, 0x00, 0x00, 0x48, 0x89, 0x37, 0xc3, 0x66, 0x90,
+    0x99, 0x48, 0x83, 0xee, 0x04, 0xf7, 0xf9, 0x4c, 0x89, 0xc2, 0x89, 0x46,
+    0xfc, 0xe9, 0x00, 0x00, 0x00, 0x00, 0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00,
+    0x48, 0x83, 0xee, 0x08, 0xb8, 0x00, 0x00, 0x00, 0x00, 0x89, 0x47, 0x0c,
+    0xb8, 0x04, 0x00, 0x00, 0x00, 0x48, 0x89, 0x37, 0xc3
+};
+inline constexpr Hole div_holes[3] = {
+    { 30, HoleKind::Operand, 0, Helper::COUNT },
+    { 77, HoleKind::Operand, 0, Helper::COUNT },
+    { 62, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil div = { div_code, 93, 93, div_holes, 3 };
+
+inline constexpr std::uint8_t mul_imm_code[17] = {
+    0xb8, 0x00, 0x00, 0x00, 0x00, 0x0f, 0xaf, 0x46, 0xfc, 0x89, 0x46, 0xfc,
+    0xe9, 0x00, 0x00, 0x00, 0x00
+};
+inline constexpr Hole mul_imm_holes[2] = {
+    { 1, HoleKind::Operand, 0, Helper::COUNT },
+    { 13, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil mul_imm = { mul_imm_code, 17, 12, mul_imm_holes, 2 };
+
+inline constexpr std::uint8_t shl_imm_code[15] = {
+    0xb8, 0x00, 0x00, 0x00, 0x00, 0x8d, 0x08, 0xd3, 0x66, 0xfc, 0xe9, 0x00,
+    0x00, 0x00, 0x00
+};
+inline constexpr Hole shl_imm_holes[2] = {
+    { 1, HoleKind::Operand, 0, Helper::COUNT },
+    { 11, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil shl_imm = { shl_imm_code, 15, 10, shl_imm_holes, 2 };
+
+inline constexpr std::uint8_t neg_code[8] = {
+    0xf7, 0x5e, 0xfc, 0xe9, 0x00, 0x00, 0x00, 0x00
+};
+inline constexpr Hole neg_holes[1] = {
+    { 4, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil neg = { neg_code, 8, 3, neg_holes, 1 };
+
+inline constexpr std::uint8_t div_neg1_code[45] = {
+    0x8b, 0x46, 0xfc, 0x3d, 0x00, 0x00, 0x00, 0x80, 0x74, 0x0e, 0xf7, 0xd8,
+    0x89, 0x46, 0xfc, 0xe9, 0x00, 0x00, 0x00, 0x00, 0x0f, 0x1f, 0x40, 0x00,
+    0x48, 0x83, 0xee, 0x04, 0xb8, 0x00, 0x00, 0x00, 0x00, 0x89, 0x47, 0x0c,
+    0xb8, 0x05, 0x00, 0x00, 0x00, 0x48, 0x89, 0x37, 0xc3
+};
+inline constexpr Hole div_neg1_holes[2] = {
+    { 29, HoleKind::Operand, 0, Helper::COUNT },
+    { 16, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil div_neg1 = { div_neg1_code, 45, 45, div_neg1_holes, 2 };
+
+inline constexpr std::uint8_t div_pow2_code[34] = {
+    0x8b, 0x4e, 0xfc, 0x41, 0xb9, 0x00, 0x00, 0x00, 0x00, 0x89, 0xc8, 0xc1,
+    0xf8, 0x1f, 0x44, 0x21, 0xc8, 0x01, 0xc8, 0xb9, 0x00, 0x00, 0x00, 0x00,
+    0xd3, 0xf8, 0x89, 0x46, 0xfc, 0xe9, 0x00, 0x00, 0x00, 0x00
+};
+inline constexpr Hole div_pow2_holes[3] = {
+    { 5, HoleKind::Operand2, 0, Helper::COUNT },
+    { 20, HoleKind::Operand, 0, Helper::COUNT },
+    { 30, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil div_pow2 = { div_pow2_code, 34, 29, div_pow2_holes, 3 };
+
+inline constexpr std::uint8_t div_magic_code[49] = {
+    0x48, 0x63, 0x46, 0xfc, 0xb9, 0x00, 0x00, 0x00, 0x00, 0x49, 0x89, 0xf8,
+    0x48, 0x63, 0xc9, 0x48, 0x89, 0xc7, 0x48, 0x0f, 0xaf, 0xc1, 0xb9, 0x00,
+    0x00, 0x00, 0x00, 0xc1, 0xef, 0x1f, 0x48, 0xc1, 0xf8, 0x20, 0xd3, 0xf8,
+    0x01, 0xf8, 0x4c, 0x89, 0xc7, 0x89, 0x46, 0xfc, 0xe9, 0x00, 0x00, 0x00,
+    0x00
+};
+inline constexpr Hole div_magic_holes[3] = {
+    { 5, HoleKind::Operand, 0, Helper::COUNT },
+    { 23, HoleKind::Operand2, 0, Helper::COUNT },
+    { 45, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil div_magic = { div_magic_code, 49, 44, div_magic_holes, 3 };
+
+inline constexpr std::uint8_t div_magic_add_code[51] = {
+    0x48, 0x63, 0x46, 0xfc, 0xb9, 0x00, 0x00, 0x00, 0x00, 0x49, 0x89, 0xf8,
+    0x48, 0x63, 0xc9, 0x48, 0x89, 0xc7, 0x48, 0x0f, 0xaf, 0xc1, 0xb9, 0x00,
+    0x00, 0x00, 0x00, 0x48, 0xc1, 0xf8, 0x20, 0x01, 0xf8, 0xc1, 0xef, 0x1f,
+    0xd3, 0xf8, 0x01, 0xf8, 0x4c, 0x89, 0xc7, 0x89, 0x46, 0xfc, 0xe9, 0x00,
+    0x00, 0x00, 0x00
+};
+inline constexpr Hole div_magic_add_holes[3] = {
+    { 5, HoleKind::Operand, 0, Helper::COUNT },
+    { 23, HoleKind::Operand2, 0, Helper::COUNT },
+    { 47, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil div_magic_add = { div_magic_add_code, 51, 46, div_magic_add_holes, 3 };
+
+inline constexpr std::uint8_t print_code[10] = {
+    0xe8, 0x00, 0x00, 0x00, 0x00, 0xe9, 0x00, 0x00, 0x00, 0x00
+};
+inline constexpr Hole print_holes[2] = {
+    { 1, HoleKind::Call, -4, Helper::print },
+    { 6, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil print = { print_code, 10, 5, print_holes, 2 };
+
+inline constexpr std::uint8_t flush_code[10] = {
+    0xe8, 0x00, 0x00, 0x00, 0x00, 0xe9, 0x00, 0x00, 0x00, 0x00
+};
+inline constexpr Hole flush_holes[2] = {
+    { 1, HoleKind::Call, -4, Helper::flush },
+    { 6, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil flush = { flush_code, 10, 5, flush_holes, 2 };
+
+inline constexpr std::uint8_t vec_code[22] = {
+    0xb8, 0x00, 0x00, 0x00, 0x00, 0x48, 0x83, 0xee, 0x04, 0x89, 0x47, 0x0c,
+    0xe8, 0x00, 0x00, 0x00, 0x00, 0xe9, 0x00, 0x00, 0x00, 0x00
+};
+inline constexpr Hole vec_holes[3] = {
+    { 1, HoleKind::Operand, 0, Helper::COUNT },
+    { 13, HoleKind::Call, -4, Helper::vec },
+    { 18, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil vec = { vec_code, 22, 17, vec_holes, 3 };
+
+inline constexpr std::uint8_t iret_code[22] = {
+    0xb8, 0x00, 0x00, 0x00, 0x00, 0x48, 0x83, 0xee, 0x04, 0x89, 0x47, 0x0c,
+    0xe8, 0x00, 0x00, 0x00, 0x00, 0xe9, 0x00, 0x00, 0x00, 0x00
+};
+inline constexpr Hole iret_holes[3] = {
+    { 1, HoleKind::Operand, 0, Helper::COUNT },
+    { 13, HoleKind::Call, -4, Helper::iret },
+    { 18, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil iret = { iret_code, 22, 17, iret_holes, 3 };
+
+inline constexpr std::uint8_t halt_code[12] = {
+    0xc7, 0x47, 0x08, 0x00, 0x00, 0x00, 0x00, 0xe9, 0x00, 0x00, 0x00, 0x00
+};
+inline constexpr Hole halt_holes[1] = {
+    { 8, HoleKind::Continue, -4, Helper::COUNT }
+};
+inline constexpr Stencil halt = { halt_code, 12, 7, halt_holes, 1 };
+
+inline constexpr std::uint8_t block_exit_code[6] = {
+    0x48, 0x89, 0x37, 0x31, 0xc0, 0xc3
+};
+inline constexpr Hole block_exit_holes[1] = {{}};
+inline constexpr Stencil block_exit = { block_exit_code, 6, 6, block_exit_holes, 0 };
+
+} // namespace tcg_stencils
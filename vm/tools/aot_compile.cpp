@@ -0,0 +1,41 @@
+// aot_compile.cpp  (C++20)
+// g++ -std=c++20 -O2 aot_compile.cpp -o aot_compile
+// Usage: ./aot_compile <out.bin> <module.cpp> [max_block=512]
+//
+// Compiles a bytecode image (as written by lesson5's lexer_asm, or a legacy
+// headerless one) to a C++ translation unit, see common/aot.h. Build the
+// result into a shared object with the line at its top and hand that to
+// AotLibrary.
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "../common/aot.h"
+
+int main(int argc, char** argv) {
+    if (argc < 3 || argc > 4) {
+        std::cerr << "Usage: " << argv[0] << " <out.bin> <module.cpp> [max_block=512]\n";
+        return 1;
+    }
+    try {
+        MappedImage image(argv[1]);
+        AotCompiler::Options opt;
+        opt.source_name = argv[1];
+        if (argc == 4) opt.max_block = std::stoul(argv[3]);
+        const std::string unit = AotCompiler::translate(image.code(), opt);
+
+        std::ofstream out(argv[2], std::ios::binary);
+        if (!out) throw std::runtime_error(std::string("Cannot open output file: ") + argv[2]);
+        out << unit;
+        if (!out) throw std::runtime_error(std::string("Write failed: ") + argv[2]);
+        std::cerr << "OK: " << image.code().size() << " instructions -> " << argv[2] << " (" << unit.size()
+                  << " bytes)\n";
+        return 0;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 2;
+    }
+}
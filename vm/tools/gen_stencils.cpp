@@ -0,0 +1,197 @@
+// gen_stencils.cpp  (C++20, Linux)
+// g++ -std=c++20 -O2 gen_stencils.cpp -o gen_stencils
+// Usage: ./gen_stencils <tcg_stencils.o> > ../mini_TCG/mini_TCG/tcg_stencils.h
+//
+// Turns the object file built from tcg_stencils.cpp (its line 2 has the
+// flags) into tcg_stencils.h: for every section .text.stencil_<op>, the
+// machine code as a byte array plus its holes. A relocation against
+// _JIT_OPERAND (R_X86_64_32 / 32S) becomes an Operand hole (_JIT_OPERAND2 an
+// Operand2 hole), one against _JIT_CONTINUE (R_X86_64_PLT32 / PC32, as the
+// operand of a jmp) a Continue hole, and one against _JIT_CALL_<name> (the
+// same, operand of a call) a Call hole for helper <name>; the helpers are
+// numbered in name order. One against _JIT_HELPER (R_X86_64_64) is an
+// Address hole, used by the helper veneer.
+// Anything else -- other symbols, other relocation types, a call to the
+// continuation -- is an error: the stencil would not be self-contained once
+// copied.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <elf.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct Hole {
+    std::uint32_t offset;
+    const char* kind;
+    std::int64_t addend;
+    std::string helper; // Call holes
+};
+
+struct Stencil {
+    std::string name;
+    std::vector<std::uint8_t> code;
+    std::vector<Hole> holes;
+    std::size_t body = 0; // size without a trailing jmp to the continuation
+};
+
+template <class T>
+static const T& at(const std::vector<char>& obj, std::size_t off) {
+    if (off + sizeof(T) > obj.size()) throw std::runtime_error("truncated object file");
+    return *reinterpret_cast<const T*>(obj.data() + off);
+}
+
+static std::vector<Stencil> read_stencils(const std::vector<char>& obj, std::set<std::string>& helpers) {
+    const auto& eh = at<Elf64_Ehdr>(obj, 0);
+    if (std::memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0 || eh.e_ident[EI_CLASS] != ELFCLASS64 ||
+        eh.e_machine != EM_X86_64 || eh.e_type != ET_REL) {
+        throw std::runtime_error("not an x86-64 ELF relocatable object");
+    }
+    auto shdr = [&](std::size_t i) -> const Elf64_Shdr& { return at<Elf64_Shdr>(obj, eh.e_shoff + i * eh.e_shentsize); };
+    const Elf64_Shdr& shstr = shdr(eh.e_shstrndx);
+    auto section_name = [&](const Elf64_Shdr& s) { return std::string(&obj.at(shstr.sh_offset + s.sh_name)); };
+
+    std::map<std::size_t, Stencil> by_section;
+    for (std::size_t i = 0; i < eh.e_shnum; ++i) {
+        const Elf64_Shdr& s = shdr(i);
+        const std::string name = section_name(s);
+        if (s.sh_type != SHT_PROGBITS || name.rfind(".text.stencil_", 0) != 0) continue;
+        Stencil st;
+        st.name = name.substr(std::strlen(".text.stencil_"));
+        st.code.assign(obj.begin() + static_cast<std::ptrdiff_t>(s.sh_offset),
+                       obj.begin() + static_cast<std::ptrdiff_t>(s.sh_offset + s.sh_size));
+        st.body = st.code.size();
+        by_section.emplace(i, std::move(st));
+    }
+
+    for (std::size_t i = 0; i < eh.e_shnum; ++i) {
+        const Elf64_Shdr& rs = shdr(i);
+        if (rs.sh_type == SHT_REL) throw std::runtime_error("unexpected SHT_REL section");
+        if (rs.sh_type != SHT_RELA) continue;
+        auto it = by_section.find(rs.sh_info);
+        if (it == by_section.end()) {
+            const std::string target = section_name(shdr(rs.sh_info));
+            if (target.rfind(".text", 0) == 0) throw std::runtime_error("relocations in " + target);
+            continue; // .eh_frame and the like, not copied
+        }
+        Stencil& st = it->second;
+        const Elf64_Shdr& symtab = shdr(rs.sh_link);
+        const Elf64_Shdr& strtab = shdr(symtab.sh_link);
+        for (std::size_t off = 0; off < rs.sh_size; off += sizeof(Elf64_Rela)) {
+            const auto& r = at<Elf64_Rela>(obj, rs.sh_offset + off);
+            const auto& sym = at<Elf64_Sym>(obj, symtab.sh_offset + ELF64_R_SYM(r.r_info) * sizeof(Elf64_Sym));
+            const std::string sym_name(&obj.at(strtab.sh_offset + sym.st_name));
+            const std::uint32_t type = ELF64_R_TYPE(r.r_info);
+            const std::string where = "stencil_" + st.name + "+" + std::to_string(r.r_offset);
+            const bool rel32 = type == R_X86_64_PLT32 || type == R_X86_64_PC32;
+            if (sym_name == "_JIT_OPERAND" && (type == R_X86_64_32 || type == R_X86_64_32S)) {
+                st.holes.push_back({ static_cast<std::uint32_t>(r.r_offset), "Operand", r.r_addend, {} });
+            }
+            else if (sym_name == "_JIT_OPERAND2" && (type == R_X86_64_32 || type == R_X86_64_32S)) {
+                st.holes.push_back({ static_cast<std::uint32_t>(r.r_offset), "Operand2", r.r_addend, {} });
+            }
+            else if (sym_name == "_JIT_HELPER" && type == R_X86_64_64) {
+                st.holes.push_back({ static_cast<std::uint32_t>(r.r_offset), "Address", r.r_addend, {} });
+            }
+            else if (sym_name.rfind("_JIT_CALL_", 0) == 0 && rel32) {
+                if (r.r_offset == 0 || st.code.at(r.r_offset - 1) != 0xE8) {
+                    throw std::runtime_error(where + ": " + sym_name + " is not the target of a call rel32");
+                }
+                const std::string name = sym_name.substr(std::strlen("_JIT_CALL_"));
+                helpers.insert(name);
+                st.holes.push_back({ static_cast<std::uint32_t>(r.r_offset), "Call", r.r_addend, name });
+            }
+            else if (sym_name == "_JIT_CONTINUE" && rel32) {
+                if (r.r_offset == 0 || st.code.at(r.r_offset - 1) != 0xE9) {
+                    throw std::runtime_error(where + ": _JIT_CONTINUE is not the target of a jmp rel32");
+                }
+                st.holes.push_back({ static_cast<std::uint32_t>(r.r_offset), "Continue", r.r_addend, {} });
+                if (r.r_offset + 4 == st.code.size()) st.body = r.r_offset - 1;
+            }
+            else {
+                throw std::runtime_error(where + ": unsupported relocation " + std::to_string(type) + " against '" +
+                                         sym_name + "'");
+            }
+        }
+    }
+
+    std::vector<Stencil> out;
+    for (auto& [_, st] : by_section) out.push_back(std::move(st));
+    return out;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        std::cerr << "usage: gen_stencils <tcg_stencils.o>\n";
+        return 2;
+    }
+    try {
+        std::ifstream in(argv[1], std::ios::binary);
+        if (!in) throw std::runtime_error(std::string("cannot read ") + argv[1]);
+        const std::vector<char> obj{ std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+        std::set<std::string> helpers;
+        const std::vector<Stencil> stencils = read_stencils(obj, helpers);
+        if (stencils.empty()) throw std::runtime_error("no .text.stencil_* sections (missing -ffunction-sections?)");
+
+        std::cout << "// tcg_stencils.h\n"
+                     "// Generated by tools/gen_stencils from tools/tcg_stencils.cpp; do not edit.\n"
+                     "// x86-64 SysV machine code for the copy-and-patch backend (tcg_jit.h).\n"
+                     "#pragma once\n"
+                     "#include <cstdint>\n\n"
+                     "namespace tcg_stencils {\n\n"
+                     "enum class HoleKind : std::uint8_t {\n"
+                     "    Operand,  // absolute 32-bit: the op's immediate\n"
+                     "    Operand2, // absolute 32-bit: its second immediate\n"
+                     "    Continue, // jmp rel32 to the next stencil\n"
+                     "    Call,     // call rel32 to a helper's veneer\n"
+                     "    Address,  // absolute 64-bit: the helper (veneer only)\n"
+                     "};\n\n"
+                     "enum class Helper : std::uint8_t {";
+        for (const std::string& h : helpers) std::cout << " " << h << ",";
+        std::cout << " COUNT };\n\n"
+                     "struct Hole {\n"
+                     "    std::uint16_t offset;\n"
+                     "    HoleKind kind;\n"
+                     "    std::int32_t addend;\n"
+                     "    Helper helper; // Call holes\n"
+                     "};\n\n"
+                     "struct Stencil {\n"
+                     "    const std::uint8_t* code;\n"
+                     "    std::uint16_t size;\n"
+                     "    std::uint16_t body; // size without a trailing jmp to the next stencil\n"
+                     "    const Hole* holes;\n"
+                     "    std::uint8_t hole_count;\n"
+                     "};\n";
+        for (const Stencil& st : stencils) {
+            std::cout << "\ninline constexpr std::uint8_t " << st.name << "_code[" << st.code.size() << "] = {";
+            for (std::size_t i = 0; i < st.code.size(); ++i) {
+                char hex[8];
+                std::snprintf(hex, sizeof(hex), "0x%02x", st.code[i]);
+                std::cout << (i % 12 == 0 ? "\n    " : " ") << hex << (i + 1 < st.code.size() ? "," : "");
+            }
+            std::cout << "\n};\n";
+            std::cout << "inline constexpr Hole " << st.name << "_holes[" << (st.holes.empty() ? 1 : st.holes.size())
+                      << "] = {";
+            for (std::size_t i = 0; i < st.holes.size(); ++i) {
+                const Hole& h = st.holes[i];
+                std::cout << (i ? ",\n    " : "\n    ") << "{ " << h.offset << ", HoleKind::" << h.kind << ", " << h.addend
+                          << ", Helper::" << (h.helper.empty() ? "COUNT" : h.helper) << " }";
+            }
+            std::cout << (st.holes.empty() ? "{}" : "\n") << "};\n";
+            std::cout << "inline constexpr Stencil " << st.name << " = { " << st.name << "_code, " << st.code.size()
+                      << ", " << st.body << ", " << st.name << "_holes, " << st.holes.size() << " };\n";
+        }
+        std::cout << "\n} // namespace tcg_stencils\n";
+    }
+    catch (const std::exception& ex) {
+        std::cerr << "gen_stencils: " << ex.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
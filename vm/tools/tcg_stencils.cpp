@@ -0,0 +1,226 @@
+// tcg_stencils.cpp  (C++20, x86-64 SysV)
+// g++ -std=c++20 -O2 -c -fno-pic -mcmodel=small -mno-red-zone -fno-asynchronous-unwind-tables -fno-exceptions -fno-stack-protector -fcf-protection=none -fno-jump-tables -ffunction-sections -fomit-frame-pointer tcg_stencils.cpp -o tcg_stencils.o
+// Then: ./gen_stencils tcg_stencils.o > ../mini_TCG/mini_TCG/tcg_stencils.h
+//
+// Stencils for MiniTCGVM's copy-and-patch backend (tcg_jit.h): one function
+// per micro-op, compiled ahead of time. The generator copies their machine
+// code into tcg_stencils.h and turns the relocations against the marker
+// symbols below into holes the JIT patches at translation time:
+//
+//   _JIT_OPERAND       absolute 32-bit: the op's immediate (the guest pc
+//                      of an op that can trap, for TcgJitFrame::fault_pc)
+//   _JIT_OPERAND2      absolute 32-bit: a second one (the div_* stencils)
+//   _JIT_CONTINUE      jmp rel32: the next stencil of the block
+//   _JIT_CALL_<name>   call rel32: the veneer of host helper <name>
+//   _JIT_HELPER        absolute 64-bit, veneer only: the helper itself
+//
+// Anything else that needs a relocation (a constant in .rodata, a jump
+// table) is rejected by the generator; the flags above keep the code
+// self-contained. Each stencil ends in a tail call to _JIT_CONTINUE, which
+// the JIT drops when the next stencil is copied right behind it.
+//
+// Translated code mostly runs a handful of times, so it executes cold:
+// instruction bytes stream in from L2 or memory and its branches are new to
+// the predictor. Bytes per op are what decide its speed (over a 200k-op
+// chain of flushes, a 56-byte call stencil that saved registers and checked
+// the status cost ~32 ns per op, the 5-byte one below ~17 ns), and an
+// indirect call from translated code mispredicts where a direct one is
+// resolved at decode. So a helper call is a bare direct `call` to a veneer
+// shared by every call site: the veneer saves the three registers the chain
+// lives in, makes the one indirect call, and on a fault stores sp and
+// returns from the block itself.
+#include <cstddef>
+#include <cstdint>
+
+#include "../mini_TCG/mini_TCG/tcg_jit_abi.h"
+
+using i32 = std::int32_t;
+using u32 = std::uint32_t;
+
+static_assert(offsetof(TcgJitFrame, sp) == 0, "the veneer stores sp at offset 0");
+
+extern "C" {
+extern char _JIT_OPERAND[];
+extern char _JIT_OPERAND2[];
+u32 _JIT_CONTINUE(TcgJitFrame* f, i32* sp, i32* base);
+
+#define OPERAND (static_cast<i32>(reinterpret_cast<std::uintptr_t>(_JIT_OPERAND)))
+#define OPERAND2 (static_cast<i32>(reinterpret_cast<std::uintptr_t>(_JIT_OPERAND2)))
+// a sibling call at -O2; the generator rejects a stencil where it is not a jmp
+#if defined(__clang__)
+#define CONTINUE(f, sp, base) __attribute__((musttail)) return _JIT_CONTINUE(f, sp, base)
+#else
+#define CONTINUE(f, sp, base) return _JIT_CONTINUE(f, sp, base)
+#endif
+
+// Helper <name>(f, sp, base) through its veneer, which preserves the three
+// argument registers and nothing else a SysV callee may clobber. On a fault
+// the veneer returns from the whole block, so a stencil that calls must keep
+// no stack frame of its own (these are leaf code around one asm statement;
+// -mno-red-zone since the call pushes).
+#define CALL(name, f, sp, base)                                              \
+    asm volatile("call _JIT_CALL_" #name : : "D"(f), "S"(sp), "d"(base)      \
+                 : "rax", "rcx", "r8", "r9", "r10", "r11", "cc", "memory")
+
+u32 stencil_push(TcgJitFrame* f, i32* sp, i32* base) {
+    *sp = OPERAND;
+    CONTINUE(f, sp + 1, base);
+}
+
+u32 stencil_add(TcgJitFrame* f, i32* sp, i32* base) {
+    sp[-2] = static_cast<i32>(static_cast<u32>(sp[-2]) + static_cast<u32>(sp[-1]));
+    CONTINUE(f, sp - 1, base);
+}
+
+// push imm; add
+u32 stencil_add_imm(TcgJitFrame* f, i32* sp, i32* base) {
+    sp[-1] = static_cast<i32>(static_cast<u32>(sp[-1]) + static_cast<u32>(OPERAND));
+    CONTINUE(f, sp, base);
+}
+
+u32 stencil_sub(TcgJitFrame* f, i32* sp, i32* base) {
+    sp[-2] = static_cast<i32>(static_cast<u32>(sp[-2]) - static_cast<u32>(sp[-1]));
+    CONTINUE(f, sp - 1, base);
+}
+
+u32 stencil_mul(TcgJitFrame* f, i32* sp, i32* base) {
+    sp[-2] = static_cast<i32>(static_cast<u32>(sp[-2]) * static_cast<u32>(sp[-1]));
+    CONTINUE(f, sp - 1, base);
+}
+
+// On a trap both operands are popped, as by the closures.
+u32 stencil_div(TcgJitFrame* f, i32* sp, i32* base) {
+    const i32 a = sp[-2], b = sp[-1];
+    if (b == 0) {
+        f->sp = sp - 2;
+        f->fault_pc = OPERAND;
+        return TCG_JIT_DIV_ZERO;
+    }
+    if (a == INT32_MIN && b == -1) {
+        f->sp = sp - 2;
+        f->fault_pc = OPERAND;
+        return TCG_JIT_DIV_OVERFLOW;
+    }
+    sp[-2] = a / b;
+    CONTINUE(f, sp - 1, base);
+}
+
+// push c; mul or div, strength reduced (common/strength_reduce.h). The
+// translator picks the stencil from the constant's plan, and appends neg
+// for a negative one where the plan says so.
+
+u32 stencil_mul_imm(TcgJitFrame* f, i32* sp, i32* base) {
+    sp[-1] = static_cast<i32>(static_cast<u32>(sp[-1]) * static_cast<u32>(OPERAND));
+    CONTINUE(f, sp, base);
+}
+
+u32 stencil_shl_imm(TcgJitFrame* f, i32* sp, i32* base) {
+    sp[-1] = static_cast<i32>(static_cast<u32>(sp[-1]) << OPERAND);
+    CONTINUE(f, sp, base);
+}
+
+u32 stencil_neg(TcgJitFrame* f, i32* sp, i32* base) {
+    sp[-1] = static_cast<i32>(0u - static_cast<u32>(sp[-1]));
+    CONTINUE(f, sp, base);
+}
+
+// x / -1: the one constant divisor that can still overflow
+u32 stencil_div_neg1(TcgJitFrame* f, i32* sp, i32* base) {
+    if (sp[-1] == INT32_MIN) {
+        f->sp = sp - 1;
+        f->fault_pc = OPERAND;
+        return TCG_JIT_DIV_OVERFLOW;
+    }
+    sp[-1] = -sp[-1];
+    CONTINUE(f, sp, base);
+}
+
+// x / 2^OPERAND, rounded toward zero: OPERAND2 = 2^OPERAND - 1 is the bias
+// for a negative x
+u32 stencil_div_pow2(TcgJitFrame* f, i32* sp, i32* base) {
+    const i32 x = sp[-1];
+    const u32 bias = static_cast<u32>(x >> 31) & static_cast<u32>(OPERAND2);
+    sp[-1] = static_cast<i32>(static_cast<u32>(x) + bias) >> OPERAND;
+    CONTINUE(f, sp, base);
+}
+
+// x / d as mulhi(magic, x) >> shift, rounded toward zero: OPERAND is the
+// magic number, OPERAND2 the shift
+u32 stencil_div_magic(TcgJitFrame* f, i32* sp, i32* base) {
+    const i32 x = sp[-1];
+    const i32 q = static_cast<i32>((std::int64_t(OPERAND) * x) >> 32);
+    sp[-1] = (q >> OPERAND2) - (x >> 31);
+    CONTINUE(f, sp, base);
+}
+
+// the same for a magic number >= 2^31 (read as negative): add x back
+u32 stencil_div_magic_add(TcgJitFrame* f, i32* sp, i32* base) {
+    const i32 x = sp[-1];
+    const i32 q = static_cast<i32>((std::int64_t(OPERAND) * x) >> 32) + x;
+    sp[-1] = (q >> OPERAND2) - (x >> 31);
+    CONTINUE(f, sp, base);
+}
+
+u32 stencil_print(TcgJitFrame* f, i32* sp, i32* base) {
+    CALL(print, f, sp, base);
+    CONTINUE(f, sp, base);
+}
+
+u32 stencil_flush(TcgJitFrame* f, i32* sp, i32* base) {
+    CALL(flush, f, sp, base);
+    CONTINUE(f, sp, base);
+}
+
+// vec and iret pop first; the helper finds the popped value at sp[0]. Their
+// pc is stored up front, since a trap returns from the veneer.
+u32 stencil_vec(TcgJitFrame* f, i32* sp, i32* base) {
+    --sp;
+    f->fault_pc = OPERAND;
+    CALL(vec, f, sp, base);
+    CONTINUE(f, sp, base);
+}
+
+u32 stencil_iret(TcgJitFrame* f, i32* sp, i32* base) {
+    --sp;
+    f->fault_pc = OPERAND;
+    CALL(iret, f, sp, base);
+    CONTINUE(f, sp, base);
+}
+
+u32 stencil_halt(TcgJitFrame* f, i32* sp, i32* base) {
+    f->running = 0;
+    CONTINUE(f, sp, base);
+}
+
+// last stencil of every block
+u32 stencil_block_exit(TcgJitFrame* f, i32* sp, i32*) {
+    f->sp = sp;
+    return TCG_JIT_OK;
+}
+}
+
+// One copy per helper at the start of the JIT buffer. Entered by a call from
+// a stencil with f, sp, base in rdi, rsi, rdx; stencils keep no frame, so
+// rsp is 16-byte aligned here (block entry was a SysV call, plus this call)
+// and three saves plus one pad keep it aligned for the helper.
+asm(R"(
+    .section .text.stencil_veneer,"ax",@progbits
+    .globl stencil_veneer
+stencil_veneer:
+    push %rdi
+    push %rsi
+    push %rdx
+    sub $8, %rsp
+    movabs $_JIT_HELPER, %rax
+    call *%rax
+    add $8, %rsp
+    pop %rdx
+    pop %rsi
+    pop %rdi
+    test %eax, %eax
+    jnz 1f
+    ret
+1:  mov %rsi, (%rdi)
+    add $8, %rsp
+    ret
+)");
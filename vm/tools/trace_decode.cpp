@@ -0,0 +1,87 @@
+// trace_decode.cpp  (C++20)
+// g++ -std=c++20 -O2 trace_decode.cpp -o trace_decode
+// Usage: ./trace_decode <trace.bin> [--summary]
+//
+// Decodes a binary event log written by TraceRing::dump (common/trace.h).
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../common/trace.h"
+
+static const char* prim_name(std::uint32_t op) {
+    static const char* names[] = { "halt", "add", "sub", "mul", "div", "print", "flush", "load", "store", "vec", "iret" };
+    return op < sizeof(names) / sizeof(names[0]) ? names[op] : "?";
+}
+
+static void print_insn(std::uint32_t w) {
+    const std::uint32_t type = w >> 30;
+    const std::uint32_t data = w & 0x3FFF'FFFFu;
+    switch (type) {
+    case 0: std::cout << "push " << data; break;
+    case 2: std::cout << "push -" << data; break;
+    case 1: std::cout << prim_name(data); break;
+    default: std::cout << "undef 0x" << std::hex << w << std::dec; break;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <trace.bin> [--summary]\n";
+        return 1;
+    }
+    const bool summary = argc > 2 && std::string(argv[2]) == "--summary";
+
+    std::FILE* f = std::fopen(argv[1], "rb");
+    if (!f) {
+        std::cerr << "Cannot open " << argv[1] << "\n";
+        return 1;
+    }
+
+    std::uint32_t hdr[4] = {};
+    std::uint64_t dropped = 0;
+    if (std::fread(hdr, sizeof(hdr), 1, f) != 1 || std::fread(&dropped, sizeof(dropped), 1, f) != 1 ||
+        hdr[0] != TraceRing::FILE_MAGIC || hdr[1] != TraceRing::FILE_VERSION || hdr[2] != sizeof(TraceRecord)) {
+        std::cerr << "Not a trace file (or unsupported version): " << argv[1] << "\n";
+        std::fclose(f);
+        return 1;
+    }
+
+    std::vector<TraceRecord> recs(hdr[3]);
+    const std::size_t got = std::fread(recs.data(), sizeof(TraceRecord), recs.size(), f);
+    std::fclose(f);
+    if (got != recs.size()) {
+        std::cerr << "Truncated trace: " << got << " of " << recs.size() << " records\n";
+        recs.resize(got);
+    }
+
+    std::array<std::uint64_t, 5> by_kind{};
+    std::array<std::uint64_t, 16> by_prim{};
+    for (std::size_t i = 0; i < recs.size(); ++i) {
+        const TraceRecord& r = recs[i];
+        if (r.kind < by_kind.size()) ++by_kind[r.kind];
+        if (r.kind == static_cast<std::uint8_t>(TraceKind::Insn) && (r.data >> 30) == 1u) ++by_prim[r.data & 15u];
+        if (summary) continue;
+
+        std::cout << (dropped + i) << " e" << int(r.engine) << " pc=" << r.pc << " ";
+        switch (static_cast<TraceKind>(r.kind)) {
+        case TraceKind::Insn: print_insn(r.data); break;
+        case TraceKind::TbHit: std::cout << "[TB HIT]"; break;
+        case TraceKind::TbMiss: std::cout << "[TB MISS]"; break;
+        case TraceKind::TbExec: std::cout << "[TB EXEC] next_pc=" << r.data; break;
+        default: std::cout << "kind=" << int(r.kind); break;
+        }
+        std::cout << "\n";
+    }
+
+    std::cout << "records: " << recs.size() << " (dropped " << dropped << ")\n"
+              << "insns: " << by_kind[1] << "  tb hit/miss/exec: " << by_kind[2] << "/" << by_kind[3]
+              << "/" << by_kind[4] << "\n";
+    for (std::uint32_t op = 0; op < by_prim.size(); ++op) {
+        if (by_prim[op]) std::cout << "  " << prim_name(op) << ": " << by_prim[op] << "\n";
+    }
+    return 0;
+}